@@ -0,0 +1,42 @@
+#include "basetables.h"
+
+static EBrick * buildTable(Big a, Big b, Big p, Big q, ECn base) {
+	Big x, y;
+	base.get(x, y);
+	return new EBrick(x, y, a, b, p, BASE_TABLE_WINDOW, bits(q));
+}
+
+BaseTables::BaseTables(Big a, Big b, Big p, Big q, ECn g, ECn h, ECn f) {
+	this->q = q;
+	this->g = buildTable(a, b, p, q, g);
+	this->h = buildTable(a, b, p, q, h);
+	this->f = buildTable(a, b, p, q, f);
+}
+
+BaseTables::~BaseTables() {
+	delete this->g;
+	delete this->h;
+	delete this->f;
+}
+
+ECn BaseTables::multiply(EBrick *table, const Big &e) {
+	Big k = e % this->q, x, y;
+	ECn result;
+
+	if (k < Big(0)) k += this->q;
+
+	// The comb yields no coordinates for the point at infinity, so a zero scalar (a zero balance, for instance) is handled
+	// here instead.
+	if (k == Big(0)) return result;
+	table->mul(k, x, y);
+	result.set(x, y);
+	return result;
+}
+
+bool BaseTables::verifyKnownValues(LedgerEntry &e) {
+	ECn rhs = this->multiply(this->g, e.idHashPrime);
+	rhs += this->multiply(this->h, e.balance);
+	rhs += this->multiply(this->f, e.r);
+
+	return e.lec == rhs;
+}
@@ -0,0 +1,39 @@
+#ifndef BASETABLES_H
+#define BASETABLES_H
+
+#include "zeroledge.h"
+#include "ledger.h"
+#include "ebrick.h"
+
+#define BASE_TABLE_WINDOW 8
+
+// BaseTables holds precomputed multiples of the bases g, h, and f of a proof, so that the commitment to a known entry can
+// be recomputed without a general point multiplication for each base. It uses MIRACL's fixed-base comb method (EBrick),
+// with tables of 2^BASE_TABLE_WINDOW points per base; each multiplication then costs a single doubling and addition per
+// BASE_TABLE_WINDOW bits of the scalar, rather than one doubling per bit.
+//
+// The tables are built once, by the thread which constructs the object, and only read thereafter, so any number of threads
+// may use a single BaseTables object concurrently, provided that each has its own MIRACL instance with the same curve.
+class BaseTables {
+
+private:
+
+	Big q;
+	EBrick *g, *h, *f;
+
+	// Multiply the base whose table is given by e, which is first reduced modulo the order of the curve.
+	ECn multiply(EBrick *table, const Big &e);
+
+public:
+
+	// Build the tables for the bases g, h, f on the curve y^2 = x^3 + ax + b over the field of order p, whose points have
+	// order q.
+	BaseTables(Big a, Big b, Big p, Big q, ECn g, ECn h, ECn f);
+	~BaseTables();
+
+	// Check the commitment of e against its id, balance, and nonce, exactly as LedgerEntry::verifyKnownValues does.
+	bool verifyKnownValues(LedgerEntry &e);
+
+};
+
+#endif
@@ -0,0 +1,189 @@
+#include "checkpoint.h"
+#include "partialsummary.h"
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+
+Checkpoint::Checkpoint(ECn g, ECn h, ECn f, int valueBits) : sums(g, h, f, valueBits) {
+	this->interval = CHECKPOINT_INTERVAL_DEFAULT;
+	this->lastSaved = time(0);
+	this->saving = false;
+	this->saveFailed = false;
+	this->syncOutputs = NULL;
+	this->context = NULL;
+	this->proofTime = 0;
+	this->valueBits = valueBits;
+	this->mark.entryCount = 0;
+	this->mark.ledgerFile = 0;
+	this->mark.ledgerOffset = 0;
+	this->mark.entriesSize = 0;
+	this->mark.incrSize = 0;
+	pthread_mutex_init(&this->lock, NULL);
+}
+
+Checkpoint::~Checkpoint() {
+	for (map<uint64_t, PendingGroup>::iterator it = this->pending.begin(); it != this->pending.end(); it++) {
+		delete it->second.sums;
+	}
+	pthread_mutex_destroy(&this->lock);
+}
+
+void Checkpoint::setDestination(const char *path, int interval, time_t proofTime, bool (*syncOutputs)(void *context), void *context) {
+	this->path = path;
+	this->interval = interval;
+	this->proofTime = proofTime;
+	this->syncOutputs = syncOutputs;
+	this->context = context;
+	this->lastSaved = time(0);
+}
+
+bool Checkpoint::save(Ledger &sums, CheckpointMark &mark) {
+	TextBuffer output;
+	vector<uint64_t> numbers;
+
+	output.putText("BEGIN ZEROLEDGE CHECKPOINT\n" SECTION_SEPARATOR "\n");
+	numbers.assign(1, this->proofTime);
+	putLabelledNumbers(output, "TIME", numbers);
+	numbers.assign(1, this->valueBits);
+	putLabelledNumbers(output, "BITS", numbers);
+	numbers.assign(1, mark.entryCount);
+	putLabelledNumbers(output, "ENTRIES", numbers);
+	numbers.assign(1, mark.ledgerFile);
+	numbers.push_back(mark.ledgerOffset);
+	putLabelledNumbers(output, "LEDGER", numbers);
+	numbers.assign(1, mark.proofSizes.size());
+	numbers.insert(numbers.end(), mark.proofSizes.begin(), mark.proofSizes.end());
+	putLabelledNumbers(output, "PROOF", numbers);
+	numbers.assign(1, mark.shardEntries.size());
+	numbers.insert(numbers.end(), mark.shardEntries.begin(), mark.shardEntries.end());
+	putLabelledNumbers(output, "SHARDS", numbers);
+	numbers.assign(1, mark.entriesSize);
+	numbers.push_back(mark.incrSize);
+	putLabelledNumbers(output, "EXPORTS", numbers);
+	output.putText(SECTION_SEPARATOR "\n");
+
+	putLedgerSums(output, sums);
+
+	output.putText(SECTION_SEPARATOR "\nEND ZEROLEDGE CHECKPOINT\n");
+
+	// The outputs must reach the disk before the checkpoint that describes them does, and the checkpoint is written in full
+	// to a temporary file before it replaces the previous one, so that a crash at any point leaves a usable checkpoint.
+	if (this->syncOutputs != NULL && !this->syncOutputs(this->context)) return false;
+
+	string temporary = this->path + ".tmp";
+	int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return false;
+
+	bool ok = write(fd, output.data(), output.size()) == (ssize_t) output.size();
+	ok &= fsync(fd) == 0;
+	ok &= ::close(fd) == 0;
+	ok = ok && rename(temporary.c_str(), this->path.c_str()) == 0;
+
+	size_t slash = this->path.find_last_of('/');
+	string directory = (slash == string::npos) ? "." : this->path.substr(0, slash + 1);
+	fd = ::open(directory.c_str(), O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		::close(fd);
+	}
+
+	return ok;
+}
+
+bool Checkpoint::load(const char *path) {
+	MappedFile file;
+	vector<uint64_t> numbers;
+
+	if (!mapFile(path, file)) return false;
+
+	const char *p = file.data, *end = file.data + file.length;
+	bool ok = file.length >= 26 && strncmp(p, "BEGIN ZEROLEDGE CHECKPOINT", 26) == 0;
+	p = skipLines(p, end, 2);	// BEGIN ZEROLEDGE CHECKPOINT, ====================
+
+	ok = ok && (p = readLabelledNumbers(p, end, "TIME", numbers, false)) != NULL && numbers.size() == 1;
+	if (ok) this->proofTime = numbers[0];
+	ok = ok && (p = readLabelledNumbers(p, end, "BITS", numbers, false)) != NULL && numbers.size() == 1 && (int) numbers[0] == this->valueBits;
+	ok = ok && (p = readLabelledNumbers(p, end, "ENTRIES", numbers, false)) != NULL && numbers.size() == 1;
+	if (ok) this->mark.entryCount = numbers[0];
+	ok = ok && (p = readLabelledNumbers(p, end, "LEDGER", numbers, false)) != NULL && numbers.size() == 2;
+	if (ok) {
+		this->mark.ledgerFile = numbers[0];
+		this->mark.ledgerOffset = numbers[1];
+	}
+	ok = ok && (p = readLabelledNumbers(p, end, "PROOF", this->mark.proofSizes, true)) != NULL;
+	ok = ok && (p = readLabelledNumbers(p, end, "SHARDS", this->mark.shardEntries, true)) != NULL;
+	ok = ok && (p = readLabelledNumbers(p, end, "EXPORTS", numbers, false)) != NULL && numbers.size() == 2;
+	if (ok) {
+		this->mark.entriesSize = numbers[0];
+		this->mark.incrSize = numbers[1];
+	}
+
+	if (ok) {
+		p = skipLines(p, end, 1);	// ====================
+		p = readLedgerSums(p, end, this->sums);
+		ok = end - p >= 20 && *p == '=' && strncmp(skipLines(p, end, 1), "END ZEROLEDGE CHECKPOINT", 24) == 0;
+	}
+
+	unmapFile(file);
+	return ok;
+}
+
+void Checkpoint::complete(uint64_t first, Ledger &sums, const CheckpointMark &mark) {
+	Ledger *snapshot = NULL;
+	CheckpointMark snapshotMark;
+	bool advanced = false;
+
+	pthread_mutex_lock(&this->lock);
+
+	if (first == this->mark.entryCount) {
+		this->sums.appendLedger(sums);
+		this->mark = mark;
+		advanced = true;
+
+		// Merge any later groups which were completed first and are now part of the prefix.
+		map<uint64_t, PendingGroup>::iterator it;
+		while ((it = this->pending.find(this->mark.entryCount)) != this->pending.end()) {
+			this->sums.appendLedger(*it->second.sums);
+			this->mark = it->second.mark;
+			delete it->second.sums;
+			this->pending.erase(it);
+		}
+	} else {
+		PendingGroup &group = this->pending[first];
+		group.sums = new Ledger(sums);
+		group.mark = mark;
+	}
+
+	// Only one thread writes a checkpoint at a time; the others carry on while it does.
+	if (advanced && !this->saving && !this->path.empty() && time(0) - this->lastSaved >= this->interval) {
+		this->saving = true;
+		snapshot = new Ledger(this->sums);
+		snapshotMark = this->mark;
+	}
+
+	pthread_mutex_unlock(&this->lock);
+
+	if (snapshot != NULL) {
+		bool saved = this->save(*snapshot, snapshotMark);
+		delete snapshot;
+
+		pthread_mutex_lock(&this->lock);
+		this->saveFailed |= !saved;
+		this->saving = false;
+		this->lastSaved = time(0);
+		pthread_mutex_unlock(&this->lock);
+	}
+}
+
+bool Checkpoint::failed() {
+	pthread_mutex_lock(&this->lock);
+	bool failed = this->saveFailed;
+	pthread_mutex_unlock(&this->lock);
+	return failed;
+}
+
+void Checkpoint::finish() {
+	if (!this->path.empty()) unlink(this->path.c_str());
+}
@@ -0,0 +1,96 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <map>
+#include <pthread.h>
+#include "zeroledge.h"
+#include "zlutil.h"
+#include "ledger.h"
+
+#define CHECKPOINT_INTERVAL_DEFAULT 300
+
+using namespace std;
+
+// CheckpointMark records how far proof generation had progressed once a group of entries was complete: the number of
+// entries generated, the position of the ledger reader after them, and the length of each ordered output once they had
+// been placed in it (the proof transcript or manifest followed by each shard, with the number of entries in each shard,
+// and the entries and incremental data exports).
+typedef struct CheckpointMark {
+	uint64_t entryCount;
+	uint64_t ledgerFile;
+	uint64_t ledgerOffset;
+	vector<uint64_t> proofSizes;
+	vector<uint64_t> shardEntries;
+	uint64_t entriesSize;
+	uint64_t incrSize;
+} CheckpointMark;
+
+// Checkpoint allows a long proof generation to be resumed after it is interrupted. Groups of entries are completed (that is,
+// generated and written) out of order, so as each is completed, its sums and mark are set aside until every group before
+// it has also been completed; then they are merged into the sums and mark for the longest complete prefix of the ledger.
+// Periodically, once that prefix has grown, every output is flushed to disk, and only then are the merged sums and the
+// mark written to the checkpoint file, which is replaced atomically. Thus the checkpoint never describes output which
+// might have been lost, and generation can continue from it by reopening every output at the recorded lengths (the
+// positional stores simply keep the records for the entries before the mark) and reading the ledger from the recorded
+// position. Entries after the mark are generated afresh, with new nonces.
+//
+// The checkpoint file is a text file laid out like a proof transcript: a header with the proof time, balance bits, and
+// the mark, followed by the merged sums of the ledger (see partialsummary.h).
+class Checkpoint {
+
+private:
+
+	typedef struct PendingGroup {
+		Ledger *sums;
+		CheckpointMark mark;
+	} PendingGroup;
+
+	string path;
+	int interval;
+	time_t lastSaved;
+	bool saving;
+	bool saveFailed;
+	pthread_mutex_t lock;
+	map<uint64_t, PendingGroup> pending;
+	bool (*syncOutputs)(void *context);
+	void *context;
+
+	bool save(Ledger &sums, CheckpointMark &mark);
+
+public:
+
+	time_t proofTime;
+	int valueBits;
+
+	// The sums and mark for the longest complete prefix of the ledger. Once generation is complete, the sums are those of
+	// the whole ledger.
+	Ledger sums;
+	CheckpointMark mark;
+
+	Checkpoint(ECn g, ECn h, ECn f, int valueBits);
+	~Checkpoint();
+
+	// Write checkpoints to path no more than once every interval seconds. syncOutputs is called with context to flush every
+	// output to disk before each checkpoint is written, and returns false if it could not.
+	void setDestination(const char *path, int interval, time_t proofTime, bool (*syncOutputs)(void *context), void *context);
+
+	// Read the checkpoint at path, restoring the sums and mark from it. Returns false if it cannot be read, or is malformed.
+	bool load(const char *path);
+
+	// Record that the group of entries beginning with entry index first is complete, given its sums and the mark following
+	// it. This function may be called concurrently by many threads, and may write a checkpoint.
+	void complete(uint64_t first, Ledger &sums, const CheckpointMark &mark);
+
+	// Return whether any checkpoint could not be written, in which case generation cannot safely be resumed from it.
+	bool failed();
+
+	// Remove the checkpoint once the proof is finished.
+	void finish();
+
+};
+
+#endif
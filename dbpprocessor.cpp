@@ -1,4 +1,5 @@
 #include "dbpprocessor.h"
+#include "pipeline.h"
 
 DBPProcessor::DBPProcessor(Big q, ECn g, ECn h, ECn f, int workingbits, int valuebits) {
 	this->q = q;
@@ -144,4 +145,96 @@ bool DBPProcessor::verifyProofs(Ledger &l) {
 		result &= this->verifyProof(l, ii);
 	}
 	return result;
-}
\ No newline at end of file
+}
+
+// The difference bits are generated by a pipeline in which each pack is a single bit, which is all the reader assigns.
+// The commitments all share the value of gx, which is computed once beforehand.
+typedef struct DifferenceContext {
+	DBPProcessor *processor;
+	Ledger *l;
+	Big a, b, p;
+	ECn gx;
+	int valueBits;
+	int nextBit;
+} DifferenceContext;
+
+typedef struct DifferenceWorker {
+	Miracl *precision;
+	DBPProcessor *dbpgen;
+} DifferenceWorker;
+
+static void * newDifferencePack(void *rawContext) {
+	return new int(0);
+}
+
+static void deleteDifferencePack(void *rawContext, void *rawPack) {
+	delete static_cast<int*>(rawPack);
+}
+
+static bool readDifferencePack(void *rawContext, void *rawPack) {
+	DifferenceContext &context = *(static_cast<DifferenceContext*>(rawContext));
+	if (context.nextBit >= context.valueBits) return false;
+	*static_cast<int*>(rawPack) = context.nextBit++;
+	return true;
+}
+
+static void * beginDifferenceWorker(void *rawContext, int worker) {
+	DifferenceContext &context = *(static_cast<DifferenceContext*>(rawContext));
+	DifferenceWorker *state = new DifferenceWorker;
+
+	// per-thread MIRACL setup
+	state->precision = newThreadMiracl();
+
+	irand(fetchRandomSeed());
+
+	ecurve(context.a, context.b, context.p, MR_PROJECTIVE);
+
+	state->dbpgen = new DBPProcessor(*context.processor);
+	return state;
+}
+
+static void calcDifferencePack(void *rawContext, void *rawWorker, void *rawPack) {
+	DifferenceContext &context = *(static_cast<DifferenceContext*>(rawContext));
+	DifferenceWorker *state = static_cast<DifferenceWorker*>(rawWorker);
+	int ii = *static_cast<int*>(rawPack);
+
+	state->dbpgen->genCommitment(*context.l, ii, context.gx);
+	state->dbpgen->genProof(*context.l, ii);
+}
+
+static void endDifferenceWorker(void *rawContext, void *rawWorker) {
+	DifferenceWorker *state = static_cast<DifferenceWorker*>(rawWorker);
+
+	// Everything allocated by this thread's MIRACL instance must be freed before the instance itself.
+	delete state->dbpgen;
+	delete state->precision;
+	delete state;
+}
+
+void DBPProcessor::genParallel(Ledger &l, Big a, Big b, Big p, int threads) {
+	DifferenceContext context;
+	context.processor = this;
+	context.l = &l;
+	context.a = a;
+	context.b = b;
+	context.p = p;
+	context.gx = -l.idHashSum * this->g;
+	context.valueBits = this->valuebits;
+	context.nextBit = 0;
+
+	if (threads > this->valuebits) threads = this->valuebits;
+
+	PipelineStages stages;
+	stages.context = static_cast<void*>(&context);
+	stages.newPack = &newDifferencePack;
+	stages.deletePack = &deleteDifferencePack;
+	stages.read = &readDifferencePack;
+	stages.beginWorker = &beginDifferenceWorker;
+	stages.work = &calcDifferencePack;
+	stages.endWorker = &endDifferenceWorker;
+	stages.write = NULL;
+	stages.flush = NULL;
+
+	Pipeline pipeline(stages, threads, 2 * threads + 1);
+	pipeline.run();
+}
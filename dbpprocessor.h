@@ -65,6 +65,11 @@ public:
 	// Calls the LBPProcessor.genProof function once for each bit
 	void genProofs(Ledger &l);
 
+	// Generate the commitment and proof for every difference bit, as DBPProcessor::genCommitments followed by
+	// DBPProcessor::genProofs would, but with the bits divided among a pipeline of threads workers (see pipeline.h), since
+	// each is independent of the others. Each worker sets up its own MIRACL instance, on the curve given by a, b, and p.
+	void genParallel(Ledger &l, Big a, Big b, Big p, int threads);
+
 	// Given a difference bit which has had its commitment, gamma values, challenge values, and z values assigned manually,
 	// verify the proof. Returns true if proof is valid; false otherwise.
 	bool verifyProof(Ledger &l, int ii);
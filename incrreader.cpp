@@ -0,0 +1,208 @@
+#include "incrreader.h"
+#include "zlutil.h"
+#include "pipeline.h"
+#include "textcodec.h"
+
+IncrDataRaw::IncrDataRaw(int valueBits) {
+	lbc_cx.resize(valueBits);
+	lbc_ylsb.resize(valueBits);
+	lbp_gamma_cx.resize(valueBits);
+	lbp_gamma_ylsb.resize(valueBits);
+	lbp_r.resize(valueBits);
+	lbp_b1.resize(valueBits);
+	lbp_b2.resize(valueBits);
+}
+
+bool IncrDataRaw::read(istream &src) {
+	if (!(src >> index)) return false;
+
+	src >> identifier;
+	src >> balance;
+	for (size_t kk = 0; kk < lbc_cx.size(); kk++) {
+		src >> lbc_cx[kk] >> lbc_ylsb[kk];
+	}
+	src >> lec_cx >> lec_ylsb;
+	for (size_t kk = 0; kk < lbc_cx.size(); kk++) {
+		src >> lbp_gamma_cx[kk] >> lbp_gamma_ylsb[kk];
+	}
+	src >> lep_gamma_cx >> lep_gamma_ylsb;
+	for (size_t kk = 0; kk < lbc_cx.size(); kk++) {
+		src >> lbp_r[kk];
+	}
+	src >> lep_r;
+	for (size_t kk = 0; kk < lbc_cx.size(); kk++) {
+		src >> lbp_b1[kk];
+	}
+	for (size_t kk = 0; kk < lbc_cx.size(); kk++) {
+		src >> lbp_b2[kk];
+	}
+	src >> lep_b1;
+	src >> lep_b2;
+	src >> lep_b3;
+	return true;
+}
+
+bool IncrDataRaw::decode(IncrEntry &entry) {
+	Big cx;
+	int valueBits = lbc_cx.size();
+
+	if ((int) entry.lbc.size() != valueBits) entry = IncrEntry(valueBits);
+
+	if (!decodeDecimal(balance.data(), balance.size(), entry.balance)) return false;
+
+	for (int kk = 0; kk < valueBits; kk++) {
+		decodeBig(lbc_cx[kk].data(), lbc_cx[kk].size(), cx);
+		entry.lbc[kk] = ECn(cx, stoi(lbc_ylsb[kk]));
+	}
+
+	decodeBig(lec_cx.data(), lec_cx.size(), cx);
+	entry.lec = ECn(cx, stoi(lec_ylsb));
+
+	for (int kk = 0; kk < valueBits; kk++) {
+		decodeBig(lbp_gamma_cx[kk].data(), lbp_gamma_cx[kk].size(), cx);
+		entry.lbp_gamma[kk] = ECn(cx, stoi(lbp_gamma_ylsb[kk]));
+	}
+
+	decodeBig(lep_gamma_cx.data(), lep_gamma_cx.size(), cx);
+	entry.lep_gamma = ECn(cx, stoi(lep_gamma_ylsb));
+
+	for (int kk = 0; kk < valueBits; kk++) {
+		decodeBig(lbp_r[kk].data(), lbp_r[kk].size(), entry.lbp_r[kk]);
+	}
+
+	decodeBig(lep_r.data(), lep_r.size(), entry.lep_r);
+
+	for (int kk = 0; kk < valueBits; kk++) {
+		decodeBig(lbp_b1[kk].data(), lbp_b1[kk].size(), entry.lbp_b1[kk]);
+	}
+
+	for (int kk = 0; kk < valueBits; kk++) {
+		decodeBig(lbp_b2[kk].data(), lbp_b2[kk].size(), entry.lbp_b2[kk]);
+	}
+
+	decodeBig(lep_b1.data(), lep_b1.size(), entry.lep_b1);
+	decodeBig(lep_b2.data(), lep_b2.size(), entry.lep_b2);
+	decodeBig(lep_b3.data(), lep_b3.size(), entry.lep_b3);
+	return true;
+}
+
+
+// The ingest pipeline reads raw records on the calling thread, decodes them into bignums and curve points and packs them
+// into fixed-size records on the workers, and appends the records to the store on the writer, which is the only thread to
+// touch the store, so that no locks are required.
+
+typedef struct IncrIngestContext {
+	istream *src;
+	IncrStore *store;
+	Big a;
+	Big b;
+	Big p;
+	int valueBits;
+	int packSize;
+	bool exhausted;
+	atomic<uint64_t> malformed;
+} IncrIngestContext;
+
+typedef struct IncrIngestPack {
+	int count;
+	vector<IncrDataRaw> rawData;
+	vector<char> records;
+} IncrIngestPack;
+
+typedef struct IncrIngestWorker {
+	Miracl *precision;
+	IncrEntry incrData;
+} IncrIngestWorker;
+
+static void * newIngestPack(void *rawContext) {
+	IncrIngestContext &context = *(static_cast<IncrIngestContext*>(rawContext));
+	IncrIngestPack *pack = new IncrIngestPack;
+	pack->count = 0;
+	pack->rawData.resize(context.packSize, IncrDataRaw(context.valueBits));
+	pack->records.resize(context.packSize * context.store->recordSize);
+	return pack;
+}
+
+static void deleteIngestPack(void *rawContext, void *rawPack) {
+	delete static_cast<IncrIngestPack*>(rawPack);
+}
+
+static bool readIngestPack(void *rawContext, void *rawPack) {
+	IncrIngestContext &context = *(static_cast<IncrIngestContext*>(rawContext));
+	IncrIngestPack *pack = static_cast<IncrIngestPack*>(rawPack);
+
+	if (context.exhausted || context.malformed.load() != UINT64_MAX) return false;
+
+	for (pack->count = 0; pack->count < context.packSize; pack->count++) {
+		if (!pack->rawData[pack->count].read(*context.src)) break;
+	}
+
+	if (pack->count != context.packSize) context.exhausted = true;
+	return pack->count > 0;
+}
+
+static void * beginIngestWorker(void *rawContext, int worker) {
+	IncrIngestContext &context = *(static_cast<IncrIngestContext*>(rawContext));
+	IncrIngestWorker *state = new IncrIngestWorker;
+	state->precision = newThreadMiracl();
+	ecurve(context.a, context.b, context.p, MR_PROJECTIVE);
+	state->incrData = IncrEntry(context.valueBits);
+	return state;
+}
+
+static void ingestPack(void *rawContext, void *rawWorker, void *rawPack) {
+	IncrIngestContext &context = *(static_cast<IncrIngestContext*>(rawContext));
+	IncrIngestWorker *state = static_cast<IncrIngestWorker*>(rawWorker);
+	IncrIngestPack *pack = static_cast<IncrIngestPack*>(rawPack);
+
+	for (int jj = 0; jj < pack->count; jj++) {
+		if (!pack->rawData[jj].decode(state->incrData)) {
+			uint64_t first = context.malformed.load();
+			while (pack->rawData[jj].index < first && !context.malformed.compare_exchange_weak(first, pack->rawData[jj].index));
+		}
+		context.store->encode(&pack->records[jj * context.store->recordSize], pack->rawData[jj].identifier, pack->rawData[jj].index, state->incrData);
+	}
+}
+
+static void endIngestWorker(void *rawContext, void *rawWorker) {
+	IncrIngestWorker *state = static_cast<IncrIngestWorker*>(rawWorker);
+	state->incrData = IncrEntry();
+	delete state->precision;
+	delete state;
+}
+
+static void writeIngestPack(void *rawContext, void *rawPack) {
+	IncrIngestContext &context = *(static_cast<IncrIngestContext*>(rawContext));
+	IncrIngestPack *pack = static_cast<IncrIngestPack*>(rawPack);
+	context.store->append(&pack->records[0], pack->count);
+}
+
+bool ingestIncrData(istream &src, IncrStore &store, Big a, Big b, Big p, int valueBits, int workers, int packSize, uint64_t &malformed) {
+	IncrIngestContext context;
+	context.src = &src;
+	context.store = &store;
+	context.a = a;
+	context.b = b;
+	context.p = p;
+	context.valueBits = valueBits;
+	context.packSize = packSize;
+	context.exhausted = false;
+	context.malformed = UINT64_MAX;
+
+	PipelineStages stages;
+	stages.context = static_cast<void*>(&context);
+	stages.newPack = &newIngestPack;
+	stages.deletePack = &deleteIngestPack;
+	stages.read = &readIngestPack;
+	stages.beginWorker = &beginIngestWorker;
+	stages.work = &ingestPack;
+	stages.endWorker = &endIngestWorker;
+	stages.write = &writeIngestPack;
+	stages.flush = NULL;
+
+	Pipeline pipeline(stages, workers, 2 * workers + 1);
+	pipeline.run();
+
+	malformed = context.malformed.load();
+	return malformed == UINT64_MAX;
+}
@@ -0,0 +1,50 @@
+#ifndef INCRREADER_H
+#define INCRREADER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <istream>
+#include "zeroledge.h"
+#include "ledger.h"
+#include "incrstore.h"
+
+using namespace std;
+
+// IncrDataRaw holds a single record of text incremental data, as written by zlgenerate -r, in the form of raw strings, so
+// that it can be read without any MIRACL context, and decoded later by whichever thread has one.
+class IncrDataRaw {
+
+public:
+
+	uint64_t index;
+	string identifier, balance;
+	string lec_cx, lec_ylsb, lep_r;
+	string lep_b1, lep_b2, lep_b3;
+	string lep_gamma_cx, lep_gamma_ylsb;
+	vector<string> lbc_cx;
+	vector<string> lbc_ylsb;
+	vector<string> lbp_gamma_cx;
+	vector<string> lbp_gamma_ylsb;
+	vector<string> lbp_r;
+	vector<string> lbp_b1;
+	vector<string> lbp_b2;
+
+	IncrDataRaw() {}
+	IncrDataRaw(int valueBits);
+
+	// Read a single record of text incremental data from src, without ingesting it. Returns false at the end of the input.
+	bool read(istream &src);
+
+	// Ingest the record into bignums and curve points. This requires the curve to have been set up in the calling thread,
+	// and leaves the MIRACL IO base set to DATA_BASE. Returns false if the balance is not a decimal number.
+	bool decode(IncrEntry &entry);
+};
+
+// Ingest the text incremental data remaining in src (that is, following the proof time) into store, which must already
+// have been initialized. The records are read on the calling thread, and decoded and packed by worker threads, each with
+// its own MIRACL context and curve, packSize records at a time. Returns false if any record could not be decoded, in which
+// case malformed is set to the lowest entry index of any such record.
+bool ingestIncrData(istream &src, IncrStore &store, Big a, Big b, Big p, int valueBits, int workers, int packSize, uint64_t &malformed);
+
+#endif
@@ -0,0 +1,374 @@
+#include "incrstore.h"
+#include "placement.h"
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+IncrStore::IncrStore() {
+	this->fd = -1;
+	this->failed = false;
+	this->file.data = NULL;
+	this->file.length = 0;
+	this->file.mapped = false;
+	this->records = NULL;
+	this->table = NULL;
+	this->valueBits = 0;
+	this->fieldBytes = 0;
+	this->proofTime = 0;
+	this->recordSize = 0;
+	this->recordCount = 0;
+	this->tableSize = 0;
+	this->replica = NULL;
+	this->replicaLength = 0;
+}
+
+IncrStore::~IncrStore() {
+	for (size_t ii = 0; ii < this->blocks.size(); ii++) {
+		delete[] this->blocks[ii];
+	}
+	freeLocal(this->replica, this->replicaLength);
+	if (this->fd >= 0) ::close(this->fd);
+}
+
+uint64_t IncrStore::tableSlot(const char *digest) {
+	uint64_t slot;
+	memcpy(&slot, digest, sizeof(slot));
+	return slot;
+}
+
+uint64_t IncrStore::computeRecordSize(int fieldBytes, int valueBits) {
+	// The digest and entry index, the balance, the commitment and gamma points for the entry and for each bit, and the
+	// nonce and b values for the entry and for each bit, rounded up so that every record is aligned.
+	uint64_t size = INCR_STORE_ID_BYTES + sizeof(uint64_t) + fieldBytes
+		+ (2 * valueBits + 2) * 2 * fieldBytes + (3 * valueBits + 4) * fieldBytes;
+	return (size + 7) & ~((uint64_t) 7);
+}
+
+const char * IncrStore::record(uint64_t ii) {
+	if (this->records != NULL) return this->records + ii * this->recordSize;
+	return this->blocks[ii / INCR_STORE_BLOCK_RECORDS] + (ii % INCR_STORE_BLOCK_RECORDS) * this->recordSize;
+}
+
+void IncrStore::buildTable(uint64_t *slots) {
+	uint64_t mask = this->tableSize - 1;
+	memset(slots, 0, this->tableSize * sizeof(uint64_t));
+	for (uint64_t ii = 0; ii < this->recordCount; ii++) {
+		uint64_t slot = tableSlot(this->record(ii)) & mask;
+		while (slots[slot] != 0) slot = (slot + 1) & mask;
+		slots[slot] = ii + 1;
+	}
+}
+
+void IncrStore::writeBig(char *&p, const Big &x) {
+	to_binary(x, this->fieldBytes, p, true);
+	p += this->fieldBytes;
+}
+
+void IncrStore::writePoint(char *&p, ECn &point) {
+	Big x, y;
+	point.get(x, y);
+	this->writeBig(p, x);
+	this->writeBig(p, y);
+}
+
+void IncrStore::readBig(const char *&p, Big &x) {
+	x = from_binary(this->fieldBytes, (char *) p);
+	p += this->fieldBytes;
+}
+
+void IncrStore::readPoint(const char *&p, ECn &point) {
+	Big x, y;
+	this->readBig(p, x);
+	this->readBig(p, y);
+	point.set(x, y);
+}
+
+bool IncrStore::create(const char *path, Big q, int workingbits, int valueBits, time_t proofTime, bool resume) {
+	this->fd = ::open(path, O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+	this->failed = false;
+	this->q = q;
+	this->valueBits = valueBits;
+	this->fieldBytes = workingbits / 8;
+	this->proofTime = proofTime;
+	this->recordSize = computeRecordSize(this->fieldBytes, valueBits);
+	return this->fd >= 0;
+}
+
+bool IncrStore::isOpen() {
+	return this->fd >= 0 || this->file.data != NULL;
+}
+
+bool IncrStore::sync() {
+	return this->fd < 0 || (!this->failed && fdatasync(this->fd) == 0);
+}
+
+void IncrStore::setEntries(uint64_t first, LedgerEntry *e, int count) {
+	if (this->fd < 0) return;
+
+	vector<char> buffer(count * this->recordSize, 0);
+	IncrEntry entry(this->valueBits);
+	int ii, kk;
+
+	for (ii = 0; ii < count; ii++) {
+		entry.balance = e[ii].balance;
+		entry.lec = e[ii].lec;
+		entry.lep_gamma = e[ii].lep.gamma;
+		entry.lep_r = e[ii].r;
+		entry.lep_b1 = e[ii].lep.b1;
+		entry.lep_b2 = e[ii].lep.b2;
+		entry.lep_b3 = e[ii].lep.b3;
+
+		for (kk = 0; kk < this->valueBits; kk++) {
+			entry.lbc[kk] = e[ii].lbc[kk];
+			entry.lbp_gamma[kk] = bit(e[ii].balance, kk) ? e[ii].lbp[kk].gamma2 : e[ii].lbp[kk].gamma1;
+			entry.lbp_r[kk] = e[ii].lbp[kk].r;
+			entry.lbp_b1[kk] = bit(e[ii].balance, kk) ? e[ii].lbp[kk].b3 : e[ii].lbp[kk].b1;
+			entry.lbp_b2[kk] = bit(e[ii].balance, kk) ? e[ii].lbp[kk].b4 : e[ii].lbp[kk].b2;
+		}
+
+		this->encode(&buffer[ii * this->recordSize], e[ii].id, first + ii, entry);
+	}
+
+	if (pwrite(this->fd, &buffer[0], buffer.size(), sizeof(IncrStoreHeader) + first * this->recordSize) != (ssize_t) buffer.size()) {
+		this->failed = true;
+	}
+}
+
+bool IncrStore::finish(uint64_t recordCount) {
+	if (this->fd < 0) return false;
+
+	// The table is kept at most half full, so that probe sequences remain short.
+	this->recordCount = recordCount;
+	this->tableSize = 1;
+	while (this->tableSize < 2 * recordCount) this->tableSize <<= 1;
+
+	IncrStoreHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, INCR_STORE_MAGIC, sizeof(header.magic));
+	header.valueBits = this->valueBits;
+	header.fieldBytes = this->fieldBytes;
+	header.proofTime = this->proofTime;
+	header.recordSize = this->recordSize;
+	header.recordCount = recordCount;
+	header.tableSize = this->tableSize;
+	header.tableOffset = sizeof(IncrStoreHeader) + recordCount * this->recordSize;
+
+	size_t length = header.tableOffset + this->tableSize * sizeof(uint64_t);
+	bool ok = !this->failed && ftruncate(this->fd, length) == 0;
+
+	// Read the digests back from the records in place, rather than holding them in memory while the proof is generated.
+	char *data = ok ? (char *) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0) : (char *) MAP_FAILED;
+	ok &= data != MAP_FAILED;
+
+	if (ok) {
+		this->records = data + sizeof(IncrStoreHeader);
+		this->buildTable(reinterpret_cast<uint64_t *>(data + header.tableOffset));
+		this->records = NULL;
+		memcpy(data, &header, sizeof(header));
+		ok &= munmap(data, length) == 0;
+	}
+
+	return ok;
+}
+
+bool IncrStore::open(const char *path) {
+	if (!mapFile(path, this->file)) return false;
+
+	const IncrStoreHeader *header = reinterpret_cast<const IncrStoreHeader *>(this->file.data);
+	if (this->file.length < sizeof(IncrStoreHeader) || memcmp(header->magic, INCR_STORE_MAGIC, sizeof(header->magic)) != 0
+		|| header->tableSize == 0 || (header->tableSize & (header->tableSize - 1)) != 0
+		|| header->recordSize != computeRecordSize(header->fieldBytes, header->valueBits)
+		|| header->tableOffset != sizeof(IncrStoreHeader) + header->recordCount * header->recordSize
+		|| this->file.length < header->tableOffset + header->tableSize * sizeof(uint64_t)) {
+		this->close();
+		return false;
+	}
+
+	this->valueBits = header->valueBits;
+	this->fieldBytes = header->fieldBytes;
+	this->proofTime = header->proofTime;
+	this->recordSize = header->recordSize;
+	this->recordCount = header->recordCount;
+	this->tableSize = header->tableSize;
+	this->records = this->file.data + sizeof(IncrStoreHeader);
+	this->table = reinterpret_cast<const uint64_t *>(this->file.data + header->tableOffset);
+	return true;
+}
+
+void IncrStore::close() {
+	if (this->fd >= 0) ::close(this->fd);
+	this->fd = -1;
+	if (this->file.data != NULL) unmapFile(this->file);
+	this->records = NULL;
+	this->table = NULL;
+}
+
+void IncrStore::init(Big q, int workingbits, int valueBits) {
+	this->q = q;
+	this->valueBits = valueBits;
+	this->fieldBytes = workingbits / 8;
+	this->recordSize = computeRecordSize(this->fieldBytes, valueBits);
+	this->recordCount = 0;
+	this->tableSize = INCR_STORE_TABLE_MIN;
+	this->arenaTable.assign(this->tableSize, 0);
+	this->table = &this->arenaTable[0];
+}
+
+void IncrStore::encode(char *p, const string &id, uint64_t index, IncrEntry &entry) {
+	int kk;
+
+	memset(p, 0, this->recordSize);
+	zldigest(id.c_str(), id.length(), p);
+	p += INCR_STORE_ID_BYTES;
+	memcpy(p, &index, sizeof(index));
+	p += sizeof(index);
+
+	this->writeBig(p, entry.balance);
+
+	for (kk = 0; kk < this->valueBits; kk++) {
+		this->writePoint(p, entry.lbc[kk]);
+	}
+
+	this->writePoint(p, entry.lec);
+
+	for (kk = 0; kk < this->valueBits; kk++) {
+		this->writePoint(p, entry.lbp_gamma[kk]);
+	}
+
+	this->writePoint(p, entry.lep_gamma);
+
+	for (kk = 0; kk < this->valueBits; kk++) {
+		this->writeBig(p, entry.lbp_r[kk] % this->q);
+	}
+
+	this->writeBig(p, entry.lep_r % this->q);
+
+	for (kk = 0; kk < this->valueBits; kk++) {
+		this->writeBig(p, entry.lbp_b1[kk] % this->q);
+	}
+
+	for (kk = 0; kk < this->valueBits; kk++) {
+		this->writeBig(p, entry.lbp_b2[kk] % this->q);
+	}
+
+	this->writeBig(p, entry.lep_b1 % this->q);
+	this->writeBig(p, entry.lep_b2 % this->q);
+	this->writeBig(p, entry.lep_b3 % this->q);
+}
+
+void IncrStore::append(const char *p, int count) {
+	uint64_t mask = this->tableSize - 1;
+
+	for (int ii = 0; ii < count; ii++, p += this->recordSize) {
+		if (this->recordCount % INCR_STORE_BLOCK_RECORDS == 0) {
+			this->blocks.push_back(new char[INCR_STORE_BLOCK_RECORDS * this->recordSize]);
+		}
+
+		memcpy((char *) this->record(this->recordCount), p, this->recordSize);
+		this->recordCount++;
+
+		// As in the binary format, the table is kept at most half full; when it fills, it is doubled and rebuilt.
+		if (2 * this->recordCount > this->tableSize) {
+			this->tableSize <<= 1;
+			mask = this->tableSize - 1;
+			this->arenaTable.resize(this->tableSize);
+			this->table = &this->arenaTable[0];
+			this->buildTable(&this->arenaTable[0]);
+		} else {
+			uint64_t slot = tableSlot(p) & mask;
+			while (this->arenaTable[slot] != 0) slot = (slot + 1) & mask;
+			this->arenaTable[slot] = this->recordCount;
+		}
+	}
+}
+
+bool IncrStore::replicate(IncrStore &source) {
+	if (source.table == NULL) return false;
+
+	uint64_t recordBytes = source.recordCount * source.recordSize;
+	size_t length = recordBytes + source.tableSize * sizeof(uint64_t);
+	this->replica = static_cast<char *>(allocLocal(length));
+	if (this->replica == NULL) return false;
+	this->replicaLength = length;
+
+	// The records are copied a block at a time, since those of an in-memory store are not contiguous. Every record is a
+	// multiple of eight bytes long, so the table which follows them is aligned.
+	for (uint64_t ii = 0; ii < source.recordCount; ii += INCR_STORE_BLOCK_RECORDS) {
+		uint64_t count = min((uint64_t) INCR_STORE_BLOCK_RECORDS, source.recordCount - ii);
+		memcpy(this->replica + ii * source.recordSize, source.record(ii), count * source.recordSize);
+	}
+	memcpy(this->replica + recordBytes, source.table, source.tableSize * sizeof(uint64_t));
+
+	this->valueBits = source.valueBits;
+	this->fieldBytes = source.fieldBytes;
+	this->proofTime = source.proofTime;
+	this->recordSize = source.recordSize;
+	this->recordCount = source.recordCount;
+	this->tableSize = source.tableSize;
+	this->records = this->replica;
+	this->table = reinterpret_cast<const uint64_t *>(this->replica + recordBytes);
+	return true;
+}
+
+bool IncrStore::fetch(const string &id, IncrEntry &entry) {
+	if (this->table == NULL) return false;
+
+	char digest[INCR_STORE_ID_BYTES];
+	zldigest(id.c_str(), id.length(), digest);
+
+	uint64_t mask = this->tableSize - 1;
+	const char *p = NULL;
+	for (uint64_t slot = tableSlot(digest) & mask; this->table[slot] != 0; slot = (slot + 1) & mask) {
+		const char *record = this->record(this->table[slot] - 1);
+		if (memcmp(record, digest, INCR_STORE_ID_BYTES) == 0) {
+			p = record + INCR_STORE_ID_BYTES + sizeof(uint64_t);
+			break;
+		}
+	}
+
+	if (p == NULL) return false;
+
+	if ((int) entry.lbc.size() != this->valueBits) entry = IncrEntry(this->valueBits);
+
+	int kk;
+
+	this->readBig(p, entry.balance);
+
+	for (kk = 0; kk < this->valueBits; kk++) {
+		this->readPoint(p, entry.lbc[kk]);
+	}
+
+	this->readPoint(p, entry.lec);
+
+	for (kk = 0; kk < this->valueBits; kk++) {
+		this->readPoint(p, entry.lbp_gamma[kk]);
+	}
+
+	this->readPoint(p, entry.lep_gamma);
+
+	for (kk = 0; kk < this->valueBits; kk++) {
+		this->readBig(p, entry.lbp_r[kk]);
+	}
+
+	this->readBig(p, entry.lep_r);
+
+	for (kk = 0; kk < this->valueBits; kk++) {
+		this->readBig(p, entry.lbp_b1[kk]);
+	}
+
+	for (kk = 0; kk < this->valueBits; kk++) {
+		this->readBig(p, entry.lbp_b2[kk]);
+	}
+
+	this->readBig(p, entry.lep_b1);
+	this->readBig(p, entry.lep_b2);
+	this->readBig(p, entry.lep_b3);
+
+	return true;
+}
+
+uint64_t IncrStore::size() {
+	return this->recordCount;
+}
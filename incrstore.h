@@ -0,0 +1,122 @@
+#ifndef INCRSTORE_H
+#define INCRSTORE_H
+
+#include <stdint.h>
+#include <ctime>
+#include <string>
+#include <atomic>
+#include "zeroledge.h"
+#include "zlutil.h"
+#include "ledger.h"
+
+#define INCR_STORE_MAGIC "ZLINCR02"
+#define INCR_STORE_ID_BYTES 32
+#define INCR_STORE_BLOCK_RECORDS 1024
+#define INCR_STORE_TABLE_MIN 1024
+
+// IncrStoreHeader is the fixed-size header at the start of a binary incremental data file. It is followed by recordCount
+// fixed-size records, in order of entry index, and then by a hash table of tableSize 64-bit slots, each of which holds
+// either zero or one plus the index of a record. All fields are in native byte order.
+struct IncrStoreHeader {
+	char magic[8];
+	uint32_t valueBits;
+	uint32_t fieldBytes;
+	int64_t proofTime;
+	uint64_t recordSize;
+	uint64_t recordCount;
+	uint64_t tableSize;
+	uint64_t tableOffset;
+};
+
+// IncrStore holds the incremental data saved along with a previous proof, indexed by account identifier. Each account is
+// represented by a single fixed-size record, which identifies the account by the SHA-256 digest of its identifier, and
+// contains the balance, curve points (as affine x and y coordinates), and scalars (reduced modulo q), each in a fixed-width
+// big-endian field. The records are located via an open-addressing hash table keyed by the same digest, so that a lookup
+// touches one table slot and the head of one record, and decoding a record requires no point decompression.
+//
+// The records can be memory-mapped from the binary format written by zlgenerate -R, in which case nothing at all is read
+// until an account is actually looked up, or appended to an arena in memory as text incremental data is ingested. The arena
+// is allocated in blocks of records, so that it never needs to be copied as it grows.
+class IncrStore {
+
+private:
+
+	int fd;
+	atomic<bool> failed;
+	MappedFile file;
+	const char *records;
+	const uint64_t *table;
+	vector<char *> blocks;
+	vector<uint64_t> arenaTable;
+	char *replica;
+	size_t replicaLength;
+	Big q;
+
+	static uint64_t tableSlot(const char *digest);
+	static uint64_t computeRecordSize(int fieldBytes, int valueBits);
+	const char * record(uint64_t ii);
+	void buildTable(uint64_t *slots);
+	void writeBig(char *&p, const Big &x);
+	void writePoint(char *&p, ECn &point);
+	void readBig(const char *&p, Big &x);
+	void readPoint(const char *&p, ECn &point);
+
+public:
+
+	int valueBits, fieldBytes;
+	time_t proofTime;
+	uint64_t recordSize, recordCount, tableSize;
+
+	IncrStore();
+	~IncrStore();
+
+	// Create a new binary incremental data file at path. Scalars are reduced modulo q, and every field is workingbits bits
+	// wide, which must be sufficient for both q and the x coordinates of curve points. If resume is set, the records
+	// already in an existing file are kept, so that generation can continue from a checkpoint.
+	bool create(const char *path, Big q, int workingbits, int valueBits, time_t proofTime, bool resume);
+
+	bool isOpen();
+
+	// Flush the records written so far to disk. Returns false if any of them could not be written.
+	bool sync();
+
+	// Record the incremental data for count consecutive entries, beginning with entry index first. As with the proof
+	// index, this function may be called concurrently by many threads, so long as no two calls cover the same entries.
+	void setEntries(uint64_t first, LedgerEntry *e, int count);
+
+	// Build the hash table and write the header. This must be called only once all entries have been recorded. The file
+	// remains open, so that it can still be synced, until the store is closed. Returns false if anything, including any of
+	// the records, could not be written.
+	bool finish(uint64_t recordCount);
+
+	// Map an existing binary incremental data file. Returns false if it cannot be read, or is not in the binary format.
+	// close releases the file, whether it was opened or created.
+	bool open(const char *path);
+	void close();
+
+	// Prepare an empty in-memory store, into which text incremental data can be ingested.
+	void init(Big q, int workingbits, int valueBits);
+
+	// Encode the incremental data for the account id into a record at p, which must have room for recordSize bytes. This
+	// function is thread-safe, so that records can be encoded before the lock that guards append is taken.
+	void encode(char *p, const string &id, uint64_t index, IncrEntry &entry);
+
+	// Append count encoded records from p to the in-memory arena, and add them to the hash table. This function is not
+	// thread-safe.
+	void append(const char *p, int count);
+
+	// Look up the incremental data for the account id, decoding it into entry. Returns false if there is none. This function
+	// may be called concurrently by many threads once the store has been opened or populated.
+	bool fetch(const string &id, IncrEntry &entry);
+
+	// Make this empty store a copy of source, which must have been opened or populated, holding its records and hash table in
+	// a single region of memory (on huge pages where available) allocated and filled by the calling thread, so that a
+	// thread on each NUMA node can keep a replica on its own node. The copy can only be fetched from. It touches no MIRACL
+	// objects, so the calling thread needs no MIRACL instance. Returns false if the memory cannot be allocated.
+	bool replicate(IncrStore &source);
+
+	uint64_t size();
+
+};
+
+#endif
@@ -11,7 +11,7 @@ LBPProcessor::LBPProcessor(Big q, ECn g, ECn h, ECn f, int workingbits, int valu
 	this->incrData = NULL;
 }
 
-LBPProcessor::LBPProcessor(Big q, ECn g, ECn h, ECn f, int workingbits, int valuebits, unordered_map<string, IncrEntry> *incrData) {
+LBPProcessor::LBPProcessor(Big q, ECn g, ECn h, ECn f, int workingbits, int valuebits, IncrStore *incrData) {
 	this->q = q;
 	this->g = g;
 	this->h = h;
@@ -51,12 +51,23 @@ void LBPProcessor::genCommitments(LedgerEntry &e) {
 	}
 }
 	
+void LBPProcessor::fetchIncremental(LedgerEntry &e) {
+	if (this->incrData && !e.incremental) {
+		e.incremental = this->incrData->fetch(e.id, e.incrDatum);
+	}
+}
+
 void LBPProcessor::beginProof(LedgerEntry &e, int ii) {
 
+	// The incremental data is decoded only once per entry, when the first bit is proven.
+	this->fetchIncremental(e);
+	this->beginFetchedProof(e, ii);
+
+}
+
+void LBPProcessor::beginFetchedProof(LedgerEntry &e, int ii) {
 
-	if (this->incrData && this->incrData->count(e.id)) {
-		e.incremental = true;
-		e.incrDatum = this->incrData->at(e.id);
+	if (e.incremental) {
 		e.lbp[ii].b_incr = rand(this->q);
 	}
 
@@ -163,6 +174,17 @@ void LBPProcessor::genProofs(LedgerEntry &e) {
 	}
 }
 
+void LBPProcessor::genBits(LedgerEntry &e, int first, int last, ECn &gx) {
+	int ii;
+	for (ii = first; ii < last; ii++) {
+		this->genR(e, ii);
+		this->genCommitment(e, ii, gx);
+		this->beginFetchedProof(e, ii);
+		this->challengeProof(e, ii);
+		this->completeProof(e, ii);
+	}
+}
+
 bool LBPProcessor::verifyProof(LedgerEntry &e, int ii) {
 
 	ECn proven1 = e.lbp[ii].z1 * this->g;
@@ -180,9 +202,13 @@ bool LBPProcessor::verifyProof(LedgerEntry &e, int ii) {
 }
 
 bool LBPProcessor::verifyProofs(LedgerEntry &e) {
+	return this->verifyBits(e, 0, this->valuebits);
+}
+
+bool LBPProcessor::verifyBits(LedgerEntry &e, int first, int last) {
 	bool result = true;
 	int ii;
-	for (ii = 0; ii < this->valuebits; ii++) {
+	for (ii = first; ii < last; ii++) {
 		result &= this->verifyProof(e, ii);
 	}
 	return result;
@@ -4,6 +4,7 @@
 #include "zeroledge.h"
 #include "zlutil.h"
 #include "ledger.h"
+#include "incrstore.h"
 
 class LBPProcessor {
 
@@ -12,7 +13,10 @@ private:
 	int bits, bytes, valuebits;
 	Big q;
 	ECn g, h, f;
-	unordered_map<string, IncrEntry> *incrData;
+	IncrStore *incrData;
+
+	// Begin the proof as LBPProcessor::beginProof does, once the incremental data for the entry has been fetched.
+	void beginFetchedProof(LedgerEntry &e, int ii);
 
 public:
 
@@ -25,7 +29,7 @@ public:
 
 	// Constructor for the LBPProcessor object. Parameters are as above, with the addition of
 	// incrData:	a collection of incremental data generated along with a previous proof, indexed by account identifier.
-	LBPProcessor(Big q, ECn g, ECn h, ECn f, int workingbits, int valuebits, unordered_map<string, IncrEntry> *incrData);
+	LBPProcessor(Big q, ECn g, ECn h, ECn f, int workingbits, int valuebits, IncrStore *incrData);
 
 	// Choose a random nonce for a single ledger entry bit
 	void genR(LedgerEntry &e, int ii);
@@ -76,6 +80,16 @@ public:
 	// Calls the LBPProcessor.genProof function once for each bit
 	void genProofs(LedgerEntry &e);
 
+	// Look up the incremental data for a ledger entry, if there is any and it has not been found already. This is done by
+	// LBPProcessor::beginProof when the first bit is proven, but must be done beforehand if the bits are to be divided.
+	void fetchIncremental(LedgerEntry &e);
+
+	// Choose the nonces for, and generate the commitments and proofs of, the bits [first, last) of a ledger entry, given the
+	// precomputed value of gx. Disjoint ranges of the bits of a single entry may be generated by several threads at once,
+	// each with its own processor, once LBPProcessor::fetchIncremental has been called for the entry. The result is the
+	// same as that of LBPProcessor::genCommitments followed by LBPProcessor::genProofs.
+	void genBits(LedgerEntry &e, int first, int last, ECn &gx);
+
 	// Given a ledger entry bit which has had its commitment, gamma values, challenge values, and z values assigned manually,
 	// verify the proof. Returns true if proof is valid; false otherwise.
 	bool verifyProof(LedgerEntry &e, int ii);
@@ -83,6 +97,10 @@ public:
 	// Calls the LBPProcessor::verifyProof function once for each bit, Returns true if all proofs are valid; false otherwise.
 	bool verifyProofs(LedgerEntry &e);
 
+	// Verify the proofs of the bits [first, last) only. As with LBPProcessor::genBits, disjoint ranges of the bits of a single
+	// entry may be verified by several threads at once.
+	bool verifyBits(LedgerEntry &e, int first, int last);
+
 };
 
 #endif
\ No newline at end of file
@@ -16,6 +16,7 @@ IncrEntry::IncrEntry(int valueBits) {
 
 LedgerEntry::LedgerEntry() {
 	this->incremental = false;
+	this->idCommitted = false;
 }
 
 LedgerEntry::LedgerEntry(int valueBits) {
@@ -24,6 +25,7 @@ LedgerEntry::LedgerEntry(int valueBits) {
 	this->lbp.resize(valueBits);
 
 	this->incremental = false;
+	this->idCommitted = false;
 }
 
 LedgerEntry::LedgerEntry(string id, Big balance, int valueBits) {
@@ -32,6 +34,7 @@ LedgerEntry::LedgerEntry(string id, Big balance, int valueBits) {
 	this->lbp.resize(valueBits);
 
 	this->incremental = false;
+	this->idCommitted = false;
 	
 	this->setId(id);
 	this->setBalance(balance);
@@ -41,6 +44,15 @@ void LedgerEntry::setId(string id) {
 	this->id = id;
 	this->idHash = zlhash(id.c_str(), id.length());
 	this->idHashPrime = (pow(Big(2),this->valueBits) -1) * this->idHash;
+	this->idCommitted = false;
+}
+
+void LedgerEntry::shareId(const LedgerEntry &other) {
+	this->id = other.id;
+	this->idHash = other.idHash;
+	this->idHashPrime = other.idHashPrime;
+	this->idCommitment = other.idCommitment;
+	this->idCommitted = other.idCommitted;
 }
 
 void LedgerEntry::setBalance(Big balance) {
@@ -118,6 +130,28 @@ void Ledger::appendLedger(Ledger &l) {
 	this->totalCommitment += l.totalCommitment;
 }
 
+void Ledger::removeLedger(Ledger &l) {
+	this->idHashSum -= l.idHashSum;
+	this->idHashPrimeSum -= l.idHashPrimeSum;
+	this->totalLiabilities -= l.totalLiabilities;
+	this->rSum -= l.rSum;
+	for (int jj = 0; jj < this->valueBits; jj++) {
+		this->rBitSums[jj] -= l.rBitSums[jj];
+	}
+	this->totalCommitment -= l.totalCommitment;
+}
+
+void Ledger::reset() {
+	this->totalCommitment = ECn();
+	this->idHashSum = Big(0);
+	this->idHashPrimeSum = Big(0);
+	this->totalLiabilities = Big(0);
+	this->rSum = Big(0);
+	for (int jj = 0; jj < this->valueBits; jj++) {
+		this->rBitSums[jj] = Big(0);
+	}
+}
+
 void Ledger::computeSums() {
 	this->difference = this->totalAssets - this->totalLiabilities;
 }
@@ -134,5 +168,9 @@ bool Ledger::verifyCommitmentEquivilancy() {
 		differenceBitProduct += pow(Big(2), ii) * this->dbc[ii];
 	}
 
+	return this->verifyCommitmentEquivilancy(differenceBitProduct);
+}
+
+bool Ledger::verifyCommitmentEquivilancy(ECn &differenceBitProduct) {
 	return differenceBitProduct == this->differenceCommitment;
 }
\ No newline at end of file
@@ -56,6 +56,11 @@ public:
 	bool incremental;
 	IncrEntry incrDatum;
 
+	// The commitment to the identifier alone, x'g, once it has been computed for an account holding several assets, so that
+	// the entries for the other assets can share it (see LedgerEntry::shareId). idCommitted is false otherwise.
+	ECn idCommitment;
+	bool idCommitted;
+
 	ECn lec;
 	LedgerEntryProof lep;
 	vector<ECn> lbc;
@@ -72,6 +77,10 @@ public:
 	// Set the raw id and calculate x by taking the hash of the id, and x' as specified in Section VII-B (Commitment to
 	// Ledger Entries) of the paper.
 	void setId(string id);
+
+	// Take the raw id, x, and x' (and x'g, if it has been computed) from another entry belonging to the same account, rather
+	// than hashing the id again. Both entries must be restricted to the same number of bits.
+	void shareId(const LedgerEntry &other);
 	
 	void setBalance (Big balance);
 	void setR(Big r);
@@ -116,6 +125,13 @@ public:
 	void addEntry(LedgerEntry e);
 	void appendLedger(Ledger &l);
 
+	// Subtract the sums of l, which must previously have been added, so that an entry can be replaced without summing the
+	// rest of the ledger again.
+	void removeLedger(Ledger &l);
+
+	// Clear the sums accumulated by Ledger::addEntry and Ledger::appendLedger, so that the ledger can be reused.
+	void reset();
+
 	// Compute various values which depend on all entries having been valid, but which are required before the ledger can
 	// actually be used. This function must be called before any of the following functions, and before it is passed to an
 	// instance of DBPProcessor
@@ -129,6 +145,10 @@ public:
 	// liabilities, as specified Section VII-F (Proof of Solvency by Inequality). This is used by the verifier tocheck that
 	// no uncomitted values have been included, and that the institution is solvent.
 	bool verifyCommitmentEquivilancy();
+
+	// Verify the equivalency as above, given the sum of the difference bit commitments each multiplied by its place value,
+	// which may have been accumulated in parts by several threads as the difference bits were read.
+	bool verifyCommitmentEquivilancy(ECn &differenceBitProduct);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,281 @@
+#include "ledgerreader.h"
+#include "textcodec.h"
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+static inline bool isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Return whether the line beginning at p holds anything but whitespace, and set next to the start of the following line.
+static bool lineHasEntry(const char *p, const char *end, const char *&next) {
+	const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+	const char *lineEnd = (newline != NULL) ? newline : end;
+	next = (newline != NULL) ? newline + 1 : end;
+
+	for (; p < lineEnd; p++) {
+		if (!isBlank(*p)) return true;
+	}
+	return false;
+}
+
+LedgerReader::LedgerReader() {
+	this->file = 0;
+	this->cursor = NULL;
+	this->error = false;
+}
+
+LedgerReader::~LedgerReader() {
+	for (size_t ii = 0; ii < this->files.size(); ii++) {
+		unmapFile(this->files[ii].view);
+		if (this->files[ii].fd > STDIN_FILENO) close(this->files[ii].fd);
+	}
+}
+
+const char * LedgerReader::fileEnd() {
+	return this->files[this->file].view.data + this->files[this->file].view.length;
+}
+
+bool LedgerReader::open(const vector<const char *> &paths, bool whole) {
+	size_t count = (paths.size() > 0) ? paths.size() : 1;
+	struct stat st;
+
+	this->files.resize(count);
+	for (size_t ii = 0; ii < count; ii++) {
+		const char *path = (paths.size() > 0) ? paths[ii] : NULL;
+		LedgerFile &f = this->files[ii];
+		f.streamed = !whole && ((path != NULL) ? stat(path, &st) : fstat(STDIN_FILENO, &st)) == 0 && !S_ISREG(st.st_mode);
+		f.fd = -1;
+		f.capacity = 0;
+		f.offset = 0;
+
+		if (f.streamed) {
+			f.view.data = static_cast<char *>(malloc(LEDGER_BLOCK_SIZE));
+			f.view.length = 0;
+			f.view.mapped = false;
+			f.fd = (path != NULL) ? ::open(path, O_RDONLY) : STDIN_FILENO;
+			f.capacity = LEDGER_BLOCK_SIZE;
+		}
+
+		if (f.streamed ? (f.view.data == NULL || f.fd < 0) : !mapFile(path, f.view)) {
+			if (f.streamed) {
+				free(const_cast<char *>(f.view.data));
+				if (f.fd > STDIN_FILENO) close(f.fd);
+			}
+			this->files.resize(ii);
+			return false;
+		}
+	}
+
+	this->file = 0;
+	this->cursor = this->files[0].view.data;
+	return true;
+}
+
+// Read more of the current file, which is streamed, into its buffer. The data from the cursor on is kept, and moved to the
+// beginning of the buffer, which grows only if the data kept fills it. The file is closed once it is exhausted.
+bool LedgerReader::refill() {
+	LedgerFile &f = this->files[this->file];
+	char *buffer = const_cast<char *>(f.view.data);
+	size_t keep = this->fileEnd() - this->cursor;
+	ssize_t got;
+
+	f.offset += this->cursor - buffer;
+	memmove(buffer, this->cursor, keep);
+	if (keep == f.capacity) {
+		char *grown = static_cast<char *>(realloc(buffer, 2 * f.capacity));
+		if (grown == NULL) return false;
+		buffer = grown;
+		f.capacity *= 2;
+	}
+
+	f.view.data = buffer;
+	f.view.length = keep;
+	this->cursor = buffer;
+
+	while ((got = read(f.fd, buffer + keep, f.capacity - keep)) < 0 && errno == EINTR);
+	if (got < 0) return false;
+
+	f.view.length += got;
+	if (got == 0) {
+		if (f.fd > STDIN_FILENO) close(f.fd);
+		f.fd = -1;
+	}
+	return true;
+}
+
+// Read the current file, which is streamed, until the next count entries are held in full, or the file is exhausted.
+void LedgerReader::fill(int count) {
+	LedgerFile &f = this->files[this->file];
+	const char *p = this->cursor, *newline, *next;
+	size_t scanned;
+	int found = 0;
+
+	while (found < count && f.fd >= 0) {
+		newline = static_cast<const char *>(memchr(p, '\n', this->fileEnd() - p));
+		if (newline != NULL) {
+			if (lineHasEntry(p, newline + 1, next)) found++;
+			p = next;
+			continue;
+		}
+
+		scanned = p - this->cursor;
+		if (!this->refill()) {
+			this->error = true;
+			return;
+		}
+		p = this->cursor + scanned;
+	}
+}
+
+bool LedgerReader::readAssets(Big &assets) {
+	return this->readAssets(&assets, 1);
+}
+
+bool LedgerReader::readAssets(Big *assets, int count) {
+	if (this->files[this->file].fd >= 0) this->fill(1);
+	if (this->error) return false;
+
+	const char *end = this->fileEnd();
+	const char *p = this->cursor, *token;
+
+	while (p < end && isBlank(*p)) p++;
+	for (int ii = 0; ii < count; ii++) {
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		for (token = p; p < end && !isBlank(*p); p++);
+		if (p == token || !decodeDecimal(token, p - token, assets[ii])) return false;
+	}
+
+	this->cursor = skipLines(p, end, 1);
+	return true;
+}
+
+uint64_t LedgerReader::countEntries() {
+	uint64_t count = 0;
+	const char *p, *end, *next;
+
+	for (size_t ii = this->file; ii < this->files.size(); ii++) {
+		p = (ii == this->file) ? this->cursor : this->files[ii].view.data;
+		end = this->files[ii].view.data + this->files[ii].view.length;
+		for (; p < end; p = next) {
+			if (lineHasEntry(p, end, next)) count++;
+		}
+	}
+
+	return count;
+}
+
+void LedgerReader::tell(uint64_t &file, uint64_t &offset) {
+	file = this->file;
+	offset = (this->file < this->files.size()) ? this->files[this->file].offset + (this->cursor - this->files[this->file].view.data) : 0;
+}
+
+bool LedgerReader::seek(uint64_t file, uint64_t offset) {
+	if (file > this->files.size() || (file < this->files.size() && offset > this->files[file].view.length)) return false;
+	for (size_t ii = 0; ii < this->files.size(); ii++) {
+		if (this->files[ii].streamed) return false;
+	}
+
+	this->file = file;
+	this->cursor = (file < this->files.size()) ? this->files[file].view.data + offset : NULL;
+	return true;
+}
+
+int LedgerReader::nextEntries(int count, const char *&begin, const char *&end) {
+	const char *next;
+	int found = 0;
+
+	while (this->file < this->files.size()) {
+		if (this->files[this->file].fd >= 0) this->fill(count);
+		if (this->error) return 0;
+
+		if (this->cursor >= this->fileEnd()) {
+			if (++this->file < this->files.size()) this->cursor = this->files[this->file].view.data;
+			continue;
+		}
+
+		begin = this->cursor;
+		while (found < count && this->cursor < this->fileEnd()) {
+			if (lineHasEntry(this->cursor, this->fileEnd(), next)) found++;
+			this->cursor = next;
+		}
+		end = this->cursor;
+
+		if (found > 0) return found;
+	}
+
+	return 0;
+}
+
+bool LedgerReader::isStreamed() {
+	return this->file < this->files.size() && this->files[this->file].streamed;
+}
+
+bool LedgerReader::failed() {
+	return this->error;
+}
+
+uint64_t LedgerReader::skipEntries(uint64_t count) {
+	const char *begin, *end;
+	uint64_t skipped = 0;
+	int found;
+
+	while (skipped < count && (found = this->nextEntries(min(count - skipped, (uint64_t) INT_MAX), begin, end)) > 0) {
+		skipped += found;
+	}
+
+	return skipped;
+}
+
+const char * LedgerReader::parseEntry(const char *p, const char *end, LedgerLine &line) {
+	while (p < end && isBlank(*p)) p++;
+	if (p >= end) return NULL;
+
+	for (line.id = p; p < end && !isBlank(*p); p++);
+	line.idLength = p - line.id;
+
+	while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+	for (line.balance = p; p < end && !isBlank(*p); p++);
+	line.balanceLength = p - line.balance;
+
+	return skipLines(p, end, 1);
+}
+
+const char * LedgerReader::parseEntry(const char *p, const char *end, LedgerLine &line, int count, Big *balances, bool &valid) {
+	const char *token;
+
+	while (p < end && isBlank(*p)) p++;
+	if (p >= end) return NULL;
+
+	for (line.id = p; p < end && !isBlank(*p); p++);
+	line.idLength = p - line.id;
+
+	for (int ii = 0; ii < count; ii++) {
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		for (token = p; p < end && !isBlank(*p); p++);
+
+		if (ii == 0) {
+			line.balance = token;
+			line.balanceLength = p - token;
+		}
+		if (p > token) {
+			valid = decodeDecimal(token, p - token, balances[ii]) && valid;
+		} else {
+			balances[ii] = 0;
+			valid = false;
+		}
+	}
+
+	// Nothing but whitespace may follow the last balance.
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+	if (p < end && *p != '\n') valid = false;
+
+	return skipLines(p, end, 1);
+}
@@ -0,0 +1,110 @@
+#ifndef LEDGERREADER_H
+#define LEDGERREADER_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include "zeroledge.h"
+#include "zlutil.h"
+
+// The size of the first block read from a streamed ledger file, and of its buffer, which grows only if a single group of
+// entries does not fit.
+#define LEDGER_BLOCK_SIZE (1 << 20)
+
+using namespace std;
+
+// LedgerLine locates the fields of a single ledger entry within the mapped ledger, without copying them.
+typedef struct LedgerLine {
+	const char *id;
+	size_t idLength;
+	const char *balance;
+	size_t balanceLength;
+} LedgerLine;
+
+// LedgerReader provides access to a ledger which may be divided among several files (one per database shard, for instance),
+// each of which is memory-mapped if it is a regular file, and otherwise streamed: read a block at a time, as its entries
+// are found, so that a ledger piped into the generator is never held in memory in full. The first file begins with the total assets; after that, every non-blank line of every
+// file holds a single entry, consisting of an account identifier and a balance, separated by whitespace. The entries of the
+// ledger are the entries of the files, in the order in which the files are given.
+//
+// A multi-asset ledger is laid out in the same way, except that its first line holds the totals of several assets, and
+// every entry holds a balance of each, in the same order, following the account identifier.
+//
+// The reader only ever finds the boundaries of groups of lines, which requires nothing more than a scan for newlines, and
+// leaves the parsing of the entries within each group to whichever thread processes the group. No group spans two files.
+class LedgerReader {
+
+private:
+
+	// LedgerFile is a single file of the ledger. The buffer of a streamed file holds only the block being read, which begins
+	// offset bytes into the file, and fd remains open until the file is exhausted.
+	typedef struct LedgerFile {
+		MappedFile view;
+		bool streamed;
+		int fd;
+		size_t capacity;
+		uint64_t offset;
+	} LedgerFile;
+
+	vector<LedgerFile> files;
+	size_t file;
+	const char *cursor;
+	bool error;
+
+	const char * fileEnd();
+	bool refill();
+	void fill(int count);
+
+public:
+
+	LedgerReader();
+	~LedgerReader();
+
+	// Open the files at paths, or stdin if there are none. Returns false if any of them cannot be read. If whole is set,
+	// files which cannot be mapped are read in full in advance, rather than streamed, as countEntries and seek require.
+	bool open(const vector<const char *> &paths, bool whole = false);
+
+	// Read the total assets from the beginning of the first file, in base 10. This must be called before any entries are
+	// found. Returns false if they are missing or are not a decimal number.
+	bool readAssets(Big &assets);
+
+	// Read the totals of count assets from the first line of a multi-asset ledger, in base 10, separated by whitespace.
+	bool readAssets(Big *assets, int count);
+
+	// Count the entries in all of the files. This does not affect the position of the reader. A streamed file is counted
+	// only as far as it has been read.
+	uint64_t countEntries();
+
+	// Report the position of the reader, as the index of the current file and the offset within it, so that reading can
+	// later be resumed from the same place with seek. seek returns false if the position lies outside the ledger, or if
+	// any file is streamed.
+	void tell(uint64_t &file, uint64_t &offset);
+	bool seek(uint64_t file, uint64_t offset);
+
+	// Find up to count entries following the last ones found, all within a single file. On return, [begin, end) holds the
+	// lines in which they appear. Returns the number found, which is zero once the ledger is exhausted, or a streamed file
+	// could not be read. The lines of a streamed file remain valid only until entries are next found.
+	int nextEntries(int count, const char *&begin, const char *&end);
+
+	// Return whether the entries last found belong to a streamed file.
+	bool isStreamed();
+
+	// Return whether a streamed file could not be read, so that the ledger ended early.
+	bool failed();
+
+	// Pass over up to count entries following the last ones found. Returns the number passed over, which is fewer than count
+	// only if the ledger is exhausted.
+	uint64_t skipEntries(uint64_t count);
+
+	// Parse the first entry at or after p into line, and return a pointer to the line which follows it. Blank lines are
+	// skipped. Returns NULL if no entry remains before end.
+	static const char * parseEntry(const char *p, const char *end, LedgerLine &line);
+
+	// Parse the first entry of a multi-asset ledger at or after p, as parseEntry does, and decode its count balances into
+	// balances. line holds the first of them. valid is cleared if any balance is missing or is not a decimal number, or if
+	// the line holds more than count balances, and is otherwise left as it was.
+	static const char * parseEntry(const char *p, const char *end, LedgerLine &line, int count, Big *balances, bool &valid);
+
+};
+
+#endif
@@ -10,7 +10,7 @@ LEPProcessor::LEPProcessor(Big q, ECn g, ECn h, ECn f, int workingbits) {
 	this->incrData = NULL;
 }
 
-LEPProcessor::LEPProcessor(Big q, ECn g, ECn h, ECn f, int workingbits, unordered_map<string, IncrEntry> *incrData) {
+LEPProcessor::LEPProcessor(Big q, ECn g, ECn h, ECn f, int workingbits, IncrStore *incrData) {
 	this->q = q;
 	this->g = g;
 	this->h = h;
@@ -28,16 +28,23 @@ void LEPProcessor::genCommitment(LedgerEntry &e) {
 			e.lec += (e.balance - e.incrDatum.balance) * this->h;
 		}
 	} else {		
-		e.lec = e.idHashPrime * this->g;
+		e.lec = e.idCommitted ? e.idCommitment : e.idHashPrime * this->g;
 		e.lec += e.balance * this->h;
 		e.lec += e.r * this->f;
 	}
 }
 
+void LEPProcessor::genIdCommitment(LedgerEntry &e) {
+	e.idCommitment = e.idHashPrime * this->g;
+	e.idCommitted = true;
+}
+
 void LEPProcessor::beginProof(LedgerEntry &e) {
-	if (this->incrData && this->incrData->count(e.id)) {
-		e.incremental = true;
-		e.incrDatum = this->incrData->at(e.id);
+	if (this->incrData && !e.incremental) {
+		e.incremental = this->incrData->fetch(e.id, e.incrDatum);
+	}
+
+	if (e.incremental) {
 		e.lep.b_incr = rand(this->q);
 		e.lep.b1 = e.incrDatum.lep_b1 * e.lep.b_incr;
 		e.lep.b2 = e.incrDatum.lep_b2 * e.lep.b_incr;
@@ -4,6 +4,7 @@
 #include "zeroledge.h"
 #include "zlutil.h"
 #include "ledger.h"
+#include "incrstore.h"
 
 class LEPProcessor {
 
@@ -12,7 +13,7 @@ private:
 	int bits, bytes;
 	Big q;
 	ECn g, h, f;
-	unordered_map<string, IncrEntry> *incrData;
+	IncrStore *incrData;
 
 
 public: 
@@ -25,7 +26,7 @@ public:
 
 	// Constructor for the LEPProcessor object. Parameters are as above, with the addition of
 	// incrData:	a collection of incremental data generated along with a previous proof, indexed by account identifier.
-	LEPProcessor(Big q, ECn g, ECn h, ECn f, int workingbits, unordered_map<string, IncrEntry> *incrData);
+	LEPProcessor(Big q, ECn g, ECn h, ECn f, int workingbits, IncrStore *incrData);
 
 
 
@@ -33,6 +34,10 @@ public:
 	// commitments to each ledger entry. the LEPProcessor::genCommitment function implements that algorithm.
 	void genCommitment(LedgerEntry &e);
 
+	// Compute x'g for a ledger entry, which depends upon nothing but its identifier, so that the entries for the other
+	// assets of the same account (see LedgerEntry::shareId) need not compute it again in LEPProcessor::genCommitment.
+	void genIdCommitment(LedgerEntry &e);
+
 
 
 	// In the paper, Section Section VII-C (Ledger Commitments) specifies the algorithm for the the generation and
@@ -0,0 +1,971 @@
+#include "libzeroledge.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <fstream>
+#include <atomic>
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "zeroledge.h"
+#include "zlutil.h"
+#include "placement.h"
+#include "ledger.h"
+#include "lepprocessor.h"
+#include "lbpprocessor.h"
+#include "dbpprocessor.h"
+#include "proofreader.h"
+#include "proofwriter.h"
+#include "pipeline.h"
+#include "textcodec.h"
+#include "treehash.h"
+
+// The number of bytes of proof a verifier holds before zl_verifier_push waits for the workers.
+#define VERIFIER_BUFFER_BYTES (64 << 20)
+
+using namespace std;
+
+static pthread_once_t threadingOnce = PTHREAD_ONCE_INIT;
+
+static void initThreading() {
+	mr_init_threading();
+}
+
+// Convert an integer to a Big, exactly as it would be read from a ledger.
+static Big toBig(uint64_t value) {
+	char text[24];
+	Big x;
+	decodeDecimal(text, snprintf(text, sizeof(text), "%" PRIu64, value), x);
+	return x;
+}
+
+// Find the end of the lines which hold count items of n lines each, beginning at p, or NULL if they are not all complete.
+static const char * completeLines(const char *p, const char *end, size_t n) {
+	for (; n > 0; n--) {
+		p = static_cast<const char *>(memchr(p, '\n', end - p));
+		if (p == NULL) return NULL;
+		p++;
+	}
+	return p;
+}
+
+
+// SessionParameters holds the curve and bases used by a session. It belongs to the session's thread, and so must be
+// destroyed before that thread's MIRACL instance.
+typedef struct SessionParameters {
+	Big a, b, p, q;
+	int bits;
+	ECn g, h, f;
+} SessionParameters;
+
+// Read the curve and derive the bases from their seeds, exactly as the tools do, and set up the curve for the calling
+// thread.
+static bool loadParameters(const char *curve_source, const char *bases_source, SessionParameters &parameters) {
+	ifstream curve(curve_source);
+	if (curve.fail()) return false;
+
+	get_mip()->IOBASE=16;
+	Big x, y;
+	curve >> parameters.bits >> parameters.p >> parameters.a >> parameters.b >> parameters.q >> x >> y;
+	curve.close();
+
+	ecurve(parameters.a, parameters.b, parameters.p, MR_PROJECTIVE);
+
+	// Set up commitment bases as specified in Sections VII-A and IX-A of the paper
+	ifstream seedsource(bases_source);
+	if (seedsource.fail()) return false;
+
+	get_mip()->IOBASE=10;
+	Big gseed, hseed, fseed;
+	seedsource >> gseed >> hseed >> fseed;
+	seedsource.close();
+
+	while (! parameters.g.set(gseed, 0)) {
+		gseed += 1;
+	}
+	while (! parameters.h.set(hseed, 0)) {
+		hseed += 1;
+	}
+	while (! parameters.f.set(fseed, 0)) {
+		fseed += 1;
+	}
+
+	get_mip()->IOBASE=DATA_BASE;
+	return true;
+}
+
+
+// Session holds what the caller and a session's thread share. Everything but config and failed is guarded by lock, and
+// changed is broadcast whenever any of it changes: when the thread has started (with status saying whether it could), when
+// the caller has supplied input or is finishing, when the thread has consumed input, and when it has stopped. starving is
+// set while the thread waits for input, so that the caller never waits for the thread at the same time.
+typedef struct Session {
+	zl_config config;
+	string curvePath, basesPath;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	bool running, started, finishing, starving, stopped;
+	int status;
+	atomic<bool> failed;
+} Session;
+
+static void initSession(Session &session, const zl_config *config) {
+	session.config = *config;
+	session.curvePath = config->curve_path;
+	session.basesPath = config->bases_path;
+	if (session.config.threads <= 0) session.config.threads = availableProcessors();
+	if (session.config.pack_size <= 0) session.config.pack_size = ENTRIES_PER_PACK_DEFAULT;
+	pthread_mutex_init(&session.lock, NULL);
+	pthread_cond_init(&session.changed, NULL);
+	session.running = false;
+	session.started = false;
+	session.finishing = false;
+	session.starving = false;
+	session.stopped = false;
+	session.status = ZL_OK;
+	session.failed = false;
+}
+
+static void destroySession(Session &session) {
+	pthread_cond_destroy(&session.changed);
+	pthread_mutex_destroy(&session.lock);
+}
+
+// Start the session's thread, and wait until it has read its parameters. Returns the status with which it started.
+static int startSession(Session &session, void * (*run)(void *), void *owner) {
+	pthread_once(&threadingOnce, &initThreading);
+
+	if (pthread_create(&session.thread, NULL, run, owner) != 0) return ZL_ERROR_PARAMETERS;
+	session.running = true;
+
+	pthread_mutex_lock(&session.lock);
+	while (!session.started) pthread_cond_wait(&session.changed, &session.lock);
+	int status = session.status;
+	pthread_mutex_unlock(&session.lock);
+	return status;
+}
+
+// Called by the session's thread once it has started, or when it stops.
+static void setStarted(Session &session, int status) {
+	pthread_mutex_lock(&session.lock);
+	session.started = true;
+	session.status = status;
+	pthread_cond_broadcast(&session.changed);
+	pthread_mutex_unlock(&session.lock);
+}
+
+static void setStopped(Session &session, int status) {
+	pthread_mutex_lock(&session.lock);
+	session.stopped = true;
+	if (session.status == ZL_OK) session.status = status;
+	pthread_cond_broadcast(&session.changed);
+	pthread_mutex_unlock(&session.lock);
+}
+
+// Tell the session's thread that no more input is coming, and wait for it to exit. Returns its final status.
+static int finishSession(Session &session) {
+	pthread_mutex_lock(&session.lock);
+	session.finishing = true;
+	pthread_cond_broadcast(&session.changed);
+	pthread_mutex_unlock(&session.lock);
+
+	if (session.running) {
+		pthread_join(session.thread, NULL);
+		session.running = false;
+	}
+	return session.status;
+}
+
+// Wait, with the lock held, for the caller to supply input or finish.
+static void waitForInput(Session &session) {
+	session.starving = true;
+	pthread_cond_broadcast(&session.changed);
+	pthread_cond_wait(&session.changed, &session.lock);
+	session.starving = false;
+}
+
+
+extern "C" void zl_config_init(zl_config *config) {
+	config->curve_path = CURVE_SOURCE_DEFAULT;
+	config->bases_path = BASES_SOURCE_DEFAULT;
+	config->threads = 0;
+	config->pack_size = ENTRIES_PER_PACK_DEFAULT;
+	config->value_bits = BALANCE_BITS_DEFAULT;
+}
+
+extern "C" const char * zl_error_string(int error) {
+	switch (error) {
+		case ZL_OK:
+			return "success";
+		case ZL_ERROR_PARAMETERS:
+			return "curve or bases could not be read";
+		case ZL_ERROR_RANGE:
+			return "balance is out of range";
+		case ZL_ERROR_OUTPUT:
+			return "output was refused";
+		case ZL_ERROR_MALFORMED:
+			return "proof is malformed";
+		case ZL_ERROR_STATE:
+			return "session cannot accept this call";
+		default:
+			return "unknown error";
+	}
+}
+
+
+// A generator session runs a pipeline much like zlgenerate's (see zlgenerate.cpp), except that its reader takes groups of
+// entries queued by zl_generator_add, rather than reading them from a ledger. The caller fills a group at a time, and
+// queues it once it holds pack_size entries, waiting first if too many groups are already queued. The writer places each
+// group in the transcript, which passes it straight to the caller, and then passes on its openers.
+
+// GeneratorBatch is a group of entries, with the identifiers laid end to end.
+typedef struct GeneratorBatch {
+	string ids;
+	vector<size_t> idEnds;
+	vector<uint64_t> balances;
+} GeneratorBatch;
+
+struct zl_generator {
+	Session session;
+	uint64_t assets;
+	time_t proofTime;
+	zl_write_fn write;
+	void *writeUser;
+	zl_opener_fn opener;
+	void *openerUser;
+	GeneratorBatch current;
+	deque<GeneratorBatch> batches;
+	size_t maxBatches;
+	string digest;
+};
+
+typedef struct GeneratorContext {
+	zl_generator *generator;
+	SessionParameters *parameters;
+	ProofWriter *proof;
+	vector<Ledger> *partialLedgers;
+	int valueBits;
+	uint64_t nextEntry;
+} GeneratorContext;
+
+// GeneratorPack holds a single group of entries until its output has been passed on. The worker writes the entries into
+// proof, and the nonces of their openers into nonces, with the offset of each in entryOffsets and nonceOffsets.
+typedef struct GeneratorPack {
+	uint64_t first;
+	GeneratorBatch batch;
+	TextBuffer proof, nonces;
+	vector<uint64_t> entryOffsets;
+	vector<size_t> nonceOffsets;
+	vector<OutputRun> runs;
+} GeneratorPack;
+
+typedef struct GeneratorWorker {
+	Miracl *precision;
+	LEPProcessor *lepgen;
+	LBPProcessor *lbpgen;
+	Ledger *partialLedger;
+	LedgerEntry e;
+} GeneratorWorker;
+
+static void * newGeneratorPack(void* rawContext) {
+	GeneratorPack *pack = new GeneratorPack;
+	pack->first = 0;
+	return pack;
+}
+
+static void deleteGeneratorPack(void* rawContext, void* rawPack) {
+	delete static_cast<GeneratorPack*>(rawPack);
+}
+
+static bool readGeneratorPack(void* rawContext, void* rawPack) {
+	GeneratorContext &context = *(static_cast<GeneratorContext*>(rawContext));
+	GeneratorPack *pack = static_cast<GeneratorPack*>(rawPack);
+	zl_generator &generator = *context.generator;
+	Session &session = generator.session;
+
+	pthread_mutex_lock(&session.lock);
+	while (generator.batches.empty() && !session.finishing && !session.failed) waitForInput(session);
+	if (generator.batches.empty() || session.failed) {
+		pthread_mutex_unlock(&session.lock);
+		return false;
+	}
+	swap(pack->batch, generator.batches.front());
+	generator.batches.pop_front();
+	pthread_cond_broadcast(&session.changed);
+	pthread_mutex_unlock(&session.lock);
+
+	pack->first = context.nextEntry;
+	context.nextEntry += pack->batch.balances.size();
+	return true;
+}
+
+static void * beginGeneratorWorker(void* rawContext, int worker) {
+	GeneratorContext &context = *(static_cast<GeneratorContext*>(rawContext));
+	SessionParameters &parameters = *context.parameters;
+	GeneratorWorker *state = new GeneratorWorker;
+
+	// per-thread MIRACL setup
+	state->precision = newThreadMiracl();
+
+	irand(fetchRandomSeed());
+
+	ecurve(parameters.a, parameters.b, parameters.p, MR_PROJECTIVE);
+
+	// zl setup
+	state->lepgen = new LEPProcessor(parameters.q, parameters.g, parameters.h, parameters.f, parameters.bits);
+	state->lbpgen = new LBPProcessor(parameters.q, parameters.g, parameters.h, parameters.f, parameters.bits, context.valueBits);
+	state->partialLedger = &(*context.partialLedgers)[worker];
+
+	return state;
+}
+
+static void calcGeneratorPack(void* rawContext, void* rawWorker, void* rawPack) {
+	GeneratorContext &context = *(static_cast<GeneratorContext*>(rawContext));
+	GeneratorWorker *state = static_cast<GeneratorWorker*>(rawWorker);
+	GeneratorPack *pack = static_cast<GeneratorPack*>(rawPack);
+	GeneratorBatch &batch = pack->batch;
+	LedgerEntry &e = state->e;
+	size_t count = batch.balances.size(), idBegin = 0;
+
+	pack->proof.clear();
+	pack->nonces.clear();
+	pack->entryOffsets.resize(count);
+	pack->nonceOffsets.resize(count + 1);
+
+	for (size_t jj = 0; jj < count; jj++) {
+
+		e = LedgerEntry(batch.ids.substr(idBegin, batch.idEnds[jj] - idBegin), toBig(batch.balances[jj]), context.valueBits);
+		idBegin = batch.idEnds[jj];
+
+		state->lbpgen->genCommitments(e);
+		state->lbpgen->genProofs(e);
+
+		e.computeR();
+
+		state->lepgen->genCommitment(e);
+		state->lepgen->genProof(e);
+
+		state->partialLedger->addEntry(e);
+
+		pack->entryOffsets[jj] = pack->proof.size();
+		ProofWriter::putEntry(pack->proof, e);
+
+		if (context.generator->opener != NULL) {
+			pack->nonceOffsets[jj] = pack->nonces.size();
+			pack->nonces.putBig(e.r);
+		}
+
+	}
+
+	pack->nonceOffsets[count] = pack->nonces.size();
+}
+
+static void endGeneratorWorker(void* rawContext, void* rawWorker) {
+	GeneratorWorker *state = static_cast<GeneratorWorker*>(rawWorker);
+
+	// Everything allocated by this thread's MIRACL instance must be freed before the instance itself.
+	delete state->lepgen;
+	delete state->lbpgen;
+	state->e = LedgerEntry();
+	delete state->precision;
+	delete state;
+}
+
+// The transcript is not positional, so placing a group passes it to the caller at once, in order.
+static void writeGeneratorPack(void* rawContext, void* rawPack) {
+	GeneratorContext &context = *(static_cast<GeneratorContext*>(rawContext));
+	GeneratorPack *pack = static_cast<GeneratorPack*>(rawPack);
+	zl_generator &generator = *context.generator;
+	GeneratorBatch &batch = pack->batch;
+	size_t count = batch.balances.size();
+
+	context.proof->placeEntries(pack->first, pack->proof.data(), pack->proof.size(), &pack->entryOffsets[0], count, pack->runs);
+	OutputFile::writeRuns(pack->runs);
+
+	for (size_t jj = 0, idBegin = 0; generator.opener != NULL && !generator.session.failed && jj < count; jj++) {
+		zl_opener opener;
+		opener.index = pack->first + jj;
+		opener.id = batch.ids.data() + idBegin;
+		opener.id_length = batch.idEnds[jj] - idBegin;
+		opener.balance = batch.balances[jj];
+		opener.nonce = pack->nonces.data() + pack->nonceOffsets[jj];
+		opener.nonce_length = pack->nonceOffsets[jj + 1] - pack->nonceOffsets[jj];
+		idBegin = batch.idEnds[jj];
+
+		if (generator.opener(generator.openerUser, &opener) != 0) generator.session.failed = true;
+	}
+}
+
+static bool writeTranscript(void *user, const char *data, size_t length) {
+	zl_generator &generator = *(static_cast<zl_generator*>(user));
+
+	if (generator.session.failed || generator.write(generator.writeUser, data, length) != 0) {
+		generator.session.failed = true;
+		return false;
+	}
+	return true;
+}
+
+// Generate the proof on the session's thread: write the header, run the pipeline until the caller finishes, then sum the
+// partial ledgers, generate the difference bits, and write the footer, just as zlgenerate does.
+static void generateProof(zl_generator &generator) {
+	Session &session = generator.session;
+	zl_config &config = session.config;
+	SessionParameters parameters;
+
+	if (!loadParameters(session.curvePath.c_str(), session.basesPath.c_str(), parameters)) {
+		setStarted(session, ZL_ERROR_PARAMETERS);
+		return;
+	}
+	setStarted(session, ZL_OK);
+
+	Big assets = toBig(generator.assets);
+	ProofWriter proof;
+	proof.openSink(&writeTranscript, &generator);
+	proof.writeHeader(assets, generator.proofTime, config.value_bits, parameters.g, parameters.h, parameters.f);
+
+	vector<Ledger> partialLedgers(config.threads, Ledger(parameters.g, parameters.h, parameters.f, config.value_bits));
+
+	GeneratorContext context;
+	context.generator = &generator;
+	context.parameters = &parameters;
+	context.proof = &proof;
+	context.partialLedgers = &partialLedgers;
+	context.valueBits = config.value_bits;
+	context.nextEntry = 0;
+
+	PipelineStages stages;
+	stages.context = static_cast<void*>(&context);
+	stages.newPack = &newGeneratorPack;
+	stages.deletePack = &deleteGeneratorPack;
+	stages.read = &readGeneratorPack;
+	stages.beginWorker = &beginGeneratorWorker;
+	stages.work = &calcGeneratorPack;
+	stages.endWorker = &endGeneratorWorker;
+	stages.write = &writeGeneratorPack;
+	stages.flush = NULL;
+
+	Pipeline pipeline(stages, config.threads, 2 * config.threads + 1);
+	pipeline.run();
+
+	Ledger finalLedger(parameters.g, parameters.h, parameters.f, config.value_bits);
+	for (int ii = 0; ii < config.threads; ii++) {
+		finalLedger.appendLedger(partialLedgers[ii]);
+	}
+	finalLedger.totalAssets = assets;
+	finalLedger.computeSums();
+
+	DBPProcessor dbpgen(parameters.q, parameters.g, parameters.h, parameters.f, parameters.bits, config.value_bits);
+	dbpgen.genParallel(finalLedger, parameters.a, parameters.b, parameters.p, config.threads);
+
+	finalLedger.generateCommitments();
+
+	bool ok = proof.writeFooter(finalLedger) && !session.failed;
+	generator.digest = proof.digest;
+	setStopped(session, ok ? ZL_OK : ZL_ERROR_OUTPUT);
+}
+
+static void * runGenerator(void *rawGenerator) {
+	zl_generator *generator = static_cast<zl_generator*>(rawGenerator);
+
+	// MIRACL setup for the session's thread
+	Miracl *precision = newThreadMiracl();
+	irand(fetchRandomSeed());
+
+	generateProof(*generator);
+
+	delete precision;
+	return NULL;
+}
+
+extern "C" zl_generator * zl_generator_new(const zl_config *config, uint64_t assets, int64_t proof_time, zl_write_fn write, void *write_user, zl_opener_fn opener, void *opener_user) {
+	if (config == NULL || write == NULL || config->value_bits <= 0) return NULL;
+
+	zl_generator *generator = new zl_generator;
+	initSession(generator->session, config);
+	generator->assets = assets;
+	generator->proofTime = (proof_time != 0) ? proof_time : time(0);
+	generator->write = write;
+	generator->writeUser = write_user;
+	generator->opener = opener;
+	generator->openerUser = opener_user;
+	generator->maxBatches = 2 * generator->session.config.threads + 1;
+
+	if (startSession(generator->session, &runGenerator, generator) != ZL_OK) {
+		zl_generator_free(generator);
+		return NULL;
+	}
+	return generator;
+}
+
+extern "C" int zl_generator_add(zl_generator *generator, const char *id, size_t id_length, uint64_t balance) {
+	Session &session = generator->session;
+	GeneratorBatch &batch = generator->current;
+	int status = ZL_OK;
+
+	if (session.finishing) return ZL_ERROR_STATE;
+	if (session.failed) return ZL_ERROR_OUTPUT;
+	if (session.config.value_bits < 64 && (balance >> session.config.value_bits) != 0) return ZL_ERROR_RANGE;
+
+	batch.ids.append(id, id_length);
+	batch.idEnds.push_back(batch.ids.size());
+	batch.balances.push_back(balance);
+	if (batch.balances.size() < (size_t) session.config.pack_size) return ZL_OK;
+
+	pthread_mutex_lock(&session.lock);
+	while (generator->batches.size() >= generator->maxBatches && !session.starving && !session.stopped) {
+		pthread_cond_wait(&session.changed, &session.lock);
+	}
+	if (session.stopped) {
+		status = ZL_ERROR_OUTPUT;
+	} else {
+		generator->batches.push_back(GeneratorBatch());
+		swap(generator->batches.back(), batch);
+		pthread_cond_broadcast(&session.changed);
+	}
+	pthread_mutex_unlock(&session.lock);
+
+	return status;
+}
+
+extern "C" int zl_generator_finish(zl_generator *generator, char *digest) {
+	Session &session = generator->session;
+	if (session.finishing) return ZL_ERROR_STATE;
+
+	pthread_mutex_lock(&session.lock);
+	if (!generator->current.balances.empty()) {
+		generator->batches.push_back(GeneratorBatch());
+		swap(generator->batches.back(), generator->current);
+	}
+	pthread_mutex_unlock(&session.lock);
+
+	int status = finishSession(session);
+	if (digest != NULL) snprintf(digest, ZL_DIGEST_HEX_BYTES, "%s", (status == ZL_OK) ? generator->digest.c_str() : "");
+	return status;
+}
+
+extern "C" void zl_generator_free(zl_generator *generator) {
+	if (generator == NULL) return;
+	finishSession(generator->session);
+	destroySession(generator->session);
+	delete generator;
+}
+
+
+// A verifier session reads the proof as it is pushed, much as zlverify reads it from stdin, except that each group of
+// entries is handed to the workers as soon as all of it has arrived (see calcPack in zlverify.cpp), so that verification
+// proceeds while the rest of the proof is still being received. The header is read once it is complete, and the
+// difference bit section, which follows the last entry, once the caller finishes. The digest of the transcript is
+// computed as it is pushed.
+
+typedef struct VerifierKnown {
+	string id;
+	uint64_t balance;
+	string nonce;
+} VerifierKnown;
+
+struct zl_verifier {
+	Session session;
+	unordered_map<uint64_t, VerifierKnown> known;
+	bool pushed;
+	string input;
+	size_t consumed;
+	uint64_t inputLength;
+	TreeHash digest;
+	zl_result result;
+};
+
+typedef struct VerifierContext {
+	zl_verifier *verifier;
+	SessionParameters *parameters;
+	ProofReader *reader;
+	int packSize;
+	size_t entryLines;
+	uint64_t nextEntry;
+	bool rooted, entriesDone;
+	vector<Ledger> *partialLedgers;
+	vector<char> *entryLeaves;
+	vector<uint64_t> correctCounts, validCounts, lbpValidCounts, equivalencyCounts;
+} VerifierContext;
+
+// VerifierPack holds the text of a group of consecutive entries, and the leaves of the entry tree for them, if the proof
+// is rooted.
+typedef struct VerifierPack {
+	uint64_t first;
+	int count;
+	string text;
+	vector<char> leaves;
+} VerifierPack;
+
+typedef struct VerifierWorker {
+	int worker;
+	Miracl *precision;
+	LEPProcessor *lepgen;
+	LBPProcessor *lbpgen;
+	LedgerEntry e;
+	uint64_t correctCount, validCount, lbpValidCount, equivalencyCount;
+} VerifierWorker;
+
+// Find the end of the proof header at p: the line which begins the proof, a separator, the labelled lines, another separator,
+// and the three bases. Returns NULL if it has not all arrived. A header which never reaches its second separator is cut
+// short, so that it fails to parse instead.
+static const char * headerEnd(const char *p, const char *end) {
+	int separators = 0;
+
+	for (int lines = 0; separators < 2 && lines < 16; lines++) {
+		const char *eol = completeLines(p, end, 1);
+		if (eol == NULL) return NULL;
+		if (*p == '=') separators++;
+		p = eol;
+	}
+
+	return (separators < 2) ? p : completeLines(p, end, 6);
+}
+
+static void * newVerifierPack(void* rawContext) {
+	VerifierPack *pack = new VerifierPack;
+	pack->first = 0;
+	pack->count = 0;
+	return pack;
+}
+
+static void deleteVerifierPack(void* rawContext, void* rawPack) {
+	delete static_cast<VerifierPack*>(rawPack);
+}
+
+// Take the next pack_size entries which have been pushed, or fewer once the entries are over or the caller has finished.
+// The entries are over when a separator begins where an entry would.
+static bool readVerifierPack(void* rawContext, void* rawPack) {
+	VerifierContext &context = *(static_cast<VerifierContext*>(rawContext));
+	VerifierPack *pack = static_cast<VerifierPack*>(rawPack);
+	zl_verifier &verifier = *context.verifier;
+	Session &session = verifier.session;
+	const char *begin, *end, *p, *next;
+	int count;
+
+	pthread_mutex_lock(&session.lock);
+	while (true) {
+		begin = verifier.input.data() + verifier.consumed;
+		end = verifier.input.data() + verifier.input.size();
+		for (p = begin, count = 0; count < context.packSize && p < end && *p != '='; p = next, count++) {
+			next = completeLines(p, end, context.entryLines);
+			if (next == NULL) break;
+		}
+		context.entriesDone = p < end && *p == '=';
+		if (count == context.packSize || context.entriesDone || session.finishing) break;
+		waitForInput(session);
+	}
+
+	if (count > 0) {
+		pack->text.assign(begin, p - begin);
+		pack->first = context.nextEntry;
+		pack->count = count;
+		context.nextEntry += count;
+		verifier.consumed += p - begin;
+
+		// Drop what has been consumed once it is the greater part of the buffer.
+		if (verifier.consumed > verifier.input.size() / 2) {
+			verifier.input.erase(0, verifier.consumed);
+			verifier.consumed = 0;
+		}
+		pthread_cond_broadcast(&session.changed);
+	}
+	pthread_mutex_unlock(&session.lock);
+
+	return count > 0;
+}
+
+static void * beginVerifierWorker(void* rawContext, int worker) {
+	VerifierContext &context = *(static_cast<VerifierContext*>(rawContext));
+	SessionParameters &parameters = *context.parameters;
+	ProofReader &reader = *context.reader;
+	VerifierWorker *state = new VerifierWorker;
+	state->worker = worker;
+	state->correctCount = 0;
+	state->validCount = 0;
+	state->lbpValidCount = 0;
+	state->equivalencyCount = 0;
+
+	// per-thread MIRACL setup
+	state->precision = newThreadMiracl();
+
+	ecurve(parameters.a, parameters.b, parameters.p, MR_PROJECTIVE);
+
+	// zl setup
+	state->lepgen = new LEPProcessor(parameters.q, reader.g, reader.h, reader.f, parameters.bits);
+	state->lbpgen = new LBPProcessor(parameters.q, reader.g, reader.h, reader.f, parameters.bits, reader.valueBits);
+
+	get_mip()->IOBASE=DATA_BASE;
+
+	return state;
+}
+
+static void calcVerifierPack(void* rawContext, void* rawWorker, void* rawPack) {
+	VerifierContext &context = *(static_cast<VerifierContext*>(rawContext));
+	VerifierWorker *state = static_cast<VerifierWorker*>(rawWorker);
+	VerifierPack *pack = static_cast<VerifierPack*>(rawPack);
+	unordered_map<uint64_t, VerifierKnown> &known = context.verifier->known;
+	unordered_map<uint64_t, VerifierKnown>::iterator k;
+	Ledger &l = (*context.partialLedgers)[state->worker];
+	LedgerEntry &e = state->e;
+	const char *cursor = pack->text.data(), *end = pack->text.data() + pack->text.size(), *entryBegin;
+	Big r;
+
+	if (context.rooted) pack->leaves.resize(pack->count * TREE_HASH_DIGEST_BYTES);
+
+	for (int jj = 0; jj < pack->count; jj++) {
+
+		entryBegin = cursor;
+		cursor = context.reader->readEntry(cursor, end, e, *state->lepgen, *state->lbpgen);
+
+		if (context.rooted) hashEntryLeaf(pack->first + jj, entryBegin, cursor - entryBegin, &pack->leaves[jj * TREE_HASH_DIGEST_BYTES]);
+
+		if (state->lepgen->verifyProof(e)) state->validCount++;
+		if (state->lbpgen->verifyProofs(e)) state->lbpValidCount++;
+		if (e.verifyCommitmentEquivilancy()) state->equivalencyCount++;
+
+		if ((k = known.find(pack->first + jj)) != known.end()) {
+			decodeBig(k->second.nonce.data(), k->second.nonce.size(), r);
+			e.setId(k->second.id);
+			e.setBalance(toBig(k->second.balance));
+			e.setR(r);
+			if (e.verifyKnownValues(context.parameters->g, context.parameters->h, context.parameters->f)) state->correctCount++;
+		}
+
+		l.addEntry(e);
+
+	}
+}
+
+static void endVerifierWorker(void* rawContext, void* rawWorker) {
+	VerifierContext &context = *(static_cast<VerifierContext*>(rawContext));
+	VerifierWorker *state = static_cast<VerifierWorker*>(rawWorker);
+
+	context.correctCounts[state->worker] = state->correctCount;
+	context.validCounts[state->worker] = state->validCount;
+	context.lbpValidCounts[state->worker] = state->lbpValidCount;
+	context.equivalencyCounts[state->worker] = state->equivalencyCount;
+
+	// Everything allocated by this thread's MIRACL instance must be freed before the instance itself.
+	delete state->lepgen;
+	delete state->lbpgen;
+	state->e = LedgerEntry();
+	delete state->precision;
+	delete state;
+}
+
+// The leaves of the entry tree are gathered in order.
+static void writeVerifierPack(void* rawContext, void* rawPack) {
+	VerifierContext &context = *(static_cast<VerifierContext*>(rawContext));
+	VerifierPack *pack = static_cast<VerifierPack*>(rawPack);
+
+	if (context.rooted) context.entryLeaves->insert(context.entryLeaves->end(), pack->leaves.begin(), pack->leaves.end());
+}
+
+// Verify the proof on the session's thread, performing the same checks as zlverify, and store the outcome in the result.
+// Returns false if the proof could not be read.
+static bool verifyProof(zl_verifier &verifier) {
+	Session &session = verifier.session;
+	zl_config &config = session.config;
+	SessionParameters parameters;
+
+	if (!loadParameters(session.curvePath.c_str(), session.basesPath.c_str(), parameters)) {
+		setStarted(session, ZL_ERROR_PARAMETERS);
+		return false;
+	}
+	setStarted(session, ZL_OK);
+
+	// Wait for the whole header, and read it from a copy of its own, since the buffer moves as the proof is pushed.
+	string header;
+	const char *p;
+	pthread_mutex_lock(&session.lock);
+	while ((p = headerEnd(verifier.input.data(), verifier.input.data() + verifier.input.size())) == NULL && !session.finishing) {
+		waitForInput(session);
+	}
+	if (p != NULL) {
+		header.assign(verifier.input.data(), p);
+		verifier.consumed = header.size();
+	}
+	pthread_mutex_unlock(&session.lock);
+
+	ProofReader reader;
+	if (p == NULL || !reader.readHeader(header.data(), header.size()) || reader.manifest) return false;
+
+	vector<Ledger> partialLedgers(config.threads, Ledger(reader.g, reader.h, reader.f, reader.valueBits));
+	vector<char> entryLeaves;
+
+	VerifierContext context;
+	context.verifier = &verifier;
+	context.parameters = &parameters;
+	context.reader = &reader;
+	context.packSize = config.pack_size;
+	context.entryLines = reader.entryLines();
+	context.nextEntry = 0;
+	context.rooted = !reader.entriesRoot.empty();
+	context.entriesDone = false;
+	context.partialLedgers = &partialLedgers;
+	context.entryLeaves = &entryLeaves;
+	context.correctCounts.resize(config.threads, 0);
+	context.validCounts.resize(config.threads, 0);
+	context.lbpValidCounts.resize(config.threads, 0);
+	context.equivalencyCounts.resize(config.threads, 0);
+
+	PipelineStages stages;
+	stages.context = static_cast<void*>(&context);
+	stages.newPack = &newVerifierPack;
+	stages.deletePack = &deleteVerifierPack;
+	stages.read = &readVerifierPack;
+	stages.beginWorker = &beginVerifierWorker;
+	stages.work = &calcVerifierPack;
+	stages.endWorker = &endVerifierWorker;
+	stages.write = &writeVerifierPack;
+	stages.flush = NULL;
+
+	Pipeline pipeline(stages, config.threads, 2 * config.threads + 1);
+	pipeline.run();
+
+	if (!context.entriesDone) return false;
+
+	// The difference bit section follows the separator after the last entry, and is read once the caller has finished.
+	pthread_mutex_lock(&session.lock);
+	while (!session.finishing) waitForInput(session);
+	pthread_mutex_unlock(&session.lock);
+
+	const char *end = verifier.input.data() + verifier.input.size();
+	reader.differenceBegin = skipLines(verifier.input.data() + verifier.consumed, end, 1);	// ====================
+	reader.end = end;
+	p = completeLines(reader.differenceBegin, end, PROOF_BIT_LINES * reader.valueBits + 1);
+	if (p == NULL || p[-2] != '=' || end - p < 19 || strncmp(p, "END ZEROLEDGE PROOF", 19) != 0) return false;
+
+	Ledger l(reader.g, reader.h, reader.f, reader.valueBits);
+	l.totalAssets = reader.assets;
+
+	uint64_t entryCount = context.nextEntry, correctCount = 0, validCount = 0, lbpValidCount = 0, equivalencyCount = 0;
+	for (int ii = 0; ii < config.threads; ii++) {
+		l.appendLedger(partialLedgers[ii]);
+		correctCount += context.correctCounts[ii];
+		validCount += context.validCounts[ii];
+		lbpValidCount += context.lbpValidCounts[ii];
+		equivalencyCount += context.equivalencyCounts[ii];
+	}
+
+	char digest[TREE_HASH_DIGEST_BYTES];
+	bool entriesRootValidated = true;
+	if (context.rooted) {
+		hashTreeRoot(entryLeaves.empty() ? NULL : &entryLeaves[0], entryCount, digest);
+		entriesRootValidated = toHex(digest, sizeof(digest)) == reader.entriesRoot;
+	}
+
+	l.generateCommitments();
+
+	DBPProcessor dbpgen(parameters.q, reader.g, reader.h, reader.f, parameters.bits, reader.valueBits);
+	reader.readDifferenceBits(l, dbpgen);
+
+	zl_result &result = verifier.result;
+	result.entry_count = entryCount;
+	result.known_count = correctCount;
+	result.proof_time = reader.proofTime;
+	result.bases = parameters.g == reader.g && parameters.h == reader.h && parameters.f == reader.f;
+	result.known_entries = correctCount == verifier.known.size();
+	result.entry_tree = entriesRootValidated;
+	result.entry_proofs = validCount == entryCount;
+	result.bit_proofs = lbpValidCount == entryCount;
+	result.commitment_equivalency = equivalencyCount == entryCount;
+	result.difference_bit_proofs = dbpgen.verifyProofs(l);
+	result.total_equivalency = l.verifyCommitmentEquivilancy();
+	result.valid = result.bases && result.known_entries && result.entry_tree && result.entry_proofs && result.bit_proofs
+		&& result.commitment_equivalency && result.difference_bit_proofs && result.total_equivalency;
+
+	verifier.digest.finish(verifier.inputLength, digest);
+	snprintf(result.digest, sizeof(result.digest), "%s", toHex(digest, sizeof(digest)).c_str());
+
+	return true;
+}
+
+static void * runVerifier(void *rawVerifier) {
+	zl_verifier *verifier = static_cast<zl_verifier*>(rawVerifier);
+
+	// MIRACL setup for the session's thread
+	Miracl *precision = newThreadMiracl();
+
+	bool ok = verifyProof(*verifier);
+	setStopped(verifier->session, ok ? ZL_OK : ZL_ERROR_MALFORMED);
+
+	delete precision;
+	return NULL;
+}
+
+extern "C" zl_verifier * zl_verifier_new(const zl_config *config) {
+	if (config == NULL) return NULL;
+
+	zl_verifier *verifier = new zl_verifier;
+	initSession(verifier->session, config);
+	verifier->pushed = false;
+	verifier->consumed = 0;
+	verifier->inputLength = 0;
+	memset(&verifier->result, 0, sizeof(verifier->result));
+
+	if (startSession(verifier->session, &runVerifier, verifier) != ZL_OK) {
+		zl_verifier_free(verifier);
+		return NULL;
+	}
+	return verifier;
+}
+
+extern "C" int zl_verifier_known(zl_verifier *verifier, uint64_t index, const char *id, size_t id_length, uint64_t balance, const char *nonce, size_t nonce_length) {
+	if (verifier->pushed || verifier->session.finishing) return ZL_ERROR_STATE;
+
+	VerifierKnown &k = verifier->known[index];
+	k.id.assign(id, id_length);
+	k.balance = balance;
+	k.nonce.assign(nonce, nonce_length);
+	return ZL_OK;
+}
+
+extern "C" int zl_verifier_push(zl_verifier *verifier, const char *data, size_t length) {
+	Session &session = verifier->session;
+	int status = ZL_OK;
+
+	if (session.finishing) return ZL_ERROR_STATE;
+
+	// Only the caller changes the length pushed, so the digest need not be updated under the lock.
+	verifier->digest.add(verifier->inputLength, data, length);
+	verifier->inputLength += length;
+	verifier->pushed = true;
+
+	pthread_mutex_lock(&session.lock);
+	while (verifier->input.size() - verifier->consumed > VERIFIER_BUFFER_BYTES && !session.starving && !session.stopped) {
+		pthread_cond_wait(&session.changed, &session.lock);
+	}
+	if (session.stopped) {
+		status = (session.status != ZL_OK) ? session.status : ZL_ERROR_MALFORMED;
+	} else {
+		verifier->input.append(data, length);
+		pthread_cond_broadcast(&session.changed);
+	}
+	pthread_mutex_unlock(&session.lock);
+
+	return status;
+}
+
+extern "C" int zl_verifier_finish(zl_verifier *verifier, zl_result *result) {
+	if (verifier->session.finishing) return ZL_ERROR_STATE;
+
+	int status = finishSession(verifier->session);
+	if (status != ZL_OK) memset(&verifier->result, 0, sizeof(verifier->result));
+	if (result != NULL) *result = verifier->result;
+	return status;
+}
+
+extern "C" void zl_verifier_free(zl_verifier *verifier) {
+	if (verifier == NULL) return;
+	finishSession(verifier->session);
+	destroySession(verifier->session);
+	delete verifier;
+}
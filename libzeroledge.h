@@ -0,0 +1,127 @@
+#ifndef LIBZEROLEDGE_H
+#define LIBZEROLEDGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// libzeroledge exposes the proof generator and verifier to other programs through a C interface, so that a ledger held in
+// memory can be proven, and a proof held in memory verified, without writing either to a file or starting zlgenerate or
+// zlverify. The interface is stable: its types and functions change only along with ZL_API_VERSION.
+//
+// Work is done in sessions. Each session runs on a thread of its own, with its own MIRACL instance, and divides its work
+// among a pipeline of workers (see pipeline.h) exactly as the tools do, so the caller never needs to set up MIRACL itself.
+// The functions of a single session must not be called concurrently, but any number of sessions may run at once.
+
+#define ZL_API_VERSION 1
+
+// The length of a digest in hexadecimal, including its terminating null.
+#define ZL_DIGEST_HEX_BYTES 65
+
+#define ZL_OK 0
+#define ZL_ERROR_PARAMETERS -1	// the curve or bases could not be read
+#define ZL_ERROR_RANGE -2		// a balance does not fit in the number of bits allowed
+#define ZL_ERROR_OUTPUT -3		// a callback refused the output
+#define ZL_ERROR_MALFORMED -4	// the proof is malformed, incomplete, or sharded
+#define ZL_ERROR_STATE -5		// the session has finished, or has begun reading the proof
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// zl_config holds the parameters shared by every session. zl_config_init sets the same defaults the tools use; threads is
+// the number of workers (zero for one per processor available to the process), and pack_size the number of entries each is given at a time.
+typedef struct zl_config {
+	const char *curve_path;
+	const char *bases_path;
+	int threads;
+	int pack_size;
+	int value_bits;
+} zl_config;
+
+void zl_config_init(zl_config *config);
+
+// Describe an error code returned by any of the functions below.
+const char * zl_error_string(int error);
+
+
+// zl_opener is the opener of a single entry, exactly as it appears in the entries export written by zlgenerate -e: the
+// index of the entry, its account and balance, and its nonce in base 64. The fields are valid only during the callback.
+typedef struct zl_opener {
+	uint64_t index;
+	const char *id;
+	size_t id_length;
+	uint64_t balance;
+	const char *nonce;
+	size_t nonce_length;
+} zl_opener;
+
+// Callbacks return zero to accept their data, and anything else to refuse it, in which case the session fails with
+// ZL_ERROR_OUTPUT. They are called from a thread belonging to the session, one at a time, in order.
+typedef int (*zl_write_fn)(void *user, const char *data, size_t length);
+typedef int (*zl_opener_fn)(void *user, const zl_opener *opener);
+
+typedef struct zl_generator zl_generator;
+
+// Begin generating a proof of assets, at proof_time (or now, if it is zero). The transcript is passed to write as it is
+// produced, as a monolithic proof identical in layout to one written by zlgenerate: its header at once, each group of
+// entries as soon as it and every group before it have been generated, and the difference bits when the session
+// finishes. opener, if it is not NULL, is passed the opener of each entry, in order. Returns NULL if the curve or bases
+// cannot be read.
+zl_generator * zl_generator_new(const zl_config *config, uint64_t assets, int64_t proof_time, zl_write_fn write, void *write_user, zl_opener_fn opener, void *opener_user);
+
+// Add an entry to the ledger. The entry is copied, and generated in the background; once enough entries are waiting, this
+// waits for the workers to catch up.
+int zl_generator_add(zl_generator *generator, const char *id, size_t id_length, uint64_t balance);
+
+// Generate the remaining entries and the difference bits, and finish the transcript. If digest is not NULL, it receives
+// the digest of the transcript in hexadecimal, as printed by zlverify, and must hold ZL_DIGEST_HEX_BYTES characters.
+int zl_generator_finish(zl_generator *generator, char *digest);
+
+// Free the session, finishing it first if necessary.
+void zl_generator_free(zl_generator *generator);
+
+
+// zl_result reports the outcome of each of the checks zlverify performs, each of which is nonzero if it passed; valid is
+// set only if all of them did. entry_tree is set if the proof is not rooted, and known_entries if no entries were known.
+typedef struct zl_result {
+	uint64_t entry_count;
+	uint64_t known_count;
+	int64_t proof_time;
+	int bases;
+	int known_entries;
+	int entry_tree;
+	int entry_proofs;
+	int bit_proofs;
+	int commitment_equivalency;
+	int difference_bit_proofs;
+	int total_equivalency;
+	int valid;
+	char digest[ZL_DIGEST_HEX_BYTES];
+} zl_result;
+
+typedef struct zl_verifier zl_verifier;
+
+// Begin verifying a proof, which is then passed to zl_verifier_push in pieces of any size. Only monolithic proofs can be
+// verified this way. Returns NULL if the curve or bases cannot be read.
+zl_verifier * zl_verifier_new(const zl_config *config);
+
+// Check the entry at index against the given opener, as zlverify -k does. Every known entry must be given before the
+// proof is pushed.
+int zl_verifier_known(zl_verifier *verifier, uint64_t index, const char *id, size_t id_length, uint64_t balance, const char *nonce, size_t nonce_length);
+
+// Pass the next length bytes of the proof. The data is copied, and each entry is verified as soon as all of it has been
+// pushed; once enough entries are waiting, this waits for the workers to catch up.
+int zl_verifier_push(zl_verifier *verifier, const char *data, size_t length);
+
+// Verify the remainder of the proof, and store the outcome in result. Returns ZL_ERROR_MALFORMED, with result cleared, if
+// the proof could not be read.
+int zl_verifier_finish(zl_verifier *verifier, zl_result *result);
+
+// Free the session, finishing it first if necessary.
+void zl_verifier_free(zl_verifier *verifier);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
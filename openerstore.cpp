@@ -0,0 +1,252 @@
+#include "openerstore.h"
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// The digest and entry index, then the leaf of the entry tree; the balance and nonce follow.
+#define OPENER_RECORD_LEAF (OPENER_STORE_ID_BYTES + sizeof(uint64_t))
+#define OPENER_RECORD_FIELDS (OPENER_RECORD_LEAF + TREE_HASH_DIGEST_BYTES)
+
+OpenerStore::OpenerStore() {
+	this->fd = -1;
+	this->failed = false;
+	this->file.data = NULL;
+	this->file.length = 0;
+	this->file.mapped = false;
+	this->records = NULL;
+	this->table = NULL;
+	this->tree = NULL;
+	this->fieldBytes = 0;
+	this->proofTime = 0;
+	this->recordSize = 0;
+	this->recordCount = 0;
+	this->tableSize = 0;
+	memset(this->root, 0, sizeof(this->root));
+}
+
+OpenerStore::~OpenerStore() {
+	this->close();
+}
+
+uint64_t OpenerStore::tableSlot(const char *digest) {
+	uint64_t slot;
+	memcpy(&slot, digest, sizeof(slot));
+	return slot;
+}
+
+void OpenerStore::locateLevels() {
+	uint64_t offset = 0;
+
+	// Each level holds half as many nodes as the one below it, rounded up, since a node left over is carried up unchanged.
+	this->levelOffsets.clear();
+	for (uint64_t count = this->recordCount; count > 1; count = (count + 1) / 2) {
+		this->levelOffsets.push_back(offset);
+		offset += ((count + 1) / 2) * TREE_HASH_DIGEST_BYTES;
+	}
+	this->levelOffsets.push_back(offset);
+}
+
+// Return the node at position within level of the entry tree, where level zero holds the leaves.
+const char * OpenerStore::treeNode(int level, uint64_t position) {
+	if (level == 0) return this->records + position * this->recordSize + OPENER_RECORD_LEAF;
+	return this->tree + this->levelOffsets[level - 1] + position * TREE_HASH_DIGEST_BYTES;
+}
+
+bool OpenerStore::create(const char *path, Big q, int workingbits, time_t proofTime, bool resume) {
+	this->fd = ::open(path, O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+	this->failed = false;
+	this->q = q;
+	this->fieldBytes = workingbits / 8;
+	this->proofTime = proofTime;
+
+	// The fixed fields, then the balance and nonce, rounded up so that every record is aligned.
+	this->recordSize = (OPENER_RECORD_FIELDS + 2 * this->fieldBytes + 7) & ~((uint64_t) 7);
+	return this->fd >= 0;
+}
+
+bool OpenerStore::isOpen() {
+	return this->fd >= 0 || this->file.data != NULL;
+}
+
+bool OpenerStore::sync() {
+	return this->fd < 0 || (!this->failed && fdatasync(this->fd) == 0);
+}
+
+void OpenerStore::setEntries(uint64_t first, LedgerEntry *e, const char *leaves, int count) {
+	if (this->fd < 0) return;
+
+	vector<char> buffer(count * this->recordSize, 0);
+	uint64_t index;
+	char *p;
+
+	for (int ii = 0; ii < count; ii++) {
+		p = &buffer[ii * this->recordSize];
+		index = first + ii;
+
+		zldigest(e[ii].id.c_str(), e[ii].id.length(), p);
+		memcpy(p + OPENER_STORE_ID_BYTES, &index, sizeof(index));
+		memcpy(p + OPENER_RECORD_LEAF, leaves + ii * TREE_HASH_DIGEST_BYTES, TREE_HASH_DIGEST_BYTES);
+		p += OPENER_RECORD_FIELDS;
+
+		to_binary(e[ii].balance, this->fieldBytes, p, true);
+		to_binary(e[ii].r % this->q, this->fieldBytes, p + this->fieldBytes, true);
+	}
+
+	if (pwrite(this->fd, &buffer[0], buffer.size(), sizeof(OpenerStoreHeader) + first * this->recordSize) != (ssize_t) buffer.size()) {
+		this->failed = true;
+	}
+}
+
+bool OpenerStore::finish(uint64_t recordCount) {
+	if (this->fd < 0) return false;
+
+	// As with the binary incremental data, the table is kept at most half full, so that probe sequences remain short.
+	this->recordCount = recordCount;
+	this->tableSize = 1;
+	while (this->tableSize < 2 * recordCount) this->tableSize <<= 1;
+
+	OpenerStoreHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OPENER_STORE_MAGIC, sizeof(header.magic));
+	header.fieldBytes = this->fieldBytes;
+	header.proofTime = this->proofTime;
+	header.recordSize = this->recordSize;
+	header.recordCount = recordCount;
+	header.tableSize = this->tableSize;
+	header.tableOffset = sizeof(OpenerStoreHeader) + recordCount * this->recordSize;
+	header.treeOffset = header.tableOffset + this->tableSize * sizeof(uint64_t);
+
+	this->locateLevels();
+	size_t length = header.treeOffset + this->levelOffsets.back();
+	bool ok = !this->failed && ftruncate(this->fd, length) == 0;
+
+	// Read the digests back from the records in place, rather than holding them in memory while the proof is generated.
+	char *data = ok ? (char *) mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0) : (char *) MAP_FAILED;
+	ok &= data != MAP_FAILED;
+
+	if (ok) {
+		const char *records = data + sizeof(OpenerStoreHeader);
+		uint64_t *slots = reinterpret_cast<uint64_t *>(data + header.tableOffset);
+		uint64_t mask = this->tableSize - 1;
+
+		for (uint64_t ii = 0; ii < recordCount; ii++) {
+			uint64_t slot = tableSlot(records + ii * this->recordSize) & mask;
+			while (slots[slot] != 0) slot = (slot + 1) & mask;
+			slots[slot] = ii + 1;
+		}
+
+		// Build the entry tree a level at a time, exactly as hashTreeRoot would, but keeping every level.
+		this->records = records;
+		this->tree = data + header.treeOffset;
+		char *tree = data + header.treeOffset;
+		uint64_t count = recordCount;
+
+		for (int level = 0; count > 1; level++, count = (count + 1) / 2) {
+			for (uint64_t ii = 0; ii < count; ii += 2) {
+				char *parent = tree + this->levelOffsets[level] + (ii / 2) * TREE_HASH_DIGEST_BYTES;
+				if (ii + 1 < count) {
+					hashTreeNode(this->treeNode(level, ii), this->treeNode(level, ii + 1), parent);
+				} else {
+					memcpy(parent, this->treeNode(level, ii), TREE_HASH_DIGEST_BYTES);
+				}
+			}
+		}
+
+		if (recordCount > 0) {
+			memcpy(this->root, this->treeNode(this->levelOffsets.size() - 1, 0), TREE_HASH_DIGEST_BYTES);
+		}
+		memcpy(header.root, this->root, sizeof(header.root));
+		this->records = NULL;
+		this->tree = NULL;
+
+		memcpy(data, &header, sizeof(header));
+		ok &= munmap(data, length) == 0;
+	}
+
+	return ok;
+}
+
+bool OpenerStore::open(const char *path) {
+	if (!mapFile(path, this->file)) return false;
+
+	const OpenerStoreHeader *header = reinterpret_cast<const OpenerStoreHeader *>(this->file.data);
+	if (this->file.length < sizeof(OpenerStoreHeader) || memcmp(header->magic, OPENER_STORE_MAGIC, sizeof(header->magic)) != 0
+		|| header->tableSize == 0 || (header->tableSize & (header->tableSize - 1)) != 0
+		|| header->recordSize < OPENER_RECORD_FIELDS + 2 * (uint64_t) header->fieldBytes
+		|| header->tableOffset != sizeof(OpenerStoreHeader) + header->recordCount * header->recordSize
+		|| header->treeOffset != header->tableOffset + header->tableSize * sizeof(uint64_t)) {
+		this->close();
+		return false;
+	}
+
+	this->recordCount = header->recordCount;
+	this->locateLevels();
+	if (this->file.length < header->treeOffset + this->levelOffsets.back()) {
+		this->close();
+		return false;
+	}
+
+	this->fieldBytes = header->fieldBytes;
+	this->proofTime = header->proofTime;
+	this->recordSize = header->recordSize;
+	this->tableSize = header->tableSize;
+	this->records = this->file.data + sizeof(OpenerStoreHeader);
+	this->table = reinterpret_cast<const uint64_t *>(this->file.data + header->tableOffset);
+	this->tree = this->file.data + header->treeOffset;
+	memcpy(this->root, header->root, sizeof(this->root));
+	return true;
+}
+
+void OpenerStore::close() {
+	if (this->fd >= 0) ::close(this->fd);
+	this->fd = -1;
+	if (this->file.data != NULL) unmapFile(this->file);
+	this->records = NULL;
+	this->table = NULL;
+	this->tree = NULL;
+}
+
+bool OpenerStore::fetch(const char *id, size_t length, uint64_t &index, Big &balance, Big &r) {
+	if (this->table == NULL) return false;
+
+	char digest[OPENER_STORE_ID_BYTES];
+	zldigest(id, length, digest);
+
+	uint64_t mask = this->tableSize - 1;
+	for (uint64_t slot = tableSlot(digest) & mask; this->table[slot] != 0; slot = (slot + 1) & mask) {
+		const char *record = this->records + (this->table[slot] - 1) * this->recordSize;
+		if (memcmp(record, digest, OPENER_STORE_ID_BYTES) == 0) {
+			memcpy(&index, record + OPENER_STORE_ID_BYTES, sizeof(index));
+			record += OPENER_RECORD_FIELDS;
+			balance = from_binary(this->fieldBytes, (char *) record);
+			r = from_binary(this->fieldBytes, (char *) record + this->fieldBytes);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool OpenerStore::fetchPath(uint64_t index, vector<TreePathStep> &path) {
+	if (this->table == NULL || index >= this->recordCount) return false;
+
+	TreePathStep step;
+	uint64_t count = this->recordCount;
+	path.clear();
+
+	for (int level = 0; count > 1; level++, count = (count + 1) / 2, index /= 2) {
+		if (index % 2 == 1) {
+			step.left = true;
+			memcpy(step.sibling, this->treeNode(level, index - 1), TREE_HASH_DIGEST_BYTES);
+			path.push_back(step);
+		} else if (index + 1 < count) {
+			step.left = false;
+			memcpy(step.sibling, this->treeNode(level, index + 1), TREE_HASH_DIGEST_BYTES);
+			path.push_back(step);
+		}
+	}
+
+	return true;
+}
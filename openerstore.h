@@ -0,0 +1,111 @@
+#ifndef OPENERSTORE_H
+#define OPENERSTORE_H
+
+#include <stdint.h>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "zeroledge.h"
+#include "zlutil.h"
+#include "ledger.h"
+#include "treehash.h"
+
+#define OPENER_STORE_MAGIC "ZLOPEN02"
+#define OPENER_STORE_ID_BYTES 32
+
+// OpenerStoreHeader is the fixed-size header at the start of an openers store. It is followed by recordCount fixed-size
+// records, in order of entry index, then by a hash table of tableSize 64-bit slots, each of which holds either zero or one
+// plus the index of a record, and finally by the levels of the entry tree above its leaves, from the bottom up. All fields
+// are in native byte order.
+struct OpenerStoreHeader {
+	char magic[8];
+	uint32_t fieldBytes;
+	uint32_t reserved;
+	int64_t proofTime;
+	uint64_t recordSize;
+	uint64_t recordCount;
+	uint64_t tableSize;
+	uint64_t tableOffset;
+	uint64_t treeOffset;
+	char root[TREE_HASH_DIGEST_BYTES];
+};
+
+// OpenerStore holds the opener of every ledger entry in a proof - its entry index, balance, and commitment nonce, which
+// together allow the owner of the account to locate their entry and check it - indexed by account identifier, so that
+// a single account's opener can be delivered without reading the rest. It contains the same information as the entries
+// export, and is laid out in the same way as the binary incremental data (see incrstore.h): each account is represented by
+// a fixed-size record, which identifies the account by the SHA-256 digest of its identifier and holds the balance and the
+// nonce (reduced modulo q) in fixed-width big-endian fields, and the records are located via an open-addressing hash
+// table keyed by the same digest. The records are written by position as the proof is generated, and the table is built
+// from them once it is complete, so that no second pass over the ledger is needed.
+//
+// Each record also holds the leaf of the entry tree (see treehash.h) for its entry, which is hashed by the worker that
+// generates the entry. The remainder of the tree is built from the leaves along with the table, and is kept in the store,
+// so that the authentication path for any account can be delivered alongside its opener.
+class OpenerStore {
+
+private:
+
+	int fd;
+	atomic<bool> failed;
+	MappedFile file;
+	const char *records;
+	const uint64_t *table;
+	const char *tree;
+	Big q;
+
+	static uint64_t tableSlot(const char *digest);
+
+	// The offset within the tree section of each level of the entry tree above the leaves.
+	vector<uint64_t> levelOffsets;
+	void locateLevels();
+	const char * treeNode(int level, uint64_t position);
+
+public:
+
+	int fieldBytes;
+	time_t proofTime;
+	uint64_t recordSize, recordCount, tableSize;
+
+	// The root of the entry tree, once the store has been finished or opened.
+	char root[TREE_HASH_DIGEST_BYTES];
+
+	OpenerStore();
+	~OpenerStore();
+
+	// Create a new openers store at path. Nonces are reduced modulo q, and every field is workingbits bits wide, which must
+	// be sufficient for both q and any balance. If resume is set, the records already in an existing store are kept.
+	bool create(const char *path, Big q, int workingbits, time_t proofTime, bool resume);
+
+	bool isOpen();
+
+	// Flush the records written so far to disk. Returns false if any of them could not be written.
+	bool sync();
+
+	// Record the openers for count consecutive entries, beginning with entry index first, along with the digests of their
+	// leaves in the entry tree. This function may be called concurrently by many threads, so long as no two calls cover
+	// the same entries.
+	void setEntries(uint64_t first, LedgerEntry *e, const char *leaves, int count);
+
+	// Build the hash table and the entry tree, and write the header. This must be called only once all entries have been
+	// recorded. The file remains open, so that it can still be synced, until the store is closed. Returns false if
+	// anything, including any of the records, could not be written.
+	bool finish(uint64_t recordCount);
+
+	// Map an existing openers store. Returns false if it cannot be read, or is not an openers store. close releases the
+	// store, whether it was opened or created.
+	bool open(const char *path);
+	void close();
+
+	// Look up the opener for the account id. Returns false if there is none. This function may be called concurrently by
+	// many threads once the store has been opened.
+	bool fetch(const char *id, size_t length, uint64_t &index, Big &balance, Big &r);
+
+	// Retrieve the authentication path from the leaf of entry index to the root of the entry tree. Returns false if there is
+	// no such entry.
+	bool fetchPath(uint64_t index, vector<TreePathStep> &path);
+
+};
+
+#endif
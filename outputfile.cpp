@@ -0,0 +1,220 @@
+#include "outputfile.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+OutputFile::OutputFile() {
+	this->fd = -1;
+	this->direct = false;
+	this->positional = false;
+	this->owned = false;
+	this->length = 0;
+	this->allocated = 0;
+	this->failed = false;
+	this->digest = NULL;
+	this->sink = NULL;
+	this->sinkUser = NULL;
+}
+
+OutputFile::~OutputFile() {
+	if (this->owned && this->fd >= 0) ::close(this->fd);
+}
+
+bool OutputFile::open(const char *path, bool direct) {
+	struct stat st;
+
+	if (path == NULL) {
+		this->fd = STDOUT_FILENO;
+		this->owned = false;
+	} else {
+		this->fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (this->fd < 0) return false;
+		this->owned = true;
+	}
+
+	this->direct = direct;
+	this->positional = fstat(this->fd, &st) == 0 && S_ISREG(st.st_mode) && lseek(this->fd, 0, SEEK_CUR) == 0;
+	this->length = 0;
+	this->allocated = 0;
+	this->failed = false;
+
+	#ifdef __APPLE__
+	if (this->direct && this->positional) fcntl(this->fd, F_NOCACHE, 1);
+	#endif
+
+	return true;
+}
+
+bool OutputFile::openSink(OutputSink sink, void *user) {
+	this->fd = -1;
+	this->owned = false;
+	this->sink = sink;
+	this->sinkUser = user;
+	this->direct = false;
+	this->positional = false;
+	this->length = 0;
+	this->allocated = 0;
+	this->failed = false;
+	return sink != NULL;
+}
+
+bool OutputFile::reopen(const char *path, bool direct, uint64_t length) {
+	struct stat st;
+
+	// The file is also read, to restore its digest.
+	this->fd = ::open(path, O_RDWR);
+	if (this->fd < 0) return false;
+	this->owned = true;
+
+	this->direct = direct;
+	this->positional = fstat(this->fd, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t) st.st_size >= length;
+	if (!this->positional || ftruncate(this->fd, length) != 0) return false;
+
+	this->length = length;
+	this->allocated = length;
+	this->failed = false;
+
+	#ifdef __APPLE__
+	if (this->direct) fcntl(this->fd, F_NOCACHE, 1);
+	#endif
+
+	return true;
+}
+
+bool OutputFile::isOpen() {
+	return this->fd >= 0 || this->sink != NULL;
+}
+
+bool OutputFile::isPositional() {
+	return this->positional;
+}
+
+void OutputFile::setDigest(TreeHash *digest) {
+	this->digest = digest;
+}
+
+bool OutputFile::digestExisting(uint64_t offset) {
+	vector<char> buffer(TREE_HASH_LEAF_BYTES);
+	ssize_t result;
+
+	if (this->digest == NULL) return true;
+
+	// The file is read in whole leaves where possible, so that few of them need to be buffered by the digest.
+	for (; offset < this->length; offset += result) {
+		size_t length = min((uint64_t) buffer.size() - offset % buffer.size(), this->length - offset);
+		result = pread(this->fd, &buffer[0], length, offset);
+		if (result <= 0) return false;
+		this->digest->add(offset, &buffer[0], result);
+	}
+
+	return true;
+}
+
+uint64_t OutputFile::size() {
+	return this->length;
+}
+
+uint64_t OutputFile::reserve(size_t length) {
+	uint64_t offset = this->length;
+	this->length += length;
+
+	// Preallocation is only a hint; filesystems which do not support it are simply written as usual.
+	#ifdef __linux__
+	if (this->positional && this->length > this->allocated) {
+		uint64_t step = this->length - this->allocated;
+		if (step < OUTPUT_PREALLOCATE_BYTES) step = OUTPUT_PREALLOCATE_BYTES;
+		fallocate(this->fd, FALLOC_FL_KEEP_SIZE, this->allocated, step);
+		this->allocated += step;
+	}
+	#endif
+
+	return offset;
+}
+
+void OutputFile::writeAt(const char *data, size_t length, uint64_t offset) {
+	size_t written = 0;
+	ssize_t result;
+
+	if (this->digest != NULL) this->digest->add(offset, data, length);
+
+	if (this->sink != NULL) {
+		if (length > 0 && !this->sink(this->sinkUser, data, length)) this->failed = true;
+		return;
+	}
+
+	while (written < length) {
+		if (this->positional) {
+			result = pwrite(this->fd, data + written, length - written, offset + written);
+		} else {
+			result = ::write(this->fd, data + written, length - written);
+		}
+		if (result <= 0) {
+			this->failed = true;
+			return;
+		}
+		written += result;
+	}
+
+	#ifdef __linux__
+	if (this->direct && this->positional && length > 0) {
+		sync_file_range(this->fd, offset, length, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(this->fd, offset, length, POSIX_FADV_DONTNEED);
+	}
+	#endif
+}
+
+void OutputFile::place(const char *data, size_t length, vector<OutputRun> &runs) {
+	if (length == 0) return;
+
+	OutputRun run;
+	run.file = this;
+	run.data = data;
+	run.length = length;
+	run.offset = this->reserve(length);
+
+	if (this->positional) {
+		runs.push_back(run);
+	} else {
+		this->writeAt(data, length, run.offset);
+	}
+}
+
+void OutputFile::append(const char *data, size_t length) {
+	this->writeAt(data, length, this->reserve(length));
+}
+
+void OutputFile::writeRuns(vector<OutputRun> &runs) {
+	for (size_t ii = 0; ii < runs.size(); ii++) {
+		runs[ii].file->writeAt(runs[ii].data, runs[ii].length, runs[ii].offset);
+	}
+	runs.clear();
+}
+
+bool OutputFile::sync() {
+	return this->fd < 0 || !this->positional || fdatasync(this->fd) == 0;
+}
+
+bool OutputFile::finish() {
+	bool ok = !this->failed;
+
+	if (this->fd >= 0 && this->positional) {
+		ok &= ftruncate(this->fd, this->length) == 0;
+	}
+
+	return ok;
+}
+
+bool OutputFile::close() {
+	bool ok = this->finish();
+
+	this->sink = NULL;
+	if (this->fd < 0) return ok;
+
+	if (this->owned) {
+		ok &= ::close(this->fd) == 0;
+	}
+
+	this->fd = -1;
+	return ok;
+}
@@ -0,0 +1,114 @@
+#ifndef OUTPUTFILE_H
+#define OUTPUTFILE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include "treehash.h"
+
+using namespace std;
+
+#define OUTPUT_PREALLOCATE_BYTES (64 << 20)
+
+class OutputFile;
+
+// OutputSink receives the output of an OutputFile which writes to the caller rather than to a file, in order. It returns
+// false if the output could not be accepted.
+typedef bool (*OutputSink)(void *user, const char *data, size_t length);
+
+// OutputRun is a piece of output which has been assigned its position within an OutputFile, but not yet written. data must
+// remain valid until the run is written.
+typedef struct OutputRun {
+	OutputFile *file;
+	const char *data;
+	size_t length;
+	uint64_t offset;
+} OutputRun;
+
+// OutputFile separates the placement of output from the writing of it, so that output which must appear in a particular
+// order need only be placed in that order, which is cheap, while the writing itself can be done by many threads at once,
+// in any order, using positional writes. Space for the file is preallocated ahead of the writes, in large steps, so that
+// concurrent writes do not fragment it, and it is trimmed to its final length when it is closed.
+//
+// In direct mode, written data is not retained in the page cache: each write is flushed to disk and then dropped from the
+// cache (on OS X, caching is disabled for the file entirely). True O_DIRECT is not used, because it requires that every
+// write be aligned to the device's block size, which the variable-length records of the text outputs are not.
+//
+// If the output is not a regular file (a pipe on stdout, for instance), positional writes are impossible, so place writes
+// its data immediately instead.
+//
+// If a sink is given instead of a file, the output is passed to it as it would be written to a pipe.
+//
+// If a digest is attached, every write is added to it by the thread that performs the write, so that the digest of the
+// file is complete as soon as the file is, without reading it back.
+class OutputFile {
+
+private:
+
+	int fd;
+	bool direct, positional, owned;
+	uint64_t length, allocated;
+	atomic<bool> failed;
+	TreeHash *digest;
+	OutputSink sink;
+	void *sinkUser;
+
+public:
+
+	OutputFile();
+	~OutputFile();
+
+	// Create the file at path, or use stdout if path is NULL.
+	bool open(const char *path, bool direct);
+
+	// Pass everything written to sink, along with user, in order.
+	bool openSink(OutputSink sink, void *user);
+
+	// Open the existing file at path, keeping its first length bytes and discarding the rest, so that output can continue
+	// from a checkpoint. Returns false if the file is shorter than length, or does not support positional writes.
+	bool reopen(const char *path, bool direct, uint64_t length);
+
+	bool isOpen();
+
+	// Whether the file supports positional writes, so that placed runs are written later rather than immediately.
+	bool isPositional();
+
+	// Add everything subsequently written to the file to digest.
+	void setDigest(TreeHash *digest);
+
+	// Add the bytes of a reopened file from offset to the end of what it kept to its digest, by reading them back.
+	bool digestExisting(uint64_t offset);
+
+	// The number of bytes placed so far.
+	uint64_t size();
+
+	// Reserve length bytes at the end of the file, and return their offset. This is not thread safe, and must be called in
+	// the order in which the output is to appear.
+	uint64_t reserve(size_t length);
+
+	// Write length bytes of data at offset. This may be called concurrently by many threads, so long as no two calls overlap.
+	void writeAt(const char *data, size_t length, uint64_t offset);
+
+	// Reserve space for length bytes of data, and either append a run to runs so that it can be written later, or, if the
+	// file does not support positional writes, write it now. This is not thread safe.
+	void place(const char *data, size_t length, vector<OutputRun> &runs);
+
+	// Reserve space for length bytes of data and write it immediately. This is not thread safe.
+	void append(const char *data, size_t length);
+
+	// Write each of the runs, and clear them. This may be called concurrently by many threads.
+	static void writeRuns(vector<OutputRun> &runs);
+
+	// Flush everything written so far to disk. Returns false if it could not be.
+	bool sync();
+
+	// Trim the file to its final length, leaving it open, so that it can still be synced. Returns false if any write failed.
+	bool finish();
+
+	// Trim the file to its final length and close it. Returns false if any write failed.
+	bool close();
+
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include "partialsummary.h"
+#include "proofreader.h"
+#include "treehash.h"
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+
+void putLedgerSums(TextBuffer &output, Ledger &l) {
+	Big cx;
+
+	output.putBig(l.idHashSum);
+	output.putChar('\n');
+	output.putBig(l.idHashPrimeSum);
+	output.putChar('\n');
+	output.putBig(l.rSum);
+	output.putChar('\n');
+	output.putBig(l.totalLiabilities);
+	output.putChar('\n');
+	output.putPoint(l.totalCommitment, cx, '\n');
+	for (int ii = 0; ii < l.valueBits; ii++) {
+		output.putBig(l.rBitSums[ii]);
+		output.putChar('\n');
+	}
+}
+
+const char * readLedgerSums(const char *p, const char *end, Ledger &l) {
+	p = ProofReader::readBig(p, end, l.idHashSum);
+	p = ProofReader::readBig(p, end, l.idHashPrimeSum);
+	p = ProofReader::readBig(p, end, l.rSum);
+	p = ProofReader::readBig(p, end, l.totalLiabilities);
+	p = ProofReader::readPoint(p, end, l.totalCommitment);
+	for (int ii = 0; ii < l.valueBits; ii++) {
+		p = ProofReader::readBig(p, end, l.rBitSums[ii]);
+	}
+	return p;
+}
+
+void putLabelledNumbers(TextBuffer &output, const char *label, const vector<uint64_t> &numbers) {
+	output.putText(label, strlen(label));
+	for (size_t ii = 0; ii < numbers.size(); ii++) {
+		output.putChar(' ');
+		output.putInteger(numbers[ii]);
+	}
+	output.putChar('\n');
+}
+
+const char * readLabelledNumbers(const char *p, const char *end, const char *label, vector<uint64_t> &numbers, bool counted) {
+	size_t length = strlen(label);
+	uint64_t value, count;
+
+	numbers.clear();
+	if (p == NULL) return NULL;
+
+	const char *eol = skipLines(p, end, 1);
+	if (eol - p < (ptrdiff_t) length || strncmp(p, label, length) != 0) return NULL;
+
+	istringstream line(string(p + length, eol - p - length));
+	if (counted && !(line >> count)) return NULL;
+	while ((!counted || numbers.size() < count) && line >> value) numbers.push_back(value);
+	if (counted && numbers.size() != count) return NULL;
+
+	return eol;
+}
+
+PartialSummary::PartialSummary(ECn g, ECn h, ECn f, int valueBits) : sums(g, h, f, valueBits) {
+	this->proofTime = 0;
+	this->valueBits = valueBits;
+	this->shard = 0;
+	this->shardCount = 1;
+	this->first = 0;
+	this->count = 0;
+}
+
+bool PartialSummary::write(const char *path) {
+	TextBuffer output;
+	vector<uint64_t> numbers;
+
+	output.putText("BEGIN ZEROLEDGE PARTIAL\n" SECTION_SEPARATOR "\nASSETS ");
+	output.putDecimal(this->assets);
+	output.putChar('\n');
+	numbers.assign(1, this->proofTime);
+	putLabelledNumbers(output, "TIME", numbers);
+	numbers.assign(1, this->valueBits);
+	putLabelledNumbers(output, "BITS", numbers);
+	numbers.assign(1, this->shard);
+	numbers.push_back(this->shardCount);
+	putLabelledNumbers(output, "SHARD", numbers);
+	numbers.assign(1, this->first);
+	numbers.push_back(this->count);
+	putLabelledNumbers(output, "ENTRIES", numbers);
+	output.putText("DIGEST " + this->digest + "\n" SECTION_SEPARATOR "\n");
+	putLedgerSums(output, this->sums);
+	output.putText(SECTION_SEPARATOR "\nEND ZEROLEDGE PARTIAL\n");
+
+	int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return false;
+
+	bool ok = ::write(fd, output.data(), output.size()) == (ssize_t) output.size();
+	ok &= ::close(fd) == 0;
+	return ok;
+}
+
+bool PartialSummary::read(const char *path) {
+	MappedFile file;
+	vector<uint64_t> numbers;
+	char digest[TREE_HASH_DIGEST_BYTES];
+
+	if (!mapFile(path, file)) return false;
+
+	const char *p = file.data, *end = file.data + file.length, *eol;
+	bool ok = file.length >= 23 && strncmp(p, "BEGIN ZEROLEDGE PARTIAL", 23) == 0;
+	p = skipLines(p, end, 2);	// BEGIN ZEROLEDGE PARTIAL, ====================
+
+	eol = skipLines(p, end, 1);
+	ok = ok && eol - p > 8 && strncmp(p, "ASSETS ", 7) == 0 && decodeDecimal(p + 7, eol - p - 8, this->assets);
+	p = eol;
+
+	ok = ok && (p = readLabelledNumbers(p, end, "TIME", numbers, false)) != NULL && numbers.size() == 1;
+	if (ok) this->proofTime = numbers[0];
+	ok = ok && (p = readLabelledNumbers(p, end, "BITS", numbers, false)) != NULL && numbers.size() == 1 && (int) numbers[0] == this->valueBits;
+	ok = ok && (p = readLabelledNumbers(p, end, "SHARD", numbers, false)) != NULL && numbers.size() == 2;
+	if (ok) {
+		this->shard = numbers[0];
+		this->shardCount = numbers[1];
+	}
+	ok = ok && (p = readLabelledNumbers(p, end, "ENTRIES", numbers, false)) != NULL && numbers.size() == 2;
+	if (ok) {
+		this->first = numbers[0];
+		this->count = numbers[1];
+	}
+
+	// The digest must be exactly as wide as a tree hash, as it is copied into the manifest unchanged.
+	eol = ok ? skipLines(p, end, 1) : end;
+	ok = ok && eol - p > 8 && strncmp(p, "DIGEST ", 7) == 0 && fromHex(p + 7, eol - p - 8, TREE_HASH_DIGEST_BYTES, digest);
+	if (ok) this->digest.assign(p + 7, eol - p - 8);
+
+	if (ok) {
+		p = skipLines(eol, end, 1);	// ====================
+		p = readLedgerSums(p, end, this->sums);
+		ok = end - p >= 20 && *p == '=' && strncmp(skipLines(p, end, 1), "END ZEROLEDGE PARTIAL", 21) == 0;
+	}
+
+	unmapFile(file);
+	return ok;
+}
+
+PartialResult::PartialResult() {
+	this->first = 0;
+	this->count = 0;
+	this->entryCount = 0;
+	this->validCount = 0;
+	this->lbpValidCount = 0;
+	this->equivalencyCount = 0;
+	this->knownCount = 0;
+	this->correctCount = 0;
+}
+
+bool PartialResult::write(const char *path) {
+	TextBuffer output;
+	vector<uint64_t> numbers;
+	Big cx;
+
+	output.putText("BEGIN ZEROLEDGE RESULT\n" SECTION_SEPARATOR "\nPROOF " + this->proofDigest + "\n");
+	numbers.assign(1, this->first);
+	numbers.push_back(this->count);
+	numbers.push_back(this->entryCount);
+	putLabelledNumbers(output, "ENTRIES", numbers);
+	numbers.assign(1, this->validCount);
+	numbers.push_back(this->lbpValidCount);
+	numbers.push_back(this->equivalencyCount);
+	numbers.push_back(this->knownCount);
+	numbers.push_back(this->correctCount);
+	putLabelledNumbers(output, "CHECKS", numbers);
+	numbers.assign(1, this->validShards.size());
+	numbers.insert(numbers.end(), this->validShards.begin(), this->validShards.end());
+	putLabelledNumbers(output, "SHARDS", numbers);
+	numbers.assign(1, this->leaves.size() / TREE_HASH_DIGEST_BYTES);
+	putLabelledNumbers(output, "LEAVES", numbers);
+	output.putText(SECTION_SEPARATOR "\n");
+	output.putPoint(this->totalCommitment, cx, '\n');
+	for (size_t ii = 0; ii < this->leaves.size(); ii += TREE_HASH_DIGEST_BYTES) {
+		output.putText(toHex(&this->leaves[ii], TREE_HASH_DIGEST_BYTES) + "\n");
+	}
+	output.putText(SECTION_SEPARATOR "\nEND ZEROLEDGE RESULT\n");
+
+	int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return false;
+
+	bool ok = ::write(fd, output.data(), output.size()) == (ssize_t) output.size();
+	ok &= ::close(fd) == 0;
+	return ok;
+}
+
+bool PartialResult::read(const char *path) {
+	MappedFile file;
+	vector<uint64_t> numbers;
+	char digest[TREE_HASH_DIGEST_BYTES];
+
+	if (!mapFile(path, file)) return false;
+
+	const char *p = file.data, *end = file.data + file.length, *eol;
+	bool ok = file.length >= 22 && strncmp(p, "BEGIN ZEROLEDGE RESULT", 22) == 0;
+	p = skipLines(p, end, 2);	// BEGIN ZEROLEDGE RESULT, ====================
+
+	eol = skipLines(p, end, 1);
+	ok = ok && eol - p > 7 && strncmp(p, "PROOF ", 6) == 0 && fromHex(p + 6, eol - p - 7, TREE_HASH_DIGEST_BYTES, digest);
+	if (ok) this->proofDigest.assign(p + 6, eol - p - 7);
+	p = eol;
+
+	ok = ok && (p = readLabelledNumbers(p, end, "ENTRIES", numbers, false)) != NULL && numbers.size() == 3;
+	if (ok) {
+		this->first = numbers[0];
+		this->count = numbers[1];
+		this->entryCount = numbers[2];
+	}
+	ok = ok && (p = readLabelledNumbers(p, end, "CHECKS", numbers, false)) != NULL && numbers.size() == 5;
+	if (ok) {
+		this->validCount = numbers[0];
+		this->lbpValidCount = numbers[1];
+		this->equivalencyCount = numbers[2];
+		this->knownCount = numbers[3];
+		this->correctCount = numbers[4];
+	}
+	ok = ok && (p = readLabelledNumbers(p, end, "SHARDS", this->validShards, true)) != NULL;
+	ok = ok && (p = readLabelledNumbers(p, end, "LEAVES", numbers, false)) != NULL && numbers.size() == 1;
+
+	if (ok) {
+		p = skipLines(p, end, 1);	// ====================
+		p = ProofReader::readPoint(p, end, this->totalCommitment);
+
+		this->leaves.resize(numbers[0] * TREE_HASH_DIGEST_BYTES);
+		for (size_t ii = 0; ok && ii < this->leaves.size(); ii += TREE_HASH_DIGEST_BYTES) {
+			eol = skipLines(p, end, 1);
+			ok = eol - p > 1 && fromHex(p, eol - p - 1, TREE_HASH_DIGEST_BYTES, &this->leaves[ii]);
+			p = eol;
+		}
+
+		ok = ok && end - p >= 20 && *p == '=' && strncmp(skipLines(p, end, 1), "END ZEROLEDGE RESULT", 20) == 0;
+	}
+
+	unmapFile(file);
+	return ok;
+}
@@ -0,0 +1,95 @@
+#ifndef PARTIALSUMMARY_H
+#define PARTIALSUMMARY_H
+
+#include <stdint.h>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "zeroledge.h"
+#include "zlutil.h"
+#include "ledger.h"
+#include "textcodec.h"
+
+#define PARTIAL_NAME_FORMAT "%s.%d.partial"
+
+using namespace std;
+
+// The sums of a ledger (or of part of one) are everything needed to complete a proof once the entries themselves have been
+// generated: idHashSum, idHashPrimeSum, rSum, totalLiabilities, totalCommitment, and rBitSums. They are written one field to a
+// line in base DATA_BASE, in that order, with the commitment as a compressed point (two lines), exactly as fields are laid
+// out in a proof transcript. Summary files (checkpoints and partial summaries) hold them after a header of labelled numbers.
+
+void putLedgerSums(TextBuffer &output, Ledger &l);
+
+// Read the sums written by putLedgerSums into l, whose valueBits must match. Returns a pointer to the following line.
+const char * readLedgerSums(const char *p, const char *end, Ledger &l);
+
+// Write a line holding label, followed by each of numbers, separated by spaces.
+void putLabelledNumbers(TextBuffer &output, const char *label, const vector<uint64_t> &numbers);
+
+// Read a line written by putLabelledNumbers into numbers. If counted is set, the first number is the count of those which
+// follow it, and only those are stored. Returns a pointer to the following line, or NULL if the line does not begin with
+// label, or does not hold as many numbers as it should. p may itself be NULL, so that calls can be chained.
+const char * readLabelledNumbers(const char *p, const char *end, const char *label, vector<uint64_t> &numbers, bool counted);
+
+// PartialSummary records the outcome of generating a single shard of a proof in its own process (a partition): the shard it
+// generated and its entry range and digest, along with the parameters of the proof and the sums of the entries in the shard.
+// Since the sums of a ledger are simply the sums of the sums of its parts (see Ledger::appendLedger), a coordinator can merge
+// the summaries of every partition into the sums of the whole ledger, then generate the difference bits and write the
+// manifest, without ever seeing an entry. The summary of partition k is written alongside its shard, with a name formed
+// from the manifest path with PARTIAL_NAME_FORMAT.
+class PartialSummary {
+
+public:
+
+	time_t proofTime;
+	int valueBits;
+	Big assets;
+	int shard, shardCount;
+	uint64_t first, count;
+
+	// The hexadecimal digest of the shard.
+	string digest;
+
+	Ledger sums;
+
+	PartialSummary(ECn g, ECn h, ECn f, int valueBits);
+
+	// Write the summary to path. Returns false if it could not be written in full.
+	bool write(const char *path);
+
+	// Read the summary at path. Returns false if it cannot be read, or is malformed, or its valueBits do not match.
+	bool read(const char *path);
+
+};
+
+// PartialResult records the outcome of verifying a range of the entries of a proof, [first, first + count), in its own
+// process (see zlverify.cpp): the digest of the proof (for a sharded proof, of its manifest), the number of entries in the
+// whole proof, the number of entries in the range which passed each check, the number of known entries in the range and
+// how many of them were correct, the shards whose digests were checked and found to match the manifest, and the sum of the
+// commitments to the entries in the range. If the proof is rooted, the leaf of each entry in the range follows (see
+// treehash.h), one to a line in hexadecimal. The difference bit proofs and the total commitment equivalency can only be
+// checked over every entry at once; since the total commitment is simply the sum of the commitments of the ranges, they
+// are checked by merging the results for a set of ranges which together cover the proof.
+class PartialResult {
+
+public:
+
+	string proofDigest;
+	uint64_t first, count, entryCount;
+	uint64_t validCount, lbpValidCount, equivalencyCount, knownCount, correctCount;
+	vector<uint64_t> validShards;
+	ECn totalCommitment;
+	vector<char> leaves;
+
+	PartialResult();
+
+	// Write the result to path. Returns false if it could not be written in full.
+	bool write(const char *path);
+
+	// Read the result at path. Returns false if it cannot be read, or is malformed.
+	bool read(const char *path);
+
+};
+
+#endif
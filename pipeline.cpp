@@ -0,0 +1,396 @@
+#include "pipeline.h"
+#include <sched.h>
+#include <unistd.h>
+#include <ctime>
+
+// The fields of Offer::claim: the generation of the group, the number of tasks in it, and the number taken.
+#define CLAIM_TASK_BITS 20
+#define CLAIM_TASK_MASK ((1ULL << CLAIM_TASK_BITS) - 1)
+#define CLAIM_COUNT_SHIFT CLAIM_TASK_BITS
+#define CLAIM_GENERATION_SHIFT (2 * CLAIM_TASK_BITS)
+
+// Each pack travels through the pipeline wrapped with the sequence number it was read in, so that the writer can restore
+// the original order, and a flag which tells the workers whether it is to be worked on or flushed.
+typedef struct PipelinePack {
+	uint64_t sequence;
+	bool written;
+	void *data;
+} PipelinePack;
+
+double Pipeline::budget = 0;
+
+static double clockSeconds(clockid_t clock) {
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Pacer keeps the processor time used by a worker since it started within share of the time elapsed, by sleeping off any
+// excess after each pack or task.
+typedef struct Pacer {
+	double share;
+	double wallStart;
+	double cpuStart;
+} Pacer;
+
+static void startPacer(Pacer &pacer, double share) {
+	pacer.share = share;
+	pacer.wallStart = clockSeconds(CLOCK_MONOTONIC);
+	pacer.cpuStart = clockSeconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+static void pace(Pacer &pacer) {
+	if (pacer.share <= 0) return;
+	double ahead = (clockSeconds(CLOCK_THREAD_CPUTIME_ID) - pacer.cpuStart) / pacer.share - (clockSeconds(CLOCK_MONOTONIC) - pacer.wallStart);
+	if (ahead <= 0) return;
+
+	struct timespec delay;
+	delay.tv_sec = (time_t) ahead;
+	delay.tv_nsec = (long) ((ahead - delay.tv_sec) * 1e9);
+	nanosleep(&delay, NULL);
+}
+
+Signal::Signal() {
+	pthread_mutex_init(&this->lock, NULL);
+	pthread_cond_init(&this->changed, NULL);
+	this->epoch.store(0);
+	this->sleepers.store(0);
+}
+
+Signal::~Signal() {
+	pthread_cond_destroy(&this->changed);
+	pthread_mutex_destroy(&this->lock);
+}
+
+// A sleeper counts itself before it checks the epoch, and a notifier advances the epoch before it counts the sleepers, so
+// either the sleeper sees the new epoch, or the notifier sees the sleeper and wakes it under the lock.
+void Signal::notify() {
+	this->epoch.fetch_add(1);
+	if (this->sleepers.load() > 0) {
+		pthread_mutex_lock(&this->lock);
+		pthread_cond_broadcast(&this->changed);
+		pthread_mutex_unlock(&this->lock);
+	}
+}
+
+void Signal::backoff(int &attempts, uint64_t &epoch) {
+	if (attempts < 64) {
+		// spin
+	} else if (attempts < 128) {
+		sched_yield();
+	} else if (attempts == 128) {
+		// The caller checks once more after the epoch is recorded, so no change after this point can be missed.
+		epoch = this->epoch.load();
+	} else {
+		pthread_mutex_lock(&this->lock);
+		this->sleepers.fetch_add(1);
+		while (this->epoch.load() == epoch) pthread_cond_wait(&this->changed, &this->lock);
+		this->sleepers.fetch_sub(1);
+		pthread_mutex_unlock(&this->lock);
+		attempts = 127;
+	}
+	attempts++;
+}
+
+static size_t roundCapacity(size_t capacity) {
+	size_t rounded = 2;
+	while (rounded < capacity) rounded <<= 1;
+	return rounded;
+}
+
+PackQueue::PackQueue(size_t capacity) {
+	size_t rounded = roundCapacity(capacity);
+	this->cells = new Cell[rounded];
+	this->mask = rounded - 1;
+	for (size_t ii = 0; ii < rounded; ii++) {
+		this->cells[ii].sequence.store(ii, memory_order_relaxed);
+		this->cells[ii].item = NULL;
+	}
+	this->head.store(0, memory_order_relaxed);
+	this->tail.store(0, memory_order_relaxed);
+}
+
+PackQueue::~PackQueue() {
+	delete[] this->cells;
+}
+
+bool PackQueue::tryPush(void *item) {
+	uint64_t position = this->tail.load(memory_order_relaxed);
+	while (true) {
+		Cell *cell = &this->cells[position & this->mask];
+		uint64_t sequence = cell->sequence.load(memory_order_acquire);
+		int64_t difference = (int64_t) sequence - (int64_t) position;
+		if (difference == 0) {
+			if (this->tail.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+				cell->item = item;
+				cell->sequence.store(position + 1, memory_order_release);
+				this->signal.notify();
+				return true;
+			}
+		} else if (difference < 0) {
+			return false;
+		} else {
+			position = this->tail.load(memory_order_relaxed);
+		}
+	}
+}
+
+bool PackQueue::tryPop(void *&item) {
+	uint64_t position = this->head.load(memory_order_relaxed);
+	while (true) {
+		Cell *cell = &this->cells[position & this->mask];
+		uint64_t sequence = cell->sequence.load(memory_order_acquire);
+		int64_t difference = (int64_t) sequence - (int64_t) (position + 1);
+		if (difference == 0) {
+			if (this->head.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+				item = cell->item;
+				cell->sequence.store(position + this->mask + 1, memory_order_release);
+				this->signal.notify();
+				return true;
+			}
+		} else if (difference < 0) {
+			return false;
+		} else {
+			position = this->head.load(memory_order_relaxed);
+		}
+	}
+}
+
+Signal & PackQueue::changes() {
+	return this->signal;
+}
+
+void PackQueue::push(void *item) {
+	int attempts = 0;
+	uint64_t epoch = 0;
+	while (!this->tryPush(item)) this->signal.backoff(attempts, epoch);
+}
+
+void * PackQueue::pop() {
+	void *item;
+	int attempts = 0;
+	uint64_t epoch = 0;
+	while (!this->tryPop(item)) this->signal.backoff(attempts, epoch);
+	return item;
+}
+
+// The free queue holds every pack, the work queue holds every pack plus a NULL for each worker to stop it, and the done
+// queue holds every pack plus the NULL which stops the writer. The NULLs are only pushed once every pack is free.
+Pipeline::Pipeline(PipelineStages stages, int workers, int depth) :
+	freeQueue(depth > 0 ? depth : 1),
+	workQueue((depth > 0 ? depth : 1) + (workers > 0 ? workers : 1)),
+	doneQueue((depth > 0 ? depth : 1) + 1) {
+	this->stages = stages;
+	this->workers = (workers > 0) ? workers : 1;
+	this->depth = (depth > 0) ? depth : 1;
+	this->slots = new Slot[this->depth];
+	this->offers = new Offer[this->workers];
+	this->placement = NULL;
+	for (int ii = 0; ii < this->workers; ii++) {
+		this->offers[ii].claim.store(0, memory_order_relaxed);
+		this->offers[ii].group.store(NULL, memory_order_relaxed);
+		this->offers[ii].done.store(0, memory_order_relaxed);
+	}
+	for (int ii = 0; ii < this->depth; ii++) {
+		PipelinePack *pack = new PipelinePack;
+		pack->sequence = 0;
+		pack->written = false;
+		pack->data = this->stages.newPack(this->stages.context);
+		this->freeQueue.push(pack);
+	}
+}
+
+Pipeline::~Pipeline() {
+	void *item;
+	while (this->freeQueue.tryPop(item)) {
+		PipelinePack *pack = (PipelinePack *) item;
+		this->stages.deletePack(this->stages.context, pack->data);
+		delete pack;
+	}
+	delete[] this->slots;
+	delete[] this->offers;
+}
+
+bool Pipeline::takeTask(Offer &offer, void *state) {
+	uint64_t claim = offer.claim.load(memory_order_acquire);
+
+	while ((claim & CLAIM_TASK_MASK) < ((claim >> CLAIM_COUNT_SHIFT) & CLAIM_TASK_MASK)) {
+		if (offer.claim.compare_exchange_weak(claim, claim + 1, memory_order_acq_rel, memory_order_acquire)) {
+			// Once a task has been taken, its group cannot be released until the task is done.
+			TaskGroup *group = offer.group.load(memory_order_relaxed);
+			group->run(this->stages.context, state, group->data, (int) (claim & CLAIM_TASK_MASK));
+			offer.done.fetch_add(1, memory_order_release);
+			this->workQueue.changes().notify();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool Pipeline::steal(int worker, void *state) {
+	for (int ii = 1; ii < this->workers; ii++) {
+		if (this->takeTask(this->offers[(worker + ii) % this->workers], state)) return true;
+	}
+	return false;
+}
+
+void Pipeline::share(int worker, void *state, TaskGroup &group) {
+	// With no other workers, or too many tasks to count in a claim, the tasks are simply performed in turn.
+	if (this->workers == 1 || (uint64_t) group.count > CLAIM_TASK_MASK) {
+		for (int ii = 0; ii < group.count; ii++) group.run(this->stages.context, state, group.data, ii);
+		return;
+	}
+	if (group.count <= 0) return;
+
+	Offer &offer = this->offers[worker];
+	uint64_t generation = (offer.claim.load(memory_order_relaxed) >> CLAIM_GENERATION_SHIFT) + 1;
+	offer.group.store(&group, memory_order_relaxed);
+	offer.done.store(0, memory_order_relaxed);
+	offer.claim.store((generation << CLAIM_GENERATION_SHIFT) | ((uint64_t) group.count << CLAIM_COUNT_SHIFT), memory_order_release);
+	this->workQueue.changes().notify();
+
+	while (this->takeTask(offer, state));
+
+	// While the last tasks taken by others are completed, this worker helps the others in turn. Idle workers, and the
+	// owners of groups, wait on the signal of the work queue, which is also announced whenever tasks are offered or done.
+	int attempts = 0;
+	uint64_t epoch = 0;
+	while (offer.done.load(memory_order_acquire) < group.count) {
+		if (!this->steal(worker, state)) this->workQueue.changes().backoff(attempts, epoch);
+	}
+}
+
+void Pipeline::place(Placement *placement) {
+	this->placement = placement;
+}
+
+void Pipeline::setBudget(double processors) {
+	Pipeline::budget = (processors > 0) ? processors : 0;
+}
+
+void * Pipeline::workerLoop(void *rawPipeline) {
+	Pipeline *pipeline = (Pipeline *) rawPipeline;
+	PipelineStages *stages = &pipeline->stages;
+
+	// workers are numbered in the order in which they start, so that each may own per-worker state in the caller
+	int worker = pipeline->nextWorker.fetch_add(1);
+
+	if (pipeline->placement != NULL) pipeline->placement->pin(worker);
+
+	// Under a budget, each worker is allowed an equal share of it.
+	Pacer pacer;
+	startPacer(pacer, Pipeline::budget / pipeline->workers);
+#ifdef SCHED_IDLE
+	if (Pipeline::budget > 0) {
+		struct sched_param priority;
+		priority.sched_priority = 0;
+		pthread_setschedparam(pthread_self(), SCHED_IDLE, &priority);
+	}
+#endif
+
+	void *state = (stages->beginWorker != NULL) ? stages->beginWorker(stages->context, worker) : NULL;
+
+	// A worker which finds no pack waiting takes tasks shared by the others instead.
+	void *item;
+	while (true) {
+		int attempts = 0;
+		uint64_t epoch = 0;
+		while (!pipeline->workQueue.tryPop(item)) {
+			if (pipeline->steal(worker, state)) {
+				attempts = 0;
+				pace(pacer);
+			} else {
+				pipeline->workQueue.changes().backoff(attempts, epoch);
+			}
+		}
+		if (item == NULL) break;
+
+		PipelinePack *pack = (PipelinePack *) item;
+		if (pack->written) {
+			stages->flush(stages->context, state, pack->data);
+			pipeline->freeQueue.push(pack);
+			continue;
+		}
+		stages->work(stages->context, state, pack->data);
+		if (stages->write != NULL) {
+			pipeline->doneQueue.push(pack);
+		} else {
+			pipeline->freeQueue.push(pack);
+		}
+		pace(pacer);
+	}
+
+	if (stages->endWorker != NULL) stages->endWorker(stages->context, state);
+	return NULL;
+}
+
+void * Pipeline::writerLoop(void *rawPipeline) {
+	Pipeline *pipeline = (Pipeline *) rawPipeline;
+	PipelineStages *stages = &pipeline->stages;
+
+	// Since no more than depth packs are ever in circulation, the sequence numbers of those waiting here always differ by
+	// less than depth, and each has its own slot.
+	for (int ii = 0; ii < pipeline->depth; ii++) pipeline->slots[ii].pack = NULL;
+	uint64_t nextWrite = 0;
+
+	void *item;
+	while ((item = pipeline->doneQueue.pop()) != NULL) {
+		PipelinePack *pack = (PipelinePack *) item;
+		Slot *slot = &pipeline->slots[pack->sequence % pipeline->depth];
+		slot->sequence = pack->sequence;
+		slot->pack = pack;
+
+		while ((slot = &pipeline->slots[nextWrite % pipeline->depth])->pack != NULL && slot->sequence == nextWrite) {
+			PipelinePack *next = (PipelinePack *) slot->pack;
+			slot->pack = NULL;
+			stages->write(stages->context, next->data);
+			if (stages->flush != NULL) {
+				next->written = true;
+				pipeline->workQueue.push(next);
+			} else {
+				pipeline->freeQueue.push(next);
+			}
+			nextWrite++;
+		}
+	}
+
+	return NULL;
+}
+
+void Pipeline::run() {
+	this->nextWorker.store(0);
+
+	pthread_t writer;
+	if (this->stages.write != NULL) pthread_create(&writer, NULL, Pipeline::writerLoop, (void *) this);
+
+	vector<pthread_t> threads(this->workers);
+	for (int ii = 0; ii < this->workers; ii++) {
+		pthread_create(&threads[ii], NULL, Pipeline::workerLoop, (void *) this);
+	}
+
+	uint64_t sequence = 0;
+	while (true) {
+		PipelinePack *pack = (PipelinePack *) this->freeQueue.pop();
+		if (!this->stages.read(this->stages.context, pack->data)) {
+			this->freeQueue.push(pack);
+			break;
+		}
+		pack->sequence = sequence++;
+		pack->written = false;
+		this->workQueue.push(pack);
+	}
+
+	// Once every pack has returned to the free queue, all work is complete, and the other threads can be stopped.
+	vector<void *> returned(this->depth);
+	for (int ii = 0; ii < this->depth; ii++) returned[ii] = this->freeQueue.pop();
+	for (int ii = 0; ii < this->depth; ii++) this->freeQueue.push(returned[ii]);
+
+	for (int ii = 0; ii < this->workers; ii++) this->workQueue.push(NULL);
+	for (int ii = 0; ii < this->workers; ii++) pthread_join(threads[ii], NULL);
+
+	if (this->stages.write != NULL) {
+		this->doneQueue.push(NULL);
+		pthread_join(writer, NULL);
+	}
+}
@@ -0,0 +1,187 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+#include "placement.h"
+
+using namespace std;
+
+// Signal lets threads which have found nothing to do sleep until another thread announces that something they are waiting
+// for may have changed. Announcing a change costs a single atomic increment unless some thread is asleep, so it can be
+// done for every item pushed or popped. Waiting threads first spin briefly, and then yield, before they sleep, so that a
+// short wait costs no system calls, and a long one occupies no processor.
+class Signal {
+
+private:
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	atomic<uint64_t> epoch;
+	atomic<int> sleepers;
+
+public:
+
+	Signal();
+	~Signal();
+
+	// Announce a change, waking every sleeping thread.
+	void notify();
+
+	// Wait a little longer each time this is called with the same counters, which must both begin at zero: first spinning,
+	// then yielding, and finally sleeping until a change is announced after the previous call.
+	void backoff(int &attempts, uint64_t &epoch);
+
+};
+
+// PackQueue is a bounded queue of pointers, which may be pushed and popped concurrently by any number of threads without
+// locks. Each cell carries a sequence number which tells producers and consumers whether it is free or full for the
+// current lap around the ring, so that each operation requires only a single compare-and-swap on the head or tail.
+// Threads which find the queue full or empty spin briefly, then yield, and then sleep until an item is pushed or popped
+// (see Signal), so that waiting threads do not contend for any lock, nor occupy a processor which a working thread could
+// use.
+class PackQueue {
+
+private:
+
+	struct Cell {
+		atomic<uint64_t> sequence;
+		void *item;
+	};
+
+	Cell *cells;
+	uint64_t mask;
+	char padding0[64];
+	atomic<uint64_t> head;
+	char padding1[64];
+	atomic<uint64_t> tail;
+	char padding2[64];
+	Signal signal;
+
+public:
+
+	// The capacity is rounded up to the nearest power of two.
+	PackQueue(size_t capacity);
+	~PackQueue();
+
+	bool tryPush(void *item);
+	bool tryPop(void *&item);
+
+	// Push or pop an item, waiting for space or for an item as necessary.
+	void push(void *item);
+	void * pop();
+
+	// The signal announced whenever an item is pushed or popped.
+	Signal & changes();
+
+};
+
+// PipelineStages describes the work done by a pipeline, as a set of functions which are each passed context. Work is divided
+// into packs, which are allocated by newPack before the pipeline starts, and recycled until it finishes, when they are freed
+// by deletePack. read fills a pack with input, returning false once the input is exhausted; it is only ever called from a
+// single thread, in sequence. work performs the computation for a pack, and is called concurrently by each of the workers.
+// beginWorker is called on each worker thread before its first pack, and returns a pointer to any state the worker needs,
+// such as its MIRACL instance and processors, which is passed to work, and finally to endWorker before the thread exits.
+// write is called with each completed pack, from a single thread, strictly in the order in which the packs were read; it
+// may be NULL, in which case completed packs are recycled immediately. flush, if it is not NULL, is called with each pack
+// after it has been written, by any of the workers, in any order; thus write need only decide where the output of each
+// pack belongs, and the output itself can be written by flush in parallel. beginWorker and endWorker may also be NULL.
+typedef struct PipelineStages {
+	void *context;
+	void * (*newPack)(void *context);
+	void (*deletePack)(void *context, void *pack);
+	bool (*read)(void *context, void *pack);
+	void * (*beginWorker)(void *context, int worker);
+	void (*work)(void *context, void *worker, void *pack);
+	void (*endWorker)(void *context, void *worker);
+	void (*write)(void *context, void *pack);
+	void (*flush)(void *context, void *worker, void *pack);
+} PipelineStages;
+
+// TaskGroup is a set of count independent tasks into which a worker divides the computation for a pack, so that workers
+// which would otherwise be idle can take some of them (see Pipeline::share). run performs a single task, given the context,
+// the state of whichever worker has taken it, data, and the index of the task.
+typedef struct TaskGroup {
+	void (*run)(void *context, void *worker, void *data, int task);
+	void *data;
+	int count;
+} TaskGroup;
+
+// Pipeline runs a reader, a number of compute workers, and a writer concurrently, each on its own thread, connected by
+// PackQueues. Workers which find no pack waiting steal tasks from those which have shared them, so that the computation
+// for a single pack may be spread among several workers when there are too few packs to occupy them all, as at the end of
+// the input, or when some packs are far cheaper than others. A fixed number of packs circulate from the reader to the workers to the writer (and, optionally, back to
+// the workers to be flushed) and back to the reader, so
+// memory consumption depends only on the pipeline depth, and the reader is held back whenever all packs are in use. The
+// reader and writer perform all IO, so the workers never wait on IO or on any lock, and IO overlaps with computation.
+class Pipeline {
+
+private:
+
+	struct Slot {
+		uint64_t sequence;
+		void *pack;
+	};
+
+	// Offer holds the task group a worker has most recently shared. claim packs the generation of the group (which counts
+	// the groups the worker has shared), the number of tasks in it, and the number taken so far into a single word, so that
+	// a task is taken with a single compare-and-swap which fails if the group has since been replaced. done counts the
+	// tasks completed, and the owner waits until all of them are before the group is released.
+	struct Offer {
+		atomic<uint64_t> claim;
+		atomic<TaskGroup *> group;
+		atomic<int> done;
+		char padding[64];
+	};
+
+	PipelineStages stages;
+	int workers, depth;
+	Slot *slots;
+	PackQueue freeQueue, workQueue, doneQueue;
+	atomic<int> nextWorker;
+	Offer *offers;
+	Placement *placement;
+
+	static double budget;
+
+	// Take and perform a single task from offer, if any remain, with the given worker state.
+	bool takeTask(Offer &offer, void *state);
+
+	// Take and perform a single task from any worker other than worker. Returns false if there are none to take.
+	bool steal(int worker, void *state);
+
+	static void * workerLoop(void *rawPipeline);
+	static void * writerLoop(void *rawPipeline);
+
+public:
+
+	// workers:	the number of compute threads
+	// depth:	the number of packs in circulation; it must be greater than workers to keep every worker busy
+	Pipeline(PipelineStages stages, int workers, int depth);
+	~Pipeline();
+
+	// Pin each worker to the processor placement assigns it (see placement.h) as soon as it starts, before beginWorker is
+	// called, so that everything the worker allocates is placed on its own node. This must be called before run.
+	void place(Placement *placement);
+
+	// Limit the workers of every pipeline run afterward to processors' worth of processor time among them, so that each
+	// worker sleeps whenever it has used more than its share of the budget since it started, and run them at the lowest
+	// scheduling priority, so that they yield to any other process which needs a processor. The reader and writer, which
+	// mostly wait on IO, are not limited. Zero (the default) removes the limit.
+	static void setBudget(double processors);
+
+	// Run the pipeline on the calling thread (which becomes the reader) until the input is exhausted and every pack has
+	// been written.
+	void run();
+
+	// Perform every task of group, which belongs to the pack being worked on by worker (numbered as given to beginWorker),
+	// whose state is given. The tasks are offered to the other workers, which take them whenever they have no pack to work
+	// on, while worker performs as many of them as it can take itself. Returns once all of them are complete, so that the
+	// tasks may refer to anything the caller holds. Tasks must not share tasks of their own.
+	void share(int worker, void *state, TaskGroup &group);
+
+};
+
+#endif
@@ -0,0 +1,223 @@
+#include "placement.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <cmath>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PLACEMENT_MAX_NODES 1024
+#define HUGE_PAGE_BYTES (2 << 20)
+
+// Read a list of processors in the format used throughout sysfs (such as "0-3,8,10-11") from path. Returns false if the
+// file cannot be read.
+static bool readCpuList(const char *path, vector<int> &list) {
+	ifstream source(path);
+	string text;
+	if (!(source >> text)) return false;
+
+	const char *p = text.c_str();
+	while (*p != '\0') {
+		char *next;
+		long first = strtol(p, &next, 10), last = first;
+		if (next == p) return false;
+		if (*next == '-') {
+			p = next + 1;
+			last = strtol(p, &next, 10);
+			if (next == p) return false;
+		}
+		for (long cpu = first; cpu <= last; cpu++) list.push_back((int) cpu);
+		p = (*next == ',') ? next + 1 : next;
+		if (*next != ',' && *next != '\0') return false;
+	}
+	return true;
+}
+
+typedef struct CpuRank {
+	int rank;
+	int node;
+	int cpu;
+
+	bool operator < (const CpuRank &other) const {
+		if (rank != other.rank) return rank < other.rank;
+		if (node != other.node) return node < other.node;
+		return cpu < other.cpu;
+	}
+} CpuRank;
+
+Placement::Placement() {
+}
+
+bool Placement::load() {
+#ifdef __linux__
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if (sched_getaffinity(0, sizeof(mask), &mask) != 0) return false;
+
+	// The node of each processor, numbered as the kernel numbers them, and then renumbered among those available.
+	vector<int> kernelNodes(CPU_SETSIZE, 0);
+	char path[128];
+	for (int node = 0; node < PLACEMENT_MAX_NODES; node++) {
+		vector<int> list;
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		if (!readCpuList(path, list)) continue;
+		for (size_t ii = 0; ii < list.size(); ii++) {
+			if (list[ii] >= 0 && list[ii] < CPU_SETSIZE) kernelNodes[list[ii]] = node;
+		}
+	}
+
+	// Hardware threads other than the first of their core rank behind every first thread.
+	vector<CpuRank> ranks;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &mask)) continue;
+		CpuRank rank;
+		rank.rank = 0;
+		rank.node = kernelNodes[cpu];
+		rank.cpu = cpu;
+
+		vector<int> siblings;
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+		if (readCpuList(path, siblings)) {
+			rank.rank = find(siblings.begin(), siblings.end(), cpu) - siblings.begin();
+			if (rank.rank == (int) siblings.size()) rank.rank = 0;
+		}
+		ranks.push_back(rank);
+	}
+	if (ranks.empty()) return false;
+	sort(ranks.begin(), ranks.end());
+
+	vector<int> nodeNumbers(PLACEMENT_MAX_NODES, -1);
+	this->cpus.clear();
+	this->cpuNodes.clear();
+	this->nodeCpus.clear();
+	for (size_t ii = 0; ii < ranks.size(); ii++) {
+		int &number = nodeNumbers[ranks[ii].node];
+		if (number < 0) {
+			number = this->nodeCpus.size();
+			this->nodeCpus.push_back(vector<int>());
+		}
+		this->cpus.push_back(ranks[ii].cpu);
+		this->cpuNodes.push_back(number);
+		this->nodeCpus[number].push_back(ranks[ii].cpu);
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+int Placement::cpuCount() {
+	return this->cpus.size();
+}
+
+int Placement::nodeCount() {
+	return this->nodeCpus.size();
+}
+
+int Placement::node(int worker) {
+	if (this->cpus.empty()) return 0;
+	return this->cpuNodes[worker % this->cpus.size()];
+}
+
+bool Placement::pin(int worker) {
+#ifdef __linux__
+	if (this->cpus.empty()) return false;
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	CPU_SET(this->cpus[worker % this->cpus.size()], &mask);
+	return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+#else
+	return false;
+#endif
+}
+
+typedef struct NodeCall {
+	void (*fn)(void *arg);
+	void *arg;
+} NodeCall;
+
+static void * runNodeCall(void *rawCall) {
+	NodeCall *call = static_cast<NodeCall*>(rawCall);
+	call->fn(call->arg);
+	return NULL;
+}
+
+void Placement::runOnNode(int node, void (*fn)(void *arg), void *arg) {
+	NodeCall call = { fn, arg };
+	pthread_attr_t attributes;
+	pthread_attr_init(&attributes);
+#ifdef __linux__
+	if (node >= 0 && node < (int) this->nodeCpus.size()) {
+		cpu_set_t mask;
+		CPU_ZERO(&mask);
+		for (size_t ii = 0; ii < this->nodeCpus[node].size(); ii++) CPU_SET(this->nodeCpus[node][ii], &mask);
+		pthread_attr_setaffinity_np(&attributes, sizeof(mask), &mask);
+	}
+#endif
+
+	pthread_t thread;
+	if (pthread_create(&thread, &attributes, runNodeCall, &call) == 0) {
+		pthread_join(thread, NULL);
+	} else {
+		fn(arg);
+	}
+	pthread_attr_destroy(&attributes);
+}
+
+// Return the smallest processor quota, in processors, of the cgroup v2 group of this process and of its ancestors, or zero
+// if none of them is limited.
+static double cgroupQuota() {
+	ifstream membership("/proc/self/cgroup");
+	string line, group;
+	while (getline(membership, line)) {
+		if (line.compare(0, 3, "0::") == 0) group = line.substr(3);
+	}
+	if (group.empty() || group[0] != '/') return 0;
+
+	double quota = 0;
+	while (true) {
+		ifstream limit(("/sys/fs/cgroup" + group + "/cpu.max").c_str());
+		string max;
+		double period;
+		if (limit >> max >> period && max != "max" && period > 0) {
+			double processors = atof(max.c_str()) / period;
+			if (processors > 0 && (quota == 0 || processors < quota)) quota = processors;
+		}
+		if (group == "/") break;
+		group = group.substr(0, group.rfind('/'));
+		if (group.empty()) group = "/";
+	}
+	return quota;
+}
+
+int availableProcessors(double budget) {
+	int count = sysconf( _SC_NPROCESSORS_ONLN );
+#ifdef __linux__
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if (sched_getaffinity(0, sizeof(mask), &mask) == 0 && CPU_COUNT(&mask) > 0) count = CPU_COUNT(&mask);
+
+	double quota = cgroupQuota();
+	if (quota > 0 && ceil(quota) < count) count = (int) ceil(quota);
+#endif
+	if (budget > 0 && ceil(budget) < count) count = (int) ceil(budget);
+	return (count > 0) ? count : 1;
+}
+
+void * allocLocal(size_t length) {
+	void *p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+	if (length >= HUGE_PAGE_BYTES) madvise(p, length, MADV_HUGEPAGE);
+#endif
+	return p;
+}
+
+void freeLocal(void *p, size_t length) {
+	if (p != NULL) munmap(p, length);
+}
@@ -0,0 +1,63 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// Placement assigns worker threads to the processors the process may run on, one worker per core, and records the NUMA
+// node of each, so that each worker's memory can be kept on its own node. Workers are assigned to the first hardware
+// thread of every core before the second of any, and to the cores of one node before those of the next, so that a
+// small number of workers occupies a single node. A worker pinned to its core before it allocates anything (its MIRACL
+// instance, its processors, its scratch entries, and its partial sums) has all of that placed on its own node by the
+// kernel's first-touch policy; data which every worker reads can be replicated once per node with runOnNode.
+//
+// The topology is read from the affinity mask of the process and from /sys/devices/system; if the latter is missing,
+// every processor is taken to be on a single node. Pinning is available only on Linux.
+class Placement {
+
+private:
+
+	vector<int> cpus;
+	vector<int> cpuNodes;
+	vector<vector<int> > nodeCpus;
+
+public:
+
+	Placement();
+
+	// Read the topology. Returns false if the affinity mask of the process cannot be read, or threads cannot be pinned on
+	// this system.
+	bool load();
+
+	// The number of processors available, and the number of nodes on which they lie.
+	int cpuCount();
+	int nodeCount();
+
+	// The node (counting from zero, among those available) of the processor assigned to worker. Workers beyond the number
+	// of processors are assigned to them again in the same order.
+	int node(int worker);
+
+	// Pin the calling thread to the processor assigned to worker. Returns false if it cannot be pinned.
+	bool pin(int worker);
+
+	// Call fn with arg on a new thread confined to the processors of node, and wait for it to return, so that anything it
+	// allocates and fills is placed on that node.
+	void runOnNode(int node, void (*fn)(void *arg), void *arg);
+
+};
+
+// Return the number of processors this process can actually use, which is the default number of threads for every tool:
+// those online, limited to the processors in the affinity mask of the process (as set by taskset or a container runtime),
+// and to the processor quota (cpu.max) of its cgroup and of every cgroup above it, rounded up, under cgroup v2. Under a
+// budget of processors (see Pipeline::setBudget), it is further limited to the budget, rounded up.
+int availableProcessors(double budget = 0);
+
+// Allocate length bytes of zeroed anonymous memory, on transparent huge pages where the kernel provides them, or return
+// NULL. As with any memory, its pages are placed on the node of the thread which first touches them. It must be freed
+// with freeLocal, given the same length.
+void * allocLocal(size_t length);
+void freeLocal(void *p, size_t length);
+
+#endif
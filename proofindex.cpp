@@ -0,0 +1,115 @@
+#include "proofindex.h"
+#include <cstring>
+#include <climits>
+#include <unistd.h>
+#include <fcntl.h>
+
+ProofIndex::ProofIndex() {
+	this->fd = -1;
+	this->failed = false;
+	this->file.data = NULL;
+	this->file.length = 0;
+	this->file.mapped = false;
+	this->differenceBitOffsets = NULL;
+	this->entryOffsets = NULL;
+	this->valueBits = 0;
+	this->entryCount = 0;
+	this->entriesOffset = 0;
+	this->differenceOffset = 0;
+}
+
+ProofIndex::~ProofIndex() {
+	this->close();
+}
+
+uint64_t ProofIndex::tableOffset(int valueBits) {
+	return sizeof(ProofIndexHeader) + valueBits * sizeof(uint64_t);
+}
+
+bool ProofIndex::create(const char *path, int valueBits, bool resume) {
+	this->fd = ::open(path, O_WRONLY | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+	this->failed = false;
+	this->valueBits = valueBits;
+	return this->fd >= 0;
+}
+
+bool ProofIndex::isOpen() {
+	return this->fd >= 0 || this->file.data != NULL;
+}
+
+bool ProofIndex::sync() {
+	return this->fd < 0 || (!this->failed && fdatasync(this->fd) == 0);
+}
+
+void ProofIndex::setEntryOffsets(uint64_t first, const uint64_t *offsets, int count) {
+	if (this->fd < 0) return;
+	size_t length = count * sizeof(uint64_t);
+	if (pwrite(this->fd, offsets, length, this->tableOffset(this->valueBits) + first * sizeof(uint64_t)) != (ssize_t) length) {
+		this->failed = true;
+	}
+}
+
+bool ProofIndex::finish(uint64_t entryCount, uint64_t entriesOffset, uint64_t differenceOffset, const vector<uint64_t> &differenceBitOffsets) {
+	if (this->fd < 0) return false;
+
+	ProofIndexHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PROOF_INDEX_MAGIC, sizeof(header.magic));
+	header.valueBits = this->valueBits;
+	header.entryCount = entryCount;
+	header.entriesOffset = entriesOffset;
+	header.differenceOffset = differenceOffset;
+
+	bool ok = !this->failed;
+	ok &= pwrite(this->fd, &header, sizeof(header), 0) == sizeof(header);
+	ok &= pwrite(this->fd, &differenceBitOffsets[0], this->valueBits * sizeof(uint64_t), sizeof(header)) == (ssize_t) (this->valueBits * sizeof(uint64_t));
+	ok &= ftruncate(this->fd, this->tableOffset(this->valueBits) + entryCount * sizeof(uint64_t)) == 0;
+	return ok;
+}
+
+bool ProofIndex::open(const char *path) {
+	if (!mapFile(path, this->file)) return false;
+
+	// The tables must fit within the file. Their lengths are checked by division, so that a hostile header cannot make
+	// them appear to fit by overflowing.
+	const ProofIndexHeader *header = reinterpret_cast<const ProofIndexHeader *>(this->file.data);
+	if (this->file.length < sizeof(ProofIndexHeader) || memcmp(header->magic, PROOF_INDEX_MAGIC, sizeof(header->magic)) != 0
+		|| header->valueBits == 0 || header->valueBits > INT_MAX
+		|| header->valueBits > (this->file.length - sizeof(ProofIndexHeader)) / sizeof(uint64_t)
+		|| header->entryCount > (this->file.length - this->tableOffset(header->valueBits)) / sizeof(uint64_t)) {
+		this->close();
+		return false;
+	}
+
+	this->valueBits = header->valueBits;
+	this->entryCount = header->entryCount;
+	this->entriesOffset = header->entriesOffset;
+	this->differenceOffset = header->differenceOffset;
+	this->differenceBitOffsets = reinterpret_cast<const uint64_t *>(this->file.data + sizeof(ProofIndexHeader));
+	this->entryOffsets = reinterpret_cast<const uint64_t *>(this->file.data + this->tableOffset(this->valueBits));
+	return true;
+}
+
+void ProofIndex::close() {
+	if (this->fd >= 0) ::close(this->fd);
+	this->fd = -1;
+	if (this->file.data != NULL) unmapFile(this->file);
+	this->differenceBitOffsets = NULL;
+	this->entryOffsets = NULL;
+}
+
+uint64_t ProofIndex::entryOffset(uint64_t index) {
+	return this->entryOffsets[index];
+}
+
+const char * ProofIndex::entryAt(uint64_t index, const char *base, const char *begin, const char *end) {
+	if (index >= this->entryCount || base == NULL) return NULL;
+	uint64_t offset = this->entryOffsets[index];
+	if (offset < (uint64_t) (begin - base) || offset >= (uint64_t) (end - base)) return NULL;
+	const char *p = base + offset;
+	return (p == begin || p[-1] == '\n') ? p : NULL;
+}
+
+uint64_t ProofIndex::differenceBitOffset(int ii) {
+	return this->differenceBitOffsets[ii];
+}
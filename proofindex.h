@@ -0,0 +1,81 @@
+#ifndef PROOFINDEX_H
+#define PROOFINDEX_H
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include "zeroledge.h"
+#include "zlutil.h"
+
+#define PROOF_INDEX_MAGIC "ZLINDEX1"
+
+// ProofIndexHeader is the fixed-size header at the start of a proof index file. It is followed by one 64-bit byte offset
+// for each difference bit, and then by one 64-bit byte offset for each ledger entry, in order of entry index. All offsets
+// are measured from the start of the proof transcript to which the index belongs, and all fields are in native byte order.
+struct ProofIndexHeader {
+	char magic[8];
+	uint32_t valueBits;
+	uint32_t reserved;
+	uint64_t entryCount;
+	uint64_t entriesOffset;
+	uint64_t differenceOffset;
+};
+
+// ProofIndex maps ledger entry indices to their locations within a proof transcript, so that a verifier which is only
+// interested in a few entries can seek directly to them rather than parsing the transcript from the beginning. It is
+// written by the generator while the proof is being written, and read by the verifier via a memory-mapping.
+class ProofIndex {
+
+private:
+
+	int fd;
+	atomic<bool> failed;
+	MappedFile file;
+	const uint64_t *differenceBitOffsets;
+	const uint64_t *entryOffsets;
+
+	uint64_t tableOffset(int valueBits);
+
+public:
+
+	int valueBits;
+	uint64_t entryCount, entriesOffset, differenceOffset;
+
+	ProofIndex();
+	~ProofIndex();
+
+	// Create a new index file at path, for a proof whose balances are restricted to valueBits bits. If resume is set, the
+	// offsets already in an existing index are kept.
+	bool create(const char *path, int valueBits, bool resume);
+
+	bool isOpen();
+
+	// Flush the offsets written so far to disk. Returns false if any of them could not be written.
+	bool sync();
+
+	// Record the offsets of count consecutive entries, beginning with entry index first. This function may be called
+	// concurrently by many threads, in any order, so long as no two calls cover the same entries.
+	void setEntryOffsets(uint64_t first, const uint64_t *offsets, int count);
+
+	// Write the header and difference bit table. This must be called only once all entry offsets have been recorded. The
+	// index remains open, so that it can still be synced, until it is closed. Returns false if anything, including any of
+	// the entry offsets, could not be written.
+	bool finish(uint64_t entryCount, uint64_t entriesOffset, uint64_t differenceOffset, const vector<uint64_t> &differenceBitOffsets);
+
+	// Map an existing index file for reading. Returns false if it cannot be read, or is not a proof index. close releases
+	// the index, whether it was opened or created.
+	bool open(const char *path);
+	void close();
+
+	// The offsets are returned exactly as they were read, without being checked against the proof, so they must not be
+	// trusted to lie within it, or to be those of whole entries.
+	uint64_t entryOffset(uint64_t index);
+
+	// Return the location of entry index within the file mapped at base, the entries in which lie in [begin, end), or NULL
+	// if the index holds no such entry, or the offset it gives does not lie at the start of a line within [begin, end).
+	const char * entryAt(uint64_t index, const char *base, const char *begin, const char *end);
+	uint64_t differenceBitOffset(int ii);
+
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include "proofreader.h"
+#include "textcodec.h"
+#include "treehash.h"
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+
+ProofReader::ProofReader() {
+	this->data = NULL;
+	this->end = NULL;
+	this->entriesBegin = NULL;
+	this->entriesEnd = NULL;
+	this->differenceBegin = NULL;
+	this->manifest = false;
+	this->valueBits = 0;
+}
+
+ProofReader::~ProofReader() {
+	if (!this->manifest) return;
+	for (size_t ii = 0; ii < this->regions.size(); ii++) {
+		if (this->regions[ii].file.data != NULL) unmapFile(this->regions[ii].file);
+	}
+}
+
+// Return the start of the line preceding the line which begins at p.
+static const char * previousLine(const char *begin, const char *p) {
+	if (p <= begin) return begin;
+	p--;
+	while (p > begin && p[-1] != '\n') p--;
+	return p;
+}
+
+bool ProofReader::readHeader(const char *data, size_t length) {
+	this->data = data;
+	this->end = data + length;
+	this->manifest = (length >= 24 && strncmp(data, "BEGIN ZEROLEDGE MANIFEST", 24) == 0);
+
+	const char *p = data;
+	int shardCount = 1;
+
+	p = skipLines(p, this->end, 2);	// BEGIN ZEROLEDGE PROOF, ====================
+
+	if (this->end - p < 7 || strncmp(p, "ASSETS ", 7) != 0) return false;
+	p = readBig(p + 7, this->end, this->assets, true);
+
+	if (this->end - p < 5 || strncmp(p, "TIME ", 5) != 0) return false;
+	this->proofTime = strtoll(p + 5, NULL, 10);
+	p = skipLines(p, this->end, 1);
+
+	if (this->end - p < 5 || strncmp(p, "BITS ", 5) != 0) return false;
+	this->valueBits = atoi(p + 5);
+	p = skipLines(p, this->end, 1);
+	if (this->valueBits <= 0) return false;
+
+	if (this->manifest) {
+		if (this->end - p < 7 || strncmp(p, "SHARDS ", 7) != 0) return false;
+		shardCount = atoi(p + 7);
+		p = skipLines(p, this->end, 1);
+		if (shardCount <= 0) return false;
+		this->regions.resize(shardCount);
+	}
+
+	// The root of the entry tree appears only in rooted proofs.
+	this->entriesRoot.clear();
+	if (this->end - p >= 8 && strncmp(p, "ENTRIES ", 8) == 0) {
+		const char *eol = skipLines(p, this->end, 1);
+		this->entriesRoot.assign(p + 8, eol - p - 8);
+		while (!this->entriesRoot.empty() && isspace(this->entriesRoot[this->entriesRoot.size() - 1])) {
+			this->entriesRoot.resize(this->entriesRoot.size() - 1);
+		}
+		if (this->entriesRoot.size() != 2 * TREE_HASH_DIGEST_BYTES) return false;
+		p = eol;
+	}
+
+	p = skipLines(p, this->end, 1);	// ====================
+
+	p = readPoint(p, this->end, this->g);
+	p = readPoint(p, this->end, this->h);
+	p = readPoint(p, this->end, this->f);
+	this->entriesBegin = p;
+
+	return true;
+}
+
+bool ProofReader::open(const char *data, size_t length, const char *path, bool mapShards) {
+	if (!this->readHeader(data, length)) return false;
+
+	const char *p = this->entriesBegin;
+	int shardCount = this->regions.size();
+
+	if (this->manifest) {
+
+		// Each shard is listed on its own line, with its name relative to the manifest, its entry range, and its digest.
+		string directory = (path != NULL) ? path : "";
+		size_t slash = directory.find_last_of('/');
+		directory = (slash == string::npos) ? "" : directory.substr(0, slash + 1);
+
+		p = skipLines(p, this->end, 1);	// ====================
+
+		uint64_t nextEntry = 0;
+		for (int ii = 0; ii < shardCount; ii++) {
+			const char *eol = skipLines(p, this->end, 1);
+			istringstream line(string(p, eol - p));
+			ProofRegion &region = this->regions[ii];
+			region.file.data = NULL;
+			if (!(line >> region.path >> region.firstEntry >> region.entryCount >> region.digest)) return false;
+			if (region.firstEntry != nextEntry) return false;
+			nextEntry += region.entryCount;
+
+			region.path = directory + region.path;
+			region.mapped = false;
+			region.base = NULL;
+			region.begin = NULL;
+			region.end = NULL;
+			p = eol;
+		}
+
+		this->entriesEnd = p;
+		if (*p != '=') return false;
+		this->differenceBegin = skipLines(p, this->end, 1);
+
+		if (*skipLines(this->differenceBegin, this->end, PROOF_BIT_LINES * this->valueBits) != '=') return false;
+		return !mapShards || this->mapRegions(0, UINT64_MAX);
+	}
+
+	// Now walk backward from the end, over END ZEROLEDGE PROOF, a separator, the difference bits, and another separator.
+	const char *q = this->end;
+	while (q > this->entriesBegin && (q[-1] == '\n' || q[-1] == '\r' || q[-1] == ' ')) q--;
+	q = previousLine(this->entriesBegin, skipLines(q, this->end, 1));	// END ZEROLEDGE PROOF
+	q = previousLine(this->entriesBegin, q);	// ====================
+	if (*q != '=') return false;
+	for (int ii = 0; ii < PROOF_BIT_LINES * this->valueBits; ii++) {
+		q = previousLine(this->entriesBegin, q);
+	}
+	this->differenceBegin = q;
+	q = previousLine(this->entriesBegin, q);	// ====================
+	if (*q != '=') return false;
+	this->entriesEnd = q;
+
+	// A monolithic proof is a single region, the number of entries in which is not known until its lines are counted.
+	this->regions.resize(1);
+	this->regions[0].mapped = true;
+	this->regions[0].base = this->data;
+	this->regions[0].begin = this->entriesBegin;
+	this->regions[0].end = this->entriesEnd;
+	this->regions[0].firstEntry = 0;
+	this->regions[0].entryCount = 0;
+	this->regions[0].file.data = NULL;
+
+	return true;
+}
+
+bool ProofReader::mapRegions(uint64_t first, uint64_t last) {
+	if (!this->manifest) return true;
+
+	for (size_t ii = 0; ii < this->regions.size(); ii++) {
+		ProofRegion &region = this->regions[ii];
+		if (region.mapped) continue;
+
+		// An empty shard is read if its position lies within the range, so that its digest is still checked.
+		uint64_t regionEnd = region.firstEntry + region.entryCount;
+		if (region.entryCount > 0 ? (region.firstEntry >= last || regionEnd <= first) : (region.firstEntry < first || region.firstEntry > last)) continue;
+
+		if (!mapFile(region.path.c_str(), region.file)) return false;
+		region.mapped = true;
+		region.base = region.file.data;
+		region.begin = region.file.data;
+		region.end = region.file.data + region.file.length;
+	}
+
+	return true;
+}
+
+size_t ProofReader::entryLines() {
+	return PROOF_ENTRY_LINES(this->valueBits);
+}
+
+int ProofReader::findRegion(uint64_t index) {
+	int low = 0, high = this->regions.size();
+	while (high - low > 1) {
+		int middle = (low + high) / 2;
+		if (this->regions[middle].firstEntry <= index) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+	ProofRegion &region = this->regions[low];
+	return (index >= region.firstEntry && index - region.firstEntry < region.entryCount) ? low : -1;
+}
+
+const char * ProofReader::readEntry(const char *p, const char *end, LedgerEntry &e, LEPProcessor &lepgen, LBPProcessor &lbpgen) {
+	e = LedgerEntry(this->valueBits);
+
+	p = this->readEntryProof(p, end, e, lepgen);
+	return this->readBits(p, end, e, lbpgen, 0, this->valueBits);
+}
+
+const char * ProofReader::readEntryProof(const char *p, const char *end, LedgerEntry &e, LEPProcessor &lepgen) {
+	p = readPoint(p, end, e.lec);
+	p = readPoint(p, end, e.lep.gamma);
+	lepgen.challengeProof(e);
+	p = readBig(p, end, e.lep.z1);
+	p = readBig(p, end, e.lep.z2);
+	p = readBig(p, end, e.lep.z3);
+
+	return p;
+}
+
+const char * ProofReader::readBits(const char *p, const char *end, LedgerEntry &e, LBPProcessor &lbpgen, int first, int last) {
+	for (int kk = first; kk < last; kk++) {
+		p = readPoint(p, end, e.lbc[kk]);
+		p = readPoint(p, end, e.lbp[kk].gamma1);
+		p = readPoint(p, end, e.lbp[kk].gamma2);
+		lbpgen.challengeProof(e, kk);
+		p = readBig(p, end, e.lbp[kk].c1);
+		e.lbp[kk].c2 = lxor(e.lbp[kk].c, e.lbp[kk].c1);
+		p = readBig(p, end, e.lbp[kk].z1);
+		p = readBig(p, end, e.lbp[kk].z2);
+		p = readBig(p, end, e.lbp[kk].z3);
+		p = readBig(p, end, e.lbp[kk].z4);
+	}
+
+	return p;
+}
+
+void ProofReader::readDifferenceBits(Ledger &l, DBPProcessor &dbpgen) {
+	this->readDifferenceBits(l, dbpgen, 0, this->valueBits);
+}
+
+void ProofReader::readDifferenceBits(Ledger &l, DBPProcessor &dbpgen, int first, int last) {
+	const char *p = skipLines(this->differenceBegin, this->end, PROOF_BIT_LINES * first);
+
+	for (int ii = first; ii < last; ii++) {
+		p = readPoint(p, this->end, l.dbc[ii]);
+		p = readPoint(p, this->end, l.dbp[ii].gamma1);
+		p = readPoint(p, this->end, l.dbp[ii].gamma2);
+		dbpgen.challengeProof(l, ii);
+		p = readBig(p, this->end, l.dbp[ii].c1);
+		l.dbp[ii].c2 = lxor(l.dbp[ii].c, l.dbp[ii].c1);
+		p = readBig(p, this->end, l.dbp[ii].z1);
+		p = readBig(p, this->end, l.dbp[ii].z2);
+		p = readBig(p, this->end, l.dbp[ii].z3);
+		p = readBig(p, this->end, l.dbp[ii].z4);
+	}
+}
+
+const char * ProofReader::readBig(const char *p, const char *end, Big &x, bool decimal) {
+	const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+	if (eol == NULL) eol = end;
+
+	// The field is decoded in place, since the transcript is read-only.
+	size_t length = eol - p;
+	if (length > 0 && p[length - 1] == '\r') length--;
+	if (decimal) {
+		decodeDecimal(p, length, x);
+	} else {
+		decodeBig(p, length, x);
+	}
+
+	return (eol < end) ? eol + 1 : end;
+}
+
+const char * ProofReader::readPoint(const char *p, const char *end, ECn &point) {
+	Big cx;
+	p = readBig(p, end, cx);
+	int ylsb = (p < end && *p == '1') ? 1 : 0;
+	point = ECn(cx, ylsb);
+	return skipLines(p, end, 1);
+}
@@ -0,0 +1,106 @@
+#ifndef PROOFREADER_H
+#define PROOFREADER_H
+
+#include <stdint.h>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "zeroledge.h"
+#include "zlutil.h"
+#include "ledger.h"
+#include "lepprocessor.h"
+#include "lbpprocessor.h"
+#include "dbpprocessor.h"
+
+// Every ledger entry in a proof transcript occupies a fixed number of lines: two each for the commitment and gamma
+// points, three for the z values, and eleven for each ledger bit (three points, c1, and four z values). Difference bits
+// are laid out identically to ledger bits.
+#define PROOF_BIT_LINES 11
+#define PROOF_ENTRY_LINES(valueBits) (7 + PROOF_BIT_LINES * (valueBits))
+
+// ProofRegion represents a contiguous run of ledger entries within a proof. A monolithic proof has a single region; a
+// sharded proof has one region per shard, each of which is a separate file. Index offsets for the entries in a region
+// are relative to base, which is the start of the file that contains them. A region is mapped once its file has been read.
+struct ProofRegion {
+	bool mapped;
+	const char *base, *begin, *end;
+	uint64_t firstEntry, entryCount;
+	string path, digest;
+	MappedFile file;
+};
+
+// ProofReader parses a proof transcript, or a manifest and the shards it lists, which are held entirely in memory
+// (generally, memory-mapped). It never modifies or copies the transcript, so any number of threads may parse entries from
+// a single ProofReader concurrently, provided that each thread uses its own LedgerEntry objects and processors.
+class ProofReader {
+
+public:
+
+	const char *data, *end;
+	const char *entriesBegin, *entriesEnd, *differenceBegin;
+	bool manifest;
+	vector<ProofRegion> regions;
+
+	Big assets;
+	time_t proofTime;
+	int valueBits;
+	ECn g, h, f;
+
+	// The hexadecimal root of the entry tree (see treehash.h), or empty if the proof is not rooted.
+	string entriesRoot;
+
+	ProofReader();
+	~ProofReader();
+
+	// Read the proof header and bases, and locate the entry and difference bit sections. The difference bit section is
+	// located by walking backward from the end of the transcript, so this costs time proportional to valueBits rather
+	// than to the number of entries. If the transcript is a manifest, each of the shards it lists is mapped (unless
+	// mapShards is cleared), and shard names are resolved relative to path. Returns false if the transcript is malformed
+	// or a shard cannot be read.
+	bool open(const char *data, size_t length, const char *path, bool mapShards = true);
+
+	// Map the shards of a manifest which hold any of the entries [first, last), if they are not already mapped. The regions
+	// of shards which are not mapped have no data. Returns false if a shard cannot be read.
+	bool mapRegions(uint64_t first, uint64_t last);
+
+	// Read only the proof header and bases, which is all that is needed to check an entry against the entry tree. The
+	// transcript may be truncated anywhere after the bases. Returns false if the header is malformed.
+	bool readHeader(const char *data, size_t length);
+
+	// The number of lines occupied by a single ledger entry in this transcript.
+	size_t entryLines();
+
+	// Return the index of the region which contains entry index, or -1 if there is none.
+	int findRegion(uint64_t index);
+
+
+	// Parse a single ledger entry whose first line begins at cursor into e, computing the ledger entry and ledger bit
+	// challenges as it goes, so that e is ready to be verified. end is the end of the region containing the entry. Returns
+	// a pointer to the line following the entry.
+	const char * readEntry(const char *cursor, const char *end, LedgerEntry &e, LEPProcessor &lepgen, LBPProcessor &lbpgen);
+
+	// Parse only the commitment and entry proof of the entry at cursor into e, which must already have valueBits bits, and
+	// compute its challenge. Returns a pointer to the first line of its bits.
+	const char * readEntryProof(const char *cursor, const char *end, LedgerEntry &e, LEPProcessor &lepgen);
+
+	// Parse the bits [first, last) of an entry into e, computing their challenges, given a pointer to the first line of bit
+	// first. Disjoint ranges of the bits of a single entry may be parsed by several threads at once, each with its own
+	// processor. Returns a pointer to the line following the last bit.
+	const char * readBits(const char *cursor, const char *end, LedgerEntry &e, LBPProcessor &lbpgen, int first, int last);
+
+	// Parse the difference bit commitments and proofs into l, computing their challenges as it goes.
+	void readDifferenceBits(Ledger &l, DBPProcessor &dbpgen);
+
+	// Parse only the difference bits [first, last) into l. As with the bits of an entry, disjoint ranges may be parsed by
+	// several threads at once.
+	void readDifferenceBits(Ledger &l, DBPProcessor &dbpgen, int first, int last);
+
+	// Read a single line into x, in base DATA_BASE, or in base 10 if decimal is set. Returns a pointer to the following line.
+	static const char * readBig(const char *p, const char *end, Big &x, bool decimal = false);
+
+	// Read a compressed point, which occupies two lines (the x coordinate and the least significant bit of y).
+	static const char * readPoint(const char *p, const char *end, ECn &point);
+
+};
+
+#endif
@@ -0,0 +1,389 @@
+#include "proofwriter.h"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+
+ProofWriter::ProofWriter() {
+	this->entriesPerShard = 0;
+	this->shardCount = 1;
+	this->entriesOffset = 0;
+	this->differenceOffset = 0;
+	this->rooted = false;
+	this->resumed = false;
+	this->rootOffset = 0;
+	this->partition = -1;
+}
+
+ProofWriter::~ProofWriter() {
+	for (size_t ii = 0; ii < this->shards.size(); ii++) {
+		delete this->shards[ii];
+		delete this->shardDigests[ii];
+	}
+}
+
+int ProofWriter::shardOf(uint64_t index) {
+	uint64_t shard = index / this->entriesPerShard;
+	return (shard < (uint64_t) this->shardCount) ? shard : this->shardCount - 1;
+}
+
+uint64_t ProofWriter::entriesPerShardOf(uint64_t entryCount, int shardCount) {
+	uint64_t entriesPerShard = (entryCount + shardCount - 1) / shardCount;
+	return (entriesPerShard > 0) ? entriesPerShard : 1;
+}
+
+void ProofWriter::shardRange(uint64_t entryCount, int shardCount, int shard, uint64_t &first, uint64_t &count) {
+	uint64_t entriesPerShard = entriesPerShardOf(entryCount, shardCount);
+
+	// The last shard takes whatever remains, exactly as shardOf assigns entries.
+	first = min(shard * entriesPerShard, entryCount);
+	count = (shard + 1 < shardCount) ? min(first + entriesPerShard, entryCount) - first : entryCount - first;
+}
+
+bool ProofWriter::open(const char *path, int shardCount, uint64_t entryCount, bool direct, bool rooted) {
+	return this->openOutputs(path, shardCount, entryCount, direct, rooted, NULL);
+}
+
+bool ProofWriter::openSink(OutputSink sink, void *user) {
+	this->shardCount = 1;
+	this->rooted = false;
+	this->proofFile.setDigest(&this->proofDigest);
+	return this->proofFile.openSink(sink, user);
+}
+
+bool ProofWriter::reopen(const char *path, int shardCount, uint64_t entryCount, bool direct, bool rooted, const vector<uint64_t> &sizes, const vector<uint64_t> &shardEntries) {
+	int count = (shardCount > 1) ? shardCount : 1;
+	if (path == NULL || sizes.size() != (size_t) (count > 1 ? count + 1 : 1) || shardEntries.size() != (size_t) (count > 1 ? count : 0)) {
+		return false;
+	}
+
+	this->resumed = true;
+	if (!this->openOutputs(path, shardCount, entryCount, direct, rooted, &sizes)) return false;
+	if (this->isSharded()) this->shardEntries = shardEntries;
+	return true;
+}
+
+// Open the outputs, either afresh, or, if sizes is given, keeping the output already written before a checkpoint.
+bool ProofWriter::openOutputs(const char *path, int shardCount, uint64_t entryCount, bool direct, bool rooted, const vector<uint64_t> *sizes) {
+	this->shardCount = (shardCount > 1) ? shardCount : 1;
+	this->rooted = rooted;
+
+	this->proofFile.setDigest(&this->proofDigest);
+
+	if (path == NULL) {
+		return this->shardCount == 1 && !rooted && this->proofFile.open(NULL, direct);
+	}
+
+	this->path = path;
+	if (sizes != NULL) {
+		if (!this->proofFile.reopen(path, direct, (*sizes)[0])) return false;
+	} else {
+		if (!this->proofFile.open(path, direct)) return false;
+	}
+
+	if (this->shardCount == 1) return !rooted || this->proofFile.isPositional();
+
+	this->entriesPerShard = entriesPerShardOf(entryCount, this->shardCount);
+	this->shards.resize(this->shardCount);
+	this->shardDigests.resize(this->shardCount);
+	this->shardEntries.resize(this->shardCount, 0);
+	this->shardDigestHex.resize(this->shardCount);
+
+	char name[this->path.size() + 16];
+	for (int ii = 0; ii < this->shardCount; ii++) {
+		snprintf(name, sizeof(name), SHARD_NAME_FORMAT, path, ii);
+		this->shards[ii] = new OutputFile();
+		this->shardDigests[ii] = new TreeHash();
+		this->shards[ii]->setDigest(this->shardDigests[ii]);
+		if (sizes != NULL) {
+			if (!this->shards[ii]->reopen(name, direct, (*sizes)[ii + 1]) || !this->shards[ii]->digestExisting(0)) return false;
+		} else {
+			if (!this->shards[ii]->open(name, direct)) return false;
+		}
+	}
+
+	return true;
+}
+
+bool ProofWriter::isSharded() {
+	return this->shardCount > 1;
+}
+
+bool ProofWriter::openPartition(const char *path, int shardCount, int shard, uint64_t entryCount, bool direct) {
+	if (path == NULL || shardCount <= 1 || shard < 0 || shard >= shardCount) return false;
+
+	this->path = path;
+	this->shardCount = shardCount;
+	this->partition = shard;
+	this->entriesPerShard = entriesPerShardOf(entryCount, shardCount);
+	this->shards.resize(shardCount, NULL);
+	this->shardDigests.resize(shardCount, NULL);
+	this->shardEntries.resize(shardCount, 0);
+
+	char name[this->path.size() + 16];
+	snprintf(name, sizeof(name), SHARD_NAME_FORMAT, path, shard);
+	this->shards[shard] = new OutputFile();
+	this->shardDigests[shard] = new TreeHash();
+	this->shards[shard]->setDigest(this->shardDigests[shard]);
+	return this->shards[shard]->open(name, direct);
+}
+
+bool ProofWriter::finishPartition(string &digest) {
+	char buffer[TREE_HASH_DIGEST_BYTES];
+	OutputFile *shard = this->shards[this->partition];
+
+	this->shardDigests[this->partition]->finish(shard->size(), buffer);
+	digest = toHex(buffer, sizeof(buffer));
+	return shard->close();
+}
+
+bool ProofWriter::openManifest(const char *path, int shardCount, bool direct) {
+	if (path == NULL || shardCount <= 1) return false;
+
+	this->path = path;
+	this->shardCount = shardCount;
+	this->shards.resize(shardCount, NULL);
+	this->shardDigests.resize(shardCount, NULL);
+	this->shardEntries.resize(shardCount, 0);
+	this->shardDigestHex.resize(shardCount);
+
+	this->proofFile.setDigest(&this->proofDigest);
+	return this->proofFile.open(path, direct);
+}
+
+void ProofWriter::setShard(int shard, uint64_t entryCount, const string &digest) {
+	this->shardEntries[shard] = entryCount;
+	this->shardDigestHex[shard] = digest;
+}
+
+void ProofWriter::mark(vector<uint64_t> &sizes, vector<uint64_t> &shardEntries) {
+	sizes.resize(this->shards.size() + 1);
+	sizes[0] = this->proofFile.size();
+	for (size_t ii = 0; ii < this->shards.size(); ii++) {
+		sizes[ii + 1] = (this->shards[ii] != NULL) ? this->shards[ii]->size() : 0;
+	}
+	shardEntries = this->shardEntries;
+}
+
+bool ProofWriter::sync() {
+	bool ok = this->proofFile.sync();
+	for (size_t ii = 0; ii < this->shards.size(); ii++) {
+		if (this->shards[ii] != NULL) ok &= this->shards[ii]->sync();
+	}
+	return ok;
+}
+
+void ProofWriter::writeHeader(Big assets, time_t proofTime, int valueBits, ECn g, ECn h, ECn f) {
+	stringstream &section = this->manifest;
+	Big cx;
+	int ylsb;
+
+	get_mip()->IOBASE=10;
+
+	section << (this->isSharded() ? "BEGIN ZEROLEDGE MANIFEST" : "BEGIN ZEROLEDGE PROOF") << endl;
+	section << SECTION_SEPARATOR;
+	section << endl;
+	section << "ASSETS " << assets << endl;
+	section << "TIME " << proofTime << endl;
+	section << "BITS " << valueBits << endl;
+	if (this->isSharded()) section << "SHARDS " << this->shardCount << endl;
+	if (this->rooted) {
+		section << "ENTRIES ";
+		this->rootOffset = section.tellp();
+		section << string(2 * TREE_HASH_DIGEST_BYTES, '0') << endl;
+	}
+
+	section << SECTION_SEPARATOR;
+	section << endl;
+
+	get_mip()->IOBASE=DATA_BASE;
+
+	ylsb = g.get(cx);
+	section << cx << endl << ylsb << endl;
+	ylsb = h.get(cx);
+	section << cx << endl << ylsb << endl;
+	ylsb = f.get(cx);
+	section << cx << endl << ylsb << endl;
+
+	this->differenceBitOffsets.resize(valueBits);
+
+	// A monolithic proof is written immediately (or placed, if it is rooted), but a manifest cannot be written until the
+	// shard digests are known. When resuming, the header was placed before the checkpoint; everything written since is
+	// added to the digest again, and a rooted header, which has yet to be written, is given its place at the start.
+	if (!this->isSharded()) {
+		this->header = section.str();
+		this->entriesOffset = this->header.size();
+		if (this->resumed) {
+			this->proofFile.digestExisting(this->rooted ? this->entriesOffset : 0);
+			if (this->rooted) {
+				OutputRun run;
+				run.file = &this->proofFile;
+				run.data = this->header.data();
+				run.length = this->header.size();
+				run.offset = 0;
+				this->headerRuns.push_back(run);
+			}
+		} else if (this->rooted) {
+			this->proofFile.place(this->header.data(), this->header.size(), this->headerRuns);
+		} else {
+			this->proofFile.append(this->header.data(), this->header.size());
+		}
+		section.str(std::string());
+	}
+}
+
+void ProofWriter::putEntry(TextBuffer &output, LedgerEntry &e) {
+	Big cx;
+
+	output.putPoint(e.lec, cx, '\n');
+	output.putPoint(e.lep.gamma, cx, '\n');
+	output.putBig(e.lep.z1);
+	output.putChar('\n');
+	output.putBig(e.lep.z2);
+	output.putChar('\n');
+	output.putBig(e.lep.z3);
+	output.putChar('\n');
+
+	for (int kk = 0; kk < e.valueBits; kk++) {
+		output.putPoint(e.lbc[kk], cx, '\n');
+		output.putPoint(e.lbp[kk].gamma1, cx, '\n');
+		output.putPoint(e.lbp[kk].gamma2, cx, '\n');
+		output.putBig(e.lbp[kk].c1);
+		output.putChar('\n');
+		output.putBig(e.lbp[kk].z1);
+		output.putChar('\n');
+		output.putBig(e.lbp[kk].z2);
+		output.putChar('\n');
+		output.putBig(e.lbp[kk].z3);
+		output.putChar('\n');
+		output.putBig(e.lbp[kk].z4);
+		output.putChar('\n');
+	}
+}
+
+void ProofWriter::placeEntries(uint64_t first, const char *text, size_t length, uint64_t *offsets, int count, vector<OutputRun> &runs) {
+	int ii, jj, kk, shard;
+	size_t begin, end;
+	uint64_t fileOffset;
+	OutputFile *destination;
+
+	// Divide the entries into runs which belong to the same shard, and place each run in its shard in one piece.
+	for (ii = 0; ii < count; ii = jj) {
+		shard = this->isSharded() ? this->shardOf(first + ii) : 0;
+		for (jj = ii + 1; jj < count && this->isSharded() && this->shardOf(first + jj) == shard; jj++);
+
+		begin = offsets[ii];
+		end = (jj < count) ? offsets[jj] : length;
+
+		if (this->isSharded()) {
+			destination = this->shards[shard];
+			this->shardEntries[shard] += jj - ii;
+		} else {
+			destination = &this->proofFile;
+		}
+
+		fileOffset = destination->size();
+		for (kk = ii; kk < jj; kk++) {
+			offsets[kk] = offsets[kk] - begin + fileOffset;
+		}
+
+		destination->place(text + begin, end - begin, runs);
+	}
+}
+
+void ProofWriter::setEntriesRoot(const char *root) {
+	this->entriesRoot = toHex(root, TREE_HASH_DIGEST_BYTES);
+}
+
+bool ProofWriter::writeFooter(Ledger &l) {
+	stringstream &section = this->manifest;
+	Big cx;
+	int ylsb;
+	bool ok = true;
+
+	// The shard table lists the name of each shard relative to the manifest, its entry range, and its digest. The digests of
+	// shards written as partitions were given to setShard.
+	if (this->isSharded()) {
+		size_t slash = this->path.find_last_of('/');
+		string base = (slash == string::npos) ? this->path : this->path.substr(slash + 1);
+		char name[base.size() + 16], digest[TREE_HASH_DIGEST_BYTES];
+
+		section << SECTION_SEPARATOR;
+		section << endl;
+
+		uint64_t first = 0;
+		for (int ii = 0; ii < this->shardCount; ii++) {
+			snprintf(name, sizeof(name), SHARD_NAME_FORMAT, base.c_str(), ii);
+			if (this->shards[ii] != NULL) {
+				this->shardDigests[ii]->finish(this->shards[ii]->size(), digest);
+				this->shardDigestHex[ii] = toHex(digest, sizeof(digest));
+				ok &= this->shards[ii]->finish();
+			}
+			section << name << ' ' << first << ' ' << this->shardEntries[ii] << ' ' << this->shardDigestHex[ii] << endl;
+			first += this->shardEntries[ii];
+		}
+	}
+
+	section << SECTION_SEPARATOR;
+	section << endl;
+
+	get_mip()->IOBASE=DATA_BASE;
+
+	this->differenceOffset = this->proofFile.size() + section.tellp();
+
+	for (int ii = 0; ii < l.valueBits; ii++) {
+		this->differenceBitOffsets[ii] = this->proofFile.size() + section.tellp();
+		ylsb = l.dbc[ii].get(cx);
+		section << cx << endl << ylsb << endl;
+		ylsb = l.dbp[ii].gamma1.get(cx);
+		section << cx << endl << ylsb << endl;
+		ylsb = l.dbp[ii].gamma2.get(cx);
+		section << cx << endl << ylsb << endl;
+		section << l.dbp[ii].c1 << endl;
+		section << l.dbp[ii].z1 << endl;
+		section << l.dbp[ii].z2 << endl;
+		section << l.dbp[ii].z3 << endl;
+		section << l.dbp[ii].z4 << endl;
+	}
+
+	section << SECTION_SEPARATOR;
+	section << endl;
+
+	section << (this->isSharded() ? "END ZEROLEDGE MANIFEST" : "END ZEROLEDGE PROOF") << endl;
+
+	string text = section.str();
+
+	// Fill in the root of the entry tree, which is the same width as the placeholder.
+	if (this->rooted && this->isSharded()) {
+		text.replace(this->rootOffset, this->entriesRoot.size(), this->entriesRoot);
+	} else if (this->rooted) {
+		memcpy(&this->header[this->rootOffset], this->entriesRoot.data(), this->entriesRoot.size());
+		OutputFile::writeRuns(this->headerRuns);
+	}
+
+	this->proofFile.append(text.data(), text.size());
+	ok &= this->proofFile.finish();
+
+	char digest[TREE_HASH_DIGEST_BYTES];
+	this->proofDigest.finish(this->proofFile.size(), digest);
+	this->digest = toHex(digest, sizeof(digest));
+
+	return ok;
+}
+
+void ProofWriter::discard() {
+	char name[this->path.size() + 16];
+	for (size_t ii = 0; ii < this->shards.size(); ii++) {
+		if (this->shards[ii] == NULL) continue;
+		this->shards[ii]->close();
+		snprintf(name, sizeof(name), SHARD_NAME_FORMAT, this->path.c_str(), (int) ii);
+		unlink(name);
+	}
+
+	// A partition writes only its own shard.
+	if (this->proofFile.isOpen()) {
+		this->proofFile.close();
+		if (!this->path.empty() && this->partition < 0) unlink(this->path.c_str());
+	}
+}
@@ -0,0 +1,138 @@
+#ifndef PROOFWRITER_H
+#define PROOFWRITER_H
+
+#include <stdint.h>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <sstream>
+#include "zeroledge.h"
+#include "zlutil.h"
+#include "ledger.h"
+#include "outputfile.h"
+#include "treehash.h"
+#include "textcodec.h"
+
+#define SHARD_NAME_FORMAT "%s.%d"
+
+// ProofWriter is responsible for the layout of the proof transcript. A proof is written either as a single monolithic
+// transcript, or as a manifest along with a number of shards. Each shard contains the entries for a contiguous range of
+// entry indices, in exactly the format in which they would appear in a monolithic transcript, and the manifest contains
+// everything else: the header, the bases, a table which lists each shard with its entry range and digest, and the
+// difference bit section. Thus concatenating the header, the shards, and the difference bit section in order yields
+// a monolithic transcript.
+//
+// ProofWriter is not thread safe; entries must be placed while holding a lock, or from a single thread, and in order of
+// entry index. Placing entries only assigns them their positions in the output, and does not write them; the resulting
+// runs may then be written by any number of threads at once (see outputfile.h). The digests of the shards and of the
+// transcript itself (or the manifest) are tree hashes (see treehash.h), which are computed as the runs are written.
+//
+// If the proof is rooted, its header also holds the root of the entry tree (see treehash.h), which is not known until every
+// entry has been generated. The header of a monolithic transcript is therefore placed with a placeholder of the same
+// width as the root, and is not written until the footer is, by which time the root has been filled in; this requires
+// that the transcript be written to a file rather than a pipe.
+//
+// A sharded proof may also be written by several processes (see partialsummary.h): each writes a single shard as a
+// partition, and a coordinator then writes the manifest, given the entry count and digest of each shard.
+class ProofWriter {
+
+private:
+
+	OutputFile proofFile;
+	string path;
+	stringstream manifest;
+	uint64_t entriesPerShard;
+	int shardCount;
+	vector<OutputFile *> shards;
+	TreeHash proofDigest;
+	vector<TreeHash *> shardDigests;
+	vector<uint64_t> shardEntries;
+	vector<string> shardDigestHex;
+	int partition;
+	bool rooted, resumed;
+	string header, entriesRoot;
+	size_t rootOffset;
+	vector<OutputRun> headerRuns;
+
+	int shardOf(uint64_t index);
+	static uint64_t entriesPerShardOf(uint64_t entryCount, int shardCount);
+	bool openOutputs(const char *path, int shardCount, uint64_t entryCount, bool direct, bool rooted, const vector<uint64_t> *sizes);
+
+public:
+
+	// The offsets of the entry section and the difference bit section, and of each difference bit. For a monolithic proof
+	// these are relative to the start of the transcript; for a sharded proof, entry offsets are relative to the start of
+	// the shard that contains them, and difference bit offsets to the start of the manifest.
+	uint64_t entriesOffset, differenceOffset;
+	vector<uint64_t> differenceBitOffsets;
+
+	// The hexadecimal digest of the monolithic transcript or the manifest, once the footer has been written.
+	string digest;
+
+	ProofWriter();
+	~ProofWriter();
+
+	// Open the proof destination. If path is NULL, a monolithic proof is written to stdout. If shardCount is greater than
+	// one, the manifest is written to path, and the shards alongside it; entryCount is the total number of entries that
+	// will be written, which is used to divide them evenly among the shards. If direct is set, the outputs are not retained
+	// in the page cache. If rooted is set, the header holds the root of the entry tree, and false is returned if the
+	// transcript cannot be written by position.
+	bool open(const char *path, int shardCount, uint64_t entryCount, bool direct, bool rooted);
+
+	// Open a monolithic proof which is passed to sink as it is written (see outputfile.h). It cannot be rooted, since its
+	// header is passed on before the root is known.
+	bool openSink(OutputSink sink, void *user);
+
+	// Open the proof destination as open does, but keep the output already written before a checkpoint, as recorded by
+	// mark; sizes holds the length of the transcript or manifest followed by that of each shard, and shardEntries the number
+	// of entries in each shard. writeHeader must still be called, but the header is not written again.
+	bool reopen(const char *path, int shardCount, uint64_t entryCount, bool direct, bool rooted, const vector<uint64_t> &sizes, const vector<uint64_t> &shardEntries);
+
+	bool isSharded();
+
+	// Find the range of entry indices [first, first + count) which belong to shard, when entryCount entries are divided among
+	// shardCount shards.
+	static void shardRange(uint64_t entryCount, int shardCount, int shard, uint64_t &first, uint64_t &count);
+
+	// Open only the given shard of a sharded proof at path, as a partition. The header and footer are not written; once
+	// every entry in the shard has been placed and written, finishPartition closes the shard and returns its digest.
+	bool openPartition(const char *path, int shardCount, int shard, uint64_t entryCount, bool direct);
+	bool finishPartition(string &digest);
+
+	// Open the manifest at path for a sharded proof whose shards have been written as partitions. setShard must be called
+	// with the entry count and hexadecimal digest of every shard before the footer is written.
+	bool openManifest(const char *path, int shardCount, bool direct);
+	void setShard(int shard, uint64_t entryCount, const string &digest);
+
+	// Record the current length of each output in sizes, and the number of entries placed in each shard in shardEntries.
+	void mark(vector<uint64_t> &sizes, vector<uint64_t> &shardEntries);
+
+	// Flush everything written so far to disk.
+	bool sync();
+
+	void writeHeader(Big assets, time_t proofTime, int valueBits, ECn g, ECn h, ECn f);
+
+	// Write the commitments and proofs of e to output, exactly as its entry appears in the transcript.
+	static void putEntry(TextBuffer &output, LedgerEntry &e);
+
+	// Place count entries beginning with entry index first. The length characters at text contain the entries in order,
+	// and offsets the position within text at which each begins; on return, offsets instead contains the position of each
+	// entry within the file to which it belongs, and runs contains the pieces of text which must be written. text must not
+	// change until they are.
+	void placeEntries(uint64_t first, const char *text, size_t length, uint64_t *offsets, int count, vector<OutputRun> &runs);
+
+	// Set the root of the entry tree of a rooted proof. This must be called before the footer is written.
+	void setEntriesRoot(const char *root);
+
+	// Write the difference bit commitments and proofs from l and the end of the proof, and finish all outputs, which remain
+	// open until the writer is destroyed, so that they can still be synced. Returns false if any output could not be
+	// written.
+	bool writeFooter(Ledger &l);
+
+	// Close all outputs and remove the files written, so that a run which fails part way leaves no partial proof behind. A
+	// proof written to stdout or a sink cannot be taken back.
+	void discard();
+
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include "textcodec.h"
+#include "zlutil.h"
+#include <cstring>
+#include <algorithm>
+
+static const char BASE64_DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static inline int base64Value(char c) {
+	if (c >= 'A' && c <= 'Z') return c - 'A';
+	if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+	if (c >= '0' && c <= '9') return c - '0' + 52;
+	if (c == '+') return 62;
+	if (c == '/') return 63;
+	return -1;
+}
+
+TextBuffer::TextBuffer() {
+	this->length = 0;
+}
+
+char * TextBuffer::extend(size_t count) {
+	if (this->length + count > this->buffer.size()) {
+		this->buffer.resize(max(2 * this->buffer.size(), this->length + count));
+	}
+	return &this->buffer[this->length];
+}
+
+const char * TextBuffer::data() const {
+	return this->buffer.empty() ? NULL : &this->buffer[0];
+}
+
+size_t TextBuffer::size() const {
+	return this->length;
+}
+
+void TextBuffer::clear() {
+	this->length = 0;
+}
+
+void TextBuffer::putChar(char c) {
+	*this->extend(1) = c;
+	this->length++;
+}
+
+void TextBuffer::putText(const char *text, size_t count) {
+	memcpy(this->extend(count), text, count);
+	this->length += count;
+}
+
+void TextBuffer::putText(const string &text) {
+	this->putText(text.data(), text.size());
+}
+
+void TextBuffer::putInteger(uint64_t value) {
+	char digits[20];
+	int count = 0;
+
+	do {
+		digits[sizeof(digits) - ++count] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+
+	this->putText(digits + sizeof(digits) - count, count);
+}
+
+void TextBuffer::putConverted(const Big &x, int base) {
+	int previous = get_mip()->IOBASE;
+
+	// Any base of at least two needs no more than one character per bit, plus a sign, padding, and the terminator.
+	get_mip()->IOBASE = base;
+	this->length += cotstr(x.getbig(), this->extend(bits(x) + 8));
+	get_mip()->IOBASE = previous;
+}
+
+void TextBuffer::putBig(const Big &x) {
+	unsigned char bytes[TEXT_MAX_BYTES];
+	char *p;
+	int count, ii;
+	uint32_t group;
+
+	if (bits(x) > 8 * TEXT_MAX_BYTES) {
+		this->putConverted(x, DATA_BASE);
+		return;
+	}
+
+	// MIRACL writes the magnitude as at least one byte, so zero is written as a single zero byte.
+	count = to_binary(x, TEXT_MAX_BYTES, (char *) bytes, false);
+	if (count == 0) bytes[count++] = 0;
+
+	p = this->extend(1 + 4 * ((count + 2) / 3));
+	if (exsign(x.getbig()) < 0) *p++ = '-';
+
+	// Each group of three bytes becomes four digits; a final partial group is padded with '='.
+	for (ii = 0; ii + 3 <= count; ii += 3) {
+		group = (bytes[ii] << 16) | (bytes[ii + 1] << 8) | bytes[ii + 2];
+		p[0] = BASE64_DIGITS[(group >> 18) & 63];
+		p[1] = BASE64_DIGITS[(group >> 12) & 63];
+		p[2] = BASE64_DIGITS[(group >> 6) & 63];
+		p[3] = BASE64_DIGITS[group & 63];
+		p += 4;
+	}
+
+	if (ii < count) {
+		group = (bytes[ii] << 16) | ((ii + 1 < count) ? (bytes[ii + 1] << 8) : 0);
+		p[0] = BASE64_DIGITS[(group >> 18) & 63];
+		p[1] = BASE64_DIGITS[(group >> 12) & 63];
+		p[2] = (ii + 1 < count) ? BASE64_DIGITS[(group >> 6) & 63] : '=';
+		p[3] = '=';
+		p += 4;
+	}
+
+	this->length = p - &this->buffer[0];
+}
+
+void TextBuffer::putDecimal(const Big &x) {
+	unsigned char bytes[8];
+	uint64_t value = 0;
+	int count;
+
+	if (exsign(x.getbig()) < 0 || bits(x) > 64) {
+		this->putConverted(x, 10);
+		return;
+	}
+
+	count = to_binary(x, sizeof(bytes), (char *) bytes, false);
+	for (int ii = 0; ii < count; ii++) {
+		value = (value << 8) | bytes[ii];
+	}
+	this->putInteger(value);
+}
+
+void TextBuffer::putPoint(ECn &point, Big &cx, char separator) {
+	int ylsb = point.get(cx);
+	this->putBig(cx);
+	this->putChar(separator);
+	this->putChar(ylsb ? '1' : '0');
+	this->putChar(separator);
+}
+
+// Decode a field with cinstr, which requires a terminated copy.
+static bool decodeConverted(const char *p, size_t length, Big &x, int base) {
+	int previous = get_mip()->IOBASE;
+	string field(p, length);
+
+	get_mip()->IOBASE = base;
+	cinstr(x.getbig(), (char *) field.c_str());
+	get_mip()->IOBASE = previous;
+	return true;
+}
+
+bool decodeBig(const char *p, size_t length, Big &x) {
+	unsigned char bytes[TEXT_MAX_BYTES];
+	bool negative = false;
+	int count = 0, held = 0, value;
+	uint32_t group = 0;
+
+	if (length > 0 && *p == '-') {
+		negative = true;
+		p++;
+		length--;
+	}
+
+	if (length > 4 * (TEXT_MAX_BYTES / 3)) {
+		return decodeConverted(p - negative, length + negative, x, DATA_BASE);
+	}
+
+	for (size_t ii = 0; ii < length && p[ii] != '='; ii++) {
+		value = base64Value(p[ii]);
+		if (value < 0) {
+			zero(x.getbig());
+			return false;
+		}
+
+		group = (group << 6) | value;
+		held += 6;
+		if (held >= 8) {
+			held -= 8;
+			bytes[count++] = (group >> held) & 0xFF;
+		}
+	}
+
+	bytes_to_big(count, (const char *) bytes, x.getbig());
+	if (negative) negify(x.getbig(), x.getbig());
+	return true;
+}
+
+bool decodeDecimal(const char *p, size_t length, Big &x) {
+	uint64_t value;
+
+	if (length <= TEXT_WORD_DIGITS) {
+		if (!parseDecimal(p, length, value)) {
+			zero(x.getbig());
+			return false;
+		}
+		lgconv((long) value, x.getbig());
+		return true;
+	}
+
+	for (size_t ii = 0; ii < length; ii++) {
+		if (p[ii] < '0' || p[ii] > '9') {
+			zero(x.getbig());
+			return false;
+		}
+	}
+
+	return decodeConverted(p, length, x, 10);
+}
@@ -0,0 +1,70 @@
+#ifndef TEXTCODEC_H
+#define TEXTCODEC_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "zeroledge.h"
+
+// The largest magnitude, in bytes, which the codec converts itself. This covers the scalars and coordinates of any curve
+// in use with room to spare; anything larger is handed to MIRACL's own conversions instead.
+#define TEXT_MAX_BYTES 96
+
+// The number of decimal digits which always fit in a long.
+#define TEXT_WORD_DIGITS (sizeof(long) >= 8 ? 18 : 9)
+
+using namespace std;
+
+// TextBuffer accumulates the text form of proof and export data. Bignums are written in exactly the form in which MIRACL
+// would write them with IOBASE set to DATA_BASE (the base-64 encoding of their big-endian bytes), or to 10, but without
+// touching IOBASE or building intermediate strings, so that any thread may write any field without regard to the state
+// of its MIRACL instance. The buffer only ever grows, so once a buffer that is reused has grown to fit its largest
+// contents, writing to it allocates nothing.
+class TextBuffer {
+
+private:
+
+	vector<char> buffer;
+	size_t length;
+
+	// Ensure that there is room for count more characters, and return a pointer to the first of them.
+	char * extend(size_t count);
+
+	// Write x in the given base with cotstr, for values too large for the codec.
+	void putConverted(const Big &x, int base);
+
+public:
+
+	TextBuffer();
+
+	const char * data() const;
+	size_t size() const;
+	void clear();
+
+	void putChar(char c);
+	void putText(const char *text, size_t count);
+	void putText(const string &text);
+	void putInteger(uint64_t value);
+
+	// Write x in base DATA_BASE.
+	void putBig(const Big &x);
+
+	// Write x in base 10.
+	void putDecimal(const Big &x);
+
+	// Write a point in compressed form: its x coordinate, then the least significant bit of its y coordinate, each
+	// followed by separator. cx is scratch space, which the caller keeps so that it need not be allocated for every point.
+	void putPoint(ECn &point, Big &cx, char separator);
+
+};
+
+// Decode the length characters at p, written in base DATA_BASE, into x. Returns false (and sets x to zero) if they are
+// not valid base-64.
+bool decodeBig(const char *p, size_t length, Big &x);
+
+// Decode the length decimal digits at p into x. Values which fit in a machine word are converted directly. Returns false,
+// leaving x zero, unless there is at least one digit and nothing else, so that no sign, space, or suffix is accepted.
+bool decodeDecimal(const char *p, size_t length, Big &x);
+
+#endif
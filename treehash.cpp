@@ -0,0 +1,189 @@
+#include "treehash.h"
+#include <cstring>
+#include <algorithm>
+
+static void hashLeaf(const char *data, size_t length, char *digest) {
+	sha256 hasher;
+	shs256_init(&hasher);
+	shs256_process(&hasher, 0);
+	for (size_t ii = 0; ii < length; ii++) {
+		shs256_process(&hasher, data[ii]);
+	}
+	shs256_hash(&hasher, digest);
+}
+
+void hashTreeNode(const char *left, const char *right, char *digest) {
+	sha256 hasher;
+	shs256_init(&hasher);
+	shs256_process(&hasher, 1);
+	for (int ii = 0; ii < TREE_HASH_DIGEST_BYTES; ii++) {
+		shs256_process(&hasher, left[ii]);
+	}
+	for (int ii = 0; ii < TREE_HASH_DIGEST_BYTES; ii++) {
+		shs256_process(&hasher, right[ii]);
+	}
+	shs256_hash(&hasher, digest);
+}
+
+uint64_t treeLeafCount(uint64_t length) {
+	return (length > 0) ? (length + TREE_HASH_LEAF_BYTES - 1) / TREE_HASH_LEAF_BYTES : 1;
+}
+
+void hashTreeLeaves(const char *data, uint64_t length, uint64_t first, uint64_t last, char *leaves) {
+	for (uint64_t leaf = first; leaf < last; leaf++) {
+		uint64_t begin = leaf * TREE_HASH_LEAF_BYTES;
+		uint64_t end = (begin + TREE_HASH_LEAF_BYTES < length) ? begin + TREE_HASH_LEAF_BYTES : length;
+		hashLeaf(data + begin, end - begin, leaves + leaf * TREE_HASH_DIGEST_BYTES);
+	}
+}
+
+void hashTreeRoot(char *leaves, uint64_t count, char *digest) {
+	char node[TREE_HASH_DIGEST_BYTES];
+
+	if (count == 0) {
+		memset(digest, 0, TREE_HASH_DIGEST_BYTES);
+		return;
+	}
+
+	// Each level is written over the start of the one below it.
+	while (count > 1) {
+		uint64_t next = 0;
+		for (uint64_t ii = 0; ii < count; ii += 2, next++) {
+			if (ii + 1 < count) {
+				hashTreeNode(leaves + ii * TREE_HASH_DIGEST_BYTES, leaves + (ii + 1) * TREE_HASH_DIGEST_BYTES, node);
+				memcpy(leaves + next * TREE_HASH_DIGEST_BYTES, node, TREE_HASH_DIGEST_BYTES);
+			} else {
+				memmove(leaves + next * TREE_HASH_DIGEST_BYTES, leaves + ii * TREE_HASH_DIGEST_BYTES, TREE_HASH_DIGEST_BYTES);
+			}
+		}
+		count = next;
+	}
+
+	memcpy(digest, leaves, TREE_HASH_DIGEST_BYTES);
+}
+
+void hashEntryLeaf(uint64_t index, const char *data, size_t length, char *digest) {
+	sha256 hasher;
+	shs256_init(&hasher);
+	shs256_process(&hasher, 0);
+	for (int ii = 56; ii >= 0; ii -= 8) {
+		shs256_process(&hasher, (index >> ii) & 0xFF);
+	}
+	for (size_t ii = 0; ii < length; ii++) {
+		shs256_process(&hasher, data[ii]);
+	}
+	shs256_hash(&hasher, digest);
+}
+
+void hashTreePath(const char *leaf, const vector<TreePathStep> &path, char *digest) {
+	char node[TREE_HASH_DIGEST_BYTES];
+
+	memcpy(node, leaf, TREE_HASH_DIGEST_BYTES);
+	for (size_t ii = 0; ii < path.size(); ii++) {
+		if (path[ii].left) {
+			hashTreeNode(path[ii].sibling, node, node);
+		} else {
+			hashTreeNode(node, path[ii].sibling, node);
+		}
+	}
+
+	memcpy(digest, node, TREE_HASH_DIGEST_BYTES);
+}
+
+TreeHash::TreeHash() {
+	pthread_mutex_init(&this->lock, NULL);
+}
+
+TreeHash::~TreeHash() {
+	for (map<uint64_t, PendingLeaf *>::iterator it = this->pending.begin(); it != this->pending.end(); it++) {
+		delete it->second;
+	}
+	for (size_t ii = 0; ii < this->spare.size(); ii++) {
+		delete this->spare[ii];
+	}
+	pthread_mutex_destroy(&this->lock);
+}
+
+void TreeHash::setLeaf(uint64_t leaf, const char *digest) {
+	pthread_mutex_lock(&this->lock);
+	if (this->leaves.size() < (leaf + 1) * TREE_HASH_DIGEST_BYTES) {
+		this->leaves.resize(max(2 * this->leaves.size(), (size_t) (leaf + 1) * TREE_HASH_DIGEST_BYTES));
+	}
+	memcpy(&this->leaves[leaf * TREE_HASH_DIGEST_BYTES], digest, TREE_HASH_DIGEST_BYTES);
+	pthread_mutex_unlock(&this->lock);
+}
+
+void TreeHash::add(uint64_t offset, const char *data, size_t length) {
+	char digest[TREE_HASH_DIGEST_BYTES];
+
+	while (length > 0) {
+		uint64_t leaf = offset / TREE_HASH_LEAF_BYTES;
+		size_t within = offset % TREE_HASH_LEAF_BYTES;
+		size_t piece = min(length, (size_t) TREE_HASH_LEAF_BYTES - within);
+
+		if (piece == TREE_HASH_LEAF_BYTES) {
+			hashLeaf(data, piece, digest);
+			this->setLeaf(leaf, digest);
+		} else {
+			PendingLeaf *p;
+
+			pthread_mutex_lock(&this->lock);
+			map<uint64_t, PendingLeaf *>::iterator it = this->pending.find(leaf);
+			if (it != this->pending.end()) {
+				p = it->second;
+			} else {
+				if (this->spare.empty()) {
+					p = new PendingLeaf;
+					p->data.resize(TREE_HASH_LEAF_BYTES);
+				} else {
+					p = this->spare.back();
+					this->spare.pop_back();
+				}
+				p->filled = 0;
+				this->pending[leaf] = p;
+			}
+			pthread_mutex_unlock(&this->lock);
+
+			// No other thread writes this part of the leaf, and the leaf cannot be completed until it has been counted.
+			memcpy(&p->data[within], data, piece);
+
+			pthread_mutex_lock(&this->lock);
+			p->filled += piece;
+			bool complete = p->filled == TREE_HASH_LEAF_BYTES;
+			if (complete) this->pending.erase(leaf);
+			pthread_mutex_unlock(&this->lock);
+
+			if (complete) {
+				hashLeaf(&p->data[0], TREE_HASH_LEAF_BYTES, digest);
+				this->setLeaf(leaf, digest);
+				pthread_mutex_lock(&this->lock);
+				this->spare.push_back(p);
+				pthread_mutex_unlock(&this->lock);
+			}
+		}
+
+		offset += piece;
+		data += piece;
+		length -= piece;
+	}
+}
+
+void TreeHash::finish(uint64_t length, char *digest) {
+	uint64_t count = treeLeafCount(length);
+	char leaf[TREE_HASH_DIGEST_BYTES];
+
+	// Only the last leaf can still be incomplete, since it alone is shorter than the others.
+	map<uint64_t, PendingLeaf *>::iterator it = this->pending.find(count - 1);
+	if (it != this->pending.end()) {
+		hashLeaf(&it->second->data[0], it->second->filled, leaf);
+		this->setLeaf(count - 1, leaf);
+		delete it->second;
+		this->pending.erase(it);
+	} else if (length == 0) {
+		hashLeaf(NULL, 0, leaf);
+		this->setLeaf(0, leaf);
+	}
+
+	this->leaves.resize(count * TREE_HASH_DIGEST_BYTES);
+	hashTreeRoot(&this->leaves[0], count, digest);
+}
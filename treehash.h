@@ -0,0 +1,85 @@
+#ifndef TREEHASH_H
+#define TREEHASH_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <map>
+#include <vector>
+#include <pthread.h>
+#include "zeroledge.h"
+
+#define TREE_HASH_LEAF_BYTES (1 << 20)
+#define TREE_HASH_DIGEST_BYTES 32
+
+using namespace std;
+
+// The digest of a proof transcript (or of any other file) is a tree hash, so that it can be computed by many threads at
+// once. The file is divided into leaves of TREE_HASH_LEAF_BYTES bytes, the last of which may be shorter (an empty file has
+// a single empty leaf). Each leaf is hashed with SHA-256, prefixed by a zero byte; then pairs of adjacent nodes are
+// combined by hashing their digests with SHA-256, prefixed by a one byte, level by level until one node remains, which is
+// the digest. A node left over at the end of a level is carried up to the next unchanged.
+
+// Return the number of leaves in a file of length bytes.
+uint64_t treeLeafCount(uint64_t length);
+
+// Hash the leaves [first, last) of the length bytes at data, storing the digest of each at its position in leaves.
+void hashTreeLeaves(const char *data, uint64_t length, uint64_t first, uint64_t last, char *leaves);
+
+// Combine the digests of count leaves into the digest of the file. The leaves are overwritten. A tree with no leaves (which
+// arises only for the entry tree, below) has a digest of all zeroes.
+void hashTreeRoot(char *leaves, uint64_t count, char *digest);
+
+// Combine the digests of two adjacent nodes into the digest of their parent.
+void hashTreeNode(const char *left, const char *right, char *digest);
+
+// The entries of a proof are committed to by a second tree of the same shape (the entry tree), the root of which appears
+// in the proof header. Its leaves are the entries themselves, each of which is hashed together with its index: the SHA-256
+// digest of a zero byte, the entry index as eight big-endian bytes, and the lines of the entry exactly as they appear in
+// the transcript. Binding the index into the leaf means that an authentication path need not reveal the number of entries
+// in order to establish the position of the entry it authenticates.
+void hashEntryLeaf(uint64_t index, const char *data, size_t length, char *digest);
+
+// TreePathStep is a single step of an authentication path from a leaf to the root: the digest of the sibling of the node
+// reached so far, and whether that sibling lies to its left. A node which is carried up unchanged has no step.
+typedef struct TreePathStep {
+	char sibling[TREE_HASH_DIGEST_BYTES];
+	bool left;
+} TreePathStep;
+
+// Compute the root reached by following path from the leaf with digest leaf.
+void hashTreePath(const char *leaf, const vector<TreePathStep> &path, char *digest);
+
+// TreeHash computes the digest of a file while it is being written, from pieces which may be written by many threads at
+// once and in any order, so long as no two overlap. A piece which covers a whole leaf is hashed immediately, by the thread
+// that supplies it; otherwise it is copied into a buffer for its leaf, which is hashed by whichever thread completes it.
+// The lock is held only to find the buffer for a leaf and to record its digest, never while hashing or copying.
+class TreeHash {
+
+private:
+
+	typedef struct PendingLeaf {
+		vector<char> data;
+		size_t filled;
+	} PendingLeaf;
+
+	pthread_mutex_t lock;
+	vector<char> leaves;
+	map<uint64_t, PendingLeaf *> pending;
+	vector<PendingLeaf *> spare;
+
+	void setLeaf(uint64_t leaf, const char *digest);
+
+public:
+
+	TreeHash();
+	~TreeHash();
+
+	// Add the length bytes at data, which appear at offset within the file.
+	void add(uint64_t offset, const char *data, size_t length);
+
+	// Compute the digest of the file, which is length bytes long, once every piece of it has been added.
+	void finish(uint64_t length, char *digest);
+
+};
+
+#endif
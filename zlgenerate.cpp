@@ -21,8 +21,11 @@
 #include <fstream>
 #include <sstream>
 #include <cstdio>
+#include <cstring>
+#include <cstdint>
 #include <ctime>
 #include <vector>
+#include <atomic>
 #include <unistd.h>
 #include <algorithm>
 #include <pthread.h>
@@ -31,65 +34,111 @@
 #include "zeroledge.h"
 #include "zlutil.h"
 #include "ledger.h"
+#include "ledgerreader.h"
 #include "lepprocessor.h"
 #include "lbpprocessor.h"
 #include "dbpprocessor.h"
+#include "proofindex.h"
+#include "proofwriter.h"
+#include "outputfile.h"
+#include "incrstore.h"
+#include "openerstore.h"
+#include "incrreader.h"
+#include "pipeline.h"
+#include "placement.h"
+#include "textcodec.h"
+#include "treehash.h"
+#include "checkpoint.h"
+#include "partialsummary.h"
 
 #define HELP_TEXT "ZeroLedge Proof Generator 1.0\n\
-Usage: zlgenerate [\x1b[4mOPTIONS\x1b[0m] [\x1b[4mLEDGER\x1b[0m]\n\
+Usage: zlgenerate [\x1b[4mOPTIONS\x1b[0m] [\x1b[4mLEDGER\x1b[0m...]\n\
 \n\
 Options:\n\
   -h \t\tprint this message\n\
   -t \x1b[4mNUMBER\x1b[0m \tuse \x1b[4mNUMBER\x1b[0m threads\n\
+  -B \x1b[4mNUMBER\x1b[0m \tuse at most \x1b[4mNUMBER\x1b[0m processors' worth of time, at the lowest priority\n\
+  -N \t\tpin each thread to a core, and keep its memory and a replica of the incremental data on its NUMA node\n\
   -g \x1b[4mNUMBER\x1b[0m \tprocess \x1b[4mNUMBER\x1b[0m entries at a time\n\
   -v \x1b[4mNUMBER\x1b[0m \trestrict balances and sums to \x1b[4mNUMBER\x1b[0m bits\n\
   -b \x1b[4mPATH\x1b[0m \tread commitment base seeds from \x1b[4mPATH\x1b[0m\n\
   -c \x1b[4mPATH\x1b[0m \tread elliptic curve parameters from \x1b[4mPATH\x1b[0m\n\
   -i \x1b[4mPATH\x1b[0m \tgenerate incremental proof using data from \x1b[4mPATH\x1b[0m\n\
+  -m \t\tmerge incremental data as it is read; the ledger and data must be sorted by account\n\
   -e \x1b[4mPATH\x1b[0m \twrite entries to \x1b[4mPATH\x1b[0m\n\
+  -E \x1b[4mPATH\x1b[0m \twrite entry openers and authentication paths to \x1b[4mPATH\x1b[0m as a store indexed by account\n\
   -r \x1b[4mPATH\x1b[0m \twrite incremental data to \x1b[4mPATH\x1b[0m\n\
-  -o \x1b[4mPATH\x1b[0m \twrite proof to \x1b[4mPATH\x1b[0m\n"
+  -R \x1b[4mPATH\x1b[0m \twrite incremental data to \x1b[4mPATH\x1b[0m in binary format\n\
+  -x \x1b[4mPATH\x1b[0m \twrite proof entry index to \x1b[4mPATH\x1b[0m\n\
+  -o \x1b[4mPATH\x1b[0m \twrite proof to \x1b[4mPATH\x1b[0m\n\
+  -D \t\twrite the proof and exports without retaining them in the page cache\n\
+  -s \x1b[4mNUMBER\x1b[0m \tsplit proof into \x1b[4mNUMBER\x1b[0m shards, with a manifest at the -o \x1b[4mPATH\x1b[0m\n\
+  -C \x1b[4mPATH\x1b[0m \tperiodically write a checkpoint to \x1b[4mPATH\x1b[0m, from which generation can be resumed\n\
+  -T \x1b[4mNUMBER\x1b[0m \twrite a checkpoint at most once every \x1b[4mNUMBER\x1b[0m seconds\n\
+  -U, --resume \tresume generation from the checkpoint at the -C \x1b[4mPATH\x1b[0m\n\
+  -P \x1b[4mNUMBER\x1b[0m \tgenerate only shard \x1b[4mNUMBER\x1b[0m of the -s shards, with a partial summary alongside it\n\
+  -M \t\tmerge the partial summaries of the -s shards at the -o \x1b[4mPATH\x1b[0m, and write the manifest\n\
+  -w \x1b[4mNUMBER\x1b[0m \tuse \x1b[4mNUMBER\x1b[0m as the time of the proof, so that partitions agree\n\
+  -a \x1b[4mNUMBER\x1b[0m \tread a ledger of \x1b[4mNUMBER\x1b[0m assets, and write a proof of each alongside the -o \x1b[4mPATH\x1b[0m\n"
+
+// The number of bits of an entry whose commitments and proofs are generated by each of the tasks a worker shares.
+#define BIT_TASK_BITS 4
+
+// The name of the proof or entries export of each asset of a multi-asset ledger, given the path and the asset's position.
+#define ASSET_NAME_FORMAT "%s.asset%d"
 
 using namespace std;
 
-pthread_mutex_t ledger_lock;
-pthread_mutex_t proof_lock;
-pthread_mutex_t entries_lock;
-pthread_mutex_t incr_src_lock;
-pthread_mutex_t incr_data_lock;
-pthread_mutex_t incr_dst_lock;
-
-class IncrDataRaw {
-
-public:
-
-	int index;
-	string identifier, balance;
-	string lec_cx, lec_ylsb, lep_r;
-	string lep_b1, lep_b2, lep_b3;
-	string lep_gamma_cx, lep_gamma_ylsb;
-	vector<string> lbc_cx;
-	vector<string> lbc_ylsb;
-	vector<string> lbp_gamma_cx;
-	vector<string> lbp_gamma_ylsb;
-	vector<string> lbp_r;
-	vector<string> lbp_b1;
-	vector<string> lbp_b2;
-
-	IncrDataRaw() {}
-
-	IncrDataRaw(int valueBits) {
-		lbc_cx.resize(valueBits);
-		lbc_ylsb.resize(valueBits);
-		lbp_gamma_cx.resize(valueBits);
-		lbp_gamma_ylsb.resize(valueBits);
-		lbp_r.resize(valueBits);
-		lbp_b1.resize(valueBits);
-		lbp_b2.resize(valueBits);
-	}
-};
-
-typedef struct calcLoopArgs {
+// IncrMerge holds the state used by the reader when the ledger and the text incremental data are both sorted by account
+// identifier and are merged as they are read, rather than the incremental data being ingested in advance. next is the first
+// incremental record which has not yet been matched or passed over, and sorted is cleared if either input is found to be
+// out of order.
+typedef struct IncrMerge {
+	istream *incr_src;
+	IncrDataRaw next;
+	bool hasNext;
+	bool sorted;
+	string lastIdentifier;
+} IncrMerge;
+
+// MalformedInput records the first entry, in ledger order, whose balance (or incremental data, when merging) could not be
+// decoded. The worker which finds such an entry reports it here, the reader stops at the next group once any has been
+// reported, and the error is shown once the pipeline has drained. The lowest entry is kept, whichever order the workers
+// come upon them in, so the error is the same as a single thread would report.
+typedef struct MalformedInput {
+	atomic<uint64_t> entry;
+	pthread_mutex_t lock;
+	string message;
+} MalformedInput;
+
+static void initMalformed(MalformedInput &malformed) {
+	malformed.entry = UINT64_MAX;
+	pthread_mutex_init(&malformed.lock, NULL);
+}
+
+// Report that what, of the entry at index entry, is malformed, naming the entry and the text of its line, which begins at
+// line.id and ends at the next newline before end.
+static void reportMalformed(MalformedInput &malformed, const char *what, uint64_t entry, const LedgerLine &line, const char *end) {
+	const char *eol = static_cast<const char *>(memchr(line.id, '\n', end - line.id));
+	if (eol == NULL) eol = end;
+	if (eol > line.id && eol[-1] == '\r') eol--;
+
+	pthread_mutex_lock(&malformed.lock);
+	if (entry < malformed.entry.load()) {
+		stringstream message;
+		message << what << " of ledger entry " << entry << " is malformed: \"" << string(line.id, eol - line.id) << "\"";
+		malformed.message = message.str();
+		malformed.entry = entry;
+	}
+	pthread_mutex_unlock(&malformed.lock);
+}
+
+// GenerateContext holds everything shared by the stages of the proof pipeline. The reader alone touches the ledger source,
+// the merge state, and entrycount; the writer alone touches the ordered outputs; and the workers share only read-only
+// parameters, the binary incremental data and openers destinations, which are written by position, and the checkpoint and
+// malformed entry, which lock. If the workers are pinned, placement assigns them their processors, and incrReplicas may hold a replica of
+// the incremental data for each NUMA node, from which the workers on that node read instead.
+typedef struct GenerateContext {
 	Big a;
 	Big b;
 	Big p;
@@ -99,353 +148,832 @@ typedef struct calcLoopArgs {
 	ECn f;
 	int bits;
 	int packSize;
-	time_t proofTime;
 	int valueBits;
-	unsigned *entrycount;
+	uint64_t entrycount;
+	uint64_t lastEntry;
+	LedgerReader *ledger;
+	IncrMerge *incrMerge;
+	IncrStore *incrData;
+	vector<IncrStore *> incrReplicas;
+	Placement *placement;
+	IncrStore *incr_bin_dst;
+	OpenerStore *openers;
+	vector<Ledger> *partialLedgers;
+	ProofWriter *proof;
+	OutputFile *entries;
+	OutputFile *incr_dst;
+	ProofIndex *index;
+	Checkpoint *checkpoint;
+	Pipeline *pipeline;
+	MalformedInput malformed;
+} GenerateContext;
+
+// GeneratePack holds a single group of ledger entries, from the time it is read from the ledger until its output has been
+// written, after which it is recycled for another group. first is the index of the first entry in the group, which is
+// assigned when the group is read, and [begin, end) holds the lines of the mapped ledger in which it appears, or of text,
+// into which they are copied when the ledger is streamed. The raw
+// incremental data and matched flags are used only when merging. The worker writes the output of the group directly into
+// its text buffers, which grow to fit the largest group and are then reused without allocation, and runs holds the pieces
+// of that output which have been placed but not yet written. leaves holds the digests of the entries in the entry tree,
+// when openers are being written. When checkpointing, the group is summed into its own ledger rather than the worker's,
+// so that the sums can be merged in order by the checkpoint, and mark records the progress made once it is written.
+typedef struct GeneratePack {
+	uint64_t first;
+	int count;
+	const char *begin;
+	const char *end;
+	vector<char> text;
+	vector<IncrDataRaw> rawData;
+	vector<bool> matched;
+	TextBuffer proof, entries, incr;
+	vector<uint64_t> entryOffsets;
+	vector<char> leaves;
+	vector<OutputRun> runs;
+	Ledger *sums;
+	CheckpointMark mark;
+} GeneratePack;
+
+// GenerateWorker holds the state belonging to a single worker thread: its number, its MIRACL instance, its processors, its
+// partial ledger, and its scratch space. A pinned worker sums into a copy of its partial ledger which it allocates itself,
+// on its own node, and which is copied back when it finishes.
+typedef struct GenerateWorker {
+	int worker;
+	Miracl *precision;
+	LEPProcessor *lepgen;
+	LBPProcessor *lbpgen;
 	Ledger *partialLedger;
-	istream *ledger;
-	ostream *proof;
-	ofstream *entries;
-	ofstream *incr_dst;
-	unordered_map<string, IncrEntry> *incrData;
-} calcLoopArgs;
-
-typedef struct incrLoopArgs {
-	Big a;
-	Big b;
-	Big p;
-	int packSize;
+	vector<LedgerEntry> e;
+	vector<ECn> gx;
+} GenerateWorker;
+
+// EntryTasks describes the entries of a group being generated by a worker, which divides them into tasks that it shares
+// with any workers which are idle (see Pipeline::share). First each entry's bits are divided into ranges of BIT_TASK_BITS,
+// each a task of its own, and then each entry's own commitment and proof is a task, which can only begin once all of its
+// bits are done. Tasks are performed with the processors of whichever worker takes them.
+typedef struct EntryTasks {
+	LedgerEntry *e;
+	ECn *gx;
+	int bitTasks;
 	int valueBits;
-	istream *incr_src;
-	unordered_map<string, IncrEntry> *incrData;
-} incrLoopArgs;
-
-
-// The calcLoop function forms the body of a pthread, and is responsible for the bulk of the work. It performs data ingest,
-// proof calculation, and data output. It does not, however, perform incremental data ingest or work with difference bits at
-// all. The general methodology is this: the thread locks the ledger source and reads a group of ledger entries from it. It
-// then unlocks the ledger and uses the ledger entries it has collected to generate a set of commitments and proofs. Once the
-// calculations are complete, it locks the output streams one at a time and writes each output to the appropriate place.
-// This process is repeated until the ledger is exhausted, at which point the thread exits. As the number of active threads
-// increases, the number of ledger entries processed in each group shoud be adjusted to avoid excessive competition for
-// locks, and the accompanying degredation of performance.
+} EntryTasks;
+
+
+// Proof generation is performed by a pipeline (see pipeline.h), which divides the bulk of the work into four stages. The
+// general methodology is this: the reader (readPack) reads a group of ledger entries from the ledger source, and assigns
+// the indices of the entries. A worker (calcPack) then uses the ledger entries in the group to generate a set of
+// commitments and proofs, and writes its output into the pack. Next, the writer (writePack) reserves space for each group in
+// the appropriate places strictly in the order in which the groups were read, regardless of the order in which they were
+// completed. Finally, a worker (flushPack) writes the group into the space reserved for it. Thus the layout of every
+// output is identical to that which a single thread would produce. None of these stages perform incremental data ingest
+// or work with difference bits at all. Because each stage has sole ownership of the state it touches, and the stages are
+// connected by lock-free queues, no thread ever waits on a lock, and the ledger group size need only be large enough to
+// amortize the cost of passing each group between threads.
+//
+// In this implementation, each thread keeps nothing for later except what is absolutely necessary. This layout is intended
+// to conserve memory - only a fixed number of groups are ever in the pipeline at once, and their buffers are recycled, so
+// the result is that memory consumption is dependant only on thread count and ledger group size, not on ledger length). In
+// cases where memory is not a concern, there is no reason why the algorithm could not cache its input and/or output and
+// perform it all at once.
 //
-// In this implementation, all threads share a single istream for the ledger source and single ostreams for each of the data
-// destinations, and each thread performs IO as it goes, keeping nothing for later except what is absolutely necessary; thus,
-// each thread must wait in turn for IO. This layout is intended to conserve memory - the result is that memory consumption
-// is dependant only on thread count and ledger group size, not on ledger length). In cases where memory is not a concern,
-// there is no reason why the algorithm could not cache its input and/or output and perform it all at once.
-void * calcLoop(void* rawArgs) {
-	calcLoopArgs &args = *(static_cast<calcLoopArgs*>(rawArgs));
+// When the ledger and the text incremental data are both sorted by account identifier, the incremental data need not be
+// ingested in advance. Instead, the reader advances through the incremental data in step with the ledger, copying the raw
+// records which match the entries in each group and passing over the rest, and the worker ingests the matching records
+// along with the group. This preserves the memory bound described above.
+
+void * newPack(void* rawContext) {
+	GenerateContext &context = *(static_cast<GenerateContext*>(rawContext));
+	GeneratePack *pack = new GeneratePack;
+	pack->first = 0;
+	pack->count = 0;
+	pack->begin = NULL;
+	pack->end = NULL;
+	pack->matched.resize(context.packSize, false);
+	if (context.incrMerge != NULL) pack->rawData.resize(context.packSize, IncrDataRaw(context.valueBits));
+	pack->entryOffsets.resize(context.packSize);
+	if (context.openers->isOpen()) pack->leaves.resize(context.packSize * TREE_HASH_DIGEST_BYTES);
+	pack->sums = (context.checkpoint != NULL) ? new Ledger(context.g, context.h, context.f, context.valueBits) : NULL;
+	return pack;
+}
+
+void deletePack(void* rawContext, void* rawPack) {
+	GeneratePack *pack = static_cast<GeneratePack*>(rawPack);
+	delete pack->sums;
+	delete pack;
+}
+
+// Compare an identifier from the incremental data with one in the mapped ledger, in the same way as strings are compared.
+static int compareIdentifier(const string &identifier, const LedgerLine &line) {
+	return identifier.compare(0, identifier.size(), line.id, line.idLength);
+}
+
+bool readPack(void* rawContext, void* rawPack) {
+	GenerateContext &context = *(static_cast<GenerateContext*>(rawContext));
+	GeneratePack *pack = static_cast<GeneratePack*>(rawPack);
+	IncrMerge *merge = context.incrMerge;
+	LedgerLine line;
+	const char *p;
+	int ii;
+
+	// Find the lines holding the next group of entries. If the ledger source (or the partition being generated) is totally
+	// exhausted, or an entry already read is malformed, terminate early.
+	if (context.entrycount >= context.lastEntry || context.malformed.entry.load() != UINT64_MAX) return false;
+	pack->count = context.ledger->nextEntries(min((uint64_t) context.packSize, context.lastEntry - context.entrycount), pack->begin, pack->end);
+	if (pack->count == 0) return false;
+
+	pack->first = context.entrycount;
+	context.entrycount += pack->count;
+
+	pack->mark.entryCount = context.entrycount;
+	context.ledger->tell(pack->mark.ledgerFile, pack->mark.ledgerOffset);
+
+	// A streamed ledger holds only the lines found last, so the pack keeps its own copy of them.
+	if (context.ledger->isStreamed()) {
+		pack->text.assign(pack->begin, pack->end);
+		pack->begin = pack->text.data();
+		pack->end = pack->begin + pack->text.size();
+	}
+
+	// When merging, the identifiers must be examined here, in order, but they are not copied.
+	for (ii = 0, p = pack->begin; merge != NULL && ii < pack->count; ii++) {
+		p = LedgerReader::parseEntry(p, pack->end, line);
+
+		if (compareIdentifier(merge->lastIdentifier, line) > 0) merge->sorted = false;
+		merge->lastIdentifier.assign(line.id, line.idLength);
+
+		while (merge->hasNext && compareIdentifier(merge->next.identifier, line) < 0) {
+			string passed = merge->next.identifier;
+			merge->hasNext = merge->next.read(*merge->incr_src);
+			if (merge->hasNext && merge->next.identifier < passed) merge->sorted = false;
+		}
+
+		pack->matched[ii] = merge->hasNext && compareIdentifier(merge->next.identifier, line) == 0;
+		if (pack->matched[ii]) {
+			swap(pack->rawData[ii], merge->next);
+			merge->hasNext = merge->next.read(*merge->incr_src);
+			if (merge->hasNext && compareIdentifier(merge->next.identifier, line) < 0) merge->sorted = false;
+		}
+	}
+
+	// Entries cannot be matched with their incremental data once either is found to be out of order, so the pipeline is
+	// stopped there, just as if the ledger had ended, rather than generating the rest of the proof only to discard it.
+	return merge == NULL || merge->sorted;
+}
+
+void * beginWorker(void* rawContext, int worker) {
+	GenerateContext &context = *(static_cast<GenerateContext*>(rawContext));
+	GenerateWorker *state = new GenerateWorker;
+	state->worker = worker;
 
 	// per-thread MIRACL setup
-	#ifndef MR_NOFULLWIDTH
-	Miracl precision(64,0);
-	#else
-	Miracl precision(64,MAXBASE);
-	#endif
+	state->precision = newThreadMiracl();
 
 	irand(fetchRandomSeed());
 
-	ecurve(args.a,args.b,args.p,MR_PROJECTIVE);
+	ecurve(context.a,context.b,context.p,MR_PROJECTIVE);
 
-	bool output_entries = args.entries->is_open();
-	bool output_incr = args.incr_dst->is_open();
+	// zl setup
+	IncrStore *incrData = context.incrData;
+	if (context.placement != NULL && !context.incrReplicas.empty()) {
+		incrData = context.incrReplicas[context.placement->node(worker)];
+	}
+
+	state->lepgen = new LEPProcessor(context.q, context.g, context.h, context.f, context.bits, incrData);
+	state->lbpgen = new LBPProcessor(context.q, context.g, context.h, context.f, context.bits, context.valueBits, incrData);
+	state->partialLedger = &(*context.partialLedgers)[worker];
+	if (context.placement != NULL) state->partialLedger = new Ledger(*state->partialLedger);
+	state->e.resize(context.packSize);
+	state->gx.resize(context.packSize);
+
+	return state;
+}
+
+static void genBitsTask(void* rawContext, void* rawWorker, void* rawTasks, int task) {
+	GenerateWorker *state = static_cast<GenerateWorker*>(rawWorker);
+	EntryTasks &tasks = *(static_cast<EntryTasks*>(rawTasks));
+	int entry = task / tasks.bitTasks, first = (task % tasks.bitTasks) * BIT_TASK_BITS;
+
+	state->lbpgen->genBits(tasks.e[entry], first, min(first + BIT_TASK_BITS, tasks.valueBits), tasks.gx[entry]);
+}
+
+static void genEntryTask(void* rawContext, void* rawWorker, void* rawTasks, int task) {
+	GenerateWorker *state = static_cast<GenerateWorker*>(rawWorker);
+	EntryTasks &tasks = *(static_cast<EntryTasks*>(rawTasks));
+	LedgerEntry &e = tasks.e[task];
+
+	e.computeR();
+
+	state->lepgen->genCommitment(e);
+	state->lepgen->genProof(e);
+}
 
-	string identifiers[args.packSize];
-	string balances[args.packSize];
-	stringstream proofOutput, entriesOutput, incrOutput;
+void calcPack(void* rawContext, void* rawWorker, void* rawPack) {
+	GenerateContext &context = *(static_cast<GenerateContext*>(rawContext));
+	GenerateWorker *state = static_cast<GenerateWorker*>(rawWorker);
+	GeneratePack *pack = static_cast<GeneratePack*>(rawPack);
+
+	vector<LedgerEntry> &e = state->e;
+	TextBuffer &proofOutput = pack->proof;
+	TextBuffer &entriesOutput = pack->entries;
+	TextBuffer &incrOutput = pack->incr;
 	Big cx, balance;
-	int ylsb, ii, jj, kk, entrycount;
-	LedgerEntry e[ENTRIES_PER_PACK_DEFAULT];
+	LedgerLine line;
+	const char *p = pack->begin;
+	int jj, kk;
 
-	// zl setup
-	LEPProcessor lepgen(args.q, args.g, args.h, args.f, args.bits, args.incrData);
-	LBPProcessor lbpgen(args.q, args.g, args.h, args.f, args.bits, args.valueBits, args.incrData);
+	// Calculate the commitments and proofs for each of the ledger entries and its bits, and write the output into the pack
+
+	proofOutput.clear();
+	entriesOutput.clear();
+	incrOutput.clear();
 
-	while (true) {
+	Ledger *sums = (pack->sums != NULL) ? pack->sums : state->partialLedger;
+	if (pack->sums != NULL) pack->sums->reset();
 
-		// Begin by ingesting entries from the ledger source. If the ledger source is totally exhausted, terminate early.
+	for (jj = 0; jj < pack->count; jj ++) {
 
-		get_mip()->IOBASE=10;
+		p = LedgerReader::parseEntry(p, pack->end, line);
+		if (!decodeDecimal(line.balance, line.balanceLength, balance)) {
+			reportMalformed(context.malformed, "balance", pack->first + jj, line, pack->end);
+		}
 
-		pthread_mutex_lock(&ledger_lock);
+		e[jj] = LedgerEntry(string(line.id, line.idLength), balance, context.valueBits);
 
-		for (ii = 0; ii < args.packSize; ii++) {
-			if (!(*args.ledger >> identifiers[ii] && *args.ledger >> balances[ii])) break;
+		if (context.incrMerge != NULL && pack->matched[jj]) {
+			e[jj].incremental = pack->rawData[jj].decode(e[jj].incrDatum);
+			if (!e[jj].incremental) reportMalformed(context.malformed, "incremental data", pack->first + jj, line, pack->end);
 		}
 
-		pthread_mutex_unlock(&ledger_lock);
+		state->lbpgen->fetchIncremental(e[jj]);
+		state->gx[jj] = e[jj].idHash * context.g;
+
+	}
 
-		if (ii == 0) break;
+	// Incremental entries are far cheaper than fresh ones, and a group may be one of the last, so the bits and then the
+	// entries are shared with any workers left idle.
+	EntryTasks tasks;
+	tasks.e = &e[0];
+	tasks.gx = &state->gx[0];
+	tasks.bitTasks = (context.valueBits + BIT_TASK_BITS - 1) / BIT_TASK_BITS;
+	tasks.valueBits = context.valueBits;
 
-		// Now calculate the commitments and proofs for each of the ledger entries and its bits, and cache the output locally
+	TaskGroup bitGroup = { &genBitsTask, &tasks, pack->count * tasks.bitTasks };
+	context.pipeline->share(state->worker, state, bitGroup);
 
-		get_mip()->IOBASE=DATA_BASE;
+	TaskGroup entryGroup = { &genEntryTask, &tasks, pack->count };
+	context.pipeline->share(state->worker, state, entryGroup);
 
-		proofOutput.str(std::string());
-		entriesOutput.str(std::string());
-		incrOutput.str(std::string());
+	for (jj = 0; jj < pack->count; jj ++) {
 
-		for (jj = 0; jj < ii; jj ++) {
+		// We do not need to lock before adding each entry to the ledger, because there is one partial ledger per worker (or
+		// one per pack, when checkpointing).
+		sums->addEntry(e[jj]);
 
-			get_mip()->IOBASE=10;
-			cinstr(balance.getbig(), (char *) balances[jj].c_str());
-			get_mip()->IOBASE=DATA_BASE;
-		
-			e[jj] = LedgerEntry(identifiers[jj], balance, args.valueBits);
+		pack->entryOffsets[jj] = proofOutput.size();
+		ProofWriter::putEntry(proofOutput, e[jj]);
 
-			lbpgen.genCommitments(e[jj]);
-			lbpgen.genProofs(e[jj]);
+	}
 
-			e[jj].computeR();
+	// The binary incremental data and the openers are written by position, so they need not wait for the writer. Along
+	// with the openers go the leaves of the entry tree, which are hashed from the text of the entries just written.
 
-			lepgen.genCommitment(e[jj]);
-			lepgen.genProof(e[jj]);
+	if (context.incr_bin_dst->isOpen()) {
+		context.incr_bin_dst->setEntries(pack->first, &e[0], pack->count);
+	}
 
-			// We do not need to lock before adding each entry to the ledger, because there is one partial ledger per thread.
-			args.partialLedger->addEntry(e[jj]);
+	if (context.openers->isOpen()) {
+		for (jj = 0; jj < pack->count; jj++) {
+			size_t end = (jj + 1 < pack->count) ? pack->entryOffsets[jj + 1] : proofOutput.size();
+			hashEntryLeaf(pack->first + jj, proofOutput.data() + pack->entryOffsets[jj], end - pack->entryOffsets[jj], &pack->leaves[jj * TREE_HASH_DIGEST_BYTES]);
+		}
+		context.openers->setEntries(pack->first, &e[0], &pack->leaves[0], pack->count);
+	}
 
-			ylsb = e[jj].lec.get(cx);
-			proofOutput << cx << endl << ylsb << endl;
-			ylsb = e[jj].lep.gamma.get(cx);
-			proofOutput << cx << endl << ylsb << endl;
-			proofOutput << e[jj].lep.z1 << endl;
-			proofOutput << e[jj].lep.z2 << endl;
-			proofOutput << e[jj].lep.z3 << endl;
+	// Now export incremental and entry data if necessary, again into the pack.
 
-			for (kk = 0; kk < args.valueBits; kk++) {
-				ylsb = e[jj].lbc[kk].get(cx);
-				proofOutput << cx << endl << ylsb << endl;
-				ylsb = e[jj].lbp[kk].gamma1.get(cx);
-				proofOutput << cx << endl << ylsb << endl;
-				ylsb = e[jj].lbp[kk].gamma2.get(cx);
-				proofOutput << cx << endl << ylsb << endl;
-				proofOutput << e[jj].lbp[kk].c1 << endl;
-				proofOutput << e[jj].lbp[kk].z1 << endl;
-				proofOutput << e[jj].lbp[kk].z2 << endl;
-				proofOutput << e[jj].lbp[kk].z3 << endl;
-				proofOutput << e[jj].lbp[kk].z4 << endl;
-			}
+	for (jj = 0; jj < pack->count; jj ++) {
 
+		if (context.entries->isOpen()) {
+			entriesOutput.putInteger(pack->first + jj);
+			entriesOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+			entriesOutput.putText(e[jj].id);
+			entriesOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+			entriesOutput.putDecimal(e[jj].balance);
+			entriesOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+			entriesOutput.putBig(e[jj].r);
+			entriesOutput.putChar('\n');
 		}
 
-		// Write the cached proof output and unlock if possible.
+		if (context.incr_dst->isOpen()) {
+			incrOutput.putInteger(pack->first + jj);
+			incrOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+			incrOutput.putText(e[jj].id);
+			incrOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+			incrOutput.putDecimal(e[jj].balance);
+			incrOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
 
-		pthread_mutex_lock(&proof_lock);
-		*args.proof << proofOutput.rdbuf();
-		entrycount = *args.entrycount;
-		*args.entrycount += ENTRIES_PER_PACK_DEFAULT;
-		pthread_mutex_unlock(&proof_lock);
+			for (kk = 0; kk < context.valueBits; kk++) {
+				incrOutput.putPoint(e[jj].lbc[kk], cx, ENTRIES_EXPORT_FIELD_SEPARATOR);
+			}
 
-		// Now export incremental and entry data if necessary and cache output locally.
+			incrOutput.putPoint(e[jj].lec, cx, ENTRIES_EXPORT_FIELD_SEPARATOR);
 
-		for (jj = 0; jj < ii; jj ++) {
+			for (kk = 0; kk < context.valueBits; kk++) {
+				incrOutput.putPoint(bit(e[jj].balance, kk) ? e[jj].lbp[kk].gamma2 : e[jj].lbp[kk].gamma1, cx, ENTRIES_EXPORT_FIELD_SEPARATOR);
+			}
+
+			incrOutput.putPoint(e[jj].lep.gamma, cx, ENTRIES_EXPORT_FIELD_SEPARATOR);
 
-			if (output_entries) {
-				entriesOutput << entrycount << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				entriesOutput << e[jj].id << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				get_mip()->IOBASE=10;
-				entriesOutput << e[jj].balance << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				get_mip()->IOBASE=DATA_BASE;
-				entriesOutput << e[jj].r << endl;
+			for (kk = 0; kk < context.valueBits; kk++) {
+				incrOutput.putBig(e[jj].lbp[kk].r);
+				incrOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
 			}
 
-			if (output_incr) {
-				incrOutput << entrycount << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				incrOutput << e[jj].id << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				get_mip()->IOBASE=10;
-				incrOutput << e[jj].balance << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				get_mip()->IOBASE=DATA_BASE;
+			incrOutput.putBig(e[jj].r);
+			incrOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
 
-				for (kk = 0; kk < args.valueBits; kk++) {
-					ylsb = e[jj].lbc[kk].get(cx);
-					incrOutput << cx << ENTRIES_EXPORT_FIELD_SEPARATOR << ylsb << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				}
+			for (kk = 0; kk < context.valueBits; kk++) {
+				incrOutput.putBig(bit(e[jj].balance, kk) ? e[jj].lbp[kk].b3 : e[jj].lbp[kk].b1);
+				incrOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+			}
 
-				ylsb = e[jj].lec.get(cx);
-				incrOutput << cx << ENTRIES_EXPORT_FIELD_SEPARATOR << ylsb << ENTRIES_EXPORT_FIELD_SEPARATOR;
+			for (kk = 0; kk < context.valueBits; kk++) {
+				incrOutput.putBig(bit(e[jj].balance, kk) ? e[jj].lbp[kk].b4 : e[jj].lbp[kk].b2);
+				incrOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+			}
 
-				for (kk = 0; kk < args.valueBits; kk++) {
-					ylsb = (bit(e[jj].balance, kk) ? e[jj].lbp[kk].gamma2.get(cx) : e[jj].lbp[kk].gamma1.get(cx));
-					incrOutput << cx << ENTRIES_EXPORT_FIELD_SEPARATOR << ylsb << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				}
+			incrOutput.putBig(e[jj].lep.b1);
+			incrOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+			incrOutput.putBig(e[jj].lep.b2);
+			incrOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+			incrOutput.putBig(e[jj].lep.b3);
 
-				ylsb = e[jj].lep.gamma.get(cx);
-				incrOutput << cx << ENTRIES_EXPORT_FIELD_SEPARATOR << ylsb << ENTRIES_EXPORT_FIELD_SEPARATOR;
+			incrOutput.putChar('\n');
+		}
 
-				for (kk = 0; kk < args.valueBits; kk++) {
-					incrOutput << e[jj].lbp[kk].r << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				}
+	}
+}
 
-				incrOutput << e[jj].r << ENTRIES_EXPORT_FIELD_SEPARATOR;
+void endWorker(void* rawContext, void* rawWorker) {
+	GenerateContext &context = *(static_cast<GenerateContext*>(rawContext));
+	GenerateWorker *state = static_cast<GenerateWorker*>(rawWorker);
 
-				for (kk = 0; kk < args.valueBits; kk++) {
-					incrOutput << (bit(e[jj].balance, kk) ? e[jj].lbp[kk].b3 : e[jj].lbp[kk].b1) << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				}
+	if (context.placement != NULL) {
+		(*context.partialLedgers)[state->worker] = *state->partialLedger;
+		delete state->partialLedger;
+	}
 
-				for (kk = 0; kk < args.valueBits; kk++) {
-					incrOutput << (bit(e[jj].balance, kk) ? e[jj].lbp[kk].b4 : e[jj].lbp[kk].b2) << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				}
+	// Everything allocated by this thread's MIRACL instance must be freed before the instance itself.
+	delete state->lepgen;
+	delete state->lbpgen;
+	state->e.clear();
+	state->gx.clear();
+	delete state->precision;
+	delete state;
+}
 
-				incrOutput << e[jj].lep.b1 << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				incrOutput << e[jj].lep.b2 << ENTRIES_EXPORT_FIELD_SEPARATOR;
-				incrOutput << e[jj].lep.b3;
+// The writePack function is called by the writer with each group of ledger entries, strictly in ledger order. It places
+// the group in each of the ordered outputs, which requires only that the space for it be reserved, so the writer never
+// waits for IO. The pack is then passed back to a worker, which writes its output with flushPack, after which it is
+// recycled. Thus many groups can be written at once, each at its own position.
+void writePack(void* rawContext, void* rawPack) {
+	GenerateContext &context = *(static_cast<GenerateContext*>(rawContext));
+	GeneratePack *pack = static_cast<GeneratePack*>(rawPack);
 
-				incrOutput << endl;
-			}
+	context.proof->placeEntries(pack->first, pack->proof.data(), pack->proof.size(), &pack->entryOffsets[0], pack->count, pack->runs);
 
-			entrycount++;
+	if (context.index->isOpen()) {
+		context.index->setEntryOffsets(pack->first, &pack->entryOffsets[0], pack->count);
+	}
 
-		}
+	if (context.entries->isOpen()) {
+		context.entries->place(pack->entries.data(), pack->entries.size(), pack->runs);
+	}
+
+	if (context.incr_dst->isOpen()) {
+		context.incr_dst->place(pack->incr.data(), pack->incr.size(), pack->runs);
+	}
+
+	// The lengths of the outputs once this group has been placed are where they must resume if it is the last group
+	// completed before a checkpoint.
+	if (context.checkpoint != NULL) {
+		context.proof->mark(pack->mark.proofSizes, pack->mark.shardEntries);
+		pack->mark.entriesSize = context.entries->size();
+		pack->mark.incrSize = context.incr_dst->size();
+	}
+}
+
+void flushPack(void* rawContext, void* rawWorker, void* rawPack) {
+	GenerateContext &context = *(static_cast<GenerateContext*>(rawContext));
+	GeneratePack *pack = static_cast<GeneratePack*>(rawPack);
+	OutputFile::writeRuns(pack->runs);
+
+	if (context.checkpoint != NULL) {
+		context.checkpoint->complete(pack->first, *pack->sums, pack->mark);
+	}
+}
+
+// Flush every output to disk before a checkpoint is written. This is called by a worker, while the others continue to
+// write later groups, which the checkpoint does not cover.
+static bool syncOutputs(void* rawContext) {
+	GenerateContext &context = *(static_cast<GenerateContext*>(rawContext));
+	bool ok = context.proof->sync() && context.entries->sync() && context.incr_dst->sync();
+	return ok && context.incr_bin_dst->sync() && context.openers->sync() && context.index->sync();
+}
+
+// ReplicaJob asks a thread confined to a NUMA node to fill a replica of the incremental data there (see
+// IncrStore::replicate).
+typedef struct ReplicaJob {
+	IncrStore *replica;
+	IncrStore *source;
+	bool replicated;
+} ReplicaJob;
+
+static void replicateIncrData(void* rawJob) {
+	ReplicaJob *job = static_cast<ReplicaJob*>(rawJob);
+	job->replicated = job->replica->replicate(*job->source);
+}
+
+
+// A proof may be generated by several processes, each of which generates a single shard of it as a partition (-P), and
+// writes the sums of its entries to a partial summary alongside the shard. Once every partition is complete, the
+// coordinator (-M) merges the summaries, exactly as the partial ledgers of the workers within a single process are merged,
+// then generates the difference bits and writes the manifest. The partitions must agree on everything in the header, so
+// unless the proof time is fixed by incremental data, it must be given to every partition (-w).
+static int mergePartitions(const char *proof_dest, int shardCount, bool directOutput, Big a, Big b, Big p, Big q, ECn g, ECn h, ECn f, int bits, int valueBits, int maxThreads) {
+	ProofWriter proof;
+	Ledger finalLedger(g, h, f, valueBits);
+	PartialSummary first(g, h, f, valueBits);
+	uint64_t entrycount = 0;
+
+	if (!proof.openManifest(proof_dest, shardCount, directOutput)) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: proof destination could not be opened." << endl;
+		return 0;
+	}
 
-		// Write cached incremental and entries data.
+	char name[strlen(proof_dest) + 24];
+	for (int ii = 0; ii < shardCount; ii++) {
+		PartialSummary partial(g, h, f, valueBits);
+		snprintf(name, sizeof(name), PARTIAL_NAME_FORMAT, proof_dest, ii);
 
-		if (output_entries) {
-			pthread_mutex_lock(&entries_lock);
-			*args.entries << entriesOutput.rdbuf();
-			pthread_mutex_unlock(&entries_lock);
+		if (!partial.read(name)) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: partial summary " << name << " could not be read, or does not match balance bits." << endl;
+			return 0;
 		}
 
-		if (output_incr) {
-			pthread_mutex_lock(&incr_dst_lock);
-			*args.incr_dst << incrOutput.rdbuf();
-			pthread_mutex_unlock(&incr_dst_lock);
+		if (ii == 0) first = partial;
+		if (partial.shard != ii || partial.shardCount != shardCount || partial.first != entrycount || partial.assets != first.assets || partial.proofTime != first.proofTime) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: partial summary " << name << " does not belong to this proof." << endl;
+			return 0;
 		}
 
-		if (ii != args.packSize) break;
+		finalLedger.appendLedger(partial.sums);
+		proof.setShard(ii, partial.count, partial.digest);
+		entrycount += partial.count;
+	}
+
+	cerr << TAG_ERASE << TAG_DONE << endl;
+	fprintf(stderr, "%-40s%s", "Merging partitions", TAG_WORKING);
+	fflush(stderr);
+
+	proof.writeHeader(first.assets, first.proofTime, valueBits, g, h, f);
 
+	finalLedger.totalAssets = first.assets;
+	finalLedger.computeSums();
+
+	DBPProcessor dbpgen(q, g, h, f, bits, valueBits);
+	dbpgen.genParallel(finalLedger, a, b, p, maxThreads);
+
+	finalLedger.generateCommitments();
+
+	if (!proof.writeFooter(finalLedger)) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: proof could not be written." << endl;
+		return 0;
 	}
 
-	pthread_exit(NULL);
+	cerr << TAG_ERASE << TAG_DONE << endl;
+	cerr << endl;
+	cerr << "Entries: " << entrycount << endl;
+	cerr << "Proof Digest: " << proof.digest << endl;
 	return 0;
 }
 
-// The incrLoop function forms the body of a pthread, and is responsible for incremental data ingest. As with the calcLoop
-// function, it attempts to keep its locks active for as little time as possible. As a consequence, it copies raw string data
-// only while the incremental source lock is active, and waits to ingest it into bignums and curve points until after the
-// lock is relinquished. Also as with calcLoop, ledger entries are processed in groups, and the group size can be adjusted to
-// optimize performance for a particular thread count.
-void * incrLoop(void* rawArgs) {
-	incrLoopArgs &args = *(static_cast<incrLoopArgs*>(rawArgs));
 
-	// per-thread MIRACL setup
-	#ifndef MR_NOFULLWIDTH
-	Miracl precision(64,0);
-	#else
-	Miracl precision(64,MAXBASE);
-	#endif
+// A multi-asset ledger (-a) holds several balances for each account, one for each asset, and a separate proof is written
+// for each asset, exactly as if its balances had been given to zlgenerate alone. Rather than reading the ledger once for
+// each asset, the ledger is read once, and every asset's entries for an account are generated together by the same worker,
+// so that the work which depends only upon the account (parsing the line, hashing the identifier, and computing x'g) is
+// done once for all of them. The pipeline is otherwise the same as the one above, except that each pack carries the
+// output of every asset, and each worker keeps a partial ledger for every asset. Each proof and entries export is written
+// to the given path with ASSET_NAME_FORMAT, and the proofs share a single time.
+typedef struct AssetsContext {
+	Big a;
+	Big b;
+	Big p;
+	Big q;
+	ECn g;
+	ECn h;
+	ECn f;
+	int bits;
+	int packSize;
+	int valueBits;
+	int assetCount;
+	uint64_t entrycount;
+	LedgerReader *ledger;
+	vector<Ledger> *partialLedgers;
+	vector<ProofWriter> *proofs;
+	vector<OutputFile> *entries;
+	MalformedInput malformed;
+} AssetsContext;
+
+// AssetsPack holds a single group of accounts, with the output of each asset kept apart, and its own copy of their lines
+// when the ledger is streamed.
+typedef struct AssetsPack {
+	uint64_t first;
+	int count;
+	const char *begin;
+	const char *end;
+	vector<char> text;
+	vector<TextBuffer> proof, entries;
+	vector< vector<uint64_t> > entryOffsets;
+	vector<OutputRun> runs;
+} AssetsPack;
+
+typedef struct AssetsWorker {
+	Miracl *precision;
+	LEPProcessor *lepgen;
+	LBPProcessor *lbpgen;
+	Ledger *partialLedgers;
+	LedgerEntry account, e;
+	vector<Big> balances;
+} AssetsWorker;
+
+void * newAssetsPack(void* rawContext) {
+	AssetsContext &context = *(static_cast<AssetsContext*>(rawContext));
+	AssetsPack *pack = new AssetsPack;
+	pack->first = 0;
+	pack->count = 0;
+	pack->begin = NULL;
+	pack->end = NULL;
+	pack->proof.resize(context.assetCount);
+	pack->entries.resize(context.assetCount);
+	pack->entryOffsets.resize(context.assetCount, vector<uint64_t>(context.packSize));
+	return pack;
+}
 
-	ecurve(args.a,args.b,args.p,MR_PROJECTIVE);
+void deleteAssetsPack(void* rawContext, void* rawPack) {
+	delete static_cast<AssetsPack*>(rawPack);
+}
 
-	Big cx;
-	int ylsb;
-	int ii, jj, kk;
+bool readAssetsPack(void* rawContext, void* rawPack) {
+	AssetsContext &context = *(static_cast<AssetsContext*>(rawContext));
+	AssetsPack *pack = static_cast<AssetsPack*>(rawPack);
 
-	IncrDataRaw rawData[args.packSize];
-	for (ii = 0; ii < args.packSize; ii++) {
-		rawData[ii] = IncrDataRaw(args.valueBits);
+	if (context.malformed.entry.load() != UINT64_MAX) return false;
+	pack->count = context.ledger->nextEntries(context.packSize, pack->begin, pack->end);
+	if (pack->count == 0) return false;
+
+	pack->first = context.entrycount;
+	context.entrycount += pack->count;
+
+	if (context.ledger->isStreamed()) {
+		pack->text.assign(pack->begin, pack->end);
+		pack->begin = pack->text.data();
+		pack->end = pack->begin + pack->text.size();
 	}
+	return true;
+}
+
+void * beginAssetsWorker(void* rawContext, int worker) {
+	AssetsContext &context = *(static_cast<AssetsContext*>(rawContext));
+	AssetsWorker *state = new AssetsWorker;
+
+	// per-thread MIRACL setup
+	state->precision = newThreadMiracl();
+
+	irand(fetchRandomSeed());
 
-	IncrEntry incrData[args.packSize];
-	for (ii = 0; ii < args.packSize; ii++) {
-		incrData[ii] = IncrEntry(args.valueBits);
+	ecurve(context.a,context.b,context.p,MR_PROJECTIVE);
+
+	// zl setup
+	state->lepgen = new LEPProcessor(context.q, context.g, context.h, context.f, context.bits);
+	state->lbpgen = new LBPProcessor(context.q, context.g, context.h, context.f, context.bits, context.valueBits);
+	state->partialLedgers = &(*context.partialLedgers)[worker * context.assetCount];
+	state->account = LedgerEntry(context.valueBits);
+	state->balances.resize(context.assetCount);
+
+	return state;
+}
+
+void calcAssetsPack(void* rawContext, void* rawWorker, void* rawPack) {
+	AssetsContext &context = *(static_cast<AssetsContext*>(rawContext));
+	AssetsWorker *state = static_cast<AssetsWorker*>(rawWorker);
+	AssetsPack *pack = static_cast<AssetsPack*>(rawPack);
+
+	LedgerEntry &account = state->account, &e = state->e;
+	LedgerLine line;
+	const char *p = pack->begin;
+	int jj, kk;
+
+	for (kk = 0; kk < context.assetCount; kk++) {
+		pack->proof[kk].clear();
+		pack->entries[kk].clear();
 	}
 
-	while (true) {
+	for (jj = 0; jj < pack->count; jj++) {
 
-		// First we read the raw incremental data from the file, but do not ingest it
+		bool valid = true;
+		p = LedgerReader::parseEntry(p, pack->end, line, context.assetCount, &state->balances[0], valid);
+		if (!valid) reportMalformed(context.malformed, "a balance", pack->first + jj, line, pack->end);
 
-		pthread_mutex_lock(&incr_src_lock);
+		account.setId(string(line.id, line.idLength));
+		state->lepgen->genIdCommitment(account);
 
-		for (ii = 0; ii < args.packSize; ii++) {
-			if (!(*args.incr_src >> rawData[ii].index)) break;
-			
-			*args.incr_src >> rawData[ii].identifier;
-			*args.incr_src >> rawData[ii].balance;
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				*args.incr_src >> rawData[ii].lbc_cx[kk] >> rawData[ii].lbc_ylsb[kk];
-			}
-			*args.incr_src >> rawData[ii].lec_cx >> rawData[ii].lec_ylsb;
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				*args.incr_src >> rawData[ii].lbp_gamma_cx[kk] >> rawData[ii].lbp_gamma_ylsb[kk];
-			}
-			*args.incr_src >> rawData[ii].lep_gamma_cx >> rawData[ii].lep_gamma_ylsb;
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				*args.incr_src >> rawData[ii].lbp_r[kk];
-			}
-			*args.incr_src >> rawData[ii].lep_r;
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				*args.incr_src >> rawData[ii].lbp_b1[kk];
-			}
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				*args.incr_src >> rawData[ii].lbp_b2[kk];
+		for (kk = 0; kk < context.assetCount; kk++) {
+			e = LedgerEntry(context.valueBits);
+			e.shareId(account);
+			e.setBalance(state->balances[kk]);
+
+			state->lbpgen->genCommitments(e);
+			state->lbpgen->genProofs(e);
+
+			e.computeR();
+
+			state->lepgen->genCommitment(e);
+			state->lepgen->genProof(e);
+
+			state->partialLedgers[kk].addEntry(e);
+
+			pack->entryOffsets[kk][jj] = pack->proof[kk].size();
+			ProofWriter::putEntry(pack->proof[kk], e);
+
+			if ((*context.entries)[kk].isOpen()) {
+				TextBuffer &entriesOutput = pack->entries[kk];
+				entriesOutput.putInteger(pack->first + jj);
+				entriesOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+				entriesOutput.putText(e.id);
+				entriesOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+				entriesOutput.putDecimal(e.balance);
+				entriesOutput.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+				entriesOutput.putBig(e.r);
+				entriesOutput.putChar('\n');
 			}
-			*args.incr_src >> rawData[ii].lep_b1;
-			*args.incr_src >> rawData[ii].lep_b2;
-			*args.incr_src >> rawData[ii].lep_b3;
 		}
 
-		pthread_mutex_unlock(&incr_src_lock);
+	}
+}
 
-		// Now that the lock is released, we actually ingest the data
+void endAssetsWorker(void* rawContext, void* rawWorker) {
+	AssetsWorker *state = static_cast<AssetsWorker*>(rawWorker);
+
+	// Everything allocated by this thread's MIRACL instance must be freed before the instance itself.
+	delete state->lepgen;
+	delete state->lbpgen;
+	state->account = LedgerEntry();
+	state->e = LedgerEntry();
+	state->balances.clear();
+	delete state->precision;
+	delete state;
+}
 
-		for (jj = 0; jj < ii; jj++) {
-			get_mip()->IOBASE=10;
-			cinstr(incrData[jj].balance.getbig(), (char *) rawData[jj].balance.c_str());
-			get_mip()->IOBASE=DATA_BASE;
+void writeAssetsPack(void* rawContext, void* rawPack) {
+	AssetsContext &context = *(static_cast<AssetsContext*>(rawContext));
+	AssetsPack *pack = static_cast<AssetsPack*>(rawPack);
 
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				cinstr(cx.getbig(), (char *) rawData[jj].lbc_cx[kk].c_str());
-				ylsb = stoi(rawData[jj].lbc_ylsb[kk]);
-				incrData[jj].lbc[kk] = ECn(cx,ylsb);
-			}
+	for (int kk = 0; kk < context.assetCount; kk++) {
+		(*context.proofs)[kk].placeEntries(pack->first, pack->proof[kk].data(), pack->proof[kk].size(), &pack->entryOffsets[kk][0], pack->count, pack->runs);
 
-			cinstr(cx.getbig(), (char *) rawData[jj].lec_cx.c_str());
-			ylsb = stoi(rawData[jj].lec_ylsb);
-			incrData[jj].lec = ECn(cx,ylsb);
+		if ((*context.entries)[kk].isOpen()) {
+			(*context.entries)[kk].place(pack->entries[kk].data(), pack->entries[kk].size(), pack->runs);
+		}
+	}
+}
 
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				cinstr(cx.getbig(), (char *) rawData[jj].lbp_gamma_cx[kk].c_str());
-				ylsb = stoi(rawData[jj].lbp_gamma_ylsb[kk]);
-				incrData[jj].lbp_gamma[kk] = ECn(cx,ylsb);
-			}
+void flushAssetsPack(void* rawContext, void* rawWorker, void* rawPack) {
+	AssetsPack *pack = static_cast<AssetsPack*>(rawPack);
+	OutputFile::writeRuns(pack->runs);
+}
 
-			cinstr(cx.getbig(), (char *) rawData[jj].lep_gamma_cx.c_str());
-			ylsb = stoi(rawData[jj].lep_gamma_ylsb);
-			incrData[jj].lep_gamma = ECn(cx,ylsb);
+static int generateAssets(AssetsContext &context, const vector<const char *> &ledger_sources, const char *proof_dest, const char *entries_dest, bool directOutput, time_t proofTime, int maxThreads) {
+	LedgerReader ledger;
+	vector<Big> assets(context.assetCount);
+	vector<ProofWriter> proofs(context.assetCount);
+	vector<OutputFile> entries(context.assetCount);
+	char name[strlen(proof_dest) + (entries_dest != NULL ? strlen(entries_dest) : 0) + 24];
+	int kk;
 
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				cinstr(incrData[jj].lbp_r[kk].getbig(), (char *) rawData[jj].lbp_r[kk].c_str());
-			}
+	if (!ledger.open(ledger_sources) || !ledger.readAssets(&assets[0], context.assetCount)) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: ledger could not be read." << endl;
+		return 0;
+	}
 
-			cinstr(incrData[jj].lep_r.getbig(), (char *) rawData[jj].lep_r.c_str());
+	for (kk = 0; kk < context.assetCount; kk++) {
+		snprintf(name, sizeof(name), ASSET_NAME_FORMAT, proof_dest, kk);
+		if (!proofs[kk].open(name, 1, 0, directOutput, false)) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: proof destination " << name << " could not be opened." << endl;
+			return 0;
+		}
 
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				cinstr(incrData[jj].lbp_b1[kk].getbig(), (char *) rawData[jj].lbp_b1[kk].c_str());
+		if (entries_dest != NULL) {
+			snprintf(name, sizeof(name), ASSET_NAME_FORMAT, entries_dest, kk);
+			if (!entries[kk].open(name, directOutput)) {
+				cerr << TAG_ERASE << TAG_FAIL << endl;
+				cerr << "Error: entries export destination " << name << " could not be opened." << endl;
+				return 0;
 			}
+		}
+	}
+
+	cerr << TAG_ERASE << TAG_DONE << endl;
+	fprintf(stderr, "%-40s%s", "Generating proofs", TAG_WORKING);
+	fflush(stderr);
 
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				cinstr(incrData[jj].lbp_b2[kk].getbig(), (char *) rawData[jj].lbp_b2[kk].c_str());
+	for (kk = 0; kk < context.assetCount; kk++) {
+		proofs[kk].writeHeader(assets[kk], proofTime, context.valueBits, context.g, context.h, context.f);
+	}
+
+	vector<Ledger> partialLedgers(maxThreads * context.assetCount, Ledger(context.g, context.h, context.f, context.valueBits));
+
+	context.entrycount = 0;
+	context.ledger = &ledger;
+	context.partialLedgers = &partialLedgers;
+	context.proofs = &proofs;
+	context.entries = &entries;
+	initMalformed(context.malformed);
+
+	PipelineStages stages;
+	stages.context = static_cast<void*>(&context);
+	stages.newPack = &newAssetsPack;
+	stages.deletePack = &deleteAssetsPack;
+	stages.read = &readAssetsPack;
+	stages.beginWorker = &beginAssetsWorker;
+	stages.work = &calcAssetsPack;
+	stages.endWorker = &endAssetsWorker;
+	stages.write = &writeAssetsPack;
+	stages.flush = &flushAssetsPack;
+
+	Pipeline pipeline(stages, maxThreads, 2 * maxThreads + 1);
+	pipeline.run();
+
+	// A malformed entry, or a ledger which ended early, leaves every proof incomplete, so none of them is left behind.
+	if (ledger.failed() || context.malformed.entry.load() != UINT64_MAX) {
+		for (kk = 0; kk < context.assetCount; kk++) {
+			proofs[kk].discard();
+			if (entries_dest != NULL) {
+				snprintf(name, sizeof(name), ASSET_NAME_FORMAT, entries_dest, kk);
+				unlink(name);
 			}
+		}
+
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		if (ledger.failed()) {
+			cerr << "Error: ledger could not be read." << endl;
+		} else {
+			cerr << "Error: " << context.malformed.message << "." << endl;
+		}
+		return 0;
+	}
 
-			cinstr(incrData[jj].lep_b1.getbig(), (char *) rawData[jj].lep_b1.c_str());
-			cinstr(incrData[jj].lep_b2.getbig(), (char *) rawData[jj].lep_b2.c_str());
-			cinstr(incrData[jj].lep_b3.getbig(), (char *) rawData[jj].lep_b3.c_str());
+	// Each asset is then finished exactly as a proof of a single asset would be.
+	DBPProcessor dbpgen(context.q, context.g, context.h, context.f, context.bits, context.valueBits);
+	for (kk = 0; kk < context.assetCount; kk++) {
+		Ledger finalLedger(context.g, context.h, context.f, context.valueBits);
+		finalLedger.totalAssets = assets[kk];
+		for (int ii = 0; ii < maxThreads; ii++) {
+			finalLedger.appendLedger(partialLedgers[ii * context.assetCount + kk]);
 		}
 
-		// Finally, insert the data we've ingested into the shared data store
+		finalLedger.computeSums();
+
+		dbpgen.genParallel(finalLedger, context.a, context.b, context.p, maxThreads);
+
+		finalLedger.generateCommitments();
 
-		pthread_mutex_lock(&incr_data_lock);
-		for (jj = 0; jj < ii; jj++) {
-			args.incrData->insert(pair<string, IncrEntry>(rawData[jj].identifier, incrData[jj]));
+		if (!proofs[kk].writeFooter(finalLedger)) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: proof could not be written." << endl;
+			return 0;
 		}
-		pthread_mutex_unlock(&incr_data_lock);
 
-		if (ii != args.packSize) break;
+		if (entries[kk].isOpen() && !entries[kk].close()) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: exports could not be written." << endl;
+			return 0;
+		}
 	}
 
-	pthread_exit(NULL);
+	cerr << TAG_ERASE << TAG_DONE << endl;
+	cerr << endl;
+	cerr << "Entries: " << context.entrycount << endl;
+	for (kk = 0; kk < context.assetCount; kk++) {
+		snprintf(name, sizeof(name), ASSET_NAME_FORMAT, proof_dest, kk);
+		cerr << "Proof Digest (" << name << "): " << proofs[kk].digest << endl;
+	}
 	return 0;
 }
 
@@ -453,20 +981,40 @@ void * incrLoop(void* rawArgs) {
 int main(int argc, char **argv) {
 
 	// Set up some variables to hold our options, with default values
-	char* ledger_source = NULL;
+	vector<const char *> ledger_sources;
 	char* incr_source = NULL;
 	char* proof_dest = NULL;
 	char* entries_dest = NULL;
 	char* incr_dest = NULL;
+	char* incr_bin_dest = NULL;
+	char* index_dest = NULL;
+	char* openers_dest = NULL;
+	char* checkpoint_dest = NULL;
 	char* bases_source = BASES_SOURCE_DEFAULT;
 	char* curve_source = CURVE_SOURCE_DEFAULT;
 	int threadcount = 0;
+	double budget = 0;
+	int shardCount = 1;
+	int assetCount = 1;
+	int partition = -1;
+	bool mergePartials = false;
+	time_t fixedTime = 0;
+	bool mergeIncr = false;
+	bool directOutput = false;
+	bool resume = false;
+	bool pinThreads = false;
+	int checkpointInterval = CHECKPOINT_INTERVAL_DEFAULT;
 	int packSize = ENTRIES_PER_PACK_DEFAULT;
 	int valueBits = BALANCE_BITS_DEFAULT;
 
 	// Now read options
+	static struct option longOptions[] = {
+		{"resume", no_argument, NULL, 'U'},
+		{NULL, 0, NULL, 0}
+	};
+
 	int c;
-	while ( (c = getopt(argc, argv, "ht:g:b:v:c:o:e:i:r:")) != -1) {
+	while ( (c = getopt_long(argc, argv, "ht:B:Ng:b:v:c:o:Ds:e:E:i:mr:R:x:C:T:UP:Mw:a:", longOptions, NULL)) != -1) {
 		switch (c) {
 			case 'h':
 				cerr << HELP_TEXT;
@@ -474,6 +1022,12 @@ int main(int argc, char **argv) {
 			case 't':
 				threadcount = atoi(optarg);
 				break;
+			case 'B':
+				budget = atof(optarg);
+				break;
+			case 'N':
+				pinThreads = true;
+				break;
 			case 'g':
 				packSize = atoi(optarg);
 				break;
@@ -489,24 +1043,66 @@ int main(int argc, char **argv) {
 			case 'o':
 				proof_dest = optarg;
 				break;
+			case 'D':
+				directOutput = true;
+				break;
+			case 's':
+				shardCount = atoi(optarg);
+				break;
 			case 'e':
 				entries_dest = optarg;
 				break;
+			case 'E':
+				openers_dest = optarg;
+				break;
 			case 'i':
 				incr_source = optarg;
 				break;
+			case 'm':
+				mergeIncr = true;
+				break;
 			case 'r':
 				incr_dest = optarg;
 				break;
+			case 'R':
+				incr_bin_dest = optarg;
+				break;
+			case 'x':
+				index_dest = optarg;
+				break;
+			case 'C':
+				checkpoint_dest = optarg;
+				break;
+			case 'T':
+				checkpointInterval = atoi(optarg);
+				break;
+			case 'U':
+				resume = true;
+				break;
+			case 'P':
+				partition = atoi(optarg);
+				break;
+			case 'M':
+				mergePartials = true;
+				break;
+			case 'w':
+				fixedTime = atoll(optarg);
+				break;
+			case 'a':
+				assetCount = atoi(optarg);
+				break;
 			default:
 				break;
 		}
 	}
 
-	if (optind < argc) {
-		ledger_source = argv[optind];
+	for (; optind < argc; optind++) {
+		ledger_sources.push_back(argv[optind]);
 	}
 
+	// Under a budget (-B), every pipeline is limited to it, so that generation can share the machine with other services.
+	Pipeline::setBudget(budget);
+
 
 	// MIRACL initialization
 	mr_init_threading();
@@ -569,46 +1165,92 @@ int main(int argc, char **argv) {
 	}
 	
 
+	// The coordinator of a distributed proof reads nothing but the partial summaries.
+	if (mergePartials) {
+		if (proof_dest == NULL || shardCount <= 1) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: merging partitions requires a sharded proof destination." << endl;
+			return 0;
+		}
+		int maxThreads = (threadcount > 0) ? threadcount : availableProcessors(budget);
+		return mergePartitions(proof_dest, shardCount, directOutput, a, b, p, q, g, h, f, bits, valueBits, maxThreads);
+	}
+
+	// A multi-asset ledger is proven in a pipeline of its own, which writes nothing but the proofs and entries exports.
+	if (assetCount > 1) {
+		if (proof_dest == NULL || shardCount > 1 || partition >= 0 || incr_source != NULL || checkpoint_dest != NULL || openers_dest != NULL || incr_dest != NULL || incr_bin_dest != NULL || index_dest != NULL) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: multi-asset ledgers require a proof destination, and can only be exported as entries." << endl;
+			return 0;
+		}
+
+		AssetsContext context;
+		context.a = a;
+		context.b = b;
+		context.p = p;
+		context.q = q;
+		context.g = g;
+		context.h = h;
+		context.f = f;
+		context.bits = bits;
+		context.packSize = packSize;
+		context.valueBits = valueBits;
+		context.assetCount = assetCount;
+
+		int maxThreads = (threadcount > 0) ? threadcount : availableProcessors(budget);
+		return generateAssets(context, ledger_sources, proof_dest, entries_dest, directOutput, (fixedTime > 0) ? fixedTime : time(0), maxThreads);
+	}
+
+	// With -N, each worker of the proof pipeline is pinned to a core of its own (see placement.h).
+	Placement placement;
+	if (pinThreads && !placement.load()) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: threads cannot be pinned on this system." << endl;
+		return 0;
+	}
+
 	// Read incremental data if any is available
 	Big cx;
 	int ylsb;
-	int maxThreads = (threadcount > 0) ? threadcount : sysconf( _SC_NPROCESSORS_ONLN );
-	time_t proofTime = time(0);
-	unordered_map<string, IncrEntry> incrData;
+	int maxThreads = (threadcount > 0) ? threadcount : availableProcessors(budget);
+	time_t proofTime = (fixedTime > 0) ? fixedTime : time(0);
+	IncrStore incrData;
+	IncrMerge incrMerge;
+	ifstream incr_src;
 	get_mip()->IOBASE=DATA_BASE;
 
-	if (incr_source != NULL) {
-		ifstream incr_src(incr_source);
+	// Binary incremental data is memory-mapped and decoded lazily as accounts are looked up, so there is nothing more to do
+	// here; text incremental data must be ingested in full before the proof is begun, unless it is to be merged with the
+	// ledger as both are read, in which case only its first record is read here.
+	if (incr_source != NULL && incrData.open(incr_source)) {
+		if (incrData.valueBits != valueBits) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: incremental data does not match balance bits." << endl;
+			return 0;
+		}
+		proofTime = incrData.proofTime;
+	} else if (incr_source != NULL && mergeIncr) {
+		incr_src.open(incr_source);
+		if (!(incr_src >> proofTime)) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: incremental data could not be read.";
+			return 0;
+		}
+		incrMerge.incr_src = &incr_src;
+		incrMerge.next = IncrDataRaw(valueBits);
+		incrMerge.hasNext = incrMerge.next.read(incr_src);
+		incrMerge.sorted = true;
+	} else if (incr_source != NULL) {
+		incr_src.open(incr_source);
 		if (incr_src.good()){
 			incr_src >> proofTime;
-
-			pthread_t incrThread[maxThreads];
-			incrLoopArgs incrArgs[maxThreads];
-
-			pthread_mutex_init(&incr_src_lock, NULL);
-			pthread_mutex_init(&incr_data_lock, NULL);
-			
-
-			for (int ii = 0; ii < maxThreads; ii++) {
-				incrArgs[ii].a = a;
-				incrArgs[ii].b = b;
-				incrArgs[ii].p = p;
-				incrArgs[ii].packSize = packSize;
-				incrArgs[ii].valueBits = valueBits;
-				incrArgs[ii].incr_src = &incr_src;
-				incrArgs[ii].incrData = &incrData;
-				pthread_create(&(incrThread[ii]), NULL, &incrLoop, static_cast<void*>(&(incrArgs[ii])));
-			}
-
-			for (int ii = 0; ii < maxThreads; ii++) {
-				pthread_join(incrThread[ii], NULL);
+			incrData.init(q, bits, valueBits);
+			uint64_t malformed;
+			if (!ingestIncrData(incr_src, incrData, a, b, p, valueBits, maxThreads, packSize, malformed)) {
+				cerr << TAG_ERASE << TAG_FAIL << endl;
+				cerr << "Error: incremental data for entry " << malformed << " is malformed." << endl;
+				return 0;
 			}
-
-
-			pthread_mutex_destroy(&incr_src_lock);
-			pthread_mutex_destroy(&incr_data_lock);
-
-
 			incr_src.close();
 		} else {
 			cerr << TAG_ERASE << TAG_FAIL << endl;
@@ -619,47 +1261,151 @@ int main(int argc, char **argv) {
 
 
 	// Prepare to read the ledger and write the various outputs
-	ifstream ledgerHandle;
-	streambuf * proof_buf;
-	ofstream proof_output;
-	ofstream entries;
-	ofstream incr_dst;
-
-	if (ledger_source != NULL) {
-		ledgerHandle.open(ledger_source);
-		if (ledgerHandle.fail()) {
+	LedgerReader ledger;
+	ProofWriter proof;
+	uint64_t ledgerLength = 0;
+	OutputFile entries;
+	OutputFile incr_dst;
+	IncrStore incr_bin_dst;
+	OpenerStore openers;
+	ProofIndex index;
+	Big assets;
+
+	// Counting the entries of a sharded proof, and resuming from a checkpoint, require the whole ledger to be at hand.
+	if (!ledger.open(ledger_sources, shardCount > 1 || checkpoint_dest != NULL) || !ledger.readAssets(assets)) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: ledger could not be read." << endl;
+		return 0;
+	}
+
+	// A sharded proof divides the entries evenly among the shards, so the ledger must be measured before it is read.
+	if (shardCount > 1) {
+		if (proof_dest == NULL) {
 			cerr << TAG_ERASE << TAG_FAIL << endl;
-			cerr << "Error: ledger could not be read." << endl;
+			cerr << "Error: sharded proofs require a proof destination." << endl;
 			return 0;
 		}
+		ledgerLength = ledger.countEntries();
 	}
 
-	if(proof_dest != NULL) {
-	    proof_output.open(proof_dest);
-	    if (proof_output.fail()) {
-			cerr << "Error: proof destination could not be opened." << endl;
+	// The root of the entry tree is written into the header of the proof once it is known, which requires a file.
+	if (openers_dest != NULL && proof_dest == NULL) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: openers require a proof destination." << endl;
+		return 0;
+	}
+
+	// A partition writes a single shard, and everything it writes must be confined to its own entries.
+	uint64_t partitionFirst = 0, partitionCount = 0;
+	if (partition >= 0) {
+		if (shardCount <= 1 || partition >= shardCount) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: a partition must be one of the shards of a sharded proof." << endl;
+			return 0;
+		}
+		if (openers_dest != NULL || incr_bin_dest != NULL || index_dest != NULL || checkpoint_dest != NULL) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: partitions cannot write openers, binary incremental data, an index, or checkpoints." << endl;
+			return 0;
+		}
+
+		ProofWriter::shardRange(ledgerLength, shardCount, partition, partitionFirst, partitionCount);
+		ledger.skipEntries(partitionFirst);
+	}
+
+	// A checkpoint records positions within the ledger files and the outputs, so all of them must be files, and the ledger
+	// must be read in order, independently of the incremental data.
+	if (checkpoint_dest != NULL && (ledger_sources.empty() || proof_dest == NULL || mergeIncr)) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: checkpoints require ledger files and a proof destination, and cannot be used when merging." << endl;
+		return 0;
+	}
+
+	if (resume && checkpoint_dest == NULL) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: resuming requires a checkpoint." << endl;
+		return 0;
+	}
+
+	// When resuming, the proof is continued exactly as it was begun, including its time; incremental data fixes the time
+	// of the proof, so it must be the same data as before.
+	Checkpoint checkpoint(g, h, f, valueBits);
+
+	if (resume) {
+		if (!checkpoint.load(checkpoint_dest)) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: checkpoint could not be read, or does not match balance bits." << endl;
+			return 0;
+		}
+		if (incr_source != NULL && checkpoint.proofTime != proofTime) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: checkpoint does not match incremental data." << endl;
+			return 0;
+		}
+		proofTime = checkpoint.proofTime;
+
+		if (!ledger.seek(checkpoint.mark.ledgerFile, checkpoint.mark.ledgerOffset)) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: checkpoint does not match ledger." << endl;
 			return 0;
 		}
-	    proof_buf = proof_output.rdbuf();
+	}
+
+	bool opened;
+	if (partition >= 0) {
+		opened = proof.openPartition(proof_dest, shardCount, partition, ledgerLength, directOutput);
+	} else if (resume) {
+		opened = proof.reopen(proof_dest, shardCount, ledgerLength, directOutput, openers_dest != NULL, checkpoint.mark.proofSizes, checkpoint.mark.shardEntries);
 	} else {
-	    proof_buf = cout.rdbuf();
+		opened = proof.open(proof_dest, shardCount, ledgerLength, directOutput, openers_dest != NULL);
+	}
+
+	if (!opened) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: proof destination could not be opened." << endl;
+		return 0;
 	}
 
 	if (entries_dest != NULL) {
-		entries.open(entries_dest);
-		if (entries.fail()) {
+		opened = resume ? entries.reopen(entries_dest, directOutput, checkpoint.mark.entriesSize) : entries.open(entries_dest, directOutput);
+		if (!opened) {
 			cerr << "Error: entries export destination could not be opened." << endl;
 			return 0;
 		}
 	}
 
 	if (incr_dest != NULL) {
-		incr_dst.open(incr_dest);
-		if (incr_dst.fail()) {
+		opened = resume ? incr_dst.reopen(incr_dest, directOutput, checkpoint.mark.incrSize) : incr_dst.open(incr_dest, directOutput);
+		if (!opened) {
 			cerr << "Error: incremental data export destination could not be opened." << endl;
 			return 0;
-		} else {
-			incr_dst << proofTime << endl;
+		} else if (!resume && partition <= 0) {
+			// The exports of the partitions may simply be concatenated, so only the first begins with the header.
+			stringstream header;
+			header << proofTime << endl;
+			string text = header.str();
+			incr_dst.append(text.data(), text.size());
+		}
+	}
+
+	if (incr_bin_dest != NULL) {
+		if (!incr_bin_dst.create(incr_bin_dest, q, bits, valueBits, proofTime, resume)) {
+			cerr << "Error: incremental data export destination could not be opened." << endl;
+			return 0;
+		}
+	}
+
+	if (openers_dest != NULL) {
+		if (!openers.create(openers_dest, q, bits, proofTime, resume)) {
+			cerr << "Error: openers destination could not be opened." << endl;
+			return 0;
+		}
+	}
+
+	if (index_dest != NULL) {
+		if (!index.create(index_dest, valueBits, resume)) {
+			cerr << "Error: index destination could not be opened." << endl;
+			return 0;
 		}
 	}
 
@@ -667,123 +1413,217 @@ int main(int argc, char **argv) {
 	fprintf(stderr, "%-40s%s", "Generating proof", TAG_WORKING);
 	fflush(stderr);
 
-	istream& ledger = (ledgerHandle.is_open() ? ledgerHandle : cin);
-		ostream proof(proof_buf);
+	// Finally, we begin reading the ledger and writing the outputs
+	proof.writeHeader(assets, proofTime, valueBits, g, h, f);
 
+	// Now start a pipeline with as many workers as we are allowed to do the processing, along with the reader and writer.
+	// Each worker may have a couple of groups in the pipeline at once, whether waiting to be processed or to be written.
+	vector<Ledger> partialLedgers(maxThreads, Ledger(g, h, f, valueBits));
 
-	// Finally, we begin reading the ledger and writing the outputs
-	get_mip()->IOBASE=10;
+	GenerateContext context;
+	context.a = a;
+	context.b = b;
+	context.p = p;
+	context.q = q;
+	context.g = g;
+	context.h = h;
+	context.f = f;
+	context.bits = bits;
+	context.packSize = packSize;
+	context.valueBits = valueBits;
+	context.entrycount = (partition >= 0) ? partitionFirst : checkpoint.mark.entryCount;
+	context.lastEntry = (partition >= 0) ? partitionFirst + partitionCount : UINT64_MAX;
+	context.ledger = &ledger;
+	context.incrMerge = (incr_src.is_open() && mergeIncr) ? &incrMerge : NULL;
+	context.incrData = &incrData;
+	context.incr_bin_dst = &incr_bin_dst;
+	context.openers = &openers;
+	context.partialLedgers = &partialLedgers;
+	context.proof = &proof;
+	context.entries = &entries;
+	context.incr_dst = &incr_dst;
+	context.index = &index;
+	context.checkpoint = (checkpoint_dest != NULL) ? &checkpoint : NULL;
+	context.placement = pinThreads ? &placement : NULL;
+	initMalformed(context.malformed);
+
+	// Every worker looks up the incremental data of each of its entries, at random, so when the workers occupy several NUMA
+	// nodes, the data is replicated on each of them. A node for which no replica can be made leaves every worker reading
+	// the original.
+	if (pinThreads && incrData.size() > 0) {
+		int nodes = 1;
+		for (int ii = 0; ii < maxThreads; ii++) nodes = max(nodes, placement.node(ii) + 1);
+
+		bool replicated = nodes > 1;
+		for (int ii = 0; replicated && ii < nodes; ii++) {
+			ReplicaJob job = { new IncrStore(), &incrData, false };
+			placement.runOnNode(ii, &replicateIncrData, &job);
+			context.incrReplicas.push_back(job.replica);
+			replicated = job.replicated;
+		}
+		if (!replicated) {
+			for (size_t ii = 0; ii < context.incrReplicas.size(); ii++) delete context.incrReplicas[ii];
+			context.incrReplicas.clear();
+		}
+	}
 
-	Big assets;
-	ledger >> assets;
-	
-	proof << "BEGIN ZEROLEDGE PROOF" << endl;
-	proof << SECTION_SEPARATOR;
-	proof << endl;
-	proof << "ASSETS " << assets << endl;
-	proof << "TIME " << proofTime << endl;
-	proof << "BITS " << valueBits << endl;
-	
-	proof << SECTION_SEPARATOR;
-	proof << endl;
+	if (checkpoint_dest != NULL) {
+		checkpoint.setDestination(checkpoint_dest, checkpointInterval, proofTime, &syncOutputs, &context);
+	}
 
-	get_mip()->IOBASE=DATA_BASE;
-	
-	ylsb = g.get(cx);
-	proof << cx << endl << ylsb << endl;
-	ylsb = h.get(cx);
-	proof << cx << endl << ylsb << endl;
-	ylsb = f.get(cx);
-	proof << cx << endl << ylsb << endl;
-
-	// Now fork as many threads as we are allowed to do the processing and IO.
-	pthread_t thread[maxThreads];
-	calcLoopArgs args[maxThreads];
-	vector<Ledger> partialLedgers(maxThreads, Ledger(g, h, f, valueBits));
-	unsigned entrycount = 0;
-
-	pthread_mutex_init(&ledger_lock, NULL);
-	pthread_mutex_init(&proof_lock, NULL);
-	pthread_mutex_init(&entries_lock, NULL);
-	pthread_mutex_init(&incr_dst_lock, NULL);
-
-	for (int ii = 0; ii < maxThreads; ii++) {
-		args[ii].a = a;
-		args[ii].b = b;
-		args[ii].p = p;
-		args[ii].q = q;
-		args[ii].g = g;
-		args[ii].h = h;
-		args[ii].f = f;
-		args[ii].bits = bits;
-		args[ii].packSize = packSize;
-		args[ii].proofTime = proofTime;
-		args[ii].valueBits = valueBits;
-		args[ii].entrycount = &entrycount;
-		args[ii].partialLedger = &partialLedgers[ii];
-		args[ii].ledger = &ledger;
-		args[ii].proof = &proof;
-		args[ii].entries = &entries;
-		args[ii].incr_dst = &incr_dst;
-		args[ii].incrData = &incrData;
-		pthread_create(&(thread[ii]), NULL, &calcLoop, static_cast<void*>(&(args[ii])));
+	PipelineStages stages;
+	stages.context = static_cast<void*>(&context);
+	stages.newPack = &newPack;
+	stages.deletePack = &deletePack;
+	stages.read = &readPack;
+	stages.beginWorker = &beginWorker;
+	stages.work = &calcPack;
+	stages.endWorker = &endWorker;
+	stages.write = &writePack;
+	stages.flush = &flushPack;
+
+	Pipeline pipeline(stages, maxThreads, 2 * maxThreads + 1);
+	context.pipeline = &pipeline;
+	if (pinThreads) pipeline.place(&placement);
+	pipeline.run();
+
+	for (size_t ii = 0; ii < context.incrReplicas.size(); ii++) delete context.incrReplicas[ii];
+
+	// Nothing written before the pipeline stopped early (or the ledger ended early) is of any use, so none of it is left
+	// behind, not even a checkpoint from which it might be resumed.
+	bool malformed = context.malformed.entry.load() != UINT64_MAX;
+	if (ledger.failed() || malformed || (incr_src.is_open() && mergeIncr && !incrMerge.sorted)) {
+		proof.discard();
+		const char *outputs[] = { entries_dest, incr_dest, incr_bin_dest, openers_dest, index_dest, checkpoint_dest };
+		for (size_t ii = 0; ii < sizeof(outputs) / sizeof(outputs[0]); ii++) {
+			if (outputs[ii] != NULL) unlink(outputs[ii]);
+		}
+
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		if (ledger.failed()) {
+			cerr << "Error: ledger could not be read." << endl;
+		} else if (malformed) {
+			cerr << "Error: " << context.malformed.message << "." << endl;
+		} else {
+			cerr << "Error: ledger and incremental data must be sorted by account to be merged." << endl;
+		}
+		return 0;
 	}
-	
+
+	// A checkpoint which could not be written means that the outputs, or the checkpoint itself, could not be flushed to disk,
+	// so the run fails rather than finishing as though it could have been resumed.
+	if (checkpoint_dest != NULL && checkpoint.failed()) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: checkpoint could not be written." << endl;
+		return 1;
+	}
+
+	uint64_t entrycount = context.entrycount;
+
 	Ledger finalLedger(g, h, f, valueBits);
 	finalLedger.totalAssets = assets;
 
-	for (int ii = 0; ii < maxThreads; ii++) {
-		pthread_join(thread[ii], NULL);
-		finalLedger.appendLedger(*args[ii].partialLedger);
+	// When checkpointing, the checkpoint has already merged the sums of every group, in order.
+	if (checkpoint_dest != NULL) {
+		finalLedger.appendLedger(checkpoint.sums);
+	} else {
+		for (int ii = 0; ii < maxThreads; ii++) {
+			finalLedger.appendLedger(partialLedgers[ii]);
+		}
 	}
 
-	pthread_mutex_destroy(&ledger_lock);
-	pthread_mutex_destroy(&proof_lock);
-	pthread_mutex_destroy(&entries_lock);
-	pthread_mutex_destroy(&incr_dst_lock);
+	// A partition leaves the difference bits and the manifest to the coordinator, and writes its sums for it to merge.
+	if (partition >= 0) {
+		PartialSummary summary(g, h, f, valueBits);
+		summary.proofTime = proofTime;
+		summary.assets = assets;
+		summary.shard = partition;
+		summary.shardCount = shardCount;
+		summary.first = partitionFirst;
+		summary.count = entrycount - partitionFirst;
+		summary.sums.appendLedger(finalLedger);
+
+		char name[strlen(proof_dest) + 24];
+		snprintf(name, sizeof(name), PARTIAL_NAME_FORMAT, proof_dest, partition);
+
+		if (!proof.finishPartition(summary.digest) || !summary.write(name)) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: proof could not be written." << endl;
+			return 0;
+		}
+
+		if ((entries.isOpen() && !entries.close()) || (incr_dst.isOpen() && !incr_dst.close())) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: exports could not be written." << endl;
+			return 0;
+		}
+
+		cerr << TAG_ERASE << TAG_DONE << endl;
+		cerr << endl;
+		cerr << "Shard Digest: " << summary.digest << endl;
+		return 0;
+	}
 
 	finalLedger.computeSums();
 
 	DBPProcessor dbpgen(q, g, h, f, bits, valueBits);
-	dbpgen.genCommitments(finalLedger);
-	dbpgen.genProofs(finalLedger);
+	dbpgen.genParallel(finalLedger, a, b, p, maxThreads);
 
 	finalLedger.generateCommitments();
 
-	proof << SECTION_SEPARATOR;
-	proof << endl;
+	// The openers must be finished first, since building them yields the root of the entry tree, which the proof holds.
+	if (openers.isOpen() && !openers.finish(entrycount)) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: openers could not be written." << endl;
+		return 0;
+	}
 
-	get_mip()->IOBASE=DATA_BASE;
+	if (openers_dest != NULL) {
+		proof.setEntriesRoot(openers.root);
+	}
 
-	for (int ii = 0; ii < valueBits; ii++) {
-		ylsb = finalLedger.dbc[ii].get(cx);
-		proof << cx << endl << ylsb << endl;
-		ylsb = finalLedger.dbp[ii].gamma1.get(cx);
-		proof << cx << endl << ylsb << endl;
-		ylsb = finalLedger.dbp[ii].gamma2.get(cx);
-		proof << cx << endl << ylsb << endl;
-		proof << finalLedger.dbp[ii].c1 << endl;
-		proof << finalLedger.dbp[ii].z1 << endl;
-		proof << finalLedger.dbp[ii].z2 << endl;
-		proof << finalLedger.dbp[ii].z3 << endl;
-		proof << finalLedger.dbp[ii].z4 << endl;
+	if (!proof.writeFooter(finalLedger)) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: proof could not be written." << endl;
+		return 0;
 	}
 
-	proof << SECTION_SEPARATOR;
-	proof << endl;
+	if (index.isOpen() && !index.finish(entrycount, proof.entriesOffset, proof.differenceOffset, proof.differenceBitOffsets)) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: index could not be written." << endl;
+		return 0;
+	}
 
-	proof << "END ZEROLEDGE PROOF" << endl;
+	if (incr_bin_dst.isOpen() && !incr_bin_dst.finish(entrycount)) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: incremental data could not be written." << endl;
+		return 0;
+	}
 
-	cerr << TAG_ERASE << TAG_DONE << endl;
+	if ((entries.isOpen() && !entries.finish()) || (incr_dst.isOpen() && !incr_dst.finish())) {
+		cerr << TAG_ERASE << TAG_FAIL << endl;
+		cerr << "Error: exports could not be written." << endl;
+		return 0;
+	}
 
-	if (proof_dest != NULL) {
-		proof_output.close();
-	} else {
-		cerr << endl;
+	// The proof is complete, so there is nothing left to resume, but the checkpoint is kept until every output has been
+	// flushed to disk, just as it is before each checkpoint is written.
+	if (checkpoint_dest != NULL) {
+		if (!syncOutputs(&context)) {
+			cerr << TAG_ERASE << TAG_FAIL << endl;
+			cerr << "Error: outputs could not be written." << endl;
+			return 0;
+		}
+		checkpoint.finish();
 	}
 
-	if (entries.is_open()) {
-		entries.close();
+	cerr << TAG_ERASE << TAG_DONE << endl;
+	cerr << endl;
+	cerr << "Proof Digest: " << proof.digest << endl;
+	if (openers_dest != NULL) cerr << "Entry Root: " << toHex(openers.root, TREE_HASH_DIGEST_BYTES) << endl;
+
+	if (proof_dest == NULL) {
+		cerr << endl;
 	}
 
 	return 0;
@@ -24,14 +24,17 @@
 #include <ctime>
 #include <vector>
 #include <unistd.h>
-#include <pthread.h>
+#include <getopt.h>
 
 #include "zeroledge.h"
 #include "zlutil.h"
+#include "placement.h"
 #include "ledger.h"
 #include "lepprocessor.h"
 #include "lbpprocessor.h"
 #include "dbpprocessor.h"
+#include "incrstore.h"
+#include "incrreader.h"
 
 #define HELP_TEXT "ZeroLedge Incremental IO Benchmark 1.0\n\
 Usage: zlincrementalio [\x1b[4mOPTIONS\x1b[0m]\n\
@@ -47,178 +50,6 @@ Options:\n\
 
 using namespace std;
 
-pthread_mutex_t incr_src_lock;
-pthread_mutex_t incr_data_lock;
-
-class IncrDataRaw {
-
-public:
-
-	int index;
-	string identifier, balance;
-	string lec_cx, lec_ylsb, lep_r;
-	string lep_b1, lep_b2, lep_b3;
-	string lep_gamma_cx, lep_gamma_ylsb;
-	vector<string> lbc_cx;
-	vector<string> lbc_ylsb;
-	vector<string> lbp_gamma_cx;
-	vector<string> lbp_gamma_ylsb;
-	vector<string> lbp_r;
-	vector<string> lbp_b1;
-	vector<string> lbp_b2;
-
-	IncrDataRaw(int valueBits) {
-		lbc_cx.resize(valueBits);
-		lbc_ylsb.resize(valueBits);
-		lbp_gamma_cx.resize(valueBits);
-		lbp_gamma_ylsb.resize(valueBits);
-		lbp_r.resize(valueBits);
-		lbp_b1.resize(valueBits);
-		lbp_b2.resize(valueBits);
-	}
-};
-
-typedef struct incrLoopArgs {
-	Big a;
-	Big b;
-	Big p;
-	int packSize;
-	int valueBits;
-	istream *incr_src;
-	unordered_map<string, IncrEntry> *incrData;
-} incrLoopArgs;
-
-
-// The incrLoop function forms the body of a pthread, and is responsible for incremental data ingest. As with the calcLoop
-// function in zlgenerate.cpp, it attempts to keep its locks active for as little time as possible. As a consequence, it 
-// copies raw string data only while the incremental source lock is active, and waits to ingest it into bignums and curve 
-// points until after the lock is relinquished. Also as with the calcLoop in zlgenerate.cpp, ledger entries are processed
-// in groups, and the group size can be adjusted to optimize performance for a particular thread count.
-void * incrLoop(void* rawArgs) {
-	incrLoopArgs &args = *(static_cast<incrLoopArgs*>(rawArgs));
-
-	// per-thread MIRACL setup
-	#ifndef MR_NOFULLWIDTH
-	Miracl precision(64,0);
-	#else
-	Miracl precision(64,MAXBASE);
-	#endif
-
-	ecurve(args.a,args.b,args.p,MR_PROJECTIVE);
-
-	// temp vars
-	IncrDataRaw rawData[args.packSize];
-	for (ii = 0; ii < args.packSize; ii++) {
-		rawData[ii] = IncrDataRaw(args.valueBits);
-	}
-
-	IncrEntry incrData[args.packSize];
-	for (ii = 0; ii < args.packSize; ii++) {
-		incrData[ii] = IncrEntry(args.valueBits);
-	}
-
-	Big cx;
-	int ylsb;
-	int ii, jj, kk;
-
-	while (true) {
-
-		// First we read the raw incremental data from the file, but do not ingest it
-
-		pthread_mutex_lock(&incr_src_lock);
-
-		for (ii = 0; ii < args.pack_size; ii++) {
-			if (!(*args.incr_src >> rawData[ii].index)) break;
-			
-			*args.incr_src >> rawData[ii].identifier;
-			*args.incr_src >> rawData[ii].balance;
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				*args.incr_src >> rawData[ii].lbc_cx[kk] >> rawData[ii].lbc_ylsb[kk];
-			}
-			*args.incr_src >> rawData[ii].lec_cx >> rawData[ii].lec_ylsb;
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				*args.incr_src >> rawData[ii].lbp_gamma_cx[kk] >> rawData[ii].lbp_gamma_ylsb[kk];
-			}
-			*args.incr_src >> rawData[ii].lep_gamma_cx >> rawData[ii].lep_gamma_ylsb;
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				*args.incr_src >> rawData[ii].lbp_r[kk];
-			}
-			*args.incr_src >> rawData[ii].lep_r;
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				*args.incr_src >> rawData[ii].lbp_b1[kk];
-			}
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				*args.incr_src >> rawData[ii].lbp_b2[kk];
-			}
-			*args.incr_src >> rawData[ii].lep_b1;
-			*args.incr_src >> rawData[ii].lep_b2;
-			*args.incr_src >> rawData[ii].lep_b3;
-		}
-
-		pthread_mutex_unlock(&incr_src_lock);
-
-		// Now that the lock is released, we actually ingest the data
-
-		for (jj = 0; jj < ii; jj++) {
-			get_mip()->IOBASE=10;
-			cinstr(incrData[jj].balance.getbig(), (char *) rawData[jj].balance.c_str());
-			get_mip()->IOBASE=DATA_BASE;
-
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				cinstr(cx.getbig(), (char *) rawData[jj].lbc_cx[kk].c_str());
-				ylsb = stoi(rawData[jj].lbc_ylsb[kk]);
-				incrData[jj].lbc[kk] = ECn(cx,ylsb);
-			}
-
-			cinstr(cx.getbig(), (char *) rawData[jj].lec_cx.c_str());
-			ylsb = stoi(rawData[jj].lec_ylsb);
-			incrData[jj].lec = ECn(cx,ylsb);
-
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				cinstr(cx.getbig(), (char *) rawData[jj].lbp_gamma_cx[kk].c_str());
-				ylsb = stoi(rawData[jj].lbp_gamma_ylsb[kk]);
-				incrData[jj].lbp_gamma[kk] = ECn(cx,ylsb);
-			}
-
-			cinstr(cx.getbig(), (char *) rawData[jj].lep_gamma_cx.c_str());
-			ylsb = stoi(rawData[jj].lep_gamma_ylsb);
-			incrData[jj].lep_gamma = ECn(cx,ylsb);
-
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				cinstr(incrData[jj].lbp_r[kk].getbig(), (char *) rawData[jj].lbp_r[kk].c_str());
-			}
-
-			cinstr(incrData[jj].lep_r.getbig(), (char *) rawData[jj].lep_r.c_str());
-
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				cinstr(incrData[jj].lbp_b1[kk].getbig(), (char *) rawData[jj].lbp_b1[kk].c_str());
-			}
-
-			for (int kk = 0; kk < args.valueBits; kk++) {
-				cinstr(incrData[jj].lbp_b2[kk].getbig(), (char *) rawData[jj].lbp_b2[kk].c_str());
-			}
-
-			cinstr(incrData[jj].lep_b1.getbig(), (char *) rawData[jj].lep_b1.c_str());
-			cinstr(incrData[jj].lep_b2.getbig(), (char *) rawData[jj].lep_b2.c_str());
-			cinstr(incrData[jj].lep_b3.getbig(), (char *) rawData[jj].lep_b3.c_str());
-		}
-
-		// Finally, insert the data we've ingested into the shared data store
-
-		pthread_mutex_lock(&incr_data_lock);
-		for (jj = 0; jj < ii; jj++) {
-			args.incrData->insert(pair<string, IncrEntry>(rawData[jj].identifier, incrData[jj]));
-		}
-		pthread_mutex_unlock(&incr_data_lock);
-
-		if (ii != args.pack_size) break;
-	}
-
-	pthread_exit(NULL);
-	return 0;
-}
-
-
 int main(int argc, char **argv) {
 
 	// Set up some variables to hold our options, with default values
@@ -226,12 +57,12 @@ int main(int argc, char **argv) {
 	char* bases_source = BASES_SOURCE_DEFAULT;
 	char* curve_source = CURVE_SOURCE_DEFAULT;
 	int threadcount = 0;
-	int pack_size = ENTRIES_PER_PACK_DEFAULT;
+	int packSize = ENTRIES_PER_PACK_DEFAULT;
 	int valueBits = BALANCE_BITS_DEFAULT;
 
 	// Now read options
 	int c;
-	while ( (c = getopt(argc, argv, "ht:g:b:c:i:")) != -1) {
+	while ( (c = getopt(argc, argv, "ht:g:v:b:c:i:")) != -1) {
 		switch (c) {
 			case 'h':
 				cerr << HELP_TEXT;
@@ -240,7 +71,7 @@ int main(int argc, char **argv) {
 				threadcount = atoi(optarg);
 				break;
 			case 'g':
-				pack_size = atoi(optarg);
+				packSize = atoi(optarg);
 				break;
 			case 'v':
 				valueBits = atoi(optarg);
@@ -288,17 +119,17 @@ int main(int argc, char **argv) {
 
 	
 	// Set up commitment bases as specified in Sections VII-A and IX-A of the paper
-	get_mip()->IOBASE=10;
-	Big gseed, hseed, fseed;
-	seedsource >> gseed >> hseed >> fseed;
-	seedsource.close();
-
 	ifstream seedsource(bases_source);
 	if (seedsource.fail()) {
 		cerr << TAG_ERASE << TAG_FAIL << endl;
 		cerr << "Error: bases source could not be read.";
 		return 0;
 	}
+
+	get_mip()->IOBASE=10;
+	Big gseed, hseed, fseed;
+	seedsource >> gseed >> hseed >> fseed;
+	seedsource.close();
 	
 	ECn g,h,f;
 	while (! g.set(gseed, 0)) {
@@ -312,45 +143,22 @@ int main(int argc, char **argv) {
 	}
 
 
-	Big cx;
-	int ylsb;
-	int maxThreads = (threadcount > 0) ? threadcount : sysconf( _SC_NPROCESSORS_ONLN );
+	int maxThreads = (threadcount > 0) ? threadcount : availableProcessors();
 	time_t proofTime = time(0);
-	unordered_map<string, IncrEntry> incrData;	
+	IncrStore incrData;
 	get_mip()->IOBASE=DATA_BASE;
 
 	if (incr_source != NULL) {
 		ifstream incr_src(incr_source);
 		if (incr_src.good()){
 			incr_src >> proofTime;
-
-			pthread_t incrThread[maxThreads];
-			incrLoopArgs incrArgs[maxThreads];
-
-			pthread_mutex_init(&incr_src_lock, NULL);
-			pthread_mutex_init(&incr_data_lock, NULL);
-			
-
-			for (int ii = 0; ii < maxThreads; ii++) {
-				incrArgs[ii].a = a;
-				incrArgs[ii].b = b;
-				incrArgs[ii].p = p;
-				incrArgs[ii].pack_size = pack_size;
-				incrArgs[ii].valueBits = valueBits;
-				incrArgs[ii].incr_src = &incr_src;
-				incrArgs[ii].incrData = &incrData;
-				pthread_create(&(incrThread[ii]), NULL, &incrLoop, static_cast<void*>(&(incrArgs[ii])));
-			}
-
-			for (int ii = 0; ii < maxThreads; ii++) {
-				pthread_join(incrThread[ii], NULL);
+			incrData.init(q, bits, valueBits);
+			uint64_t malformed;
+			if (!ingestIncrData(incr_src, incrData, a, b, p, valueBits, maxThreads, packSize, malformed)) {
+				cerr << TAG_ERASE << TAG_FAIL << endl;
+				cerr << "Error: incremental data for entry " << malformed << " is malformed." << endl;
+				return 0;
 			}
-
-
-			pthread_mutex_destroy(&incr_src_lock);
-			pthread_mutex_destroy(&incr_data_lock);
-
-
 			incr_src.close();
 		} else {
 			cerr << TAG_ERASE << TAG_FAIL << endl;
@@ -0,0 +1,231 @@
+// zlopener - a ZeroLedge opener lookup tool
+// Copyright (C) 2015 Jack Doerner
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <vector>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "zeroledge.h"
+#include "zlutil.h"
+#include "openerstore.h"
+#include "proofreader.h"
+#include "proofindex.h"
+#include "treehash.h"
+#include "textcodec.h"
+
+#define HELP_TEXT "ZeroLedge Opener Lookup 1.0\n\
+Usage: zlopener [\x1b[4mOPTIONS\x1b[0m] \x1b[4mSTORE\x1b[0m [\x1b[4mACCOUNT\x1b[0m...]\n\
+\n\
+Print the opener of each \x1b[4mACCOUNT\x1b[0m from the openers \x1b[4mSTORE\x1b[0m written by zlgenerate -E, in the same format as\n\
+the entries export. If no accounts are given, they are read from stdin, one per line.\n\
+\n\
+Options:\n\
+  -h \t\tprint this message\n\
+  -c \x1b[4mPATH\x1b[0m \tread elliptic curve parameters from \x1b[4mPATH\x1b[0m\n\
+  -p \x1b[4mPATH\x1b[0m \tfollow each opener with its entry from the proof at \x1b[4mPATH\x1b[0m and its authentication path\n\
+  -x \x1b[4mPATH\x1b[0m \tread proof entry index from \x1b[4mPATH\x1b[0m (required with -p)\n"
+
+using namespace std;
+
+// When a proof is given, each opener is followed by an inclusion proof, which together allow the owner of the account to
+// check their entry with zlverify -a using only the header of the published proof: first the lines of the entry, exactly
+// as they appear in the proof, then the number of steps in the authentication path from its leaf in the entry tree to the
+// root, and then each step on its own line, as L or R (the side on which the sibling lies) followed by the sibling's
+// digest in hexadecimal.
+typedef struct OpenerProof {
+	ProofReader *reader;
+	ProofIndex *index;
+	vector<TreePathStep> path;
+} OpenerProof;
+
+// Look up the opener for a single account, and append it to output. Returns false if the account has none.
+static bool lookup(OpenerStore &store, const string &id, OpenerProof *proof, Big &balance, Big &r, TextBuffer &output) {
+	uint64_t index;
+
+	if (!store.fetch(id.data(), id.size(), index, balance, r)) {
+		cerr << "Error: no opener for account " << id << "." << endl;
+		return false;
+	}
+
+	int region = (proof != NULL) ? proof->reader->findRegion(index) : -1;
+	if (proof != NULL && (index >= proof->index->entryCount || region < 0 || !store.fetchPath(index, proof->path))) {
+		cerr << "Error: no entry for account " << id << "." << endl;
+		return false;
+	}
+
+	const char *begin = NULL, *end = NULL;
+	if (proof != NULL) {
+		ProofRegion &entries = proof->reader->regions[region];
+		begin = proof->index->entryAt(index, entries.base, entries.begin, entries.end);
+		if (begin == NULL) {
+			cerr << "Error: index does not match proof." << endl;
+			return false;
+		}
+		end = skipLines(begin, entries.end, proof->reader->entryLines());
+	}
+
+	output.putInteger(index);
+	output.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+	output.putText(id);
+	output.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+	output.putDecimal(balance);
+	output.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+	output.putBig(r);
+	output.putChar('\n');
+
+	if (proof != NULL) {
+		output.putText(begin, end - begin);
+
+		output.putInteger(proof->path.size());
+		output.putChar('\n');
+		for (size_t ii = 0; ii < proof->path.size(); ii++) {
+			output.putChar(proof->path[ii].left ? 'L' : 'R');
+			output.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+			output.putText(toHex(proof->path[ii].sibling, TREE_HASH_DIGEST_BYTES));
+			output.putChar('\n');
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv) {
+
+	char* proof_source = NULL;
+	char* index_source = NULL;
+	char* curve_source = CURVE_SOURCE_DEFAULT;
+
+	// Now read options
+	int c;
+	while ( (c = getopt(argc, argv, "hc:p:x:")) != -1) {
+		switch (c) {
+			case 'h':
+				cerr << HELP_TEXT;
+				return 0;
+			case 'c':
+				curve_source = optarg;
+				break;
+			case 'p':
+				proof_source = optarg;
+				break;
+			case 'x':
+				index_source = optarg;
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (optind >= argc || (proof_source != NULL && index_source == NULL)) {
+		cerr << HELP_TEXT;
+		return 0;
+	}
+
+
+	// MIRACL initialization
+	#ifndef MR_NOFULLWIDTH
+	Miracl precision(64,0);
+	#else
+	Miracl precision(64,MAXBASE);
+	#endif
+
+	OpenerStore store;
+	if (!store.open(argv[optind++])) {
+		cerr << "Error: openers store could not be read." << endl;
+		return 0;
+	}
+
+	// If a proof is given, it must be the one to which the store belongs. Its bases are points on the curve, so the curve
+	// must be set up before its header can be read.
+	MappedFile proofFile;
+	ProofReader reader;
+	ProofIndex proofIndex;
+	OpenerProof proof;
+	proofFile.data = NULL;
+
+	if (proof_source != NULL) {
+		ifstream curve(curve_source);
+		if (curve.fail()) {
+			cerr << "Error: curve source could not be read." << endl;
+			return 0;
+		}
+
+		get_mip()->IOBASE=16;
+		int bits;
+		Big a,b,p,q,x,y;
+		curve >> bits >> p >> a >> b >> q >> x >> y;
+		curve.close();
+
+		ecurve(a,b,p,MR_PROJECTIVE);
+
+		if (!mapFile(proof_source, proofFile) || !reader.open(proofFile.data, proofFile.length, proof_source)) {
+			cerr << "Error: proof could not be read." << endl;
+			return 0;
+		}
+
+		if (!proofIndex.open(index_source)) {
+			cerr << "Error: index could not be read." << endl;
+			return 0;
+		}
+
+		if (reader.entriesRoot != toHex(store.root, TREE_HASH_DIGEST_BYTES) || proofIndex.valueBits != reader.valueBits) {
+			cerr << "Error: openers store does not match proof." << endl;
+			return 0;
+		}
+
+		if (!reader.manifest) reader.regions[0].entryCount = proofIndex.entryCount;
+		proof.reader = &reader;
+		proof.index = &proofIndex;
+	}
+
+	OpenerProof *proofOutput = (proof_source != NULL) ? &proof : NULL;
+	Big balance, r;
+	TextBuffer output;
+	string id;
+
+	if (optind < argc) {
+		for (; optind < argc; optind++) {
+			lookup(store, argv[optind], proofOutput, balance, r, output);
+		}
+	} else {
+		while (getline(cin, id)) {
+			if (!id.empty() && id[id.size() - 1] == '\r') id.resize(id.size() - 1);
+			if (id.empty()) continue;
+
+			lookup(store, id, proofOutput, balance, r, output);
+
+			// Flush periodically, so that a long list of accounts is not held in memory all at once.
+			if (output.size() >= (1 << 16)) {
+				fwrite(output.data(), 1, output.size(), stdout);
+				output.clear();
+			}
+		}
+	}
+
+	fwrite(output.data(), 1, output.size(), stdout);
+	store.close();
+	proofIndex.close();
+	if (proofFile.data != NULL) unmapFile(proofFile);
+
+	return 0;
+}
@@ -0,0 +1,822 @@
+// zlprover - a ZeroLedge proving daemon
+// Copyright (C) 2015 Jack Doerner
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+#include <unistd.h>
+#include <algorithm>
+#include <pthread.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "zeroledge.h"
+#include "zlutil.h"
+#include "placement.h"
+#include "ledger.h"
+#include "ledgerreader.h"
+#include "lepprocessor.h"
+#include "lbpprocessor.h"
+#include "dbpprocessor.h"
+#include "proofwriter.h"
+#include "outputfile.h"
+#include "pipeline.h"
+#include "textcodec.h"
+#include "partialsummary.h"
+
+#define HELP_TEXT "ZeroLedge Proving Daemon 1.0\n\
+Usage: zlprover [\x1b[4mOPTIONS\x1b[0m] \x1b[4mSOCKET\x1b[0m [\x1b[4mLEDGER\x1b[0m...]\n\
+\n\
+Hold the accounts of \x1b[4mLEDGER\x1b[0m in memory, regenerating the commitments and proofs of each account in the background\n\
+whenever its balance changes, and accept commands on the Unix socket \x1b[4mSOCKET\x1b[0m, one to a line. Each command is\n\
+answered with a line beginning OK or ERROR.\n\
+\n\
+Commands:\n\
+  SET \x1b[4mACCOUNT\x1b[0m \x1b[4mBALANCE\x1b[0m \tset the balance of \x1b[4mACCOUNT\x1b[0m, adding it if it is new\n\
+  ASSETS \x1b[4mAMOUNT\x1b[0m \tset the total assets\n\
+  SNAPSHOT \x1b[4mPATH\x1b[0m [\x1b[4mENTRIES\x1b[0m] \twrite a proof of the balances set so far to \x1b[4mPATH\x1b[0m, and its entries to \x1b[4mENTRIES\x1b[0m,\n\
+  \t\t\tand answer with its digest\n\
+  STATUS \t\treport the number of accounts, and the number waiting to be regenerated\n\
+  SHUTDOWN \t\tstop the daemon\n\
+\n\
+Options:\n\
+  -h \t\tprint this message\n\
+  -t \x1b[4mNUMBER\x1b[0m \tuse \x1b[4mNUMBER\x1b[0m threads\n\
+  -g \x1b[4mNUMBER\x1b[0m \tprocess \x1b[4mNUMBER\x1b[0m entries at a time\n\
+  -v \x1b[4mNUMBER\x1b[0m \trestrict balances and sums to \x1b[4mNUMBER\x1b[0m bits\n\
+  -b \x1b[4mPATH\x1b[0m \tread commitment base seeds from \x1b[4mPATH\x1b[0m\n\
+  -c \x1b[4mPATH\x1b[0m \tread elliptic curve parameters from \x1b[4mPATH\x1b[0m\n"
+
+using namespace std;
+
+// ProverAccount holds everything the daemon keeps for a single account. balance is the latest balance set for it, in
+// decimal, and pending is set from the time it changes until the account has been queued for regeneration. The rest
+// belongs to the entry generated for the account most recently: the balance and nonce (r) with which it was generated,
+// its text exactly as it appears in a proof, and its contribution to the sums of the ledger (see partialsummary.h), which
+// is subtracted from them when the entry is replaced. Thus the sums of the whole ledger are always at hand, and a snapshot
+// need only generate the difference bits and copy the entries into place.
+typedef struct ProverAccount {
+	string id;
+	string balance;
+	bool pending;
+	string entryBalance;
+	string entryR;
+	string entryText;
+	string entrySums;
+} ProverAccount;
+
+typedef struct ProverUpdate {
+	string id;
+	string balance;
+} ProverUpdate;
+
+// ProverSnapshot is a request to cut a snapshot, which is made by a connection and answered by the generator, after which
+// done is set.
+typedef struct ProverSnapshot {
+	string path;
+	string entriesPath;
+	string reply;
+	bool done;
+} ProverSnapshot;
+
+// ProverState is shared by the connections and the generator, under lock. The connections only ever queue updates and
+// snapshot requests, and wait for snapshots to complete; the generator alone touches the accounts, so they need no lock.
+// balanceLimit is 2 to the power of valueBits, in decimal, which no balance or total may reach; it is kept as text, since
+// the connections have no MIRACL instances with which to compare bignums.
+typedef struct ProverState {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	pthread_cond_t snapshotDone;
+	vector<ProverUpdate> updates;
+	string assets;
+	ProverSnapshot *snapshot;
+	bool shutdown;
+	int valueBits;
+	string balanceLimit;
+	atomic<uint64_t> accountCount;
+	atomic<uint64_t> pendingCount;
+} ProverState;
+
+// ProverContext holds everything shared by the stages of the generation pipeline, which regenerates the entries of the
+// accounts listed in pendingList, handed out in batches by advancing nextPending. As in zlgenerate, each worker has its
+// own partial ledger, which holds the sum of the contributions it has added less those it has removed; these persist from
+// one round of generation to the next, so that their sum is always the sum of the ledger.
+typedef struct ProverContext {
+	Big a;
+	Big b;
+	Big p;
+	Big q;
+	ECn g;
+	ECn h;
+	ECn f;
+	int bits;
+	int packSize;
+	int valueBits;
+	vector<ProverAccount> *accounts;
+	vector<uint64_t> *pendingList;
+	size_t nextPending;
+	vector<Ledger> *partialLedgers;
+} ProverContext;
+
+// ProverPack is a batch of consecutive positions in the pending list, [first, last).
+typedef struct ProverPack {
+	size_t first;
+	size_t last;
+} ProverPack;
+
+// ProverWorker holds the state belonging to a single worker thread: its MIRACL instance, its processors, its partial
+// ledger, and its scratch space.
+typedef struct ProverWorker {
+	Miracl *precision;
+	LEPProcessor *lepgen;
+	LBPProcessor *lbpgen;
+	Ledger *partialLedger;
+	Ledger *contribution;
+	LedgerEntry e;
+	TextBuffer output;
+} ProverWorker;
+
+void * newPack(void* rawContext) {
+	return new ProverPack;
+}
+
+void deletePack(void* rawContext, void* rawPack) {
+	delete static_cast<ProverPack*>(rawPack);
+}
+
+bool readPack(void* rawContext, void* rawPack) {
+	ProverContext &context = *(static_cast<ProverContext*>(rawContext));
+	ProverPack *pack = static_cast<ProverPack*>(rawPack);
+
+	if (context.nextPending >= context.pendingList->size()) return false;
+
+	pack->first = context.nextPending;
+	pack->last = min(context.pendingList->size(), context.nextPending + context.packSize);
+	context.nextPending = pack->last;
+	return true;
+}
+
+void * beginWorker(void* rawContext, int worker) {
+	ProverContext &context = *(static_cast<ProverContext*>(rawContext));
+	ProverWorker *state = new ProverWorker;
+
+	// per-thread MIRACL setup
+	state->precision = newThreadMiracl();
+
+	irand(fetchRandomSeed());
+
+	ecurve(context.a,context.b,context.p,MR_PROJECTIVE);
+
+	// zl setup
+	state->lepgen = new LEPProcessor(context.q, context.g, context.h, context.f, context.bits);
+	state->lbpgen = new LBPProcessor(context.q, context.g, context.h, context.f, context.bits, context.valueBits);
+	state->partialLedger = &(*context.partialLedgers)[worker];
+	state->contribution = new Ledger(context.g, context.h, context.f, context.valueBits);
+
+	return state;
+}
+
+// The generatePack function regenerates the entry of each account in a batch, exactly as calcPack in zlgenerate.cpp would,
+// and replaces the entry kept for the account, along with its contribution to the sums. No two workers are ever handed the
+// same account in a round, and the generator waits for the round to finish before touching the accounts, so the accounts
+// are written without locks.
+void generatePack(void* rawContext, void* rawWorker, void* rawPack) {
+	ProverContext &context = *(static_cast<ProverContext*>(rawContext));
+	ProverWorker *state = static_cast<ProverWorker*>(rawWorker);
+	ProverPack *pack = static_cast<ProverPack*>(rawPack);
+
+	LedgerEntry &e = state->e;
+	Ledger &contribution = *state->contribution;
+	TextBuffer &output = state->output;
+	Big balance;
+
+	for (size_t ii = pack->first; ii < pack->last; ii++) {
+
+		ProverAccount &account = (*context.accounts)[(*context.pendingList)[ii]];
+		decodeDecimal(account.balance.data(), account.balance.size(), balance);
+
+		e = LedgerEntry(account.id, balance, context.valueBits);
+
+		state->lbpgen->genCommitments(e);
+		state->lbpgen->genProofs(e);
+
+		e.computeR();
+
+		state->lepgen->genCommitment(e);
+		state->lepgen->genProof(e);
+
+		// The entry generated before, if any, no longer belongs to the ledger.
+		if (!account.entrySums.empty()) {
+			contribution.reset();
+			readLedgerSums(account.entrySums.data(), account.entrySums.data() + account.entrySums.size(), contribution);
+			state->partialLedger->removeLedger(contribution);
+		}
+
+		contribution.reset();
+		contribution.addEntry(e);
+		state->partialLedger->appendLedger(contribution);
+
+		output.clear();
+		putLedgerSums(output, contribution);
+		account.entrySums.assign(output.data(), output.size());
+
+		output.clear();
+		ProofWriter::putEntry(output, e);
+		account.entryText.assign(output.data(), output.size());
+
+		output.clear();
+		output.putBig(e.r);
+		account.entryR.assign(output.data(), output.size());
+
+		account.entryBalance = account.balance;
+
+	}
+}
+
+void endWorker(void* rawContext, void* rawWorker) {
+	ProverWorker *state = static_cast<ProverWorker*>(rawWorker);
+
+	// Everything allocated by this thread's MIRACL instance must be freed before the instance itself.
+	delete state->lepgen;
+	delete state->lbpgen;
+	delete state->contribution;
+	state->e = LedgerEntry();
+	delete state->precision;
+	delete state;
+}
+
+// Apply a set of updates to the accounts, in the order in which they were received, and queue every account whose balance
+// changed (or which is new) for regeneration.
+static void applyUpdates(vector<ProverUpdate> &updates, vector<ProverAccount> &accounts, unordered_map<string, uint64_t> &accountIndex, vector<uint64_t> &pending) {
+	for (size_t ii = 0; ii < updates.size(); ii++) {
+		unordered_map<string, uint64_t>::iterator it = accountIndex.find(updates[ii].id);
+		uint64_t index;
+
+		if (it == accountIndex.end()) {
+			index = accounts.size();
+			accountIndex[updates[ii].id] = index;
+			accounts.push_back(ProverAccount());
+			accounts[index].id = updates[ii].id;
+			accounts[index].pending = false;
+		} else {
+			index = it->second;
+			if (accounts[index].balance == updates[ii].balance) continue;
+		}
+
+		accounts[index].balance = updates[ii].balance;
+		if (!accounts[index].pending) {
+			accounts[index].pending = true;
+			pending.push_back(index);
+		}
+	}
+}
+
+// Write a proof of the entries generated for every account to path, and their openers to entriesPath if it is not empty,
+// exactly as zlgenerate would write them for a ledger holding the same accounts in the order in which they were added.
+// Only the difference bits remain to be generated, since the sums of the ledger are already known. Returns the reply to
+// the snapshot request.
+static string writeSnapshot(ProverContext &context, const string &assetsText, const string &path, const string &entriesPath) {
+	vector<ProverAccount> &accounts = *context.accounts;
+	ProofWriter proof;
+	OutputFile entries;
+	Big assets;
+
+	decodeDecimal(assetsText.data(), assetsText.size(), assets);
+
+	Ledger finalLedger(context.g, context.h, context.f, context.valueBits);
+	finalLedger.totalAssets = assets;
+	for (size_t ii = 0; ii < context.partialLedgers->size(); ii++) {
+		finalLedger.appendLedger((*context.partialLedgers)[ii]);
+	}
+
+	finalLedger.computeSums();
+
+	DBPProcessor dbpgen(context.q, context.g, context.h, context.f, context.bits, context.valueBits);
+	dbpgen.genParallel(finalLedger, context.a, context.b, context.p, context.partialLedgers->size());
+
+	finalLedger.generateCommitments();
+
+	if (!proof.open(path.c_str(), 1, accounts.size(), false, false)) return "ERROR proof destination could not be opened";
+	if (!entriesPath.empty() && !entries.open(entriesPath.c_str(), false)) return "ERROR entries export destination could not be opened";
+
+	proof.writeHeader(assets, time(0), context.valueBits, context.g, context.h, context.f);
+
+	TextBuffer text, exported;
+	vector<uint64_t> offsets(context.packSize);
+	vector<OutputRun> runs;
+
+	for (uint64_t first = 0; first < accounts.size(); first += context.packSize) {
+		int count = min((uint64_t) context.packSize, accounts.size() - first);
+
+		text.clear();
+		exported.clear();
+
+		for (int jj = 0; jj < count; jj++) {
+			ProverAccount &account = accounts[first + jj];
+			offsets[jj] = text.size();
+			text.putText(account.entryText);
+
+			if (entries.isOpen()) {
+				exported.putInteger(first + jj);
+				exported.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+				exported.putText(account.id);
+				exported.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+				exported.putText(account.entryBalance);
+				exported.putChar(ENTRIES_EXPORT_FIELD_SEPARATOR);
+				exported.putText(account.entryR);
+				exported.putChar('\n');
+			}
+		}
+
+		runs.clear();
+		proof.placeEntries(first, text.data(), text.size(), &offsets[0], count, runs);
+		if (entries.isOpen()) entries.place(exported.data(), exported.size(), runs);
+		OutputFile::writeRuns(runs);
+	}
+
+	if (!proof.writeFooter(finalLedger)) return "ERROR proof could not be written";
+	if (entries.isOpen() && !entries.close()) return "ERROR entries export could not be written";
+
+	return "OK " + proof.digest;
+}
+
+static bool isDecimal(const string &text) {
+	if (text.empty()) return false;
+	for (size_t ii = 0; ii < text.size(); ii++) {
+		if (text[ii] < '0' || text[ii] > '9') return false;
+	}
+	return true;
+}
+
+// Return whether text, which holds nothing but decimal digits, is less than limit, which has no leading zeros.
+static bool isBelow(const string &text, const string &limit) {
+	size_t first = text.find_first_not_of('0');
+	if (first == string::npos) return true;
+
+	size_t length = text.size() - first;
+	return length < limit.size() || (length == limit.size() && text.compare(first, length, limit) < 0);
+}
+
+static void reply(int fd, const string &line) {
+	string text = line + "\n";
+	send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+}
+
+typedef struct ProverConnection {
+	ProverState *state;
+	int fd;
+} ProverConnection;
+
+// Serve a single connection, one command at a time, until it is closed. Updates are only queued here, and are applied by
+// the generator in the order in which they were queued, so a snapshot covers every update acknowledged before it was
+// requested.
+static void * serveConnection(void *rawConnection) {
+	ProverConnection *connection = static_cast<ProverConnection*>(rawConnection);
+	ProverState &state = *connection->state;
+	int fd = connection->fd;
+	delete connection;
+
+	string buffered;
+	char chunk[4096];
+	ssize_t got;
+	bool open = true;
+
+	while (open && (got = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+		buffered.append(chunk, got);
+
+		size_t eol;
+		while (open && (eol = buffered.find('\n')) != string::npos) {
+			istringstream line(buffered.substr(0, eol));
+			buffered.erase(0, eol + 1);
+
+			string command, first, second;
+			line >> command >> first >> second;
+
+			if (command == "SET") {
+				if (first.empty() || !isDecimal(second)) {
+					reply(fd, "ERROR usage: SET ACCOUNT BALANCE");
+					continue;
+				}
+				if (!isBelow(second, state.balanceLimit)) {
+					reply(fd, "ERROR balance out of range");
+					continue;
+				}
+				ProverUpdate update;
+				update.id = first;
+				update.balance = second;
+				pthread_mutex_lock(&state.lock);
+				state.updates.push_back(update);
+				pthread_cond_signal(&state.changed);
+				pthread_mutex_unlock(&state.lock);
+				reply(fd, "OK");
+			} else if (command == "ASSETS") {
+				if (!isDecimal(first)) {
+					reply(fd, "ERROR usage: ASSETS AMOUNT");
+					continue;
+				}
+				if (!isBelow(first, state.balanceLimit)) {
+					reply(fd, "ERROR balance out of range");
+					continue;
+				}
+				pthread_mutex_lock(&state.lock);
+				state.assets = first;
+				pthread_mutex_unlock(&state.lock);
+				reply(fd, "OK");
+			} else if (command == "SNAPSHOT") {
+				if (first.empty()) {
+					reply(fd, "ERROR usage: SNAPSHOT PATH [ENTRIES]");
+					continue;
+				}
+				ProverSnapshot snapshot;
+				snapshot.path = first;
+				snapshot.entriesPath = second;
+				snapshot.done = false;
+				pthread_mutex_lock(&state.lock);
+				if (state.shutdown || state.snapshot != NULL) {
+					pthread_mutex_unlock(&state.lock);
+					reply(fd, state.shutdown ? "ERROR shutting down" : "ERROR a snapshot is already in progress");
+					continue;
+				}
+				state.snapshot = &snapshot;
+				pthread_cond_signal(&state.changed);
+				while (!snapshot.done) pthread_cond_wait(&state.snapshotDone, &state.lock);
+				pthread_mutex_unlock(&state.lock);
+				reply(fd, snapshot.reply);
+
+				// A snapshot refused because the daemon is shutting down is left in place until it has been answered, so
+				// that the generator can wait for the answer to be sent before the daemon exits.
+				pthread_mutex_lock(&state.lock);
+				if (state.snapshot == &snapshot) {
+					state.snapshot = NULL;
+					pthread_cond_broadcast(&state.snapshotDone);
+				}
+				pthread_mutex_unlock(&state.lock);
+			} else if (command == "STATUS") {
+				pthread_mutex_lock(&state.lock);
+				uint64_t queued = state.updates.size();
+				pthread_mutex_unlock(&state.lock);
+				stringstream status;
+				status << "OK ACCOUNTS " << state.accountCount.load() << " PENDING " << state.pendingCount.load() + queued;
+				reply(fd, status.str());
+			} else if (command == "SHUTDOWN") {
+				// The daemon exits as soon as the generator sees the request, so it is answered first.
+				reply(fd, "OK");
+				pthread_mutex_lock(&state.lock);
+				state.shutdown = true;
+				pthread_cond_signal(&state.changed);
+				pthread_mutex_unlock(&state.lock);
+				open = false;
+			} else if (!command.empty()) {
+				reply(fd, "ERROR unknown command");
+			}
+		}
+	}
+
+	close(fd);
+	return NULL;
+}
+
+typedef struct ProverListener {
+	ProverState *state;
+	int fd;
+} ProverListener;
+
+// Accept connections for as long as the daemon runs, serving each on its own thread.
+static void * acceptLoop(void *rawListener) {
+	ProverListener *listener = static_cast<ProverListener*>(rawListener);
+	pthread_t thread;
+	int fd;
+
+	while ((fd = accept(listener->fd, NULL, NULL)) >= 0) {
+		ProverConnection *connection = new ProverConnection;
+		connection->state = listener->state;
+		connection->fd = fd;
+		if (pthread_create(&thread, NULL, serveConnection, connection) != 0) {
+			close(fd);
+			delete connection;
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	return NULL;
+}
+
+
+int main(int argc, char **argv) {
+
+	// Set up some variables to hold our options, with default values
+	vector<const char *> ledger_sources;
+	char* socket_path = NULL;
+	char* bases_source = BASES_SOURCE_DEFAULT;
+	char* curve_source = CURVE_SOURCE_DEFAULT;
+	int threadcount = 0;
+	int packSize = ENTRIES_PER_PACK_DEFAULT;
+	int valueBits = BALANCE_BITS_DEFAULT;
+
+	// Now read options
+	int c;
+	while ( (c = getopt(argc, argv, "ht:g:v:b:c:")) != -1) {
+		switch (c) {
+			case 'h':
+				cerr << HELP_TEXT;
+				return 0;
+			case 't':
+				threadcount = atoi(optarg);
+				break;
+			case 'g':
+				packSize = atoi(optarg);
+				break;
+			case 'v':
+				valueBits = atoi(optarg);
+				break;
+			case 'b':
+				bases_source = optarg;
+				break;
+			case 'c':
+				curve_source = optarg;
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (optind < argc) {
+		socket_path = argv[optind++];
+	}
+
+	for (; optind < argc; optind++) {
+		ledger_sources.push_back(argv[optind]);
+	}
+
+	if (socket_path == NULL) {
+		cerr << HELP_TEXT;
+		return 0;
+	}
+
+
+	// MIRACL initialization
+	mr_init_threading();
+	#ifndef MR_NOFULLWIDTH
+	Miracl precision(64,0);
+	#else
+	Miracl precision(64,MAXBASE);
+	#endif
+
+	irand(fetchRandomSeed());
+
+
+	// Set up curve
+	ifstream curve(curve_source);
+	if (curve.fail()) {
+		cerr << "Error: curve source could not be read." << endl;
+		return 0;
+	}
+
+	get_mip()->IOBASE=16;
+	int bits;
+	Big a,b,p,q,x,y;
+	curve >> bits >> p >> a >> b >> q >> x >> y;
+	curve.close();
+
+	ecurve(a,b,p,MR_PROJECTIVE);
+
+
+	// Set up commitment bases as specified in Sections VII-A and IX-A of the paper
+	ifstream seedsource(bases_source);
+	if (seedsource.fail()) {
+		cerr << "Error: bases source could not be read." << endl;
+		return 0;
+	}
+
+	get_mip()->IOBASE=10;
+	Big gseed, hseed, fseed;
+	seedsource >> gseed >> hseed >> fseed;
+	seedsource.close();
+
+	ECn g,h,f;
+	while (! g.set(gseed, 0)) {
+		gseed += 1;
+	}
+	while (! h.set(hseed, 0)) {
+		hseed += 1;
+	}
+	while (! f.set(fseed, 0)) {
+		fseed += 1;
+	}
+
+	get_mip()->IOBASE=DATA_BASE;
+
+
+	// Read the initial ledger, if one is given. Its accounts are queued exactly as though each had been set in turn.
+	ProverState state;
+	pthread_mutex_init(&state.lock, NULL);
+	pthread_cond_init(&state.changed, NULL);
+	pthread_cond_init(&state.snapshotDone, NULL);
+	state.assets = "0";
+	state.snapshot = NULL;
+	state.shutdown = false;
+	state.valueBits = valueBits;
+	state.accountCount = 0;
+	state.pendingCount = 0;
+
+	TextBuffer limit;
+	limit.putDecimal(pow(Big(2), valueBits));
+	state.balanceLimit.assign(limit.data(), limit.size());
+
+	if (!ledger_sources.empty()) {
+		LedgerReader ledger;
+		LedgerLine line;
+		Big assets;
+		TextBuffer text;
+		const char *begin, *end;
+
+		if (!ledger.open(ledger_sources) || !ledger.readAssets(assets)) {
+			cerr << "Error: ledger could not be read." << endl;
+			return 0;
+		}
+
+		text.putDecimal(assets);
+		state.assets.assign(text.data(), text.size());
+		if (!isBelow(state.assets, state.balanceLimit)) {
+			cerr << "Error: total assets of ledger are out of range." << endl;
+			return 0;
+		}
+
+		while (ledger.nextEntries(packSize, begin, end) > 0) {
+			for (const char *p = LedgerReader::parseEntry(begin, end, line); p != NULL; p = LedgerReader::parseEntry(p, end, line)) {
+				ProverUpdate update;
+				update.id.assign(line.id, line.idLength);
+				update.balance.assign(line.balance, line.balanceLength);
+				if (!isDecimal(update.balance)) {
+					cerr << "Error: balance of ledger entry " << state.updates.size() << " is malformed: \"" << update.id << " " << update.balance << "\"." << endl;
+					return 0;
+				}
+				if (!isBelow(update.balance, state.balanceLimit)) {
+					cerr << "Error: balance of ledger entry " << state.updates.size() << " is out of range: \"" << update.id << " " << update.balance << "\"." << endl;
+					return 0;
+				}
+				state.updates.push_back(update);
+			}
+		}
+
+		if (ledger.failed()) {
+			cerr << "Error: ledger could not be read." << endl;
+			return 0;
+		}
+	}
+
+
+	// Listen on the socket, replacing any left behind by an earlier daemon.
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		cerr << "Error: socket path is too long." << endl;
+		return 0;
+	}
+	strcpy(address.sun_path, socket_path);
+	unlink(socket_path);
+
+	ProverListener listener;
+	listener.state = &state;
+	listener.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener.fd < 0 || bind(listener.fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener.fd, 64) != 0) {
+		cerr << "Error: socket could not be opened." << endl;
+		return 0;
+	}
+
+	pthread_t acceptThread;
+	if (pthread_create(&acceptThread, NULL, acceptLoop, &listener) != 0) {
+		cerr << "Error: socket could not be opened." << endl;
+		return 0;
+	}
+	pthread_detach(acceptThread);
+
+
+	// The generator runs on this thread. Each round applies the updates queued since the last, then regenerates the entries
+	// of the accounts that changed with a pipeline (see pipeline.h) of as many workers as we are allowed. A snapshot is cut
+	// once every update queued before it was requested has been applied and regenerated; updates queued during a round or a
+	// snapshot wait for the next round.
+	int maxThreads = (threadcount > 0) ? threadcount : availableProcessors();
+	vector<ProverAccount> accounts;
+	unordered_map<string, uint64_t> accountIndex;
+	vector<uint64_t> pending, pendingList;
+	vector<ProverUpdate> updates;
+	vector<Ledger> partialLedgers(maxThreads, Ledger(g, h, f, valueBits));
+
+	ProverContext context;
+	context.a = a;
+	context.b = b;
+	context.p = p;
+	context.q = q;
+	context.g = g;
+	context.h = h;
+	context.f = f;
+	context.bits = bits;
+	context.packSize = packSize;
+	context.valueBits = valueBits;
+	context.accounts = &accounts;
+	context.pendingList = &pendingList;
+	context.partialLedgers = &partialLedgers;
+
+	PipelineStages stages;
+	stages.context = static_cast<void*>(&context);
+	stages.newPack = &newPack;
+	stages.deletePack = &deletePack;
+	stages.read = &readPack;
+	stages.beginWorker = &beginWorker;
+	stages.work = &generatePack;
+	stages.endWorker = &endWorker;
+	stages.write = NULL;
+	stages.flush = NULL;
+
+	cerr << "ZEROLEDGE PROVING DAEMON" << endl;
+	cerr << endl;
+	cerr << "Listening on " << socket_path << endl;
+
+	while (true) {
+
+		pthread_mutex_lock(&state.lock);
+		while (state.updates.empty() && pending.empty() && state.snapshot == NULL && !state.shutdown) {
+			pthread_cond_wait(&state.changed, &state.lock);
+		}
+		if (state.shutdown) {
+			// A snapshot requested before the shutdown is refused rather than left unanswered.
+			if (state.snapshot != NULL) {
+				state.snapshot->reply = "ERROR shutting down";
+				state.snapshot->done = true;
+				pthread_cond_broadcast(&state.snapshotDone);
+				while (state.snapshot != NULL) pthread_cond_wait(&state.snapshotDone, &state.lock);
+			}
+			pthread_mutex_unlock(&state.lock);
+			break;
+		}
+		updates.swap(state.updates);
+		ProverSnapshot *snapshot = state.snapshot;
+		string assets = state.assets;
+		pthread_mutex_unlock(&state.lock);
+
+		applyUpdates(updates, accounts, accountIndex, pending);
+		updates.clear();
+		state.accountCount = accounts.size();
+
+		if (!pending.empty()) {
+			pendingList.swap(pending);
+			pending.clear();
+			for (size_t ii = 0; ii < pendingList.size(); ii++) {
+				accounts[pendingList[ii]].pending = false;
+			}
+			state.pendingCount = pendingList.size();
+
+			context.nextPending = 0;
+			Pipeline pipeline(stages, maxThreads, 2 * maxThreads + 1);
+			pipeline.run();
+
+			state.pendingCount = 0;
+		}
+
+		if (snapshot != NULL) {
+			string result = writeSnapshot(context, assets, snapshot->path, snapshot->entriesPath);
+			cerr << "Snapshot " << snapshot->path << ": " << result << endl;
+
+			// The request belongs to the connection, which may discard it as soon as it is answered.
+			pthread_mutex_lock(&state.lock);
+			snapshot->reply = result;
+			snapshot->done = true;
+			state.snapshot = NULL;
+			pthread_cond_broadcast(&state.snapshotDone);
+			pthread_mutex_unlock(&state.lock);
+		}
+
+	}
+
+	close(listener.fd);
+	unlink(socket_path);
+
+	return 0;
+}
@@ -0,0 +1,484 @@
+// zlquery - a ZeroLedge inclusion query service
+// Copyright (C) 2015 Jack Doerner
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "zeroledge.h"
+#include "zlutil.h"
+#include "placement.h"
+#include "ledger.h"
+#include "lepprocessor.h"
+#include "lbpprocessor.h"
+#include "proofreader.h"
+#include "proofindex.h"
+#include "basetables.h"
+#include "textcodec.h"
+
+#define QUERIES_PER_BATCH 16
+
+#define HELP_TEXT "ZeroLedge Inclusion Query Service 1.0\n\
+Usage: zlquery [\x1b[4mOPTIONS\x1b[0m] \x1b[4mPROOF\x1b[0m \x1b[4mINDEX\x1b[0m [\x1b[4mPROOF\x1b[0m \x1b[4mINDEX\x1b[0m]...\n\
+\n\
+Hold each \x1b[4mPROOF\x1b[0m in memory along with its entry \x1b[4mINDEX\x1b[0m, and answer queries as to whether an entry is included in\n\
+one of them. Each query is a line of the form\n\
+\n\
+  \x1b[4mNUMBER\x1b[0m \x1b[4mENTRY\x1b[0m \x1b[4mACCOUNT\x1b[0m \x1b[4mBALANCE\x1b[0m \x1b[4mNONCE\x1b[0m\n\
+\n\
+where \x1b[4mNUMBER\x1b[0m is the position of the proof among those given, counting from zero, and the rest is a line of the\n\
+entries export written by zlgenerate -e. Queries are answered in order, each with a line holding \x1b[4mNUMBER\x1b[0m and\n\
+\x1b[4mENTRY\x1b[0m followed by VALID or INVALID, or with a line beginning ERROR. Queries are read from stdin and answered\n\
+on stdout, unless a socket is given.\n\
+\n\
+Options:\n\
+  -h \t\tprint this message\n\
+  -t \x1b[4mNUMBER\x1b[0m \tuse \x1b[4mNUMBER\x1b[0m threads\n\
+  -c \x1b[4mPATH\x1b[0m \tread elliptic curve parameters from \x1b[4mPATH\x1b[0m\n\
+  -s \x1b[4mPATH\x1b[0m \taccept connections on the Unix socket \x1b[4mPATH\x1b[0m, answering the queries sent on each\n\
+  -q \t\tcheck only the commitment of each entry, and not its proofs (for proofs already verified)\n"
+
+using namespace std;
+
+// QueryProof holds a single proof, its index, and the tables for its bases, none of which change once the service starts.
+typedef struct QueryProof {
+	MappedFile file;
+	ProofReader reader;
+	ProofIndex index;
+	BaseTables *tables;
+} QueryProof;
+
+// Query is a single line read from a client, and the answer to it.
+typedef struct Query {
+	string line;
+	string answer;
+} Query;
+
+// QueryRequest is the set of queries read from a client at once, which are divided into batches for the workers; the
+// client waits until every batch has been answered.
+typedef struct QueryRequest {
+	vector<Query> *queries;
+	size_t remaining;
+} QueryRequest;
+
+// QueryBatch is a batch of consecutive queries from a single request, [first, last).
+typedef struct QueryBatch {
+	QueryRequest *request;
+	size_t first;
+	size_t last;
+} QueryBatch;
+
+// QueryService holds the proofs, which are only read once the service starts, and the queue of batches waiting for a
+// worker. Batches are queued and counted off under lock: queued is signalled when a batch is queued, and finished when
+// the last batch of any request has been answered.
+typedef struct QueryService {
+	Big a, b, p, q;
+	int bits;
+	bool quick;
+	vector<QueryProof *> proofs;
+
+	pthread_mutex_t lock;
+	pthread_cond_t queued, finished;
+	deque<QueryBatch> batches;
+} QueryService;
+
+// QueryWorker holds the state belonging to a single worker thread: its MIRACL instance, the processors for the bases of
+// each proof, and its scratch entry.
+typedef struct QueryWorker {
+	Miracl *precision;
+	vector<LEPProcessor *> lepgens;
+	vector<LBPProcessor *> lbpgens;
+	LedgerEntry e;
+} QueryWorker;
+
+// Split the whitespace-separated fields of line, up to count of them, into fields. Returns the number found.
+static int splitFields(const string &line, const char **fields, size_t *lengths, int count) {
+	const char *p = line.data(), *end = line.data() + line.size();
+	int found = 0;
+
+	while (found < count) {
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		if (p == end) break;
+		fields[found] = p;
+		while (p < end && *p != ' ' && *p != '\t') p++;
+		lengths[found] = p - fields[found];
+		found++;
+	}
+
+	return found;
+}
+
+// Answer a single query. The entry is located with the index of its proof and parsed in place, and is valid only if its
+// commitment opens to the account, balance, and nonce given; unless the service is quick, its proofs must also hold, just
+// as zlverify -i would require.
+static void answerQuery(QueryService &service, QueryWorker &worker, Query &query) {
+	const char *fields[6];
+	size_t lengths[6];
+	uint64_t number, index;
+	Big balance, r;
+
+	if (splitFields(query.line, fields, lengths, 6) != 5 || !parseDecimal(fields[0], lengths[0], number)
+		|| !parseDecimal(fields[1], lengths[1], index) || !decodeDecimal(fields[3], lengths[3], balance)
+		|| !decodeBig(fields[4], lengths[4], r)) {
+		query.answer = "ERROR malformed query";
+		return;
+	}
+
+	stringstream answer;
+	answer << number << ENTRIES_EXPORT_FIELD_SEPARATOR << index << ENTRIES_EXPORT_FIELD_SEPARATOR;
+
+	QueryProof *proof = (number < service.proofs.size()) ? service.proofs[number] : NULL;
+	int region = (proof != NULL && index < proof->index.entryCount) ? proof->reader.findRegion(index) : -1;
+	if (region < 0) {
+		query.answer = "ERROR no such entry";
+		return;
+	}
+
+	ProofReader &reader = proof->reader;
+	ProofRegion &entries = reader.regions[region];
+	const char *cursor = proof->index.entryAt(index, entries.base, entries.begin, entries.end);
+	if (cursor == NULL) {
+		query.answer = "ERROR index does not match proof";
+		return;
+	}
+	LedgerEntry &e = worker.e;
+	bool valid = true;
+
+	if (service.quick) {
+		e.valueBits = reader.valueBits;
+		ProofReader::readPoint(cursor, entries.end, e.lec);
+	} else {
+		reader.readEntry(cursor, entries.end, e, *worker.lepgens[number], *worker.lbpgens[number]);
+		valid = worker.lepgens[number]->verifyProof(e) && worker.lbpgens[number]->verifyProofs(e) && e.verifyCommitmentEquivilancy();
+	}
+
+	e.setId(string(fields[2], lengths[2]));
+	e.setBalance(balance);
+	e.setR(r);
+	valid = valid && proof->tables->verifyKnownValues(e);
+
+	answer << (valid ? "VALID" : "INVALID");
+	query.answer = answer.str();
+}
+
+// Answer batches of queries for as long as the service runs. Workers are never stopped; the process simply exits.
+static void * queryWorker(void *rawService) {
+	QueryService &service = *(static_cast<QueryService*>(rawService));
+	QueryWorker worker;
+
+	// per-thread MIRACL setup
+	worker.precision = newThreadMiracl();
+
+	ecurve(service.a, service.b, service.p, MR_PROJECTIVE);
+
+	for (size_t ii = 0; ii < service.proofs.size(); ii++) {
+		ProofReader &reader = service.proofs[ii]->reader;
+		worker.lepgens.push_back(new LEPProcessor(service.q, reader.g, reader.h, reader.f, service.bits));
+		worker.lbpgens.push_back(new LBPProcessor(service.q, reader.g, reader.h, reader.f, service.bits, reader.valueBits));
+	}
+
+	get_mip()->IOBASE=DATA_BASE;
+
+	while (true) {
+		pthread_mutex_lock(&service.lock);
+		while (service.batches.empty()) pthread_cond_wait(&service.queued, &service.lock);
+		QueryBatch batch = service.batches.front();
+		service.batches.pop_front();
+		pthread_mutex_unlock(&service.lock);
+
+		vector<Query> &queries = *batch.request->queries;
+		for (size_t ii = batch.first; ii < batch.last; ii++) {
+			answerQuery(service, worker, queries[ii]);
+		}
+
+		pthread_mutex_lock(&service.lock);
+		if (--batch.request->remaining == 0) pthread_cond_broadcast(&service.finished);
+		pthread_mutex_unlock(&service.lock);
+	}
+
+	return NULL;
+}
+
+// Divide queries into batches for the workers, and wait until all of them have been answered.
+static void answerQueries(QueryService &service, vector<Query> &queries) {
+	QueryRequest request;
+	request.queries = &queries;
+	request.remaining = 0;
+
+	pthread_mutex_lock(&service.lock);
+	for (size_t first = 0; first < queries.size(); first += QUERIES_PER_BATCH) {
+		QueryBatch batch;
+		batch.request = &request;
+		batch.first = first;
+		batch.last = min(queries.size(), first + QUERIES_PER_BATCH);
+		service.batches.push_back(batch);
+		request.remaining++;
+	}
+	pthread_cond_broadcast(&service.queued);
+	while (request.remaining > 0) pthread_cond_wait(&service.finished, &service.lock);
+	pthread_mutex_unlock(&service.lock);
+}
+
+static bool writeAll(int fd, const string &text) {
+	size_t written = 0;
+	ssize_t count;
+
+	while (written < text.size() && (count = write(fd, text.data() + written, text.size() - written)) > 0) {
+		written += count;
+	}
+
+	return written == text.size();
+}
+
+// Read queries from in and answer them on out until in is closed. Every complete line available is answered together, so a
+// client which sends many queries at once has them divided among all of the workers.
+static void serveQueries(QueryService &service, int in, int out) {
+	vector<Query> queries;
+	string buffered, output;
+	char chunk[1 << 16];
+	bool open = true;
+
+	while (open) {
+		ssize_t got = read(in, chunk, sizeof(chunk));
+		if (got > 0) {
+			buffered.append(chunk, got);
+		} else {
+			// The last query need not be followed by a newline.
+			if (!buffered.empty()) buffered.push_back('\n');
+			open = false;
+		}
+
+		size_t begin = 0, eol;
+		while ((eol = buffered.find('\n', begin)) != string::npos) {
+			size_t length = eol - begin;
+			if (length > 0 && buffered[eol - 1] == '\r') length--;
+			if (length > 0) {
+				queries.push_back(Query());
+				queries.back().line.assign(buffered, begin, length);
+			}
+			begin = eol + 1;
+		}
+		buffered.erase(0, begin);
+
+		if (queries.empty()) continue;
+
+		answerQueries(service, queries);
+
+		output.clear();
+		for (size_t ii = 0; ii < queries.size(); ii++) {
+			output += queries[ii].answer;
+			output += '\n';
+		}
+		queries.clear();
+
+		if (!writeAll(out, output)) open = false;
+	}
+}
+
+typedef struct QueryConnection {
+	QueryService *service;
+	int fd;
+} QueryConnection;
+
+static void * serveConnection(void *rawConnection) {
+	QueryConnection *connection = static_cast<QueryConnection*>(rawConnection);
+	serveQueries(*connection->service, connection->fd, connection->fd);
+	close(connection->fd);
+	delete connection;
+	return NULL;
+}
+
+
+int main(int argc, char **argv) {
+
+	// Set up some variables to hold our options, with default values
+	char* socket_path = NULL;
+	char* curve_source = CURVE_SOURCE_DEFAULT;
+	int threadcount = 0;
+	bool quick = false;
+
+	// Now read options
+	int c;
+	while ( (c = getopt(argc, argv, "ht:c:s:q")) != -1) {
+		switch (c) {
+			case 'h':
+				cerr << HELP_TEXT;
+				return 0;
+			case 't':
+				threadcount = atoi(optarg);
+				break;
+			case 'c':
+				curve_source = optarg;
+				break;
+			case 's':
+				socket_path = optarg;
+				break;
+			case 'q':
+				quick = true;
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (optind >= argc || (argc - optind) % 2 != 0) {
+		cerr << HELP_TEXT;
+		return 0;
+	}
+
+
+	// MIRACL initialization
+	mr_init_threading();
+	#ifndef MR_NOFULLWIDTH
+	Miracl precision(64,0);
+	#else
+	Miracl precision(64,MAXBASE);
+	#endif
+
+
+	// Set up curve
+	ifstream curve(curve_source);
+	if (curve.fail()) {
+		cerr << "Error: curve source could not be read." << endl;
+		return 0;
+	}
+
+	get_mip()->IOBASE=16;
+	int bits;
+	Big a,b,p,q,x,y;
+	curve >> bits >> p >> a >> b >> q >> x >> y;
+	curve.close();
+
+	ecurve(a,b,p,MR_PROJECTIVE);
+
+	get_mip()->IOBASE=DATA_BASE;
+
+
+	// Map each proof and its index, and make sure that the index actually describes the proof, exactly as zlverify does.
+	// The tables for the bases of each proof are built here, once, and shared by every worker.
+	QueryService service;
+	service.a = a;
+	service.b = b;
+	service.p = p;
+	service.q = q;
+	service.bits = bits;
+	service.quick = quick;
+
+	for (; optind < argc; optind += 2) {
+		const char *proof_source = argv[optind], *index_source = argv[optind + 1];
+		QueryProof *proof = new QueryProof;
+
+		if (!mapFile(proof_source, proof->file) || !proof->reader.open(proof->file.data, proof->file.length, proof_source)) {
+			cerr << "Error: proof " << proof_source << " could not be read." << endl;
+			return 0;
+		}
+
+		ProofReader &reader = proof->reader;
+		if (!proof->index.open(index_source)) {
+			cerr << "Error: index " << index_source << " could not be read." << endl;
+			return 0;
+		}
+		uint64_t entriesOffset = reader.manifest ? 0 : (uint64_t) (reader.entriesBegin - reader.data);
+		if (proof->index.valueBits != reader.valueBits || proof->index.entriesOffset != entriesOffset
+			|| proof->index.differenceOffset != (uint64_t) (reader.differenceBegin - reader.data)) {
+			cerr << "Error: index " << index_source << " does not match proof." << endl;
+			return 0;
+		}
+		if (!reader.manifest) reader.regions[0].entryCount = proof->index.entryCount;
+
+		proof->tables = new BaseTables(a, b, p, q, reader.g, reader.h, reader.f);
+		service.proofs.push_back(proof);
+	}
+
+
+	// Start the workers, which wait for queries until the process exits.
+	pthread_mutex_init(&service.lock, NULL);
+	pthread_cond_init(&service.queued, NULL);
+	pthread_cond_init(&service.finished, NULL);
+
+	int maxThreads = (threadcount > 0) ? threadcount : availableProcessors();
+	pthread_t thread;
+	for (int ii = 0; ii < maxThreads; ii++) {
+		if (pthread_create(&thread, NULL, queryWorker, &service) != 0) {
+			cerr << "Error: worker threads could not be started." << endl;
+			return 0;
+		}
+		pthread_detach(thread);
+	}
+
+	// A client which goes away before it is answered must not take the service with it.
+	signal(SIGPIPE, SIG_IGN);
+
+	if (socket_path == NULL) {
+		serveQueries(service, STDIN_FILENO, STDOUT_FILENO);
+		return 0;
+	}
+
+
+	// Listen on the socket, replacing any left behind by an earlier service, and serve each connection on its own thread.
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		cerr << "Error: socket path is too long." << endl;
+		return 0;
+	}
+	strcpy(address.sun_path, socket_path);
+	unlink(socket_path);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+		cerr << "Error: socket could not be opened." << endl;
+		return 0;
+	}
+
+	cerr << "ZEROLEDGE INCLUSION QUERY SERVICE" << endl;
+	cerr << endl;
+	cerr << "Serving " << service.proofs.size() << " proof(s) on " << socket_path << endl;
+
+	int fd;
+	while ((fd = accept(listener, NULL, NULL)) >= 0) {
+		QueryConnection *connection = new QueryConnection;
+		connection->service = &service;
+		connection->fd = fd;
+		if (pthread_create(&thread, NULL, serveConnection, connection) != 0) {
+			close(fd);
+			delete connection;
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	close(listener);
+	unlink(socket_path);
+
+	return 0;
+}
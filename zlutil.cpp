@@ -1,4 +1,10 @@
 #include "zlutil.h"
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 unsigned int fetchRandomSeed() {
 	unsigned int random_seed; 
@@ -15,6 +21,14 @@ unsigned int fetchRandomSeed() {
 	return random_seed;
 }
 
+Miracl * newThreadMiracl() {
+	#ifndef MR_NOFULLWIDTH
+	return new Miracl(64,0);
+	#else
+	return new Miracl(64,MAXBASE);
+	#endif
+}
+
 Big zlhash(const char* data, int bytes) {
 	sha256 hasher;
 	shs256_init(&hasher);
@@ -26,3 +40,141 @@ Big zlhash(const char* data, int bytes) {
 	shs256_hash(&hasher, hash);
 	return from_binary(sizeof(hash), hash);
 }
+
+void zldigest(const char* data, size_t length, char* digest) {
+	sha256 hasher;
+	shs256_init(&hasher);
+	for (size_t ii = 0; ii < length; ii++) {
+		shs256_process(&hasher, data[ii]);
+	}
+	shs256_hash(&hasher, digest);
+}
+
+string toHex(const char* data, int bytes) {
+	static const char digits[] = "0123456789abcdef";
+	string result(2 * bytes, '0');
+	for (int ii = 0; ii < bytes; ii++) {
+		result[2 * ii] = digits[(data[ii] >> 4) & 0xF];
+		result[2 * ii + 1] = digits[data[ii] & 0xF];
+	}
+	return result;
+}
+
+bool fromHex(const char* hex, size_t length, int bytes, char* data) {
+	if (length != (size_t) (2 * bytes)) return false;
+	for (int ii = 0; ii < 2 * bytes; ii++) {
+		char c = hex[ii];
+		int value = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+		if (value < 0) return false;
+		if (ii % 2 == 0) {
+			data[ii / 2] = value << 4;
+		} else {
+			data[ii / 2] |= value;
+		}
+	}
+	return true;
+}
+
+bool mapFile(const char *path, MappedFile &m) {
+	m.data = NULL;
+	m.length = 0;
+	m.mapped = false;
+
+	int fd = (path != NULL) ? open(path, O_RDONLY) : STDIN_FILENO;
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		if (st.st_size > 0) {
+			void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (data == MAP_FAILED) {
+				if (path != NULL) close(fd);
+				return false;
+			}
+			madvise(data, st.st_size, MADV_WILLNEED);
+			m.data = static_cast<const char *>(data);
+			m.length = st.st_size;
+			m.mapped = true;
+		}
+		if (path != NULL) close(fd);
+		return true;
+	}
+
+	// Not a regular file, so we cannot map it; read it into a growing heap buffer instead.
+	size_t capacity = 1 << 20;
+	char *buffer = static_cast<char *>(malloc(capacity));
+	ssize_t got = 0;
+	while (buffer != NULL && (got = read(fd, buffer + m.length, capacity - m.length)) > 0) {
+		m.length += got;
+		if (m.length == capacity) {
+			capacity *= 2;
+			char *grown = static_cast<char *>(realloc(buffer, capacity));
+			if (grown == NULL) free(buffer);
+			buffer = grown;
+		}
+	}
+	if (path != NULL) close(fd);
+	m.data = buffer;
+	return buffer != NULL && got == 0;
+}
+
+void unmapFile(MappedFile &m) {
+	if (m.mapped) {
+		munmap(const_cast<char *>(m.data), m.length);
+	} else {
+		free(const_cast<char *>(m.data));
+	}
+	m.data = NULL;
+	m.length = 0;
+	m.mapped = false;
+}
+
+size_t countLines(const char *p, const char *end) {
+	size_t count = 0;
+	while (p < end && (p = static_cast<const char *>(memchr(p, '\n', end - p))) != NULL) {
+		count++;
+		p++;
+	}
+	return count;
+}
+
+const char * skipLines(const char *p, const char *end, size_t n) {
+	for (; n > 0 && p < end; n--) {
+		p = static_cast<const char *>(memchr(p, '\n', end - p));
+		if (p == NULL) return end;
+		p++;
+	}
+	return p;
+}
+
+const char * alignToLine(const char *begin, const char *p, const char *end) {
+	if (p <= begin || p >= end || p[-1] == '\n') return p;
+	return skipLines(p, end, 1);
+}
+
+// Each group of eight digits is loaded as a single little-endian word, checked, and combined pairwise in three multiplies,
+// rather than one digit at a time.
+bool parseDecimal(const char *p, size_t length, uint64_t &value) {
+	if (length == 0 || length > 19) return false;
+
+	value = 0;
+
+	#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t chunk;
+	for (; length >= 8; p += 8, length -= 8) {
+		memcpy(&chunk, p, 8);
+		if (((chunk & 0xF0F0F0F0F0F0F0F0ULL) | (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) != 0x3333333333333333ULL) return false;
+		chunk = ((chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+		chunk = ((chunk & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+		chunk = ((chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+		value = value * 100000000 + chunk;
+	}
+	#endif
+
+	for (; length > 0; p++, length--) {
+		if (*p < '0' || *p > '9') return false;
+		value = value * 10 + (*p - '0');
+	}
+
+	return true;
+}
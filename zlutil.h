@@ -3,6 +3,9 @@
 
 #include "zeroledge.h"
 #include <fstream>
+#include <string>
+#include <cstddef>
+#include <stdint.h>
 
 #define TAG_VALID   "\e[32m[VALID]     \e[0m"
 #define TAG_INVALID "\e[31m[INVALID]   \e[0m"
@@ -15,8 +18,48 @@
 #define SUBSECTION_SEPARATOR "--------------------"
 #define ENTRIES_EXPORT_FIELD_SEPARATOR ' '
 
+
+// MappedFile represents a read-only view of an entire input. Regular files are memory-mapped, so that many threads may
+// parse them in place without copying; other inputs (such as a pipe on stdin) are read into a heap buffer instead, so
+// that callers need not distinguish between the two.
+struct MappedFile {
+	const char *data;
+	size_t length;
+	bool mapped;
+};
+
 unsigned int fetchRandomSeed();
 
+// Create a MIRACL instance for the calling thread, with the precision used throughout. It must be deleted by the same thread.
+Miracl * newThreadMiracl();
+
 Big zlhash(const char* data, int bytes);
 
-#endif
\ No newline at end of file
+// Compute the SHA-256 digest of length bytes of data into digest, which must have room for 32 bytes.
+void zldigest(const char* data, size_t length, char* digest);
+
+// Return the lowercase hexadecimal representation of bytes bytes of data.
+string toHex(const char* data, int bytes);
+
+// Parse the length hexadecimal digits at hex into bytes bytes of data. Returns false unless there are exactly two digits
+// per byte.
+bool fromHex(const char* hex, size_t length, int bytes, char* data);
+
+// Map the file at path, or read stdin if path is NULL. Returns false if the input could not be read.
+bool mapFile(const char *path, MappedFile &m);
+void unmapFile(MappedFile &m);
+
+// Return the number of newlines in the range [p, end).
+size_t countLines(const char *p, const char *end);
+
+// Return a pointer to the character following the nth newline at or after p, or end if fewer than n newlines remain.
+const char * skipLines(const char *p, const char *end, size_t n);
+
+// Return a pointer to the first line start at or after p, given that begin is itself a line start.
+const char * alignToLine(const char *begin, const char *p, const char *end);
+
+// Parse the length decimal digits at p into value, eight digits at a time. Returns false if they are not all digits, or
+// there are too many to fit in 64 bits (more than 19).
+bool parseDecimal(const char *p, size_t length, uint64_t &value);
+
+#endif
@@ -21,12 +21,15 @@
 #include <fstream>
 #include <sstream>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <vector>
 #include <unistd.h>
 #include <algorithm>
 #include <pthread.h>
 #include <getopt.h>
+#include <atomic>
 
 #include "zeroledge.h"
 #include "zlutil.h"
@@ -34,28 +37,46 @@
 #include "lepprocessor.h"
 #include "lbpprocessor.h"
 #include "dbpprocessor.h"
+#include "proofreader.h"
+#include "proofindex.h"
+#include "pipeline.h"
+#include "placement.h"
+#include "treehash.h"
+#include "partialsummary.h"
 
 #define HELP_TEXT "ZeroLedge Proof Verifier 1.0\n\
 Usage: zlverify [\x1b[4mOPTIONS\x1b[0m] [\x1b[4mPROOF\x1b[0m]\n\
+       zlverify -M [\x1b[4mOPTIONS\x1b[0m] \x1b[4mPROOF\x1b[0m \x1b[4mRESULT\x1b[0m...\n\
 \n\
 Options:\n\
   -h \t\tprint this message\n\
   -t \x1b[4mNUMBER\x1b[0m \tuse \x1b[4mNUMBER\x1b[0m threads\n\
+  -B \x1b[4mNUMBER\x1b[0m \tuse at most \x1b[4mNUMBER\x1b[0m processors' worth of time, at the lowest priority\n\
   -b \x1b[4mPATH\x1b[0m \tread commitment base seeds from \x1b[4mPATH\x1b[0m\n\
   -c \x1b[4mPATH\x1b[0m \tread elliptic curve parameters from \x1b[4mPATH\x1b[0m\n\
   -k \x1b[4mPATH\x1b[0m \tread known ledger entries from \x1b[4mPATH\x1b[0m\n\
+  -x \x1b[4mPATH\x1b[0m \tread proof entry index from \x1b[4mPATH\x1b[0m\n\
+  -d \x1b[4mDIGEST\x1b[0m \tcheck that the digest of the proof is \x1b[4mDIGEST\x1b[0m\n\
+  -a \x1b[4mPATH\x1b[0m \tcheck the inclusion proofs at \x1b[4mPATH\x1b[0m (from zlopener -p) using only the proof header\n\
+  -r \x1b[4mFIRST\x1b[0m:\x1b[4mCOUNT\x1b[0m \tverify only \x1b[4mCOUNT\x1b[0m entries, beginning with entry \x1b[4mFIRST\x1b[0m\n\
+  -s \x1b[4mNUMBER\x1b[0m \tverify only the entries in shard \x1b[4mNUMBER\x1b[0m of a sharded proof\n\
+  -w \x1b[4mPATH\x1b[0m \twrite the partial result for the entries verified to \x1b[4mPATH\x1b[0m\n\
+  -M \t\tmerge the partial results \x1b[4mRESULT\x1b[0m... and complete the verification of \x1b[4mPROOF\x1b[0m\n\
   -i \t\tverify ledger entry inclusion only\n"
 
-using namespace std;
+#define VERIFY_SEEK_BATCH 16
+#define VERIFY_DIGEST_BATCH 8
+
+// The number of bits of an entry which are parsed and verified by each of the tasks a worker shares.
+#define BIT_TASK_BITS 4
 
-pthread_mutex_t proof_lock;
-pthread_mutex_t ledger_lock;
+using namespace std;
 
 class KnownEntry {
 
 public:
 
-	int index;
+	uint64_t index;
 	string identifier;
 	Big balance;
 	Big r;
@@ -73,43 +94,45 @@ public:
     }
 };
 
-class ProofDataRaw  {
-
-public:
-
-	string lec_cx, lec_ylsb;
-	string lep_z1, lep_z2, lep_z3;
-	string lep_gamma_cx, lep_gamma_ylsb;
-	vector<string> lbc_cx;
-	vector<string> lbc_ylsb;
-	vector<string> lbp_gamma1_cx;
-	vector<string> lbp_gamma1_ylsb;
-	vector<string> lbp_gamma2_cx;
-	vector<string> lbp_gamma2_ylsb;
-	vector<string> lbp_c1;
-	vector<string> lbp_z1;
-	vector<string> lbp_z2;
-	vector<string> lbp_z3;
-	vector<string> lbp_z4;
-
-	ProofDataRaw() {}
-
-	ProofDataRaw(int valueBits) {
-		lbc_cx.resize(valueBits);
-		lbc_ylsb.resize(valueBits);
-		lbp_gamma1_cx.resize(valueBits);
-		lbp_gamma1_ylsb.resize(valueBits);
-		lbp_gamma2_cx.resize(valueBits);
-		lbp_gamma2_ylsb.resize(valueBits);
-		lbp_c1.resize(valueBits);
-		lbp_z1.resize(valueBits);
-		lbp_z2.resize(valueBits);
-		lbp_z3.resize(valueBits);
-		lbp_z4.resize(valueBits);
-	}
-};
-
-typedef struct calcLoopArgs {
+// ProofChunk represents a contiguous range of lines within one region of the proof, which is counted and then parsed by
+// a single thread. Chunks begin and end on line boundaries, but not necessarily on entry boundaries.
+typedef struct ProofChunk {
+	int region;
+	const char *begin;
+	const char *end;
+	uint64_t firstLine;
+	uint64_t lineCount;
+} ProofChunk;
+
+// DigestJob represents a file whose digest (see treehash.h) is computed by the verifier: the proof itself (region -1), or
+// one of the shards of a sharded proof. Its leaves are hashed in batches of consecutive leaves, each of which is a separate
+// item.
+typedef struct DigestJob {
+	int region;
+	const char *data;
+	uint64_t length;
+	vector<char> leaves;
+} DigestJob;
+
+typedef struct DigestBatch {
+	int job;
+	uint64_t first;
+	uint64_t last;
+} DigestBatch;
+
+// VerifyContext holds everything shared by the stages of the verification pipelines. The reader hands out items (chunks of
+// the proof, leaves to digest, or known entries to seek) in batches by advancing nextItem, and the results of each worker
+// are accumulated in the counters and partial ledger at its own position, so that no locks are required. knownCount is
+// shared, so that all workers can stop early once every known entry has been found. Only the entries [rangeFirst,
+// rangeLast) are verified. If the proof is rooted, the leaf of each entry in the entry tree is stored at its own position
+// (relative to rangeFirst) in entryLeaves as the entry is parsed.
+//
+// The checks of the proof as a whole need none of the entries, so they are handed out as the first proofItems items of
+// the verification pipeline, ahead of the chunks, and overlap with the verification of the entries: the first derives the
+// bases from the seeds into gv, hv, and fv, and each of the rest parses and verifies a single difference bit into ledger.
+// Each worker counts the difference bits it found valid and sums their commitments, weighted by place value, at its own
+// position. If shareBits is set, there are too few entries to occupy every worker, so the bits of each entry are shared.
+typedef struct VerifyContext {
 	Big a;
 	Big b;
 	Big p;
@@ -118,189 +141,505 @@ typedef struct calcLoopArgs {
 	ECn h;
 	ECn f;
 	int bits;
-	int packSize;
 	int valueBits;
 	bool includeOnly;
 	time_t proofTime;
-	int *entryCount;
-	istream *proof;
-	Ledger *l;
-	unordered_map<int, KnownEntry> *knownEntries;
-	int *knownCount;
-	int *correctCount;
-	int *validCount;
-	int *lbpValidCount;
-	int *equivalencyCount;
-} calcLoopArgs;
-
-
-// The calcLoop function forms the body of a pthread, and is responsible for the bulk of the work. It performs data ingest
-// and verification of individual ledger entry and ledger bit proofs. It does not, however, perform known entry data ingest
-// As with the calcLoop function in zlgenerate.cpp, it attempts to keep its locks active for as little time as possible. As
-// a consequence, it copies raw string data only while the proof source lock is active, and waits to ingest it into bignums
-// and curve points until after the lock is relinquished. Also as with the calcLoop in zlgenerate.cpp, ledger entries are
-// processed in groups, and the group size can be adjusted to optimize performance for a particular thread count.
-void * calcLoop(void* rawArgs) {
-	calcLoopArgs &args = *(static_cast<calcLoopArgs*>(rawArgs));
+	uint64_t rangeFirst;
+	uint64_t rangeLast;
+	size_t nextItem;
+	size_t itemCount;
+	size_t batchSize;
+	vector<ProofChunk> *chunks;
+	vector<DigestJob> *digestJobs;
+	vector<DigestBatch> *digestBatches;
+	vector<uint64_t> *seekEntries;
+	vector<char> *entryLeaves;
+	ProofReader *reader;
+	ProofIndex *index;
+	vector<Ledger> *partialLedgers;
+	unordered_map<uint64_t, KnownEntry> *knownEntries;
+	atomic<uint64_t> knownCount;
+	vector<uint64_t> correctCounts;
+	vector<uint64_t> validCounts;
+	vector<uint64_t> lbpValidCounts;
+	vector<uint64_t> equivalencyCounts;
+	Pipeline *pipeline;
+	bool shareBits;
+	size_t proofItems;
+	Ledger *ledger;
+	Big gseed, hseed, fseed;
+	ECn gv, hv, fv;
+	vector<uint64_t> differenceValidCounts;
+	vector<ECn> differenceProducts;
+} VerifyContext;
+
+// VerifyPack is a batch of consecutive items, [first, last).
+typedef struct VerifyPack {
+	size_t first;
+	size_t last;
+} VerifyPack;
+
+// VerifyWorker holds the state belonging to a single worker thread: its MIRACL instance, its processors, its scratch
+// entry, and its counters and difference bit sum, which are copied to the context when the worker finishes.
+typedef struct VerifyWorker {
+	int worker;
+	Miracl *precision;
+	LEPProcessor *lepgen;
+	LBPProcessor *lbpgen;
+	DBPProcessor *dbpgen;
+	LedgerEntry e;
+	uint64_t correctCount;
+	uint64_t validCount;
+	uint64_t lbpValidCount;
+	uint64_t equivalencyCount;
+	uint64_t differenceValidCount;
+	ECn differenceProduct;
+} VerifyWorker;
+
+// BitTasks describes an entry being verified by a worker which divides it into tasks that it shares with any workers which
+// are idle (see Pipeline::share): each range of BIT_TASK_BITS bits is parsed and verified by a task of its own, and the
+// commitment and entry proof by one more, each with the processors of whichever worker takes it. Each task records
+// whether its proofs were valid at its own position in valid.
+typedef struct BitTasks {
+	ProofReader *reader;
+	LedgerEntry *e;
+	const char *begin;
+	const char *end;
+	int bitTasks;
+	int valueBits;
+	vector<char> valid;
+} BitTasks;
+
+void * newPack(void* rawContext) {
+	return new VerifyPack;
+}
+
+void deletePack(void* rawContext, void* rawPack) {
+	delete static_cast<VerifyPack*>(rawPack);
+}
+
+bool readPack(void* rawContext, void* rawPack) {
+	VerifyContext &context = *(static_cast<VerifyContext*>(rawContext));
+	VerifyPack *pack = static_cast<VerifyPack*>(rawPack);
+
+	if (context.nextItem >= context.itemCount) return false;
+
+	pack->first = context.nextItem;
+	pack->last = min(context.itemCount, context.nextItem + context.batchSize);
+	context.nextItem = pack->last;
+	return true;
+}
+
+void * beginWorker(void* rawContext, int worker) {
+	VerifyContext &context = *(static_cast<VerifyContext*>(rawContext));
+	VerifyWorker *state = new VerifyWorker;
+	state->worker = worker;
+	state->correctCount = 0;
+	state->validCount = 0;
+	state->lbpValidCount = 0;
+	state->equivalencyCount = 0;
+	state->differenceValidCount = 0;
 
 	// per-thread MIRACL setup
-	#ifndef MR_NOFULLWIDTH
-	Miracl precision(64,0);
-	#else
-	Miracl precision(64,MAXBASE);
-	#endif
+	state->precision = newThreadMiracl();
+
+	ecurve(context.a,context.b,context.p,MR_PROJECTIVE);
+
+	// zl setup
+	state->lepgen = new LEPProcessor(context.q, context.g, context.h, context.f, context.bits);
+	state->lbpgen = new LBPProcessor(context.q, context.g, context.h, context.f, context.bits, context.valueBits);
+	state->dbpgen = new DBPProcessor(context.q, context.g, context.h, context.f, context.bits, context.valueBits);
 
-	ecurve(args.a,args.b,args.p,MR_PROJECTIVE);
+	get_mip()->IOBASE=DATA_BASE;
 
-	Big cx;
-	int ylsb, ii, jj, kk, entryCount;
-	LedgerEntry e[args.packSize];
-	ProofDataRaw rawData[args.packSize];
+	return state;
+}
 
-	for (ii = 0; ii < args.packSize; ii++) {
-		rawData[ii] = ProofDataRaw(args.valueBits);
+void endWorker(void* rawContext, void* rawWorker) {
+	VerifyContext &context = *(static_cast<VerifyContext*>(rawContext));
+	VerifyWorker *state = static_cast<VerifyWorker*>(rawWorker);
+
+	context.correctCounts[state->worker] = state->correctCount;
+	context.validCounts[state->worker] = state->validCount;
+	context.lbpValidCounts[state->worker] = state->lbpValidCount;
+	context.equivalencyCounts[state->worker] = state->equivalencyCount;
+	if (context.proofItems > 0) {
+		context.differenceValidCounts[state->worker] = state->differenceValidCount;
+		context.differenceProducts[state->worker] = state->differenceProduct;
 	}
 
-	// zl setup
-	LEPProcessor lepgen(args.q, args.g, args.h, args.f, args.bits);
-	LBPProcessor lbpgen(args.q, args.g, args.h, args.f, args.bits, args.valueBits);
+	// Everything allocated by this thread's MIRACL instance must be freed before the instance itself.
+	delete state->lepgen;
+	delete state->lbpgen;
+	delete state->dbpgen;
+	state->e = LedgerEntry();
+	state->differenceProduct = ECn();
+	delete state->precision;
+	delete state;
+}
 
-	while (true) {
+// The countPack function performs the preliminary pass over the memory-mapped proof. The first items are chunks of the
+// proof, in which the lines are counted; because every entry occupies the same number of lines, once the line counts for
+// all chunks are known, each worker in calcPack can find the first entry that begins within any chunk without consulting
+// any other thread. The remaining items are batches of the leaves of the proof and of its shards, the digests of which are
+// combined once every leaf has been hashed. No MIRACL context is needed.
+void countPack(void* rawContext, void* rawWorker, void* rawPack) {
+	VerifyContext &context = *(static_cast<VerifyContext*>(rawContext));
+	VerifyPack *pack = static_cast<VerifyPack*>(rawPack);
+	vector<ProofChunk> &chunks = *context.chunks;
+
+	for (size_t item = pack->first; item < pack->last; item++) {
+		if (item < chunks.size()) {
+			chunks[item].lineCount = countLines(chunks[item].begin, chunks[item].end);
+		} else {
+			DigestBatch &batch = (*context.digestBatches)[item - chunks.size()];
+			DigestJob &job = (*context.digestJobs)[batch.job];
+			hashTreeLeaves(job.data, job.length, batch.first, batch.last, &job.leaves[0]);
+		}
+	}
+}
 
-		// First we read the raw proof data from the file, but do not ingest it. If the proof is exhausted, or we have seen
-		// all the known entries and are not interested in any others, terminate early.
+static void verifyBitsTask(void* rawContext, void* rawWorker, void* rawTasks, int task) {
+	VerifyWorker *state = static_cast<VerifyWorker*>(rawWorker);
+	BitTasks &tasks = *(static_cast<BitTasks*>(rawTasks));
+	LedgerEntry &e = *tasks.e;
 
-		if (args.includeOnly && *args.knownCount >= args.knownEntries->size()) break;
+	if (task == tasks.bitTasks) {
+		tasks.reader->readEntryProof(tasks.begin, tasks.end, e, *state->lepgen);
+		tasks.valid[task] = state->lepgen->verifyProof(e);
+		return;
+	}
 
-		int knownCount = 0;
+	int first = task * BIT_TASK_BITS, last = min(first + BIT_TASK_BITS, tasks.valueBits);
+	const char *cursor = skipLines(tasks.begin, tasks.end, PROOF_ENTRY_LINES(first));
+	tasks.reader->readBits(cursor, tasks.end, e, *state->lbpgen, first, last);
+	tasks.valid[task] = state->lbpgen->verifyBits(e, first, last);
+}
 
-		pthread_mutex_lock(&proof_lock);
+// The verifyProofItem function performs one of the checks of the proof as a whole (see VerifyContext): item zero derives
+// the bases from their seeds, as specified in Sections VII-A and IX-A of the paper, and item ii parses and verifies
+// difference bit ii - 1, adding its commitment to the worker's sum.
+static void verifyProofItem(VerifyContext &context, VerifyWorker *state, size_t item) {
+	if (item == 0) {
+		Big gseed = context.gseed, hseed = context.hseed, fseed = context.fseed;
+		while (! context.gv.set(gseed, 0)) {
+			gseed += 1;
+		}
+		while (! context.hv.set(hseed, 0)) {
+			hseed += 1;
+		}
+		while (! context.fv.set(fseed, 0)) {
+			fseed += 1;
+		}
+		return;
+	}
 
-		for (ii = 0; ii < args.packSize; ii++) {
-			if (args.proof->peek() == '\n') args.proof->ignore(1, '\n');
-			if (args.proof->peek() == '=') break;
+	Ledger &l = *context.ledger;
+	int ii = item - 1;
+	context.reader->readDifferenceBits(l, *state->dbpgen, ii, ii + 1);
+	if (state->dbpgen->verifyProof(l, ii)) state->differenceValidCount++;
+	state->differenceProduct += pow(Big(2), ii) * l.dbc[ii];
+}
 
-			*args.proof >> rawData[ii].lec_cx >> rawData[ii].lec_ylsb;
-			*args.proof >> rawData[ii].lep_gamma_cx >> rawData[ii].lep_gamma_ylsb;
-			*args.proof >> rawData[ii].lep_z1 >> rawData[ii].lep_z2 >> rawData[ii].lep_z3;
+// The calcPack function is responsible for the bulk of the work. It performs data ingest and verification of individual
+// ledger entry and ledger bit proofs. It does not, however, perform known entry data ingest. Unlike calcPack in
+// zlgenerate.cpp, its input is not read by the pipeline's reader: the proof is memory-mapped, and the reader merely hands
+// out chunks of it, the entries which begin within which are parsed directly from the mapping, without copying fields to
+// the heap. Entries which begin near the end of a chunk may extend into the next one; they are nonetheless parsed by the
+// worker which was handed the chunk that contains their first line. The chunks of a sharded proof may belong to different
+// shards, so they are verified in parallel. Entries outside the range being verified are passed over without parsing.
+// When there are fewer entries than workers could take, the bits of each entry are shared (see BitTasks), so that a short
+// proof still occupies every processor.
+void calcPack(void* rawContext, void* rawWorker, void* rawPack) {
+	VerifyContext &context = *(static_cast<VerifyContext*>(rawContext));
+	VerifyWorker *state = static_cast<VerifyWorker*>(rawWorker);
+	VerifyPack *pack = static_cast<VerifyPack*>(rawPack);
+
+	ProofReader &reader = *context.reader;
+	LEPProcessor &lepgen = *state->lepgen;
+	LBPProcessor &lbpgen = *state->lbpgen;
+	LedgerEntry &e = state->e;
+	Ledger &l = (*context.partialLedgers)[state->worker];
+	uint64_t entryLines = reader.entryLines();
+	uint64_t line, lastLine, entryCount;
+	const char *cursor, *entryBegin;
+
+	BitTasks tasks;
+	tasks.reader = &reader;
+	tasks.e = &e;
+	tasks.bitTasks = (context.valueBits + BIT_TASK_BITS - 1) / BIT_TASK_BITS;
+	tasks.valueBits = context.valueBits;
+	tasks.valid.resize(tasks.bitTasks + 1);
+	TaskGroup bitGroup = { &verifyBitsTask, &tasks, tasks.bitTasks + 1 };
+
+	for (size_t item = pack->first; item < pack->last; item++) {
+
+		if (item < context.proofItems) {
+			verifyProofItem(context, state, item);
+			continue;
+		}
 
-			for (jj = 0; jj < args.valueBits; jj++){
-				*args.proof >> rawData[ii].lbc_cx[jj] >> rawData[ii].lbc_ylsb[jj];
-				*args.proof >> rawData[ii].lbp_gamma1_cx[jj] >> rawData[ii].lbp_gamma1_ylsb[jj];
-				*args.proof >> rawData[ii].lbp_gamma2_cx[jj] >> rawData[ii].lbp_gamma2_ylsb[jj];
-				*args.proof >> rawData[ii].lbp_c1[jj];
-				*args.proof >> rawData[ii].lbp_z1[jj];
-				*args.proof >> rawData[ii].lbp_z2[jj];
-				*args.proof >> rawData[ii].lbp_z3[jj];
-				*args.proof >> rawData[ii].lbp_z4[jj];
-			}
+		ProofChunk &c = (*context.chunks)[item - context.proofItems];
+		ProofRegion &region = reader.regions[c.region];
+		line = c.firstLine + (entryLines - c.firstLine % entryLines) % entryLines;
+		lastLine = c.firstLine + c.lineCount;
+		if (region.firstEntry + line / entryLines < context.rangeFirst) {
+			line = max(line, (context.rangeFirst - region.firstEntry) * entryLines);
 		}
+		if (line >= lastLine) continue;
+		cursor = skipLines(c.begin, region.end, line - c.firstLine);
 
-		entryCount = *args.entryCount;
-		*args.entryCount += ii;
+		for (; line < lastLine; line += entryLines) {
 
-		pthread_mutex_unlock(&proof_lock);
+			// If we have seen all the known entries and are not interested in any others, terminate early.
+			if (context.includeOnly && context.knownCount.load() >= context.knownEntries->size()) break;
 
-		if (ii == 0) break;
+			entryCount = region.firstEntry + line / entryLines;
+			if (entryCount >= context.rangeLast) break;
 
-		// Now that the lock is released, we actually ingest the data and verify the ledger entry and ledger bit proofs, as
-		// well as the inclusion of any entries for which we know the openers.
+			if (!context.includeOnly || context.knownEntries->count(entryCount) > 0) {
 
-		get_mip()->IOBASE=DATA_BASE;
+				entryBegin = cursor;
+
+				if (context.shareBits) {
+					e = LedgerEntry(context.valueBits);
+					tasks.begin = entryBegin;
+					tasks.end = region.end;
+					context.pipeline->share(state->worker, state, bitGroup);
+					cursor = skipLines(entryBegin, region.end, entryLines);
+
+					if (tasks.valid[tasks.bitTasks]) state->validCount++;
+					if (count(tasks.valid.begin(), tasks.valid.end() - 1, 0) == 0) state->lbpValidCount++;
+				} else {
+					cursor = reader.readEntry(cursor, region.end, e, lepgen, lbpgen);
+
+					if (lepgen.verifyProof(e)) state->validCount++;
+					if (lbpgen.verifyProofs(e)) state->lbpValidCount++;
+				}
 
-		for (jj = 0; jj < ii; jj ++) {
-
-			if (!args.includeOnly || args.knownEntries->count(entryCount) > 0) {
-
-				e[jj] = LedgerEntry(args.valueBits);
-				cinstr(cx.getbig(), (char *) rawData[jj].lec_cx.c_str());
-				ylsb = stoi(rawData[jj].lec_ylsb);
-				e[jj].lec = ECn(cx, ylsb);
-				cinstr(cx.getbig(), (char *) rawData[jj].lep_gamma_cx.c_str());
-				ylsb = stoi(rawData[jj].lep_gamma_ylsb);
-				e[jj].lep.gamma = ECn(cx,ylsb);
-				lepgen.challengeProof(e[jj]);
-
-				cinstr(e[jj].lep.z1.getbig(), (char *) rawData[jj].lep_z1.c_str());
-				cinstr(e[jj].lep.z2.getbig(), (char *) rawData[jj].lep_z2.c_str());
-				cinstr(e[jj].lep.z3.getbig(), (char *) rawData[jj].lep_z3.c_str());
-
-
-				for (kk = 0; kk < args.valueBits; kk++){
-					cinstr(cx.getbig(), (char *) rawData[jj].lbc_cx[kk].c_str());
-					ylsb = stoi(rawData[jj].lbc_ylsb[kk]);
-					e[jj].lbc[kk] = ECn(cx, ylsb);
-					cinstr(cx.getbig(), (char *) rawData[jj].lbp_gamma1_cx[kk].c_str());
-					ylsb = stoi(rawData[jj].lbp_gamma1_ylsb[kk]);
-					e[jj].lbp[kk].gamma1 = ECn(cx,ylsb);
-					cinstr(cx.getbig(), (char *) rawData[jj].lbp_gamma2_cx[kk].c_str());
-					ylsb = stoi(rawData[jj].lbp_gamma2_ylsb[kk]);
-					e[jj].lbp[kk].gamma2 = ECn(cx,ylsb);
-					lbpgen.challengeProof(e[jj], kk);
-					cinstr(e[jj].lbp[kk].c1.getbig(), (char *) rawData[jj].lbp_c1[kk].c_str());
-					e[jj].lbp[kk].c2 = lxor(e[jj].lbp[kk].c, e[jj].lbp[kk].c1);
-					cinstr(e[jj].lbp[kk].z1.getbig(), (char *) rawData[jj].lbp_z1[kk].c_str());
-					cinstr(e[jj].lbp[kk].z2.getbig(), (char *) rawData[jj].lbp_z2[kk].c_str());
-					cinstr(e[jj].lbp[kk].z3.getbig(), (char *) rawData[jj].lbp_z3[kk].c_str());
-					cinstr(e[jj].lbp[kk].z4.getbig(), (char *) rawData[jj].lbp_z4[kk].c_str());
+				if (context.entryLeaves != NULL) {
+					hashEntryLeaf(entryCount, entryBegin, cursor - entryBegin, &(*context.entryLeaves)[(entryCount - context.rangeFirst) * TREE_HASH_DIGEST_BYTES]);
 				}
 
-				if (lepgen.verifyProof(e[jj])) (*args.validCount)++;
-				if (lbpgen.verifyProofs(e[jj])) (*args.lbpValidCount)++;
-				if (e[jj].verifyCommitmentEquivilancy()) (*args.equivalencyCount)++;
+				if (e.verifyCommitmentEquivilancy()) state->equivalencyCount++;
+
+			} else {
+
+				cursor = skipLines(cursor, region.end, entryLines);
+				continue;
+
 			}
 
-			if (args.knownEntries->count(entryCount) > 0) {
-				knownCount++;
-				e[jj].setId(args.knownEntries->at(entryCount).identifier);
-				e[jj].setBalance(args.knownEntries->at(entryCount).balance);
-				e[jj].setR(args.knownEntries->at(entryCount).r);
-				if (e[jj].verifyKnownValues(args.g, args.h, args.f)) (*args.correctCount)++;
+			if (context.knownEntries->count(entryCount) > 0) {
+				context.knownCount++;
+				e.setId(context.knownEntries->at(entryCount).identifier);
+				e.setBalance(context.knownEntries->at(entryCount).balance);
+				e.setR(context.knownEntries->at(entryCount).r);
+				if (e.verifyKnownValues(context.g, context.h, context.f)) state->correctCount++;
 			}
 
-			entryCount++;
+			if (!context.includeOnly) {
+				l.addEntry(e);
+			}
 
 		}
 
-		if (!args.includeOnly) {
+	}
+}
 
-			for (jj = 0; jj < ii; jj ++) {
-				args.l->addEntry(e[jj]);
-			}
+// Return the location of entry in region r according to index, or NULL if the index does not place it at the start of a
+// line within the entries of the region.
+static const char * indexedEntry(ProofIndex &index, ProofRegion &r, uint64_t entry) {
+	return r.mapped ? index.entryAt(entry, r.base, r.begin, r.end) : NULL;
+}
 
-		} else {
+// The seekPack function replaces calcPack when only the inclusion of known entries is to be verified and an index for the
+// proof is available. Rather than scanning a chunk of the proof, each pack is a batch of the known entries, and the index
+// is used to parse each of those entries directly from its location in the proof. Thus the work done is proportional to
+// the number of known entries, and independent of the length of the proof. The location of every entry to be sought has
+// already been checked against the proof.
+void seekPack(void* rawContext, void* rawWorker, void* rawPack) {
+	VerifyContext &context = *(static_cast<VerifyContext*>(rawContext));
+	VerifyWorker *state = static_cast<VerifyWorker*>(rawWorker);
+	VerifyPack *pack = static_cast<VerifyPack*>(rawPack);
+
+	ProofReader &reader = *context.reader;
+	LedgerEntry &e = state->e;
+	uint64_t entryCount;
+	int region;
 
-			pthread_mutex_lock(&ledger_lock);
+	for (size_t ii = pack->first; ii < pack->last; ii++) {
 
-			*args.knownCount += knownCount;
+		entryCount = (*context.seekEntries)[ii];
+		region = reader.findRegion(entryCount);
+		if (entryCount >= context.index->entryCount || region < 0 || !reader.regions[region].mapped) continue;
 
-			pthread_mutex_unlock(&ledger_lock);
+		ProofRegion &r = reader.regions[region];
+		reader.readEntry(indexedEntry(*context.index, r, entryCount), r.end, e, *state->lepgen, *state->lbpgen);
 
+		if (state->lepgen->verifyProof(e)) state->validCount++;
+		if (state->lbpgen->verifyProofs(e)) state->lbpValidCount++;
+		if (e.verifyCommitmentEquivilancy()) state->equivalencyCount++;
+
+		context.knownCount++;
+		e.setId(context.knownEntries->at(entryCount).identifier);
+		e.setBalance(context.knownEntries->at(entryCount).balance);
+		e.setR(context.knownEntries->at(entryCount).r);
+		if (e.verifyKnownValues(context.g, context.h, context.f)) state->correctCount++;
+
+	}
+}
+
+// The verifyInclusionProofs function checks the inclusion proofs written by zlopener -p (see zlopener.cpp) for one or more
+// accounts, given only the header of the proof, which holds the bases and the root of the entry tree. Each entry is parsed
+// and verified just as calcPack would, its opener is checked against it, and its leaf is followed along its
+// authentication path, which must arrive at the root. Thus a depositor can check their own entry while reading only a few
+// kilobytes, although the integrity of the proof as a whole must still be verified by someone.
+int verifyInclusionProofs(const char *paths_source, const char *proof_source, Big q, int bits) {
+	MappedFile headerFile, pathsFile;
+	ProofReader header;
+
+	if (!mapFile(proof_source, headerFile) || !header.readHeader(headerFile.data, headerFile.length)) {
+		cerr << "Error: proof header could not be read." << endl;
+		return 0;
+	}
+
+	if (header.entriesRoot.empty()) {
+		cerr << "Error: proof has no entry tree." << endl;
+		return 0;
+	}
+
+	if (!mapFile(paths_source, pathsFile)) {
+		cerr << "Error: inclusion proofs could not be read." << endl;
+		return 0;
+	}
+
+	LEPProcessor lepgen(q, header.g, header.h, header.f, bits);
+	LBPProcessor lbpgen(q, header.g, header.h, header.f, bits, header.valueBits);
+	LedgerEntry e;
+	KnownEntry k;
+	vector<TreePathStep> path;
+	char leaf[TREE_HASH_DIGEST_BYTES], root[TREE_HASH_DIGEST_BYTES];
+	uint64_t entryCount = 0, correctCount = 0, validCount = 0, lbpValidCount = 0, equivalencyCount = 0, pathCount = 0;
+	const char *p = pathsFile.data, *end = pathsFile.data + pathsFile.length, *eol, *entryBegin;
+	size_t entryLines = header.entryLines();
+	bool malformed = false;
+
+	while (!malformed && p < end) {
+
+		// The opener, in the same format as the entries export.
+		eol = skipLines(p, end, 1);
+		istringstream opener(string(p, eol - p));
+		get_mip()->IOBASE=10;
+		malformed = !(opener >> k.index >> k.identifier >> k.balance);
+		get_mip()->IOBASE=DATA_BASE;
+		malformed = malformed || !(opener >> k.r);
+		if (malformed) break;
+
+		// The entry itself, which is hashed exactly as it appears.
+		entryBegin = eol;
+		p = skipLines(entryBegin, end, entryLines);
+		if (countLines(entryBegin, p) != entryLines) {
+			malformed = true;
+			break;
 		}
 
-		if (ii != args.packSize) break;
+		header.readEntry(entryBegin, p, e, lepgen, lbpgen);
+		hashEntryLeaf(k.index, entryBegin, p - entryBegin, leaf);
+		entryCount++;
+
+		if (lepgen.verifyProof(e)) validCount++;
+		if (lbpgen.verifyProofs(e)) lbpValidCount++;
+		if (e.verifyCommitmentEquivilancy()) equivalencyCount++;
+
+		e.setId(k.identifier);
+		e.setBalance(k.balance);
+		e.setR(k.r);
+		if (e.verifyKnownValues(header.g, header.h, header.f)) correctCount++;
+
+		// The authentication path, one step per line.
+		uint64_t steps = strtoull(p, NULL, 10);
+		p = skipLines(p, end, 1);
+		path.resize(steps <= 64 ? steps : 0);
+		malformed = steps > 64;
+
+		for (uint64_t ii = 0; ii < path.size() && !malformed; ii++) {
+			eol = skipLines(p, end, 1);
+			size_t length = eol - p;
+			while (length > 0 && (p[length - 1] == '\n' || p[length - 1] == '\r')) length--;
+
+			path[ii].left = length > 0 && p[0] == 'L';
+			malformed = length < 2 || (p[0] != 'L' && p[0] != 'R') || !fromHex(p + 2, length - 2, TREE_HASH_DIGEST_BYTES, path[ii].sibling);
+			p = eol;
+		}
+
+		hashTreePath(leaf, path, root);
+		if (!malformed && toHex(root, sizeof(root)) == header.entriesRoot) pathCount++;
+
+	}
 
+	unmapFile(pathsFile);
+	unmapFile(headerFile);
+
+	if (malformed || entryCount == 0) {
+		cerr << "Error: inclusion proofs are malformed." << endl;
+		return 0;
 	}
 
-	pthread_exit(NULL);
+	cout << "ZEROLEDGE PROOF VERIFIER" << endl;
+
+	cout << endl;
+
+	get_mip()->IOBASE=10;
+
+	cout << "Inclusion Proofs: " << entryCount << endl;
+	cout << "Maximum Liability: " << header.assets << endl;
+	cout << "Proof Time: " << ctime(&header.proofTime);
+	cout << "Entry Root: " << header.entriesRoot << endl;
+	cout << "Validating..." << endl;
+
+	cout << endl;
+
+	printf("%-40s%s\n", "Ledger Entry Proofs", (validCount == entryCount ? TAG_VALID : TAG_INVALID));
+	printf("%-40s%s\n", "Ledger Bit Proofs", (lbpValidCount == entryCount ? TAG_VALID : TAG_INVALID));
+	printf("%-40s%s\n", "Ledger Commitment Equivalency", (equivalencyCount == entryCount ? TAG_VALID : TAG_INVALID));
+	printf("%-40s%s\n", "Known Ledger Entries", (correctCount == entryCount ? TAG_VALID : TAG_INVALID));
+	printf("%-40s%s\n", "Entry Inclusion Paths", (pathCount == entryCount ? TAG_VALID : TAG_INVALID));
+
 	return 0;
 }
 
+bool resultPrecedes(const PartialResult &a, const PartialResult &b) {
+	return a.first < b.first;
+}
+
 
 int main(int argc, char **argv) {
 
 	// Set up some variables to hold our options, with default values
 	bool includeOnly = false;
+	bool merge = false;
+	bool ranged = false;
+	uint64_t rangeFirst = 0, rangeLast = UINT64_MAX;
+	int shard = -1;
 	char* proof_source = NULL;
+	char* result_output = NULL;
+	vector<const char *> result_sources;
 	char* entries_source = NULL;
+	char* index_source = NULL;
+	char* expected_digest = NULL;
+	char* paths_source = NULL;
 	char* bases_source = BASES_SOURCE_DEFAULT;
 	char* curve_source = CURVE_SOURCE_DEFAULT;
 
 	int threadcount = 0;
+	double budget = 0;
 
 	// Now read options
 	int c;
-	while ( (c = getopt(argc, argv, "ht:b:c:k:i")) != -1) {
+	char *separator;
+	uint64_t rangeLength;
+	while ( (c = getopt(argc, argv, "ht:B:b:c:k:x:d:a:r:s:w:Mi")) != -1) {
 		switch (c) {
 			case 'h':
 				cerr << HELP_TEXT;
@@ -308,6 +647,9 @@ int main(int argc, char **argv) {
 			case 't':
 				threadcount = atoi(optarg);
 				break;
+			case 'B':
+				budget = atof(optarg);
+				break;
 			case 'b':
 				bases_source = optarg;
 				break;
@@ -317,6 +659,36 @@ int main(int argc, char **argv) {
 			case 'k':
 				entries_source = optarg;
 				break;
+			case 'x':
+				index_source = optarg;
+				break;
+			case 'd':
+				expected_digest = optarg;
+				break;
+			case 'a':
+				paths_source = optarg;
+				break;
+			case 'r':
+				// Both fields must be wholly numeric, and the range must be neither empty nor beyond the last possible entry.
+				separator = strchr(optarg, ':');
+				if (separator == NULL || !parseDecimal(optarg, separator - optarg, rangeFirst)
+					|| !parseDecimal(separator + 1, strlen(separator + 1), rangeLength) || rangeLength == 0
+					|| rangeLength > UINT64_MAX - rangeFirst) {
+					cerr << "Error: entry range must be given as FIRST:COUNT." << endl;
+					return 0;
+				}
+				rangeLast = rangeFirst + rangeLength;
+				ranged = true;
+				break;
+			case 's':
+				shard = atoi(optarg);
+				break;
+			case 'w':
+				result_output = optarg;
+				break;
+			case 'M':
+				merge = true;
+				break;
 			case 'i':
 				includeOnly = true;
 				break;
@@ -331,6 +703,36 @@ int main(int argc, char **argv) {
 		proof_source = argv[optind];
 	}
 
+	// Under a budget (-B), every pipeline is limited to it, so that verification can share the machine with other services.
+	Pipeline::setBudget(budget);
+
+	// A range of the entries (or a single shard) may be verified on its own, and its partial result written; the results
+	// for a set of ranges which together cover the proof are then merged to complete its verification.
+
+	bool partial = ranged || shard >= 0 || result_output != NULL;
+
+	if (merge) {
+		for (int ii = optind + 1; ii < argc; ii++) result_sources.push_back(argv[ii]);
+		if (proof_source == NULL || result_sources.empty()) {
+			cerr << "Error: a proof and at least one partial result are required to merge." << endl;
+			return 0;
+		}
+		if (partial || includeOnly || entries_source != NULL) {
+			cerr << "Error: partial results cannot be merged while verifying entries." << endl;
+			return 0;
+		}
+	}
+
+	if (partial && (includeOnly || paths_source != NULL)) {
+		cerr << "Error: inclusion cannot be verified over a range of entries." << endl;
+		return 0;
+	}
+
+	if (ranged && shard >= 0) {
+		cerr << "Error: either a range of entries or a shard may be verified, but not both." << endl;
+		return 0;
+	}
+
 
 	// MIRACL initialization
 	mr_init_threading();
@@ -359,10 +761,10 @@ int main(int argc, char **argv) {
 
 
 	// Read in the known entries, if any are available
-	int ii, jj, index;
+	uint64_t index;
 	Big balance, r;
 	string identifier;
-	unordered_map<int, KnownEntry> knownEntries;
+	unordered_map<uint64_t, KnownEntry> knownEntries;
 
 	if (entries_source != NULL) {
 		ifstream known(entries_source);
@@ -373,156 +775,299 @@ int main(int argc, char **argv) {
 				k.identifier = identifier;
 				k.balance = balance;
 				k.r = r;
-				knownEntries.insert(pair<int, KnownEntry>(index, k));
+				knownEntries.insert(pair<uint64_t, KnownEntry>(index, k));
 			}
 			known.close();
 		}
 	}
 
 
-	// Now begin reading the proof
-	ifstream proofHandle;
-	if (proof_source != NULL) {
-		proofHandle.open(proof_source);
-		if (proofHandle.fail()) {
-			cerr << "Error: proof could not be read." << endl;
-			return 0;
-		}
+	// Inclusion proofs are checked against the proof header alone, without reading anything else.
+	if (paths_source != NULL) {
+		return verifyInclusionProofs(paths_source, proof_source, q, bits);
 	}
 
-	istream& proof = (proofHandle.is_open() ? proofHandle : cin);
 
-	string discard;
-	unsigned valueBits;
-	Big assets;
-	time_t proofTime;
+	// Now map the proof and read its header. The entries themselves are parsed in place by the calcLoop threads.
+	MappedFile proofFile;
+	if (!mapFile(proof_source, proofFile)) {
+		cerr << "Error: proof could not be read." << endl;
+		return 0;
+	}
 
-	proof >> discard >> discard >> discard;	// BEGIN ZEROLEDGE PROOF
-	proof >> discard;	// ====================
+	ProofReader proof;
+	if (!proof.open(proofFile.data, proofFile.length, proof_source, false)) {
+		cerr << "Error: proof is malformed." << endl;
+		return 0;
+	}
 
-	proof >> discard;	// ASSETS
-	get_mip()->IOBASE=10;
-	proof >> assets;
-	get_mip()->IOBASE=DATA_BASE;
-	proof >> discard;	// TIME
-	proof >> proofTime;
-	proof >> discard;	// BITS
-	proof >> valueBits;
-
-	Big cx;
-	int ylsb;
-	ECn g,h,f;
-
-	proof >> discard;	// ====================
-	if (proof.peek() == '\n') proof.ignore (1, '\n');
-
-	proof >> cx >> ylsb;
-	if (proof.peek() == '\n') proof.ignore (1, '\n');
-	g = ECn(cx, ylsb);
-	proof >> cx >> ylsb;
-	if (proof.peek() == '\n') proof.ignore (1, '\n');
-	h = ECn(cx, ylsb);
-	proof >> cx >> ylsb;
-	if (proof.peek() == '\n') proof.ignore (1, '\n');
-	f = ECn(cx, ylsb);
-
-	DBPProcessor dbpgen(q, g, h, f, bits, valueBits);
+	// Only the shards which hold entries in the range being verified are read. When merging, no entries are verified at
+	// all, so only the manifest of a sharded proof is read.
+
+	if (shard >= 0) {
+		if (!proof.manifest || shard >= (int) proof.regions.size()) {
+			cerr << "Error: proof has no such shard." << endl;
+			return 0;
+		}
+		rangeFirst = proof.regions[shard].firstEntry;
+		rangeLast = rangeFirst + proof.regions[shard].entryCount;
+	}
+	if (merge) rangeLast = 0;
+
+	if (!proof.mapRegions(rangeFirst, rangeLast)) {
+		cerr << "Error: proof is malformed." << endl;
+		return 0;
+	}
+
+	int valueBits = proof.valueBits;
+	Big assets = proof.assets;
+	time_t proofTime = proof.proofTime;
+	ECn g = proof.g, h = proof.h, f = proof.f;
 
 	Ledger l(g, h, f, valueBits);
 	l.totalAssets = assets;
 
-	int entryCount = 0, correctCount = 0, validCount = 0, lbpValidCount = 0, equivalencyCount = 0,
-		knownCount = 0;
+	uint64_t entryCount = 0, correctCount = 0, validCount = 0, lbpValidCount = 0, equivalencyCount = 0;
 
-	// Fork the maximum allowed threads to perform the proof ingest and verification of the individual entries.
+	// If an index is available, make sure that it actually describes this proof. The entry offsets in the index of a
+	// sharded proof are relative to the shards which contain them, so its entry section begins at offset zero. The index
+	// only saves seeking: unless only inclusion is being verified, the lines of the proof are still counted, and every
+	// offset used is checked against them below.
 
-	int maxThreads = (threadcount > 0) ? threadcount : sysconf( _SC_NPROCESSORS_ONLN );
+	ProofIndex proofIndex;
+	if (index_source != NULL) {
+		if (!proofIndex.open(index_source)) {
+			cerr << "Error: index could not be read." << endl;
+			return 0;
+		}
+		uint64_t entriesOffset = proof.manifest ? 0 : (uint64_t) (proof.entriesBegin - proof.data), manifestCount = 0;
+		for (size_t ii = 0; proof.manifest && ii < proof.regions.size(); ii++) {
+			manifestCount += proof.regions[ii].entryCount;
+		}
+		if (proofIndex.valueBits != valueBits || proofIndex.entriesOffset != entriesOffset
+			|| proofIndex.differenceOffset != (uint64_t) (proof.differenceBegin - proof.data)
+			|| (proof.manifest && proofIndex.entryCount != manifestCount)) {
+			cerr << "Error: index does not match proof." << endl;
+			return 0;
+		}
+		if (!proof.manifest) proof.regions[0].entryCount = proofIndex.entryCount;
+	}
 
-	pthread_t thread[maxThreads];
-	calcLoopArgs args[maxThreads];
-	vector<Ledger> partialLedgers(maxThreads, Ledger(g, h, f, valueBits));
-	vector<int> correctCounts(maxThreads, 0);
-	vector<int> validCounts(maxThreads, 0);
-	vector<int> lbpValidCounts(maxThreads, 0);
-	vector<int> equivalencyCounts(maxThreads, 0);
+	int maxThreads = (threadcount > 0) ? threadcount : availableProcessors(budget);
 
-	pthread_mutex_init(&ledger_lock, NULL);
-	pthread_mutex_init(&proof_lock, NULL);
+	size_t entryLines = proof.entryLines();
+	size_t span = 0;
 
-	for (int ii = 0; ii < maxThreads; ii++) {
-		args[ii].a = a;
-		args[ii].b = b;
-		args[ii].p = p;
-		args[ii].q = q;
-		args[ii].g = g;
-		args[ii].h = h;
-		args[ii].f = f;
-		args[ii].bits = bits;
-		args[ii].packSize = ENTRIES_PER_PACK_DEFAULT;
-		args[ii].valueBits = valueBits;
-		args[ii].includeOnly = includeOnly;
-		args[ii].proofTime = proofTime;
-		args[ii].entryCount = &entryCount;
-		args[ii].l = &partialLedgers[ii];
-		args[ii].knownEntries = &knownEntries;
-		args[ii].knownCount = &knownCount;
-		args[ii].proof = &proof;
-		args[ii].correctCount = &correctCounts[ii];
-		args[ii].validCount = &validCounts[ii];
-		args[ii].lbpValidCount = &lbpValidCounts[ii];
-		args[ii].equivalencyCount = &equivalencyCounts[ii];
-		pthread_create(&(thread[ii]), NULL, &calcLoop, static_cast<void*>(&(args[ii])));
-	}
-	
-	Ledger finalLedger(g, h, f, valueBits);
-	finalLedger.totalAssets = assets;
+	// Divide the entry sections of the proof into several chunks per thread, so that the threads remain evenly loaded even
+	// when they do not proceed at the same rate. Chunks never span regions, and every region which has been read receives
+	// at least one chunk, with the rest allotted to the regions in proportion to their length.
 
-	// Collect the results from our threads, which have completed their job.
+	vector<ProofChunk> chunks;
+	int chunkTarget = maxThreads * 4;
 
-	for (int ii = 0; ii < maxThreads; ii++) {
-		pthread_join(thread[ii], NULL);
-		l.appendLedger(*args[ii].l);
-		correctCount += *args[ii].correctCount;
-		validCount += *args[ii].validCount;
-		lbpValidCount += *args[ii].lbpValidCount;
-		equivalencyCount += *args[ii].equivalencyCount;
+	for (size_t ii = 0; ii < proof.regions.size(); ii++) {
+		span += proof.regions[ii].end - proof.regions[ii].begin;
 	}
 
-	pthread_mutex_destroy(&ledger_lock);
-	pthread_mutex_destroy(&proof_lock);
+	for (size_t ii = 0; ii < proof.regions.size(); ii++) {
+		ProofRegion &region = proof.regions[ii];
+		if (!region.mapped) continue;
+		size_t regionSpan = region.end - region.begin;
+		size_t regionChunks = (span > 0) ? (regionSpan * chunkTarget + span - 1) / span : 1;
+		if (regionChunks < 1) regionChunks = 1;
+
+		for (size_t jj = 0; jj < regionChunks; jj++) {
+			ProofChunk chunk;
+			chunk.region = ii;
+			chunk.firstLine = 0;
+			chunk.lineCount = 0;
+
+			if (proofIndex.isOpen()) {
+
+				// With an index, chunks can begin on entry boundaries without reading the proof at all. The offsets must
+				// lie at the start of lines within the region, in order, beginning with the first line of the region.
+
+				uint64_t first = region.firstEntry + region.entryCount * jj / regionChunks;
+				uint64_t last = region.firstEntry + region.entryCount * (jj + 1) / regionChunks;
+				chunk.begin = (first < region.firstEntry + region.entryCount) ? indexedEntry(proofIndex, region, first) : region.end;
+				chunk.end = (last < region.firstEntry + region.entryCount) ? indexedEntry(proofIndex, region, last) : region.end;
+				if (chunk.begin == NULL || chunk.end == NULL || chunk.end < chunk.begin || (first < last && chunk.end == chunk.begin)
+					|| (jj == 0 && chunk.begin != region.begin)) {
+					cerr << "Error: index does not match proof." << endl;
+					return 0;
+				}
+				chunk.firstLine = (first - region.firstEntry) * entryLines;
+				chunk.lineCount = (last - first) * entryLines;
+
+			} else {
 
-	// Now perform our final verification procedures for per-proof elements such as bases and difference bit proofs.
+				chunk.begin = alignToLine(region.begin, region.begin + regionSpan * jj / regionChunks, region.end);
+				chunk.end = alignToLine(region.begin, region.begin + regionSpan * (jj + 1) / regionChunks, region.end);
 
-	ECn gv,hv,fv;
-	Big gseed, hseed, fseed;
+			}
 
+			chunks.push_back(chunk);
+		}
+	}
+
+	// Count the lines in each chunk in parallel, so that each thread can determine which entries begin within the chunks it
+	// parses. The leaves of the proof, and of the shards of a sharded proof, are hashed at the same time, unless only
+	// inclusion is being verified. With an index, the lines need only be counted when the whole proof is being verified,
+	// and each chunk must then hold exactly as many entries as the index places in it, so that an index which passes over
+	// some of the entries cannot hide them from the verifier.
+
+	vector<DigestJob> digestJobs;
+	vector<DigestBatch> digestBatches;
 	if (!includeOnly) {
+		digestJobs.resize(1);
+		digestJobs[0].region = -1;
+		digestJobs[0].data = proofFile.data;
+		digestJobs[0].length = proofFile.length;
+		for (size_t ii = 0; proof.manifest && ii < proof.regions.size(); ii++) {
+			if (!proof.regions[ii].mapped) continue;
+			DigestJob job;
+			job.region = ii;
+			job.data = proof.regions[ii].begin;
+			job.length = proof.regions[ii].end - proof.regions[ii].begin;
+			digestJobs.push_back(job);
+		}
 
-		l.generateCommitments();
+		for (size_t ii = 0; ii < digestJobs.size(); ii++) {
+			uint64_t leafCount = treeLeafCount(digestJobs[ii].length);
+			digestJobs[ii].leaves.resize(leafCount * TREE_HASH_DIGEST_BYTES);
+			for (uint64_t leaf = 0; leaf < leafCount; leaf += VERIFY_DIGEST_BATCH) {
+				DigestBatch batch;
+				batch.job = ii;
+				batch.first = leaf;
+				batch.last = min(leafCount, leaf + VERIFY_DIGEST_BATCH);
+				digestBatches.push_back(batch);
+			}
+		}
+	}
 
-		proof >> discard;	// ====================
-		if (proof.peek() == '\n') proof.ignore (1, '\n');
-
-		for (ii = 0; ii < valueBits; ii ++) {
-			proof >> cx >> ylsb;
-			if (proof.peek() == '\n') proof.ignore (1, '\n');
-			l.dbc[ii] = ECn(cx, ylsb);
-			proof >> cx >> ylsb;
-			if (proof.peek() == '\n') proof.ignore (1, '\n');
-			l.dbp[ii].gamma1 = ECn(cx,ylsb);
-			proof >> cx >> ylsb;
-			if (proof.peek() == '\n') proof.ignore (1, '\n');
-			l.dbp[ii].gamma2 = ECn(cx,ylsb);
-			dbpgen.challengeProof(l, ii);
-			proof >> l.dbp[ii].c1;
-			l.dbp[ii].c2 = lxor(l.dbp[ii].c, l.dbp[ii].c1);
-			proof >> l.dbp[ii].z1;
-			proof >> l.dbp[ii].z2;
-			proof >> l.dbp[ii].z3;
-			proof >> l.dbp[ii].z4;
+	VerifyContext context;
+	context.a = a;
+	context.b = b;
+	context.p = p;
+	context.q = q;
+	context.g = g;
+	context.h = h;
+	context.f = f;
+	context.bits = bits;
+	context.valueBits = valueBits;
+	context.includeOnly = includeOnly;
+	context.proofTime = proofTime;
+	context.rangeFirst = rangeFirst;
+	context.rangeLast = rangeLast;
+	context.chunks = &chunks;
+	context.digestJobs = &digestJobs;
+	context.digestBatches = &digestBatches;
+	context.reader = &proof;
+	context.index = &proofIndex;
+	context.knownEntries = &knownEntries;
+	context.knownCount = 0;
+	context.entryLeaves = NULL;
+	context.pipeline = NULL;
+	context.shareBits = false;
+	context.proofItems = 0;
+	context.ledger = &l;
+
+	PipelineStages stages;
+	stages.context = static_cast<void*>(&context);
+	stages.newPack = &newPack;
+	stages.deletePack = &deletePack;
+	stages.read = &readPack;
+	stages.write = NULL;
+	stages.flush = NULL;
+
+	if (!proofIndex.isOpen() || !includeOnly) {
+
+		context.nextItem = 0;
+		context.itemCount = chunks.size() + digestBatches.size();
+		context.batchSize = 1;
+
+		stages.beginWorker = NULL;
+		stages.work = &countPack;
+		stages.endWorker = NULL;
+
+		vector<uint64_t> indexedLines;
+		for (size_t ii = 0; proofIndex.isOpen() && ii < chunks.size(); ii++) {
+			indexedLines.push_back(chunks[ii].lineCount);
 		}
 
-		// Verify up commitment bases as specified in Sections VII-A and IX-A of the paper
+		Pipeline countPipeline(stages, maxThreads, 2 * maxThreads + 1);
+		countPipeline.run();
+
+		for (size_t ii = 0, regionLines = 0; ii < chunks.size(); ii++) {
+			if (proofIndex.isOpen() && chunks[ii].lineCount != indexedLines[ii]) {
+				cerr << "Error: index does not match proof." << endl;
+				return 0;
+			}
+			if (ii > 0 && chunks[ii].region != chunks[ii - 1].region) regionLines = 0;
+			chunks[ii].firstLine = regionLines;
+			regionLines += chunks[ii].lineCount;
+		}
+
+	}
+
+	// Combine the leaves of each digest. The shards of a sharded proof must match the digests listed in the manifest.
+
+	string proofDigest;
+	bool digestsValidated = true;
+	vector<bool> shardsValidated(proof.manifest ? proof.regions.size() : 0, false);
+	char digest[TREE_HASH_DIGEST_BYTES];
+
+	for (size_t ii = 0; ii < digestJobs.size(); ii++) {
+		hashTreeRoot(&digestJobs[ii].leaves[0], treeLeafCount(digestJobs[ii].length), digest);
+		if (digestJobs[ii].region < 0) {
+			proofDigest = toHex(digest, sizeof(digest));
+		} else if (toHex(digest, sizeof(digest)) == proof.regions[digestJobs[ii].region].digest) {
+			shardsValidated[digestJobs[ii].region] = true;
+		} else {
+			digestsValidated = false;
+		}
+	}
+
+	// Every region which has been read must hold a whole number of entries, and the shards of a sharded proof must hold the
+	// number of entries listed in the manifest.
+
+	for (size_t ii = 0; ii < chunks.size(); ii++) {
+		if (ii + 1 < chunks.size() && chunks[ii + 1].region == chunks[ii].region) continue;
+		ProofRegion &region = proof.regions[chunks[ii].region];
+		uint64_t regionLines = chunks[ii].firstLine + chunks[ii].lineCount;
+
+		if (regionLines % entryLines != 0 || (proof.manifest && regionLines != region.entryCount * entryLines)) {
+			cerr << "Error: proof is malformed." << endl;
+			return 0;
+		}
+
+		if (!proof.manifest) region.entryCount = regionLines / entryLines;
+	}
+
+	for (size_t ii = 0; ii < proof.regions.size(); ii++) {
+		entryCount += proof.regions[ii].entryCount;
+	}
+
+	if (rangeFirst > entryCount || (ranged && rangeLast > entryCount)) {
+		cerr << "Error: entry range lies outside the proof." << endl;
+		return 0;
+	}
+
+	uint64_t rangeEnd = min(rangeLast, entryCount);
+	uint64_t rangeCount = rangeEnd - rangeFirst;
+
+	// Only the known entries in the range are expected to be found, along with any beyond the end of the proof if the range
+	// reaches it, since those can never be found.
+
+	uint64_t knownExpected = 0;
+	for (unordered_map<uint64_t, KnownEntry>::iterator it = knownEntries.begin(); it != knownEntries.end(); it++) {
+		if (it->first >= rangeFirst && (it->first < rangeEnd || rangeEnd == entryCount)) knownExpected++;
+	}
+
+	// Unless only a range or only inclusion is being verified, the bases and the difference bits are checked along with the
+	// entries. Only the seeds are read here; the bases are derived from them by a worker.
+
+	if (!includeOnly && !partial) {
 		ifstream seedsource(bases_source);
 		if (seedsource.fail()) {
 			cerr << "Error: bases source could not be read." << endl;;
@@ -530,74 +1075,240 @@ int main(int argc, char **argv) {
 		}
 
 		get_mip()->IOBASE=10;
-		seedsource >> gseed >> hseed >> fseed;
+		seedsource >> context.gseed >> context.hseed >> context.fseed;
 		seedsource.close();
-		
-		while (! gv.set(gseed, 0)) {
-			gseed += 1;
+		get_mip()->IOBASE=DATA_BASE;
+
+		context.proofItems = 1 + valueBits;
+		context.differenceValidCounts.resize(maxThreads, 0);
+		context.differenceProducts.resize(maxThreads);
+	}
+
+	// Start a pipeline with the maximum allowed workers to perform the proof ingest and verification of the individual
+	// entries, one chunk at a time, preceded by the checks of the proof as a whole. When only inclusion is being verified
+	// and an index is available, the known entries are instead handed out in batches.
+
+	bool seek = includeOnly && proofIndex.isOpen();
+	bool rooted = !includeOnly && !proof.entriesRoot.empty();
+	vector<Ledger> partialLedgers(maxThreads, Ledger(g, h, f, valueBits));
+	vector<uint64_t> seekEntries;
+	vector<char> entryLeaves(rooted ? (merge ? entryCount : rangeCount) * TREE_HASH_DIGEST_BYTES : 0);
+
+	if (seek) {
+		for (unordered_map<uint64_t, KnownEntry>::iterator it = knownEntries.begin(); it != knownEntries.end(); it++) {
+			int region = proof.findRegion(it->first);
+			if (it->first < proofIndex.entryCount && region >= 0 && proof.regions[region].mapped
+				&& indexedEntry(proofIndex, proof.regions[region], it->first) == NULL) {
+				cerr << "Error: index does not match proof." << endl;
+				return 0;
+			}
+			seekEntries.push_back(it->first);
 		}
-		while (! hv.set(hseed, 0)) {
-			hseed += 1;
+	}
+
+	context.nextItem = 0;
+	context.itemCount = seek ? seekEntries.size() : context.proofItems + chunks.size();
+	context.batchSize = seek ? VERIFY_SEEK_BATCH : 1;
+	context.shareBits = maxThreads > 1 && rangeCount < (uint64_t) chunkTarget;
+	context.seekEntries = &seekEntries;
+	context.entryLeaves = rooted ? &entryLeaves : NULL;
+	context.partialLedgers = &partialLedgers;
+	context.correctCounts.resize(maxThreads, 0);
+	context.validCounts.resize(maxThreads, 0);
+	context.lbpValidCounts.resize(maxThreads, 0);
+	context.equivalencyCounts.resize(maxThreads, 0);
+
+	stages.beginWorker = &beginWorker;
+	stages.work = seek ? &seekPack : &calcPack;
+	stages.endWorker = &endWorker;
+
+	Pipeline calcPipeline(stages, maxThreads, 2 * maxThreads + 1);
+	context.pipeline = &calcPipeline;
+	calcPipeline.run();
+
+	// Collect the results from our workers, which have completed their job.
+
+	uint64_t differenceValidCount = 0;
+	ECn differenceBitProduct;
+
+	for (int ii = 0; ii < maxThreads; ii++) {
+		l.appendLedger(partialLedgers[ii]);
+		correctCount += context.correctCounts[ii];
+		validCount += context.validCounts[ii];
+		lbpValidCount += context.lbpValidCounts[ii];
+		equivalencyCount += context.equivalencyCounts[ii];
+		if (context.proofItems > 0) {
+			differenceValidCount += context.differenceValidCounts[ii];
+			differenceBitProduct += context.differenceProducts[ii];
 		}
-		while (! fv.set(fseed, 0)) {
-			fseed += 1;
+	}
+
+	// Merge the partial results, each of which must have been written for this proof, and which together must cover every
+	// entry exactly once. The total commitment is the sum of those of the ranges, and the leaves of each range are placed at
+	// their own positions, so that the remaining checks proceed exactly as though every entry had been verified here.
+
+	bool resultsValidated = true;
+	if (merge) {
+		vector<PartialResult> results(result_sources.size());
+		for (size_t ii = 0; ii < results.size(); ii++) {
+			if (!results[ii].read(result_sources[ii])) {
+				cerr << "Error: partial result " << result_sources[ii] << " could not be read." << endl;
+				return 0;
+			}
 		}
+		sort(results.begin(), results.end(), resultPrecedes);
+
+		uint64_t nextEntry = 0;
+		for (size_t ii = 0; ii < results.size(); ii++) {
+			PartialResult &result = results[ii];
+			bool matches = result.proofDigest == proofDigest && result.entryCount == entryCount && result.first == nextEntry
+				&& result.count <= entryCount - nextEntry && (!rooted || result.leaves.size() == result.count * TREE_HASH_DIGEST_BYTES);
+			resultsValidated = resultsValidated && matches;
+			if (!matches) continue;
+
+			nextEntry += result.count;
+			validCount += result.validCount;
+			lbpValidCount += result.lbpValidCount;
+			equivalencyCount += result.equivalencyCount;
+			knownExpected += result.knownCount;
+			correctCount += result.correctCount;
+			l.totalCommitment += result.totalCommitment;
+			for (size_t jj = 0; jj < result.validShards.size(); jj++) {
+				if (result.validShards[jj] < shardsValidated.size()) shardsValidated[result.validShards[jj]] = true;
+			}
+			if (rooted && result.count > 0) {
+				copy(result.leaves.begin(), result.leaves.end(), entryLeaves.begin() + result.first * TREE_HASH_DIGEST_BYTES);
+			}
+		}
+		resultsValidated = resultsValidated && nextEntry == entryCount;
+	}
+
+	// Unless only a range is being verified, every shard must have matched its digest, whether here or in a partial result.
+
+	if (!partial) {
+		digestsValidated = digestsValidated && find(shardsValidated.begin(), shardsValidated.end(), false) == shardsValidated.end();
+	}
+
+	// The root of the entry tree must match the one given in the header.
+
+	bool entriesRootValidated = true;
+	if (rooted && !partial) {
+		hashTreeRoot(entryLeaves.empty() ? NULL : &entryLeaves[0], entryCount, digest);
+		entriesRootValidated = toHex(digest, sizeof(digest)) == proof.entriesRoot;
+	}
+
+	// The bases and the difference bits have already been checked by the workers, so all that remains is to compare the
+	// weighted sum of the difference bit commitments with the difference between the assets and the total commitment.
 
+	if (!includeOnly && !partial) {
+		l.generateCommitments();
 	}
 
+	if (result_output != NULL) {
+		PartialResult result;
+		result.proofDigest = proofDigest;
+		result.first = rangeFirst;
+		result.count = rangeCount;
+		result.entryCount = entryCount;
+		result.validCount = validCount;
+		result.lbpValidCount = lbpValidCount;
+		result.equivalencyCount = equivalencyCount;
+		result.knownCount = knownExpected;
+		result.correctCount = correctCount;
+		for (size_t ii = 0; ii < shardsValidated.size(); ii++) {
+			if (shardsValidated[ii]) result.validShards.push_back(ii);
+		}
+		result.totalCommitment = l.totalCommitment;
+		result.leaves.swap(entryLeaves);
+
+		if (!result.write(result_output)) {
+			cerr << "Error: partial result could not be written." << endl;
+			return 0;
+		}
+	}
+
+	unmapFile(proofFile);
+
 	cout << "ZEROLEDGE PROOF VERIFIER" << endl;
 
 	cout << endl;
 
+	get_mip()->IOBASE=10;
+
 	cout << "Ledger Entries: " << entryCount << endl;
+	if (partial) cout << "First Entry: " << rangeFirst << endl;
+	if (partial) cout << "Range Entries: " << rangeCount << endl;
+	if (merge) cout << "Partial Results: " << result_sources.size() << endl;
 	cout << "Maximum Liability: " << assets << endl;
 	cout << "Proof Time: " << ctime(&proofTime);
+	if (!includeOnly) cout << "Proof Digest: " << proofDigest << endl;
 	cout << "Validating..." << endl;
 	
 	cout << endl;
 
 	bool basesValidated;
 
-	if (!includeOnly) {
+	if (!includeOnly && !partial) {
 
 		// Check Bases
-		printf("%-40s%s", "Bases", TAG_WORKING);
-		fflush(stdout);
-		basesValidated = gv == g && hv == h && fv == f;
-		cout << TAG_ERASE << (basesValidated ? TAG_VALID : TAG_INVALID) << endl;
+		basesValidated = context.gv == g && context.hv == h && context.fv == f;
+		printf("%-40s%s\n", "Bases", (basesValidated ? TAG_VALID : TAG_INVALID));
 
 	}
 
-	if (knownEntries.size() > 0) printf("%-40s%s\n", "Known Ledger Entries", (correctCount == knownEntries.size() ? TAG_VALID : TAG_INVALID));
+	if (knownExpected > 0) printf("%-40s%s\n", "Known Ledger Entries", (correctCount == knownExpected ? TAG_VALID : TAG_INVALID));
 
 	if (includeOnly) return 0;
 
+	// Check Digests
+	bool proofDigestValidated = expected_digest == NULL || proofDigest == expected_digest;
+	if (expected_digest != NULL) printf("%-40s%s\n", "Proof Digest", (proofDigestValidated ? TAG_VALID : TAG_INVALID));
+	if (proof.manifest) printf("%-40s%s\n", "Shard Digests", (digestsValidated ? TAG_VALID : TAG_INVALID));
+	if (merge) printf("%-40s%s\n", "Partial Results", (resultsValidated ? TAG_VALID : TAG_INVALID));
+	if (rooted && !partial) printf("%-40s%s\n", "Entry Tree", (entriesRootValidated ? TAG_VALID : TAG_INVALID));
+
 	// Check Ledger Entry Proofs
-	printf("%-40s%s\n", "Ledger Entry Proofs", (validCount == entryCount ? TAG_VALID : TAG_INVALID));
+	uint64_t checkedCount = partial ? rangeCount : entryCount;
+	printf("%-40s%s\n", "Ledger Entry Proofs", (validCount == checkedCount ? TAG_VALID : TAG_INVALID));
 
 	// Check Ledger Bit Proofs
-	printf("%-40s%s\n", "Ledger Bit Proofs", (lbpValidCount == entryCount ? TAG_VALID : TAG_INVALID));
+	printf("%-40s%s\n", "Ledger Bit Proofs", (lbpValidCount == checkedCount ? TAG_VALID : TAG_INVALID));
 
 	// Check Ledger Entry Equivalency
-	printf("%-40s%s\n", "Ledger Commitment Equivalency", (equivalencyCount == entryCount ? TAG_VALID : TAG_INVALID));
+	printf("%-40s%s\n", "Ledger Commitment Equivalency", (equivalencyCount == checkedCount ? TAG_VALID : TAG_INVALID));
 
-	// Check Ledger Entry Proofs
-	printf("%-40s%s", "Difference Bit Proofs", TAG_WORKING);
-	fflush(stdout);
-	bool differenceBitsValidated = dbpgen.verifyProofs(l);
-	cout << TAG_ERASE << (differenceBitsValidated ? TAG_VALID : TAG_INVALID) << endl;
+	// The difference bit proofs and the total commitment equivalency can only be checked once every entry has been verified,
+	// by merging the partial results.
+	if (partial) {
+		bool rangeOK = (validCount == rangeCount)
+					&& (correctCount == knownExpected)
+					&& (lbpValidCount == rangeCount)
+					&& (equivalencyCount == rangeCount)
+					&& digestsValidated
+					&& proofDigestValidated;
+
+		printf("%-40s%s\n", "ZeroLedge Proof Range", (rangeOK ? TAG_VALID : TAG_INVALID));
+
+		return 0;
+	}
+
+	// Check Difference Bit Proofs
+	bool differenceBitsValidated = differenceValidCount == (uint64_t) valueBits;
+	printf("%-40s%s\n", "Difference Bit Proofs", (differenceBitsValidated ? TAG_VALID : TAG_INVALID));
 
 	// Check Overall Equivalency
-	printf("%-40s%s", "Total Commitment Equivalency", TAG_WORKING);
-	fflush(stdout);
-	bool equivalencyValidated = l.verifyCommitmentEquivilancy();
-	cout << TAG_ERASE << (equivalencyValidated ? TAG_VALID : TAG_INVALID) << endl;
+	bool equivalencyValidated = l.verifyCommitmentEquivilancy(differenceBitProduct);
+	printf("%-40s%s\n", "Total Commitment Equivalency", (equivalencyValidated ? TAG_VALID : TAG_INVALID));
 
 	// Final Report
 	bool proofOK = (validCount == entryCount)
-				&& (correctCount == knownEntries.size())
+				&& (correctCount == knownExpected)
 				&& (lbpValidCount == entryCount)
 				&& (equivalencyCount == entryCount)
+				&& digestsValidated
+				&& resultsValidated
+				&& entriesRootValidated
+				&& proofDigestValidated
 				&& basesValidated
 				&& differenceBitsValidated
 				&& equivalencyValidated;